@@ -0,0 +1,10 @@
+{
+    "targets": [
+        {
+            "target_name": "jcnative",
+            "sources": [ "native/jcnative.c", "jcblock/jclist.c", "jcblock/jcsubsume.c", "jcblock/jcjournal.c" ],
+            "include_dirs": [ "jcblock" ],
+            "cflags": [ "-Wall" ]
+        }
+    ]
+}
@@ -8,7 +8,10 @@
 
 var path = require('path');
 var fs = require('fs');
+var zlib = require('zlib');
+var crypto = require('crypto');
 var express = require('express');
+var bodyParser = require('body-parser');
 var app = express();
 var logprefix = require('log-prefix');
 
@@ -52,8 +55,13 @@ if (process.argv.length > 3) {
 var jcLogFile = ValidateFileExists(path.join(jcpath, 'callerID.dat'));
 var whiteListFileName = ValidateFileExists(path.join(jcpath, 'whitelist.dat'));
 var blackListFileName = ValidateFileExists(path.join(jcpath, 'blacklist.dat'));
+var listJournalFileName = path.join(jcpath, 'lists.journal');   // see jcblock/jcjournal.h
 
 var MaxNameLength = 80;
+var MaxBatchLength = 1000;              // maximum number of operations in one /api/batch request
+var CompactJournalBytes = 64 * 1024;    // compact the name database once its journal is this big
+var CompactDelayMillis = 5000;
+var FoldListJournalBytes = 16 * 1024;   // fold the list journal into the list files once it is this big
 var database = InitDatabase(path.join(jcpath, 'jcadmin.json'));
 console.log('Monitoring jcblock path %s', jcpath);
 
@@ -86,6 +94,12 @@ function IsPhoneNumber(pattern) {
     return pattern && pattern.match(/^[0-9]{7,11}$/);
 }
 
+function IsCallerIdName(text) {
+    // A caller ID name as a modem sends it: up to 15 printable characters.
+    // '-' would end the NAME field early and '=' could start another one.
+    return /^[\x20-\x7e]{1,15}$/.test(text) && !/[-=]/.test(text);
+}
+
 function LoadCallerLog(data, filename) {
     for (var line of SplitLines(fs.readFileSync(filename, 'utf8'))) {
         var call = ParseCallLine(line);
@@ -124,10 +138,137 @@ function InitDatabase(filename) {
         console.log('Created database file: %s', filename);
     }
 
-    return {
-        filename: filename,
-        data: data
+    var db = {
+        filename: filename,             // snapshot of the whole database
+        journalFilename: filename + '.journal',     // name changes made since the snapshot
+        data: data,
+        journalSize: 0,                 // bytes in the journal file
+        journalPending: [],             // queued {text, callback} appends
+        journalWriting: false,
+        compacting: false,
+        compactTimer: null
     };
+    ReplayJournal(db);
+    return db;
+}
+
+// Name changes are not saved by rewriting jcadmin.json. Instead, each change
+// is appended to jcadmin.json.journal as one line of JSON: {"number":..., "name":...}.
+// A blank name means the entry was deleted. At startup the journal is replayed
+// on top of the snapshot. Once the journal grows large enough, it is compacted:
+// the snapshot is rewritten atomically and the journal emptied, off the request path.
+function ApplyJournalRecord(data, record) {
+    if (record.name) {
+        data.callername[record.number] = record.name;
+    } else {
+        delete data.callername[record.number];
+    }
+}
+
+function ReplayJournal(db) {
+    var text;
+    try {
+        text = fs.readFileSync(db.journalFilename, 'utf8');
+    } catch (e) {
+        fs.writeFileSync(db.journalFilename, '', 'utf8');
+        return;
+    }
+
+    // A crash may have left a partial record at the end. Cut it off, so that
+    // the next append does not get glued onto it.
+    var complete = text.substr(0, text.lastIndexOf('\n') + 1);
+    if (complete.length < text.length) {
+        console.log('Discarding partial record at end of %s', db.journalFilename);
+        fs.truncateSync(db.journalFilename, Buffer.byteLength(complete, 'utf8'));
+    }
+
+    var count = 0;
+    for (var line of SplitLines(complete)) {
+        try {
+            var record = JSON.parse(line);
+            if (IsPhoneNumber(record.number)) {
+                ApplyJournalRecord(db.data, record);
+                ++count;
+            }
+        } catch (e) {
+            console.log('Ignoring corrupt journal record: %s', line);
+        }
+    }
+
+    db.journalSize = Buffer.byteLength(complete, 'utf8');
+    if (count > 0) {
+        console.log('Replayed %d name changes from %s', count, db.journalFilename);
+        ScheduleCompaction(db);
+    }
+}
+
+function FlushJournal(db) {
+    if (db.journalWriting || db.compacting || db.journalPending.length === 0) {
+        return;
+    }
+
+    // Everything queued since the last append goes out in a single append.
+    var batch = db.journalPending;
+    db.journalPending = [];
+    db.journalWriting = true;
+    var text = batch.map((item) => item.text).join('');
+    fs.appendFile(db.journalFilename, text, 'utf8', (err) => {
+        db.journalWriting = false;
+        if (!err) {
+            db.journalSize += Buffer.byteLength(text, 'utf8');
+            if (db.journalSize >= CompactJournalBytes) {
+                ScheduleCompaction(db);
+            }
+        }
+        for (var item of batch) {
+            item.callback(err);
+        }
+        FlushJournal(db);
+    });
+}
+
+function SaveName(number, callback) {
+    // Append the current name of 'number' (possibly blank) to the journal.
+    var record = {number: number, name: GetName(number)};
+    database.journalPending.push({text: JSON.stringify(record) + '\n', callback: callback});
+    FlushJournal(database);
+}
+
+function ScheduleCompaction(db) {
+    if (!db.compactTimer) {
+        db.compactTimer = setTimeout(() => {
+            db.compactTimer = null;
+            CompactDatabase(db);
+        }, CompactDelayMillis);
+    }
+}
+
+function CompactDatabase(db) {
+    if (db.journalWriting) {
+        ScheduleCompaction(db);     // try again once the append is done
+        return;
+    }
+
+    // Hold journal appends until the journal is emptied. Any change made while
+    // we are writing is already in db.data; replaying it later is harmless.
+    db.compacting = true;
+    WriteFileAtomic(db.filename, JSON.stringify(db.data), undefined, (err) => {
+        if (err) {
+            console.log('Could not compact database %s: %s', db.filename, err);
+            db.compacting = false;
+            FlushJournal(db);
+        } else {
+            fs.truncate(db.journalFilename, 0, (err) => {
+                if (err) {
+                    console.log('Could not truncate journal %s: %s', db.journalFilename, err);
+                } else {
+                    db.journalSize = 0;
+                }
+                db.compacting = false;
+                FlushJournal(db);
+            });
+        }
+    });
 }
 
 function GetName(number) {
@@ -146,6 +287,10 @@ function SetName(number, name) {
         // Blank name, so delete callername entry from database (saves space).
         delete database.data.callername[number];
     }
+
+    // Names are included in /api/calls replies, so those are now out of date.
+    InvalidateReplies(Datasets.callerid);
+    Datasets.callerid.modified = new Date();
 }
 
 function MakeDateTimeString(date, time) {
@@ -166,16 +311,18 @@ function ParseCallLine(line) {
     // Examples of caller ID data:
     // B-DATE = 011916--TIME = 1616--NMBR = 8774845967--NAME = TOLL FREE CALLE--
     // --DATE = 011916--TIME = 1623--NMBR = O--NAME = O--
-    var m = line.match(/^([WB\-])-DATE = (\d{6})--TIME = (\d{4})--NMBR = ([^\-]*)--NAME = ([^\-]*)--$/);
-    if (m) {
-        return {
-            status:   {W:'safe', B:'blocked'}[m[1]] || 'neutral',
-            when:     MakeDateTimeString(m[2], m[3]),
-            number:   FilterNameNumber(m[4]),
-            callid:   FilterNameNumber(m[5])
-        };
-    }
-    return null;
+    // '*' marks a call blocked with the star key (jcblock added it to the blacklist).
+    var m = line.match(/^([WB*\-])-DATE = (\d{6})--TIME = (\d{4})--NMBR = ([^\-]*)--NAME = ([^\-]*)--$/);
+    return m ? MakeCall(m[1], m[2], m[3], m[4], m[5]) : null;
+}
+
+function MakeCall(tag, date, time, nmbr, name) {
+    return {
+        status:   {W:'safe', B:'blocked', '*':'blocked'}[tag] || 'neutral',
+        when:     MakeDateTimeString(date, time),
+        number:   FilterNameNumber(nmbr),
+        callid:   FilterNameNumber(name)
+    };
 }
 
 function SplitLines(text) {
@@ -192,28 +339,175 @@ function SplitLines(text) {
     return lines;
 }
 
-function ParseRecentCalls(text, start, limit) {
-    var calls = [];
-    var total = 0;
-    var count = {};
-    var names = {};     // user name for each phone number, with most recent caller ID as fallback
-    var callid = {};    // most recent call ID associated with each phone number
-    for (var line of SplitLines(text).reverse()) {
+// The call log is indexed incrementally. jcblock only ever appends to callerID.dat,
+// so when the file grows we read and parse just the new bytes.
+// Each call is identified by the byte offset of its line in the file;
+// that offset is the cursor used by /api/history.
+// If the file shrinks or is replaced (truncate.c rewrites it), we start over.
+var CallLog = {
+    ino: null,
+    mtime: null,
+    size: 0,            // number of bytes indexed so far (always ends on a line boundary)
+    calls: [],          // parsed calls in file order (oldest first)
+    lines: [],          // raw text of each call's line, for matching against the lists
+    numbers: {}         // per-number aggregates: {count, callid}
+};
+
+function ResetCallLog(ino) {
+    CallLog.ino = ino;
+    CallLog.size = 0;
+    CallLog.calls = [];
+    CallLog.lines = [];
+    CallLog.numbers = {};
+}
+
+function AddCall(c, id, line) {
+    c.id = id;
+    CallLog.calls.push(c);
+    CallLog.lines.push(line);
+    if (IsPhoneNumber(c.number)) {
+        var agg = CallLog.numbers[c.number] || (CallLog.numbers[c.number] = {count: 0, callid: ''});
+        ++agg.count;
+        if (c.callid) {
+            agg.callid = c.callid;      // later lines are more recent calls
+        }
+    }
+}
+
+function AppendCallLog(buffer) {
+    // Index every complete line in the buffer, which holds the bytes
+    // starting at offset CallLog.size in the file.
+    // Any trailing partial line is left for the next time the file grows.
+    if (JcNative) {
+        var parsed = JcNative.parseCallLog(buffer);
+        var f = parsed.calls;   // [start, end, tag, date, time, nmbr, name] per call
+        for (var i = 0; i < f.length; i += 7) {
+            AddCall(MakeCall(f[i+2], f[i+3], f[i+4], f[i+5], f[i+6]), CallLog.size + f[i], buffer.toString('utf8', f[i], f[i+1]));
+        }
+        CallLog.size += parsed.consumed;
+        return;
+    }
+
+    var start = 0;
+    var end;
+    while ((end = buffer.indexOf(10, start)) >= 0) {
+        var line = buffer.toString('utf8', start, end);
         var c = ParseCallLine(line);
         if (c) {
-            if (IsPhoneNumber(c.number)) {
-                count[c.number] = (count[c.number] || 0) + 1;
-                if (!names[c.number]) {
-                    names[c.number] = GetName(c.number) || c.callid || '';
-                }
-                if (c.callid && !callid[c.number]) {
-                    callid[c.number] = c.callid || '';
+            AddCall(c, CallLog.size + start, line);
+        }
+        start = end + 1;
+    }
+    CallLog.size += start;
+}
+
+function ReadFileRange(filename, offset, length, callback) {
+    fs.open(filename, 'r', (err, fd) => {
+        if (err) {
+            callback(err);
+        } else {
+            var buffer = Buffer.alloc(length);
+            fs.read(fd, buffer, 0, length, offset, (err, nbytes) => {
+                fs.close(fd, () => {});
+                callback(err, err ? null : buffer.slice(0, nbytes));
+            });
+        }
+    });
+}
+
+function LoadCallLog(ds, callback) {
+    fs.stat(ds.filename, (err, stats) => {
+        if (err) {
+            callback(err);
+            return;
+        }
+
+        if (stats.ino !== CallLog.ino || stats.size < CallLog.size ||
+            (stats.size === CallLog.size && CallLog.mtime && stats.mtime.getTime() !== CallLog.mtime.getTime())) {
+            // Not just appended to: rebuild the index from scratch.
+            ResetCallLog(stats.ino);
+        }
+        CallLog.mtime = stats.mtime;
+
+        if (stats.size === CallLog.size) {
+            callback(null, stats);
+        } else {
+            ReadFileRange(ds.filename, CallLog.size, stats.size - CallLog.size, (err, buffer) => {
+                if (err) {
+                    callback(err);
+                } else {
+                    AppendCallLog(buffer);
+                    callback(null, stats);
                 }
-            }
-            if (total >= start && calls.length < limit) {
-                calls.push(c);
-            }
-            ++total;
+            });
+        }
+    });
+}
+
+function NumberInfo(number) {
+    var agg = CallLog.numbers[number];
+    var callid = agg ? agg.callid : '';
+    return {
+        count: agg ? agg.count : 0,
+        name:  GetName(number) || callid,   // user name, with most recent caller ID as fallback
+        callid: callid
+    };
+}
+
+function FindCallIndex(id) {
+    // Binary search for the call whose id (byte offset) is given.
+    var lo = 0;
+    var hi = CallLog.calls.length - 1;
+    while (lo <= hi) {
+        var mid = (lo + hi) >> 1;
+        var midId = CallLog.calls[mid].id;
+        if (midId === id) {
+            return mid;
+        }
+        if (midId < id) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return -1;
+}
+
+function CallHistoryPage(cursor, limit) {
+    // Return up to 'limit' calls, newest first, that are older than the call
+    // identified by 'cursor'. The cursor 'latest' starts with the most recent call.
+    var end;
+    if (cursor === 'latest') {
+        end = CallLog.calls.length;
+    } else {
+        end = FindCallIndex(ParseIntParam(cursor, -1));
+        if (end < 0) {
+            return {error: 'Invalid or expired cursor.'};
+        }
+    }
+
+    var begin = Math.max(0, end - limit);
+    return {
+        total: CallLog.calls.length,
+        calls: CallLog.calls.slice(begin, end).reverse(),
+        next: (begin > 0) ? String(CallLog.calls[begin].id) : null
+    };
+}
+
+function RecentCalls(start, limit) {
+    // The original paging format: calls by position, plus
+    // aggregates for every phone number in the log.
+    var total = CallLog.calls.length;
+    var calls = CallLog.calls.slice(Math.max(0, total - start - limit), Math.max(0, total - start)).reverse();
+    var count = {};
+    var names = {};     // user name for each phone number, with most recent caller ID as fallback
+    var callid = {};    // most recent call ID associated with each phone number
+    for (var number in CallLog.numbers) {
+        var info = NumberInfo(number);
+        count[number] = info.count;
+        names[number] = info.name;
+        if (info.callid) {
+            callid[number] = info.callid;
         }
     }
 
@@ -243,6 +537,286 @@ function FailResponse(response, error, template) {
     response.json(template);
 }
 
+// Each data file served to clients is wrapped in a "dataset" that caches
+// the file's text and the serialized JSON replies built from it.
+// When the file changes (on disk, or because we changed it), the dataset
+// is marked stale and its replies are discarded. The file is not re-read
+// until the next request for it arrives.
+var MinCompressLength = 1024;   // don't bother compressing replies smaller than this
+// Brotli's default quality (11) blocks the event loop for over a second
+// on a large /api/calls reply; quality 4 takes tens of milliseconds and
+// still beats gzip.
+var BrotliOptions = zlib.constants ? {params: {[zlib.constants.BROTLI_PARAM_QUALITY]: 4}} : {};
+var MaxCachedReplies = 32;      // per dataset; guards against unbounded variety of /api/calls URLs
+
+function MakeDataset(filename, load) {
+    return {
+        filename: filename,
+        load: load,         // function(ds, callback(err, stats)) that refreshes the dataset's data
+        stale: true,
+        invalidations: 0,   // bumped every time the dataset is invalidated
+        modified: null,     // Date the underlying data last changed, for Last-Modified
+        replies: {},        // cached reply objects, keyed by request parameters
+        numReplies: 0
+    };
+}
+
+var Datasets = {
+    callerid: MakeDataset(jcLogFile, LoadCallLog),
+    safe:     MakeDataset(whiteListFileName, (ds, callback) => RefreshListStore(ListStores.safe, callback)),
+    blocked:  MakeDataset(blackListFileName, (ds, callback) => RefreshListStore(ListStores.blocked, callback))
+};
+
+function InvalidateReplies(ds) {
+    ds.replies = {};
+    ds.numReplies = 0;
+}
+
+function InvalidateDataset(ds) {
+    ds.stale = true;
+    ++ds.invalidations;
+    InvalidateReplies(ds);
+}
+
+function DatasetForFile(filename) {
+    for (var key in Datasets) {
+        if (path.basename(Datasets[key].filename) === filename) {
+            return Datasets[key];
+        }
+    }
+    return null;
+}
+
+function WatchDataFiles() {
+    // Watch the directory rather than the files themselves, because
+    // jcblock replaces callerID.dat and blacklist.dat by renaming when it truncates them.
+    // If watching is not supported, /api/poll still notices changes by modification time.
+    try {
+        fs.watch(jcpath, (eventType, filename) => {
+            if (filename === path.basename(listJournalFileName)) {
+                // A journal record may change either list.
+                InvalidateDataset(Datasets.safe);
+                InvalidateDataset(Datasets.blocked);
+                return;
+            }
+            var ds = filename && DatasetForFile(filename);
+            if (ds) {
+                InvalidateDataset(ds);
+            }
+        });
+    } catch (e) {
+        console.log('Cannot watch directory %s: %s', jcpath, e);
+    }
+}
+
+function LoadDataset(ds, callback) {
+    if (!ds.stale) {
+        callback(null, ds);
+        return;
+    }
+
+    var invalidations = ds.invalidations;
+    ds.load(ds, (err, stats) => {
+        if (err) {
+            callback(err);
+        } else {
+            if (!ds.modified || stats.mtime > ds.modified) {
+                ds.modified = stats.mtime;
+            }
+            InvalidateReplies(ds);
+
+            // If the file changed again while we were reading it, stay stale.
+            ds.stale = (ds.invalidations !== invalidations);
+            callback(null, ds);
+        }
+    });
+}
+
+function MakeCachedReply(object, modified) {
+    var body = JSON.stringify(object);
+    var hash = crypto.createHash('sha1').update(body).digest('base64').substr(0, 20);
+    return {
+        body: body,
+        etag: `W/"${hash}"`,
+        modified: modified.toUTCString(),
+        gzip: null,         // compressed bodies are created on first demand
+        br: null
+    };
+}
+
+function IfNoneMatch(request, etag) {
+    var header = request.headers['if-none-match'];
+    if (header) {
+        for (var tag of header.split(',')) {
+            tag = tag.trim();
+            if (tag === '*' || tag === etag || ('W/' + tag) === etag) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+function ChooseEncoding(request, reply) {
+    var accept = request.headers['accept-encoding'] || '';
+    if (reply.body.length < MinCompressLength) {
+        return null;
+    }
+    if (zlib.brotliCompressSync && /\bbr\b/.test(accept)) {
+        reply.br = reply.br || zlib.brotliCompressSync(reply.body, BrotliOptions);
+        return 'br';
+    }
+    if (/\bgzip\b/.test(accept)) {
+        reply.gzip = reply.gzip || zlib.gzipSync(reply.body);
+        return 'gzip';
+    }
+    return null;
+}
+
+function SendCachedReply(request, response, ds, key, build) {
+    // Serve the reply identified by 'key' from the dataset's cache,
+    // calling build(ds) to create it when the cache does not have it.
+    LoadDataset(ds, (err) => {
+        if (err) {
+            FailResponse(response, err);
+            return;
+        }
+
+        var reply = ds.replies[key];
+        if (!reply) {
+            if (ds.numReplies >= MaxCachedReplies) {
+                InvalidateReplies(ds);
+            }
+            reply = ds.replies[key] = MakeCachedReply(build(ds), ds.modified);
+            ++ds.numReplies;
+        }
+
+        response.setHeader('ETag', reply.etag);
+        response.setHeader('Last-Modified', reply.modified);
+        response.setHeader('Cache-Control', 'no-cache');    // always revalidate, but allow 304
+        response.setHeader('Vary', 'Accept-Encoding');
+
+        if (IfNoneMatch(request, reply.etag)) {
+            response.statusCode = 304;
+            response.end();
+            return;
+        }
+
+        response.setHeader('Content-Type', 'application/json; charset=utf-8');
+        var encoding = ChooseEncoding(request, reply);
+        if (encoding) {
+            response.setHeader('Content-Encoding', encoding);
+            response.end(reply[encoding]);
+        } else {
+            response.end(reply.body);
+        }
+    });
+}
+
+// jcblock publishes counters and histograms in a shared memory segment
+// (jcblock/jcstats.h has the layout, which must match what we read here).
+// Reading it never involves the jcblock process itself.
+var JcstatsFileName = '/dev/shm/jcblock-stats';
+var JcstatsMagic = 0x5453434a;
+var JcstatsVersion = 6;
+var JcstatsBuckets = 40;
+var JcstatsCounterNames = [
+    'calls', 'rings', 'safe', 'blocked', 'neutral', 'starKey',
+    'serialReads', 'serialBytes', 'modemCommands', 'modemFailures',
+    'logWrites', 'cacheHits', 'cacheMisses', 'imported', 'queries',
+    'stageWaits', 'stageDrops',
+    'callMinorFaults', 'callMajorFaults', 'callYields', 'callPreemptions'
+];
+var JcstatsHistNames = [
+    'match', 'modemCommand', 'hangup', 'readSize', 'listReload', 'logWrite',
+    'stageLag', 'stageDepth'
+];
+
+function HistogramPercentile(hist, p) {
+    // Same estimate as jcstats_percentile(): the upper bound of the bucket holding the percentile.
+    var seen = 0;
+    for (var b = 0; b < hist.buckets.length; ++b) {
+        seen += hist.buckets[b];
+        if (seen >= p * hist.count) {
+            return Math.min(b ? Math.pow(2, b) - 1 : 0, hist.max);
+        }
+    }
+    return hist.max;
+}
+
+function IsProcessRunning(pid) {
+    try {
+        process.kill(pid, 0);
+        return true;
+    } catch (e) {
+        return e.code === 'EPERM';
+    }
+}
+
+function ReadJcblockStats(callback) {
+    fs.readFile(JcstatsFileName, (err, buffer) => {
+        if (err) {
+            callback(err);
+            return;
+        }
+        if (buffer.length < 32 || buffer.readUInt32LE(0) !== JcstatsMagic || buffer.readUInt32LE(4) !== JcstatsVersion) {
+            callback('Unrecognized jcblock statistics segment.');
+            return;
+        }
+
+        var numCounters = buffer.readUInt32LE(8);
+        var numHists = buffer.readUInt32LE(12);
+        if (buffer.length < 32 + 8*numCounters + 8*(3 + JcstatsBuckets)*numHists) {
+            callback('Truncated jcblock statistics segment.');
+            return;
+        }
+
+        var offset = 32;
+        function Next() {
+            var value = Number(buffer.readBigUInt64LE(offset));
+            offset += 8;
+            return value;
+        }
+
+        var pid = Number(buffer.readBigInt64LE(16));
+        var stats = {
+            pid: pid,
+            running: IsProcessRunning(pid),
+            started: new Date(1000 * Number(buffer.readBigInt64LE(24))),
+            counters: {},
+            histograms: {}      // times in nanoseconds, readSize in bytes, stageDepth in jobs
+        };
+
+        for (var i = 0; i < numCounters; ++i) {
+            stats.counters[JcstatsCounterNames[i] || ('counter' + i)] = Next();
+        }
+
+        for (var i = 0; i < numHists; ++i) {
+            var hist = {count: Next(), sum: Next(), max: Next(), buckets: []};
+            for (var b = 0; b < JcstatsBuckets; ++b) {
+                hist.buckets.push(Next());
+            }
+            hist.mean = hist.count ? (hist.sum / hist.count) : 0;
+            hist.p50 = HistogramPercentile(hist, 0.50);
+            hist.p90 = HistogramPercentile(hist, 0.90);
+            hist.p99 = HistogramPercentile(hist, 0.99);
+            stats.histograms[JcstatsHistNames[i] || ('histogram' + i)] = hist;
+        }
+
+        callback(null, stats);
+    });
+}
+
+app.get('/api/stats', (request, response) => {
+    ReadJcblockStats((err, stats) => {
+        if (err) {
+            FailResponse(response, err);
+        } else {
+            response.json(stats);
+        }
+    });
+});
+
 app.get('/api/poll', (request, response) => {
     // https://nodejs.org/api/fs.html#fs_fs_stat_path_callback
     // https://nodejs.org/api/fs.html#fs_class_fs_stats
@@ -263,8 +837,17 @@ app.get('/api/poll', (request, response) => {
         } else {
             if (!reply.error) {
                 reply[field] = {modified : stats.mtime};
-                if (reply.callerid && reply.safe && reply.blocked && reply.database) {
-                    // The database (jcadmin.json) and the callerID.dat are conceptually
+
+                // In case the directory watcher missed a change, notice it here.
+                // A change to the list journal may be a change to either list.
+                for (var ds of (field === 'journal') ? [Datasets.safe, Datasets.blocked] : [Datasets[field]]) {
+                    if (ds && !ds.stale && ds.modified && stats.mtime > ds.modified) {
+                        InvalidateDataset(ds);
+                    }
+                }
+
+                if (reply.callerid && reply.safe && reply.blocked && reply.database && reply.journal) {
+                    // The database (jcadmin.json + journal) and the callerID.dat are conceptually
                     // a single model from the client's point of view: together they provide
                     // a list of all the phone calls along with user-defined names for each call.
                     // So for the purposes of polling, we pick the most recent modification
@@ -272,10 +855,12 @@ app.get('/api/poll', (request, response) => {
                     // In simpler terms, when either changes, the client wants to reload
                     // /api/calls to get latest calls and names.
 
+                    // Likewise, the lists are their files and the list journal.
+
                     response.json({
                         callerid: LaterStat(reply.callerid, reply.database),
-                        safe: reply.safe,
-                        blocked: reply.blocked
+                        safe: LaterStat(reply.safe, reply.journal),
+                        blocked: LaterStat(reply.blocked, reply.journal)
                     });
                 }
             }
@@ -285,18 +870,56 @@ app.get('/api/poll', (request, response) => {
     fs.stat(jcLogFile,         (err, stats) => StatCallback(err, stats, reply, 'callerid' ));
     fs.stat(whiteListFileName, (err, stats) => StatCallback(err, stats, reply, 'safe'));
     fs.stat(blackListFileName, (err, stats) => StatCallback(err, stats, reply, 'blocked'));
-    fs.stat(database.filename, (err, stats) => StatCallback(err, stats, reply, 'database'));
+    fs.stat(database.journalFilename, (err, stats) => StatCallback(err, stats, reply, 'database'));
+    fs.stat(listJournalFileName, (err, stats) => {
+        // There is no list journal until a list has been changed.
+        if (err && err.code === 'ENOENT') {
+            StatCallback(null, {mtime: new Date(0)}, reply, 'journal');
+        } else {
+            StatCallback(err, stats, reply, 'journal');
+        }
+    });
 });
 
 app.get('/api/calls/:start/:limit', (request, response) => {
     var start = ParseIntParam(request.params.start, 0);
     var limit = ParseIntParam(request.params.limit, 1000000000);
-    fs.readFile(jcLogFile, 'utf8', (err, data) => {
-        if (err) {
-            FailResponse(response, err);
-        } else {
-            response.json(ParseRecentCalls(data, start, limit));
+    SendCachedReply(request, response, Datasets.callerid, start + '/' + limit, (ds) => {
+        return RecentCalls(start, limit);
+    });
+});
+
+app.get('/api/history/:cursor/:limit', (request, response) => {
+    // Cursor-based paging through the call history, newest first.
+    // The reply contains only the calls in the page; use /api/numbers
+    // to get counts and names for the phone numbers that appear in it.
+    var cursor = request.params.cursor;
+    var limit = Math.max(1, ParseIntParam(request.params.limit, 100));
+    SendCachedReply(request, response, Datasets.callerid, 'history/' + cursor + '/' + limit, (ds) => {
+        return CallHistoryPage(cursor, limit);
+    });
+});
+
+app.get('/api/numbers/:numbers?', (request, response) => {
+    // Per-number aggregates (call count, name, most recent caller ID) for a
+    // comma-separated list of phone numbers, or for every number in the log
+    // if the list is omitted.
+    var list = request.params.numbers;
+    if (list) {
+        for (var number of list.split(',')) {
+            if (!IsPhoneNumber(number)) {
+                FailResponse(response, 'Not a valid phone number: ' + number);
+                return;
+            }
+        }
+    }
+
+    SendCachedReply(request, response, Datasets.callerid, 'numbers/' + (list || ''), (ds) => {
+        var reply = {numbers: {}};
+        for (var number of (list ? list.split(',') : Object.keys(CallLog.numbers))) {
+            reply.numbers[number] = NumberInfo(number);
         }
+        return reply;
     });
 });
 
@@ -307,36 +930,30 @@ app.delete('/api/caller/:phonenumber', (request, response) => {
         return;
     }
 
-    fs.readFile(jcLogFile, 'utf8', (err, data) => {
+    LoadDataset(Datasets.callerid, (err, ds) => {
         if (err) {
             FailResponse(response, err);
         } else {
             // Prevent deletion of any phone number that exists in the caller history.
-            var recent = ParseRecentCalls(data, 0, 1000000000);
-            for (var i=0; i < recent.calls.length; ++i) {
-                var call = recent.calls[i];
-                if (call.number === request.params.phonenumber) {
-                    FailResponse(response, 'Cannot delete phone number because it exists in the call history.');
-                    return;
-                }
+            if (CallLog.numbers[request.params.phonenumber]) {
+                FailResponse(response, 'Cannot delete phone number because it exists in the call history.');
+                return;
             }
 
-            // Deletion is a 3-step process, each of which is performed ascynchronously:
-            // 1. Remove any entry from the safe list.
-            // 2. Remove any entry from the blocked list.
-            // 3. Remove any name entry from the database and save the database to disk.
+            // Deletion is a 2-step process, each of which is performed ascynchronously:
+            // 1. Remove any entry from the safe list and the blocked list.
+            // 2. Remove any name entry from the database and save the database to disk.
 
-            SetName(request.params.phonenumber, null);     // delete name entry if any exists
-            RemovePhoneNumberFromFile(whiteListFileName, request.params.phonenumber, response, function(){
-                RemovePhoneNumberFromFile(blackListFileName, request.params.phonenumber, response, function(){
-                    fs.writeFile(database.filename, JSON.stringify(database.data), 'utf8', (err) => {
-                        if (err) {
-                            FailResponse(response, err);
-                        } else {
-                            console.log(`Deleted phone number ${request.params.phonenumber}`);
-                            response.json({deleted: true});
-                        }
-                    });
+            var number = request.params.phonenumber;
+            SetName(number, null);     // delete name entry if any exists
+            UpdateLists([[ListStores.safe, RemoveNumber(number)], [ListStores.blocked, RemoveNumber(number)]], response, function(){
+                SaveName(number, (err) => {
+                    if (err) {
+                        FailResponse(response, err);
+                    } else {
+                        console.log(`Deleted phone number ${number}`);
+                        response.json({deleted: true});
+                    }
                 });
             });
         }
@@ -350,16 +967,15 @@ app.get('/api/caller/:phonenumber', (request, response) => {
     }
 
     // Search for any information we know about this phone number.
-    // Process the entire caller ID log and see if the number is there.
-    fs.readFile(jcLogFile, 'utf8', (err, data) => {
+    // Scan the indexed caller ID log, newest first, for calls from the number.
+    LoadDataset(Datasets.callerid, (err, ds) => {
         if (err) {
             FailResponse(response, err);
         } else {
-            var recent = ParseRecentCalls(data, 0, 1000000000);
             var callTimesList = [];
             var mostRecentCall;
-            for (var i=0; i < recent.calls.length; ++i) {
-                var call = recent.calls[i];
+            for (var i = CallLog.calls.length - 1; i >= 0; --i) {
+                var call = CallLog.calls[i];
                 if (call.number === request.params.phonenumber) {
                     if (!mostRecentCall) {
                         mostRecentCall = call;
@@ -389,29 +1005,209 @@ app.get('/api/caller/:phonenumber', (request, response) => {
     });
 });
 
-app.get('/api/fetch/:filetype', (request, response) => {
-    var filename;
+app.get('/api/verdict/:phonenumber/:callid?', (request, response) => {
+    // What would jcblock do if this number called right now, with the lists as they are?
+    // We match the most recent logged call from the number; for a number that has
+    // never called, we make up a caller ID string with the given caller ID name.
+    var phonenumber = request.params.phonenumber;
+    if (!IsPhoneNumber(phonenumber)) {
+        FailResponse(response, 'Not a valid phone number.');
+        return;
+    }
+    var callid = request.params.callid;
+    if (callid !== undefined && !IsCallerIdName(callid)) {
+        FailResponse(response, 'Not a valid caller ID name.');
+        return;
+    }
+
+    LoadDataset(Datasets.callerid, (err) => {
+        if (err) {
+            FailResponse(response, err);
+            return;
+        }
+        LoadMatchers((err, white, black) => {
+            if (err) {
+                FailResponse(response, err);
+                return;
+            }
+
+            var callstr = null;
+            for (var i = CallLog.calls.length - 1; i >= 0; --i) {
+                if (CallLog.calls[i].number === phonenumber) {
+                    callstr = CallerIdString(CallLog.lines[i]);
+                    break;
+                }
+            }
+            if (callstr === null) {
+                var now = new Date();
+                callstr = '--DATE = ' + ZeroPad(now.getMonth()+1, 2) + ZeroPad(now.getDate(), 2) + ZeroPad(now.getFullYear() % 100, 2) +
+                    '--TIME = ' + ZeroPad(now.getHours(), 2) + ZeroPad(now.getMinutes(), 2) +
+                    '--NMBR = ' + phonenumber +
+                    '--NAME = ' + (callid || 'O') + '--';
+            }
+
+            var verdict = CallVerdicts(white, black, [callstr])[0];
+            verdict.native = !!JcNative;
+            response.json(verdict);
+        });
+    });
+});
+
+app.get('/api/verdicts/:cursor/:limit', (request, response) => {
+    // Like /api/history, but instead of how each call was handled when it arrived,
+    // reports how jcblock would handle it with the lists as they are now.
+    LoadDataset(Datasets.callerid, (err) => {
+        if (err) {
+            FailResponse(response, err);
+            return;
+        }
+        LoadMatchers((err, white, black) => {
+            if (err) {
+                FailResponse(response, err);
+                return;
+            }
+
+            var page = CallHistoryPage(request.params.cursor, Math.max(1, ParseIntParam(request.params.limit, 100)));
+            if (page.error) {
+                FailResponse(response, page.error);
+                return;
+            }
+
+            var callstrs = page.calls.map((c) => CallerIdString(CallLog.lines[FindCallIndex(c.id)]));
+            var verdicts = CallVerdicts(white, black, callstrs);
+            response.json({
+                total: page.total,
+                next: page.next,
+                verdicts: page.calls.map((c, i) => ({
+                    id: c.id,
+                    logged: c.status,
+                    status: verdicts[i].status,
+                    pattern: verdicts[i].pattern
+                }))
+            });
+        });
+    });
+});
+
+app.get('/api/prune/:dead?', (request, response) => {
+    // Which list entries could go: redundant ones (covered by another entry of
+    // the same list), blacklist entries shadowed by the whitelist or overridden
+    // by it in the history, and dead entries (no call in the history used them).
+    // Returns each list without its redundant entries (and without its dead
+    // ones, unless permanent, if 'dead' is 'dead'), with a diff. Nothing is changed.
+    var dropDead = (request.params.dead === 'dead');
+    LoadDataset(Datasets.callerid, (err) => {
+        if (err) {
+            FailResponse(response, err);
+            return;
+        }
+        LoadMatchers((err, white, black) => {
+            if (err) {
+                FailResponse(response, err);
+                return;
+            }
+
+            var stores = [white ? ListStores.safe : null, ListStores.blocked];
+            var reports = stores.map((store) => store && {
+                entries: store.matcher.patterns.length,
+                redundant: [],
+                shadowed: [],
+                overridden: [],
+                dead: []
+            });
+            var drop = [new Set(), new Set()];
+
+            var findings = ListSubsumption(white, black);
+            for (var i = 0; i < findings.length; i += 5) {
+                var list = findings[i+1], entry = findings[i+2];
+                var finding = {
+                    pattern: stores[list].matcher.patterns[entry],
+                    by: stores[findings[i+3]].matcher.patterns[findings[i+4]]
+                };
+                if (findings[i] === 'redundant') {
+                    reports[list].redundant.push(finding);
+                    drop[list].add(entry);
+                } else {
+                    reports[list].shadowed.push(finding);
+                }
+            }
+
+            // Replay the history against the lists without their redundant entries.
+            // Entries are told apart by pattern: of two kept entries with the
+            // same pattern, only the first can ever decide a call.
+            var pruned = stores.map((store, list) => store && PruneList(store, drop[list]));
+            var keptWhite = white && CompileListMatcher(pruned[0].text);
+            var keptBlack = CompileListMatcher(pruned[1].text);
+            var callstrs = CallLog.lines.map(CallerIdString);
+            var verdicts = CallVerdicts(keptWhite, keptBlack, callstrs);
+            var blackOnly = CallVerdicts(null, keptBlack, callstrs.filter((c, i) => verdicts[i].status === 'safe'));
+            var hits = [new Map(), new Map()];
+            for (var v of verdicts) {
+                if (v.status !== 'neutral') {
+                    var m = hits[(v.status === 'safe') ? 0 : 1];
+                    m.set(v.pattern, (m.get(v.pattern) || 0) + 1);
+                }
+            }
+            var overridden = new Map();
+            for (var v of blackOnly) {
+                if (v.status === 'blocked') {
+                    overridden.set(v.pattern, (overridden.get(v.pattern) || 0) + 1);
+                }
+            }
+            overridden.forEach((calls, pattern) => reports[1].overridden.push({pattern: pattern, calls: calls}));
+
+            stores.forEach((store, list) => {
+                if (!store) {
+                    return;
+                }
+                var entryLines = EntryLines(store);
+                store.matcher.patterns.forEach((pattern, entry) => {
+                    if (drop[list].has(entry) || hits[list].has(pattern)) {
+                        return;
+                    }
+                    var line = store.lines[entryLines[entry]];
+                    var permanent = (line !== undefined) && (line.substr(19, 6) === '++++++');
+                    reports[list].dead.push({pattern: pattern, permanent: permanent});
+                    if (dropDead && !permanent) {
+                        drop[list].add(entry);
+                    }
+                });
+                if (dropDead) {
+                    pruned[list] = PruneList(store, drop[list]);
+                }
+                reports[list].minimised = pruned[list].text;
+                reports[list].diff = pruned[list].diff;
+            });
+
+            response.json({
+                native: !!JcNative,
+                calls: callstrs.length,
+                safe: reports[0],
+                blocked: reports[1]
+            });
+        });
+    });
+});
+
+app.get('/api/fetch/:filetype', (request, response) => {
     switch (request.params.filetype) {
-        case 'safe':     filename = whiteListFileName;  break;
-        case 'blocked':  filename = blackListFileName;  break;
+        case 'safe':
+        case 'blocked':
+            break;
         default:
             FailResponse(response, 'Invalid filetype ' + request.params.filetype);
             return;
     }
 
-    fs.readFile(filename, 'utf8', (err, data) => {
-        if (err) {
-            FailResponse(response, err);
-        } else {
-            var reply = {table: {}};
-            for (var line of SplitLines(data)) {
-                var record = ParseRecord(line);
-                if (record) {
-                    reply.table[record.pattern] = record.comment;
-                }
+    SendCachedReply(request, response, Datasets[request.params.filetype], 'table', (ds) => {
+        var reply = {table: {}};
+        for (var line of ListStores[request.params.filetype].lines) {
+            var record = ParseRecord(line);
+            if (record) {
+                reply.table[record.pattern] = record.comment;
             }
-            response.json(reply);
         }
+        return reply;
     });
 });
 
@@ -423,7 +1219,7 @@ function MakePhoneNumberRecord(phonenumber) {
     while (record.length < 19) {
         record += ' ';
     }
-    record += `++++++        ${GetName(phonenumber)}\n`;
+    record += `++++++        ${GetName(phonenumber)}`;
     return record;
 }
 
@@ -439,77 +1235,743 @@ function ParseRecord(line) {
     return null;
 }
 
-function RemovePhoneNumberFromFile(filename, phonenumber, response, callback) {
-    fs.readFile(filename, 'utf8', (err,data) => {
-        if (err) {
-            FailResponse(response, err);
-        } else {
-            var lines = SplitLines(data);
-            var updated = '';
-            var numChanges = 0;
-            for (var line of lines) {
-                var record = ParseRecord(line);
-                if (record && record.pattern===phonenumber) {
-                    ++numChanges;
+// Deciding calls: jcblock's own matching code (jcblock/jclist.c) is built into
+// a Node addon by 'node-gyp rebuild' so our verdicts agree with the daemon.
+// If the addon is missing, the JavaScript below applies the same rules.
+var JcNative = LoadNativeAddon();
+
+function LoadNativeAddon() {
+    try {
+        return require('./build/Release/jcnative');
+    } catch (e) {
+        console.log('Native matcher not available (%s); using JavaScript rules.', e.code || e.message);
+        return null;
+    }
+}
+
+var ListRecordSize = 100;   // jcblock reads list records with fgets() into a buffer this size
+
+function ListEntryPattern(record) {
+    // Same as jclist_parse_record(): the search string jcblock would use
+    // for this record (a Buffer, since jcblock counts bytes), or null if
+    // jcblock ignores the record.
+    if (record[0] === 0x23 || record[0] === 0x0a || record.length < 26) {     // '#', '\n'
+        return null;
+    }
+    var q = record.indexOf(0x3f);      // '?'
+    if (q < 0 || q > 18) {
+        return null;
+    }
+    if (AnchoredEntry(record.toString('latin1', 0, 5))) {
+        // '?' is a wildcard here, so the pattern runs to the last '?' in range.
+        var last = record.lastIndexOf(0x3f, 18);
+        var pattern = record.toString('utf8', 0, last);
+        return AnchoredTerms(pattern) ? pattern : null;
+    }
+    var tokens = record.toString('utf8').split('?').filter((t) => t !== '');     // strtok(record, "?")
+    return tokens.length > 0 ? tokens[0] : null;
+}
+
+var ListFieldLabels = ['NMBR:', 'NAME:'];
+
+function AnchoredEntry(pattern) {
+    return ListFieldLabels.some((label) => pattern.startsWith(label));
+}
+
+function GlobRegExpSource(glob) {
+    // Same elements as jclist_glob_element(); wildcards never match '-'.
+    var wild = '[^\\-\\n\\0]';
+    var escape = (c) => '\\u' + ('000' + c.charCodeAt(0).toString(16)).slice(-4);
+    var source = '';
+    for (var i = 0; i < glob.length; ) {
+        var c = glob[i];
+        if (c === '*') {
+            source += wild + '*';
+            ++i;
+        } else if (c === '?') {
+            source += wild;
+            ++i;
+        } else if (c === '#') {
+            source += '[0-9]';
+            ++i;
+        } else if (c === '[') {
+            var j = i + 1;
+            var negate = (glob[j] === '!');
+            if (negate) {
+                ++j;
+            }
+            var members = '';
+            while (j < glob.length && glob[j] !== ']') {
+                if (j + 2 < glob.length && glob[j+1] === '-' && glob[j+2] !== ']') {
+                    if (glob[j] <= glob[j+2]) {
+                        members += escape(glob[j]) + '-' + escape(glob[j+2]);
+                    }
+                    j += 3;
                 } else {
-                    updated += line + '\n';
+                    members += escape(glob[j++]);
                 }
             }
+            if (j >= glob.length || j === i + 1 + (negate ? 1 : 0)) {
+                return null;
+            }
+            source += negate ? ('[^' + members + '\\-\\n\\0]') : ('[' + members + ']');
+            i = j + 1;
+        } else {
+            source += escape(c);
+            ++i;
+        }
+    }
+    return source;
+}
 
-            if (numChanges > 0) {
-                // Write 'updated' back to the file.
-                fs.writeFile(filename, updated, 'utf8', (err) => {
-                    if (err) {
-                        FailResponse(response, err);
-                    } else {
-                        callback();
-                    }
-                });
+function AnchoredTerms(pattern) {
+    // Same as jclist_terms(): [{label, regexp}, ...] for an anchored
+    // pattern, or null if the pattern can't be understood.
+    var terms = [];
+    var pos = 0;
+    while (pos < pattern.length) {
+        var field = ListFieldLabels.findIndex((label) => pattern.startsWith(label, pos));
+        if (field < 0 || terms.some((t) => t.field === field)) {
+            return null;
+        }
+        pos += 5;
+        var next = pattern.length;
+        for (var label of ListFieldLabels) {
+            var anchor = pattern.indexOf(label, pos);
+            if (anchor >= 0 && anchor < next) {
+                next = anchor;
+            }
+        }
+        var source = GlobRegExpSource(pattern.substring(pos, next));
+        if (source === null) {
+            return null;
+        }
+        terms.push({field: field, label: '-' + ListFieldLabels[field].replace(':', ' = '), regexp: new RegExp('^' + source + '$')});
+        pos = next;
+    }
+    return terms.length > 0 ? terms : null;
+}
+
+function EntryMatches(entry, callstr) {
+    // Same as jclist_entry_match(): a literal entry matches anywhere in
+    // the caller ID string, each term of an anchored one a whole field.
+    if (!entry.terms) {
+        return callstr.indexOf(entry.pattern) >= 0;
+    }
+    for (var term of entry.terms) {
+        var value = callstr.indexOf(term.label);
+        var end = (value < 0) ? -1 : callstr.indexOf('--', value + 8);
+        if (end < 0 || !term.regexp.test(callstr.substring(value + 8, end))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+function CompileListMatcher(text) {
+    if (JcNative) {
+        var list = JcNative.compileList(text);
+        var flat = JcNative.listEntries(list);
+        var patterns = [];
+        var offsets = [];
+        for (var i = 0; i < flat.length; i += 2) {
+            patterns.push(flat[i]);
+            offsets.push(flat[i+1]);
+        }
+        return {list: list, patterns: patterns, offsets: offsets};
+    }
+
+    // Cut the text into records the way fgets() does, including
+    // splitting lines too long for jcblock's buffer. Like the native
+    // addon's, the offsets count bytes.
+    var bytes = Buffer.from(text);
+    var patterns = [];
+    var offsets = [];
+    var pos = 0;
+    while (pos < bytes.length) {
+        var nl = bytes.indexOf(0x0a, pos);
+        var end = Math.min((nl < 0) ? bytes.length : nl + 1, pos + ListRecordSize - 1);
+        var pattern = ListEntryPattern(bytes.slice(pos, end));
+        if (pattern !== null) {
+            patterns.push(pattern);
+            offsets.push(pos);
+        }
+        pos = end;
+    }
+    var entries = patterns.map((pattern) => ({
+        pattern: pattern,
+        terms: AnchoredEntry(pattern) ? AnchoredTerms(pattern) : null
+    }));
+    return {list: null, patterns: patterns, offsets: offsets, entries: entries};
+}
+
+function MatchPatterns(matcher, callstr) {
+    for (var i = 0; i < matcher.entries.length; ++i) {
+        if (EntryMatches(matcher.entries[i], callstr)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+function CallVerdicts(white, black, callstrs) {
+    // Decide each caller ID string like jcblock: the whitelist (if there is one)
+    // wins over the blacklist. Returns [{status, pattern}, ...].
+    var results = [];
+    if (JcNative) {
+        var flat = JcNative.verdicts(white && white.list, black.list, callstrs);
+        for (var i = 0; i < flat.length; i += 2) {
+            var matcher = (flat[i] === 'safe') ? white : black;
+            results.push({
+                status: flat[i],
+                pattern: (flat[i+1] >= 0) ? matcher.patterns[flat[i+1]] : null
+            });
+        }
+    } else {
+        for (var callstr of callstrs) {
+            var rule;
+            if (white && (rule = MatchPatterns(white, callstr)) >= 0) {
+                results.push({status: 'safe', pattern: white.patterns[rule]});
+            } else if ((rule = MatchPatterns(black, callstr)) >= 0) {
+                results.push({status: 'blocked', pattern: black.patterns[rule]});
             } else {
-                callback();
+                results.push({status: 'neutral', pattern: null});
             }
         }
+    }
+    return results;
+}
+
+function ListSubsumption(white, black) {
+    // Entries that other entries make pointless, as [kind, list, entry, byList, by, ...]
+    // (see jcblock/jcsubsume.h). Without the native addon, only literal entries
+    // inside other literal entries are found.
+    if (JcNative) {
+        return JcNative.subsumption(white && white.list, black.list);
+    }
+    var lists = [white ? white.patterns : [], black.patterns];
+    var findings = [];
+    var literal = (pattern) => !AnchoredEntry(pattern);
+    lists.forEach((patterns, list) => {
+        patterns.forEach((b, e) => {
+            if (!literal(b)) {
+                return;
+            }
+            var same = patterns.findIndex((a, i) => i !== e && literal(a) && b.indexOf(a) >= 0 && (i < e || a !== b));
+            var shadow = (list === 1) ? lists[0].findIndex((a) => literal(a) && b.indexOf(a) >= 0) : -1;
+            if (same >= 0) {
+                findings.push('redundant', list, e, list, same);
+            } else if (shadow >= 0) {
+                findings.push('shadowed', list, e, 0, shadow);
+            }
+        });
     });
+    return findings;
 }
 
-function AddPhoneNumberToFile(filename, phonenumber, response, callback) {
-    fs.readFile(filename, 'utf8', (err,data) => {
+function EntryLines(store) {
+    // The line holding each entry's record, or undefined if the record
+    // doesn't start a line (jcblock reads long lines in pieces).
+    var lineStart = new Map();
+    var offset = 0;
+    store.lines.forEach((line, i) => {
+        lineStart.set(offset, i);
+        offset += Buffer.byteLength(line) + 1;     // matcher offsets count bytes
+    });
+    return store.matcher.offsets.map((offset) => lineStart.get(offset));
+}
+
+function PruneList(store, drop) {
+    // The list without the records of the entries in 'drop' (indexes into
+    // store.matcher), as {text, diff}; the diff is in 'diff -U0' form.
+    var name = path.basename(store.filename);
+    var entryLines = EntryLines(store);
+    var removed = new Set();
+    for (var e of drop) {
+        if (entryLines[e] !== undefined) {
+            removed.add(entryLines[e]);
+        }
+    }
+
+    var kept = [];
+    var diff = '--- ' + name + '\n+++ ' + name + '.min\n';
+    for (var i = 0; i < store.lines.length; ) {
+        if (!removed.has(i)) {
+            kept.push(store.lines[i++]);
+            continue;
+        }
+        var start = i;
+        while (removed.has(i)) {
+            ++i;
+        }
+        diff += '@@ -' + (start+1) + ',' + (i-start) + ' +' + kept.length + ',0 @@\n';
+        diff += store.lines.slice(start, i).map((line) => '-' + line + '\n').join('');
+    }
+    return {text: kept.map((line) => line + '\n').join(''), diff: diff};
+}
+
+function CallerIdString(line) {
+    // jcblock matches the modem's caller ID string before it tags it,
+    // so the first character of a logged line is not part of what was matched.
+    return '-' + line.substr(1);
+}
+
+function LoadMatchers(callback) {
+    // callback(err, white, black); white is null if there is no whitelist,
+    // which jcblock treats as "nothing is whitelisted".
+    RefreshListStore(ListStores.safe, (err) => {
+        var white = err ? null : ListStores.safe.matcher;
+        RefreshListStore(ListStores.blocked, (err) => {
+            callback(err, white, ListStores.blocked.matcher);
+        });
+    });
+}
+
+// jcadmin keeps an authoritative copy of each list in memory, line by line,
+// so comments and formatting survive our edits. A list is its file with the
+// records of the list journal (lists.journal, shared with jcblock) applied.
+// Edits are queued as mutation functions; all the mutations queued in one
+// turn of the event loop are turned into journal records and appended together.
+// The list files themselves are only rewritten when the journal is folded into
+// them, by jcblock or by us. Before a batch is applied, the list is brought up
+// to date with the file and the journal.
+function MakeListStore(filename, code) {
+    return {
+        filename: filename,
+        code: code,         // the list's letter in journal records
+        lines: [],          // every line of the list, without '\n'
+        matcher: null,      // the entries jcblock would use, from CompileListMatcher()
+        stats: null,        // fs.Stats of the file as of the last read
+        base: null,         // ListJournal.base when the file was read
+        applied: 0,         // ListJournal.records applied to lines
+        pending: [],        // queued {mutate, callback} items
+        scheduled: false,   // a flush has been scheduled
+        flushing: false     // a flush is in progress
+    };
+}
+
+var ListStores = {
+    safe:    MakeListStore(whiteListFileName, 'W'),
+    blocked: MakeListStore(blackListFileName, 'B')
+};
+
+var ListJournal = {
+    filename: listJournalFileName,
+    stats: null,        // fs.Stats as of the last read, or null if there is no journal
+    base: 0,            // sequence number folded into the list files, from the header
+    records: [],        // {seq, op, list, text} since then
+    lastSeq: 0,
+    offset: 0,          // bytes read, up to the end of the last whole record
+    foldTimer: null
+};
+
+var ListJournalHeaderSize = 46;
+var ListJournalHeaderPattern = /^#jcblock list journal, folded to (\d{12})\n/;
+var ListJournalRecordPattern = /^\s*(\d+)\s+([ART])\s+([WB])\s*(.*)$/;
+
+function ReadListJournal(callback) {
+    // Read the records added to the journal since it was last read. Records are
+    // only ever appended to it, until it is folded, which puts a new base in the
+    // header; then (as jcjournal_read() does) it is read again from the start.
+    fs.stat(ListJournal.filename, (err, stats) => {
         if (err) {
-            console.log('Error reading from file %s: %s', filename, err);
-            FailResponse(response, err);
+            if (err.code !== 'ENOENT') {
+                callback(err);
+                return;
+            }
+            ListJournal.stats = null;
+            ListJournal.base = 0;
+            ListJournal.records = [];
+            ListJournal.lastSeq = 0;
+            ListJournal.offset = 0;
+            callback(null);
+        } else if (SameFileStats(stats, ListJournal.stats)) {
+            callback(null);
         } else {
-            var lines = SplitLines(data);
-            for (var line of lines) {
-                var record = ParseRecord(line);
-                if (record && record.pattern===phonenumber) {
-                    callback();
+            fs.open(ListJournal.filename, 'r', (err, fd) => {
+                if (err) {
+                    callback(err);
                     return;
                 }
+                ReadFdRange(fd, 0, Math.min(stats.size, ListJournalHeaderSize), (err, header) => {
+                    if (err) {
+                        fs.close(fd, () => callback(err));
+                        return;
+                    }
+                    var match = ListJournalHeaderPattern.exec(header.toString('latin1'));
+                    var base = match ? parseInt(match[1], 10) : 0;
+                    var previous = ListJournal.stats;
+                    if (!previous || previous.ino !== stats.ino || base !== ListJournal.base || stats.size < ListJournal.offset) {
+                        ListJournal.base = base;
+                        ListJournal.records = [];
+                        ListJournal.lastSeq = base;
+                        ListJournal.offset = match ? ListJournalHeaderSize : 0;
+                    }
+                    ReadFdRange(fd, ListJournal.offset, stats.size - ListJournal.offset, (err, tail) => {
+                        fs.close(fd, () => {
+                            if (!err) {
+                                // A record not yet complete is read next time.
+                                var length = tail.lastIndexOf(10) + 1;
+                                for (var line of SplitLines(tail.toString('utf8', 0, length))) {
+                                    var m = ListJournalRecordPattern.exec(line);
+                                    if (m) {
+                                        var record = {seq: parseInt(m[1], 10), op: m[2], list: m[3], text: m[4]};
+                                        ListJournal.records.push(record);
+                                        ListJournal.lastSeq = Math.max(ListJournal.lastSeq, record.seq);
+                                    }
+                                }
+                                ListJournal.offset += length;
+                                ListJournal.stats = stats;
+                            }
+                            callback(err);
+                        });
+                    });
+                });
+            });
+        }
+    });
+}
+
+function ReadFdRange(fd, position, length, callback) {
+    // Read 'length' bytes at 'position' (fewer if the file is shorter) into a new Buffer.
+    var buffer = Buffer.alloc(Math.max(length, 0));
+    var done = 0;
+    function Next() {
+        if (done >= buffer.length) {
+            callback(null, buffer);
+            return;
+        }
+        fs.read(fd, buffer, done, buffer.length - done, position + done, (err, n) => {
+            if (err) {
+                callback(err);
+            } else if (n === 0) {
+                callback(null, buffer.slice(0, done));
+            } else {
+                done += n;
+                Next();
             }
+        });
+    }
+    Next();
+}
 
-            // Append new record to file.
-            // Append a new line to the blacklist file.
-            var record = MakePhoneNumberRecord(phonenumber);
+function FindRecordLine(lines, pattern) {
+    for (var i = 0; i < lines.length; ++i) {
+        var record = ParseRecord(lines[i]);
+        if (record && record.pattern === pattern) {
+            return i;
+        }
+    }
+    return -1;
+}
 
-            // Special case: it is possible for the text file to lack a newline
-            // at its end. To prevent corrupting the last line, insert a newline
-            // if needed.
-            if (data.length > 0 && data.charAt(data.length - 1) !== '\n') {
-                record = '\n' + record;
+function ApplyListRecord(lines, record) {
+    // Apply a journal record the way jcblock folds it into a list file
+    // (apply_record() in jcblock/jcjournal.c). Returns true if the lines changed.
+    switch (record.op) {
+        case 'A':
+            var added = ParseRecord(record.text);
+            if (!added || FindRecordLine(lines, added.pattern) >= 0) {
+                return false;
             }
-            
-            fs.appendFile(filename, record, 'utf8', (aerr) => {
-                if (aerr) {
-                    console.log('Error appending to file %s: %s', filename, aerr);
-                    FailResponse(response, aerr);
-                } else {
-                    callback();
+            lines.push(record.text);
+            return true;
+
+        case 'R':
+            var changed = false;
+            for (var i = lines.length - 1; i >= 0; --i) {
+                var parsed = ParseRecord(lines[i]);
+                if (parsed && parsed.pattern === record.text.trim()) {
+                    lines.splice(i, 1);
+                    changed = true;
+                }
+            }
+            return changed;
+
+        case 'T':
+            var index = FindRecordLine(lines, record.text.substr(7).trim());
+            if (index < 0) {
+                return false;
+            }
+            var line = lines[index];
+            if (record.list === 'B' && line.substr(19, 6) === '++++++') {
+                return false;
+            }
+            lines[index] = line.substr(0, 19) + record.text.substr(0, 6) + line.substr(25);
+            return lines[index] !== line;
+    }
+    return false;
+}
+
+function ListText(lines) {
+    return lines.length > 0 ? (lines.join('\n') + '\n') : '';
+}
+
+function SameFileStats(a, b) {
+    return a && b && (a.ino === b.ino) && (a.size === b.size) && (a.mtime.getTime() === b.mtime.getTime());
+}
+
+function ListModified(store) {
+    // What the list was last changed by: its file or the journal.
+    var journal = ListJournal.stats;
+    return {mtime: (journal && journal.mtime > store.stats.mtime) ? journal.mtime : store.stats.mtime};
+}
+
+function RefreshListStore(store, callback) {
+    ReadListJournal((err) => {
+        if (err) {
+            callback(err);
+            return;
+        }
+        fs.stat(store.filename, (err, stats) => {
+            if (err) {
+                callback(err);
+            } else if (SameFileStats(stats, store.stats) && store.base === ListJournal.base) {
+                // Just apply the records added since.
+                var changed = false;
+                for (var i = store.applied; i < ListJournal.records.length; ++i) {
+                    var record = ListJournal.records[i];
+                    if (record.list === store.code && ApplyListRecord(store.lines, record)) {
+                        changed = true;
+                    }
+                }
+                store.applied = ListJournal.records.length;
+                if (changed) {
+                    store.matcher = CompileListMatcher(ListText(store.lines));
                 }
+                callback(null, ListModified(store));
+            } else {
+                // The file changed, or the journal was folded into it.
+                var records = ListJournal.records;
+                var base = ListJournal.base;
+                fs.readFile(store.filename, 'utf8', (err, text) => {
+                    if (!err) {
+                        store.lines = SplitLines(text);
+                        for (var record of records) {
+                            if (record.list === store.code) {
+                                ApplyListRecord(store.lines, record);
+                            }
+                        }
+                        store.matcher = CompileListMatcher(ListText(store.lines));
+                        store.stats = stats;
+                        store.base = base;
+                        store.applied = records.length;
+                    }
+                    callback(err, err ? null : ListModified(store));
+                });
+            }
+        });
+    });
+}
+
+function AppendListJournal(records, callback) {
+    // Append records {op, list, text} to the list journal.
+    var texts = records.map((r) => r.op + ' ' + r.list + ' ' + r.text);
+    if (JcNative) {
+        // Under the journal's lock, as jcblock writes it.
+        try {
+            JcNative.journalAppend(ListJournal.filename, texts);
+        } catch (e) {
+            callback(e);
+            return;
+        }
+        callback(null);
+        return;
+    }
+
+    // Without the addon we can't take the lock, so a record appended just as
+    // jcblock folds the journal could be lost. Build the addon to avoid that.
+    ReadListJournal((err) => {
+        if (err) {
+            callback(err);
+            return;
+        }
+        var seq = ListJournal.lastSeq;
+        var text = texts.map((t) => (++seq) + ' ' + t + '\n').join('');
+        if (!ListJournal.stats) {
+            text = '#jcblock list journal, folded to ' + ZeroPad(0, 12) + '\n' + text;
+        }
+        fs.appendFile(ListJournal.filename, text, 'utf8', callback);
+    });
+}
+
+function ScheduleListJournalFold() {
+    // jcblock folds the journal between calls; this is for when it isn't running.
+    if (JcNative && !ListJournal.foldTimer && ListJournal.stats && ListJournal.stats.size >= FoldListJournalBytes) {
+        ListJournal.foldTimer = setTimeout(() => {
+            ListJournal.foldTimer = null;
+            try {
+                var count = JcNative.journalFold(ListJournal.filename, whiteListFileName, blackListFileName);
+                console.log('Folded %d list journal records into the list files', count);
+            } catch (e) {
+                console.log('Could not fold list journal %s: %s', ListJournal.filename, e);
+            }
+        }, CompactDelayMillis);
+    }
+}
+
+function WriteFileAtomic(filename, text, mode, callback) {
+    // Write to a temporary file in the same directory, flush it to disk,
+    // then rename it over the original. Readers see either the old file or the new one.
+    var tempname = filename + '.tmp';
+    fs.open(tempname, 'w', mode, (err, fd) => {
+        if (err) {
+            callback(err);
+            return;
+        }
+        fs.write(fd, text, 0, 'utf8', (err) => {
+            fs.fsync(fd, (serr) => {
+                fs.close(fd, (cerr) => {
+                    err = err || serr || cerr;
+                    if (err) {
+                        fs.unlink(tempname, () => callback(err));
+                    } else {
+                        fs.rename(tempname, filename, callback);
+                    }
+                });
             });
+        });
+    });
+}
+
+function FlushListStore(store) {
+    store.scheduled = false;
+    if (store.flushing || store.pending.length === 0) {
+        return;     // an active flush picks up anything queued meanwhile
+    }
+
+    var batch = store.pending;
+    store.pending = [];
+    store.flushing = true;
+
+    function Finish(err) {
+        store.flushing = false;
+        InvalidateDataset(DatasetForFile(path.basename(store.filename)));
+        for (var item of batch) {
+            item.callback(err);
+        }
+        FlushListStore(store);
+    }
+
+    RefreshListStore(store, (err) => {
+        if (err) {
+            Finish(err);
+            return;
+        }
+
+        // The mutations work on a copy, to find the records to append;
+        // the list itself gets them from the journal, in the order they
+        // went in with any of jcblock's.
+        var lines = store.lines.slice();
+        var records = [];
+        for (var item of batch) {
+            item.mutate(lines, records);
+        }
+
+        if (records.length === 0) {
+            Finish(null);
+            return;
+        }
+
+        for (var record of records) {
+            record.list = store.code;
         }
+        AppendListJournal(records, (err) => {
+            if (err) {
+                console.log('Error appending to %s: %s', ListJournal.filename, err);
+                Finish(err);
+            } else {
+                RefreshListStore(store, (err) => {
+                    ScheduleListJournalFold();
+                    Finish(err);
+                });
+            }
+        });
     });
 }
 
+function QueueListMutation(store, mutate, callback) {
+    // mutate(lines, records) edits the array of lines in place and pushes a
+    // journal record {op, text} onto records for each change it makes.
+    store.pending.push({mutate: mutate, callback: callback});
+    if (!store.scheduled) {
+        store.scheduled = true;
+        setImmediate(() => FlushListStore(store));
+    }
+}
+
+function UpdateLists(changes, response, callback) {
+    // changes = [[store, mutate], ...]
+    // Calls callback() once every change has been saved,
+    // or fails the response if any of them could not be.
+    var remaining = changes.length;
+    var failed = false;
+    for (var change of changes) {
+        QueueListMutation(change[0], change[1], (err) => {
+            if (!failed) {
+                if (err) {
+                    failed = true;
+                    FailResponse(response, err);
+                } else if (--remaining === 0) {
+                    callback();
+                }
+            }
+        });
+    }
+}
+
+function RemoveNumber(phonenumber) {
+    return function(lines, records) {
+        var record = {op: 'R', text: phonenumber};
+        if (ApplyListRecord(lines, record)) {
+            records.push(record);
+        }
+    };
+}
+
+function AddNumber(phonenumber) {
+    return function(lines, records) {
+        var record = {op: 'A', text: MakePhoneNumberRecord(phonenumber)};
+        if (ApplyListRecord(lines, record)) {
+            records.push(record);
+        }
+    };
+}
+
+function RemoveAndAddNumbers(removeSet, addSet) {
+    // Like RemoveNumber and AddNumber for many numbers at once,
+    // in a single pass over the lines of the list.
+    return function(lines, records) {
+        var kept = [];
+        var present = {};
+        var removed = {};
+        for (var line of lines) {
+            var record = ParseRecord(line);
+            if (record && removeSet[record.pattern]) {
+                if (!removed[record.pattern]) {
+                    removed[record.pattern] = true;
+                    records.push({op: 'R', text: record.pattern});
+                }
+                continue;
+            }
+            if (record) {
+                present[record.pattern] = true;
+            }
+            kept.push(line);
+        }
+
+        for (var number in addSet) {
+            if (!present[number]) {
+                var added = MakePhoneNumberRecord(number);
+                kept.push(added);
+                records.push({op: 'A', text: added});
+            }
+        }
+
+        lines.splice(0, lines.length, ...kept);
+    };
+}
+
 app.post('/api/rename/:phonenumber/:name?', (request, response) => {
     var number = request.params.phonenumber;
     if (!IsPhoneNumber(number)) {
@@ -525,7 +1987,7 @@ app.post('/api/rename/:phonenumber/:name?', (request, response) => {
             FailResponse(response, `Name length must not exceed ${MaxNameLength} characters.`);
         } else {
             SetName(number, newname);
-            fs.writeFile(database.filename, JSON.stringify(database.data), 'utf8', (err) => {
+            SaveName(number, (err) => {
                 if (err) {
                     FailResponse(response, err);
                 } else {
@@ -550,29 +2012,18 @@ app.post('/api/classify/:status/:phonenumber', (request, response) => {
         return;
     }
 
+    var changes;
     switch (status) {
         case 'blocked':
-            RemovePhoneNumberFromFile(whiteListFileName, phonenumber, response, function(){
-                AddPhoneNumberToFile(blackListFileName, phonenumber, response, function(){
-                    response.json({status: status});
-                });
-            });
+            changes = [[ListStores.safe, RemoveNumber(phonenumber)], [ListStores.blocked, AddNumber(phonenumber)]];
             break;
 
         case 'neutral':
-            RemovePhoneNumberFromFile(whiteListFileName, phonenumber, response, function(){
-                RemovePhoneNumberFromFile(blackListFileName, phonenumber, response, function(){
-                    response.json({status: status});
-                });
-            });
+            changes = [[ListStores.safe, RemoveNumber(phonenumber)], [ListStores.blocked, RemoveNumber(phonenumber)]];
             break;
 
         case 'safe':
-            RemovePhoneNumberFromFile(blackListFileName, phonenumber, response, function(){
-                AddPhoneNumberToFile(whiteListFileName, phonenumber, response, function(){
-                    response.json({status: status});
-                });
-            });
+            changes = [[ListStores.blocked, RemoveNumber(phonenumber)], [ListStores.safe, AddNumber(phonenumber)]];
             break;
 
         default:
@@ -580,8 +2031,132 @@ app.post('/api/classify/:status/:phonenumber', (request, response) => {
             FailResponse(response, 'Invalid status');
             return;
     }
+
+    UpdateLists(changes, response, function(){
+        response.json({status: status});
+    });
+});
+
+function ValidateBatchItem(item) {
+    // Returns an error message, or null if the item is a valid operation.
+    if (!item || typeof item !== 'object') {
+        return 'Operation must be an object.';
+    }
+    if (!IsPhoneNumber(item.number)) {
+        return 'Invalid phone number';
+    }
+    switch (item.op) {
+        case 'classify':
+            if (['safe', 'neutral', 'blocked'].indexOf(item.status) < 0) {
+                return 'Invalid status';
+            }
+            return null;
+
+        case 'rename':
+            if (typeof (item.name || '') !== 'string') {
+                return 'Name must be a string.';
+            }
+            if ((item.name || '').trim().length > MaxNameLength) {
+                return `Name length must not exceed ${MaxNameLength} characters.`;
+            }
+            return null;
+
+        case 'delete':
+            if (CallLog.numbers[item.number]) {
+                return 'Cannot delete phone number because it exists in the call history.';
+            }
+            return null;
+
+        default:
+            return 'Invalid operation';
+    }
+}
+
+app.post('/api/batch', bodyParser.json({limit: '256kb'}), (request, response) => {
+    // Apply a JSON array of operations:
+    //     {op:'classify', number:..., status:'safe'|'neutral'|'blocked'}
+    //     {op:'rename',   number:..., name:...}
+    //     {op:'delete',   number:...}
+    // Every operation is validated before any is applied; if any is invalid, none are.
+    // Then each list file is rewritten at most once, and all name changes
+    // go to the journal in one append.
+    var items = request.body;
+    if (!Array.isArray(items) || items.length === 0 || items.length > MaxBatchLength) {
+        FailResponse(response, `Batch must be an array of 1 to ${MaxBatchLength} operations.`);
+        return;
+    }
+
+    LoadDataset(Datasets.callerid, (err) => {
+        if (err) {
+            FailResponse(response, err);
+            return;
+        }
+
+        var results = items.map((item) => {
+            var error = ValidateBatchItem(item);
+            return error ? {error: error} : {status: 'OK'};
+        });
+        if (results.some((r) => r.error)) {
+            FailResponse(response, 'Invalid batch', {results: results});
+            return;
+        }
+
+        // Work out the final state of each affected number. Later items override earlier ones.
+        var safeRemove = {}, safeAdd = {}, blockedRemove = {}, blockedAdd = {};
+        var renamed = {};       // number => final name ('' to delete it)
+        for (var item of items) {
+            var number = item.number;
+            var status = (item.op === 'classify') ? item.status : (item.op === 'delete') ? 'neutral' : null;
+            if (status) {
+                delete safeRemove[number];  delete safeAdd[number];
+                delete blockedRemove[number];  delete blockedAdd[number];
+                (status === 'safe'    ? safeAdd    : safeRemove)[number] = true;
+                (status === 'blocked' ? blockedAdd : blockedRemove)[number] = true;
+            }
+            if (item.op === 'rename' || item.op === 'delete') {
+                renamed[number] = (item.op === 'rename') ? (item.name || '').trim() : '';
+            }
+        }
+
+        var changes = [
+            [ListStores.safe, RemoveAndAddNumbers(safeRemove, safeAdd)],
+            [ListStores.blocked, RemoveAndAddNumbers(blockedRemove, blockedAdd)]
+        ];
+
+        // Names change only once the list changes are saved, so a batch
+        // whose lists can't be saved leaves no renames behind either.
+        UpdateLists(changes, response, function(){
+            var numbers = Object.keys(renamed);
+            var remaining = numbers.length;
+            for (var number of numbers) {
+                SetName(number, renamed[number]);
+            }
+            var failed = false;
+            function Done() {
+                console.log('Applied batch of %d operations', items.length);
+                response.json({results: results});
+            }
+            if (remaining === 0) {
+                Done();
+            }
+            for (var number of numbers) {
+                SaveName(number, (err) => {
+                    if (!failed) {
+                        if (err) {
+                            failed = true;
+                            FailResponse(response, err);
+                        } else if (--remaining === 0) {
+                            Done();
+                        }
+                    }
+                });
+            }
+        });
+    });
 });
 
 const server = app.listen(port, () => {
     console.log('jcadmin server listening on port %s', port);
 });
+
+WatchDataFiles();
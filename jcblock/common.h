@@ -37,6 +37,7 @@ void tonesClose();
 
 //Declarations for functions defined in file truncate.c.
 int truncate_records();
+int truncate_due();
 
 FILE *fpCa;                // callerID.dat file
 FILE *fpBl;               // blacklist.dat file
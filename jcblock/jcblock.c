@@ -44,14 +44,17 @@
 #include <signal.h>
 
 #include "common.h"
+#include "jclist.h"
 
 #define DEBUG
 
 // Comment out the following define if you don't have ALSA audio
 // support. Then compile with:
-//     gcc -o jcblock jcblock.c truncate.c -lm
+//     gcc -o jcblock jcblock.c jclist.c jcstats.c jctrace.c truncate.c -lm -lrt
 // The program will then have all capabilities except the star (*) key
-// feature.
+// feature. With it defined, add tones.c to that command. The tones are
+// then read from a file; to hear them through the sound card, define
+// DO_ALSA in tones.c and add -lasound.
 //#define DO_TONES
 
 // Comment out the following define if you don't have an answering
@@ -93,6 +96,20 @@
 #include "radio.h"
 #endif
 
+// Comment out the following define if you don't want jcblock to
+// publish call counters and timing histograms in shared memory
+// (read them with jcstat). Then remove jcstats.c from the gcc
+// compile command (jctrace.c still needs -lrt).
+#define DO_STATS
+#include "jcstats.h"
+
+// Comment out the following define if you don't want jcblock to
+// keep a timeline of the stages of each call (dumped as Chrome trace
+// JSON on SIGUSR1 or by jctimeline). Then remove jctrace.c from the
+// gcc compile command.
+#define DO_TRACE
+#include "jctrace.h"
+
 #define OPEN_PORT_BLOCKED 1
 #define OPEN_PORT_POLLED  0
 
@@ -169,6 +186,10 @@ int main(int argc, char **argv)
   // Display copyright notice
   printf( "%s", copyright );
 
+  // Publish statistics for jcstat and jcadmin
+  jcstats_open();
+  jctrace_open();
+
 #ifdef DO_TONES
   // Initialize the the star (*) key tones operation
   tonesInit();
@@ -306,8 +327,12 @@ int send_modem_command(int fd, char *command )
   char *bufptr;         // Current char in buffer
   int nbytes;           // Number of bytes read
   int tries;            // Number of tries so far
+#ifdef DO_STATS
+  uint64_t startTime = jcstats_now();
+#endif
 
   // Send an AT command followed by a CR
+  jcstats_count( JCS_MODEM_COMMANDS, 1 );
   if( write(fd, command, strlen(command) ) != strlen(command) )
   {
     printf("send_modem_command: write() failed\n" );
@@ -335,12 +360,14 @@ int send_modem_command(int fd, char *command )
 #ifdef DEBUG
       printf("got command OK\n");
 #endif
+      jcstats_record( JCS_H_MODEM_CMD, jcstats_now() - startTime );
       return( 0 );
     }
   }
 #ifdef DEBUG
     printf("did not get command OK\n");
 #endif
+  jcstats_count( JCS_MODEM_FAILURES, 1 );
   return( -1 );
 }
 
@@ -351,6 +378,7 @@ int send_modem_command(int fd, char *command )
 int send_timed_modem_command(int fd, char *command, int numSecs )
 {
   // Send an AT command ending with a CR
+  jcstats_count( JCS_MODEM_COMMANDS, 1 );
   if( write(fd, command, strlen(command) ) != strlen(command) )
   {
     printf("send_timed_modem_command: write() failed\n" );
@@ -397,9 +425,20 @@ int wait_for_response(fd)
     // shouldn't happen, since VMIN is set larger than
     // the longest string expected).
 
+    // Note when the first character arrives (if tracing).
+    jctrace_wait_input( fd );
+
     inBlockedReadCall = TRUE;
     nbytes = read( fd, buffer, 250 );
     inBlockedReadCall = FALSE;
+    jctrace_frame_read();
+
+    if( nbytes > 0 )
+    {
+      jcstats_count( JCS_SERIAL_READS, 1 );
+      jcstats_count( JCS_SERIAL_BYTES, nbytes );
+      jcstats_record( JCS_H_READ_SIZE, nbytes );
+    }
 
     // Occasionally a call comes in that has a caller ID
     // field that is too long! Example:
@@ -434,6 +473,7 @@ int wait_for_response(fd)
     // A string was received. If its a 'RING' string, just ignore it.
     if( strstr( buffer, "RING" ) != NULL )
     {
+      jcstats_count( JCS_RINGS, 1 );
       continue;
     }
 
@@ -445,6 +485,8 @@ int wait_for_response(fd)
 
     // Caller ID data was received after the first ring.
     numRings = 1;
+    jcstats_call_start();
+    jctrace_begin();
 
     // A caller ID string was constructed.
 
@@ -513,6 +555,7 @@ int wait_for_response(fd)
     // Insert the year characters.
     buffer3[13] = curYear[0];
     buffer3[14] = curYear[1];
+    jctrace_stage( JCT_NORMALISED );
 
     // If a whitelist.dat file was present, compare the
     // caller ID string to entries in the whitelist. If a match
@@ -522,6 +565,7 @@ int wait_for_response(fd)
       if( check_whitelist( buffer3 ) == TRUE )
       {
         // Caller ID match was found so accept the call
+        jcstats_verdict( JCS_SAFE );
 
         // Tag and write the call record to the callerID.dat file.
         tag_and_write_callerID_record( buffer3, 'W');
@@ -651,6 +695,7 @@ int wait_for_response(fd)
             {
               // Tag and write call record to callerID.dat file.
               tag_and_write_callerID_record( buffer3, '*');
+              jcstats_count( JCS_STAR_KEY, 1 );
             }
             else
             {
@@ -699,12 +744,17 @@ int wait_for_response(fd)
 //
 int tag_and_write_callerID_record( char *buffer, char tagChar)
 {
+#ifdef DO_STATS
+  uint64_t startTime = jcstats_now();
+#endif
+
   // Overwrite the first character in the buffer with the tag.
   buffer[0] = tagChar;
 
 #ifdef SEND_ON_NETWORK
     // Socket broadcast the buffer's contents.
     broadcast(buffer);
+    jctrace_stage( JCT_BROADCAST );
 #endif
 
   // Close and re-open file 'callerID.dat' (in case it was
@@ -728,6 +778,10 @@ int tag_and_write_callerID_record( char *buffer, char tagChar)
     printf("fflush(fpCa) failed\n");
     return(-1);
   }
+  jcstats_count( JCS_LOG_WRITES, 1 );
+  jcstats_record( JCS_H_LOG_WRITE, jcstats_now() - startTime );
+  jctrace_stage( JCT_LOG_WRITTEN );
+  jctrace_end( buffer );
   return(0);
 }
 
@@ -740,11 +794,13 @@ static bool check_whitelist( char *callstr )
 {
   char whitebuf[100];
   char whitebufsave[100];
-  char *whitebufptr;
+  char whitepattern[JCL_RECORD_SIZE];
   char call_date[10];
   char *dateptr;
-  char *strptr;
   long file_pos_last, file_pos_next;
+#ifdef DO_STATS
+  uint64_t startTime = jcstats_now();
+#endif
 
   // Close and re-open the whitelist.dat file. Note: this
   // seems to be necessary to be able to write records
@@ -763,6 +819,7 @@ static bool check_whitelist( char *callstr )
 
   // Disable buffering for whitelist.dat writes
   setbuf( fpWh, NULL );
+  jcstats_record( JCS_H_LIST_RELOAD, jcstats_now() - startTime );
 
   // Seek to beginning of list
   fseek( fpWh, 0, SEEK_SET );
@@ -782,60 +839,52 @@ static bool check_whitelist( char *callstr )
     file_pos_last = file_pos_next;
     file_pos_next = ftell( fpWh );
 
-    // Ignore lines that start with a '#' character (comment lines)
-    if( whitebuf[0] == '#' )
-      continue;
+    // Save the string (for writing back to the file later)
+    strcpy( whitebufsave, whitebuf );
 
-    // Ignore lines containing just a '\n'
-    if( whitebuf[0] == '\n' )
+    // Check the record and get its search token. Comment lines
+    // (starting with '#') and lines containing just a '\n' are
+    // silently ignored.
+    switch( jclist_parse_record( whitebuf, whitepattern ) )
     {
-      continue;
-    }
+      case JCL_ENTRY:
+        break;
 
-    // Ignore records that are too short (don't have room for the date)
-    if( strlen( whitebuf ) < 26 )
-    {
-      printf("ERROR: whitelist.dat record is too short to hold date field.\n");
-      printf("       record: %s", whitebuf);
-      printf("       record is ignored (edit file and fix it).\n");
-      continue;
-    }
+      case JCL_TOO_SHORT:
+        printf("ERROR: whitelist.dat record is too short to hold date field.\n");
+        printf("       record: %s", whitebuf);
+        printf("       record is ignored (edit file and fix it).\n");
+        continue;
 
-    // Save the string (for writing back to the file later)
-    strcpy( whitebufsave, whitebuf );
+      case JCL_NO_TERMINATOR:
+        printf("ERROR: all whitelist.dat entry first fields *must be*\n");
+        printf("       terminated with a \'?\' character!! Entry is:\n");
+        printf("       %s", whitebuf);
+        printf("       Entry was ignored!\n");
+        continue;
 
-    // Make sure a '?' char is present in the string
-    if( ( strptr = strstr( whitebuf, "?" ) ) == NULL )
-    {
-      printf("ERROR: all whitelist.dat entry first fields *must be*\n");
-      printf("       terminated with a \'?\' character!! Entry is:\n");
-      printf("       %s", whitebuf);
-      printf("       Entry was ignored!\n");
-      continue;
-    }
+      case JCL_TERMINATOR_TOO_FAR:
+        printf("ERROR: terminator '?' is not within first 20 characters\n" );
+        printf("       %s", whitebuf);
+        printf("       Entry was ignored!\n");
+        continue;
 
-    // Make sure the '?' character is within the first twenty characters
-    if( (int)( strptr - whitebuf ) > 18 )
-    {
-      printf("ERROR: terminator '?' is not within first 20 characters\n" );
-      printf("       %s", whitebuf);
-      printf("       Entry was ignored!\n");
-      continue;
-    }
+      case JCL_NO_PATTERN:
+        printf("whitebuf strtok() failed\n");
+        return(TRUE);         // accept the call
 
-    // Get a pointer to the search token in the string
-    if( ( whitebufptr = strtok( whitebuf, "?" ) ) == NULL )
-    {
-      printf("whitebuf strtok() failed\n");
-      return(TRUE);         // accept the call
+      default:
+        continue;
     }
 
-    // Scan the call string for the whitelist entry
-    if( strstr( callstr, whitebufptr ) != NULL )
+    // Scan the call string for the whitelist entry; an anchored
+    // NMBR:/NAME: entry must match its whole field.
+    if( jclist_entry_match( whitepattern, callstr ) )
     {
 #ifdef DEBUG
-      printf("whitelist entry matches: %s\n", whitebuf );
+      printf("whitelist entry matches: %s\n", whitepattern );
 #endif
+      jctrace_stage( JCT_WHITELIST );
       // Make sure the 'DATE = ' field is present
       if( (dateptr = strstr( callstr, "DATE = " ) ) == NULL )
       {
@@ -877,6 +926,7 @@ static bool check_whitelist( char *callstr )
   }                               // end of while()
 
   // No whitelist.dat entry matched, so return FALSE.
+  jctrace_stage( JCT_WHITELIST );
   return(FALSE);
 }
 
@@ -889,11 +939,13 @@ static bool check_blacklist( char *callstr )
 {
   char blackbuf[100];
   char blackbufsave[100];
-  char *blackbufptr;
+  char blackpattern[JCL_RECORD_SIZE];
   char call_date[10];
   char *dateptr;
-  char *strptr;
   long file_pos_last, file_pos_next;
+#ifdef DO_STATS
+  uint64_t startTime = jcstats_now();
+#endif
 
   // Close and re-open the blacklist.dat file. Note: this
   // seems to be necessary to be able to write records
@@ -912,6 +964,7 @@ static bool check_blacklist( char *callstr )
 
   // Disable buffering for blacklist.dat writes
   setbuf( fpBl, NULL );
+  jcstats_record( JCS_H_LIST_RELOAD, jcstats_now() - startTime );
 
   // Seek to beginning of list
   fseek( fpBl, 0, SEEK_SET );
@@ -931,62 +984,58 @@ static bool check_blacklist( char *callstr )
     file_pos_last = file_pos_next;
     file_pos_next = ftell( fpBl );
 
-    // Ignore lines that start with a '#' character (comment lines)
-    if( blackbuf[0] == '#' )
-      continue;
+    // Save the string (for writing back to the file later)
+    strcpy( blackbufsave, blackbuf );
 
-    // Ignore lines containing just a '\n'
-    if( blackbuf[0] == '\n' )
+    // Check the record and get its search token. Comment lines
+    // (starting with '#') and lines containing just a '\n' are
+    // silently ignored.
+    switch( jclist_parse_record( blackbuf, blackpattern ) )
     {
-      continue;
-    }
+      case JCL_ENTRY:
+        break;
 
-    // Ignore records that are too short (don't have room for the date)
-    if( strlen( blackbuf ) < 26 )
-    {
-       printf("ERROR: blacklist.dat record is too short to hold date field.\n");
-       printf("       record: %s", blackbuf );
-       printf("       record is ignored (edit file and fix it).\n");
-       continue;
-    }
+      case JCL_TOO_SHORT:
+        printf("ERROR: blacklist.dat record is too short to hold date field.\n");
+        printf("       record: %s", blackbuf);
+        printf("       record is ignored (edit file and fix it).\n");
+        continue;
 
-    // Save the string (for writing back to the file later)
-    strcpy( blackbufsave, blackbuf );
+      case JCL_NO_TERMINATOR:
+        printf("ERROR: all blacklist.dat entry first fields *must be*\n");
+        printf("       terminated with a \'?\' character!! Entry is:\n");
+        printf("       %s", blackbuf);
+        printf("       Entry was ignored!\n");
+        continue;
 
-    // Make sure a '?' char is present in the string
-    if( ( strptr = strstr( blackbuf, "?" ) ) == NULL )
-    {
-      printf("ERROR: all blacklist.dat entry first fields *must be*\n");
-      printf("       terminated with a \'?\' character!! Entry is:\n");
-      printf("       %s", blackbuf);
-      printf("       Entry was ignored!\n");
-      continue;
-    }
+      case JCL_TERMINATOR_TOO_FAR:
+        printf("ERROR: terminator '?' is not within first 20 characters\n" );
+        printf("       %s", blackbuf);
+        printf("       Entry was ignored!\n");
+        continue;
 
-    // Make sure the '?' character is within the first twenty characters
-    // (could not be if the previous record was only partially written).
-    if( (int)( strptr - blackbuf ) > 18 )
-    {
-      printf("ERROR: terminator '?' is not within first 20 characters\n" );
-      printf("       %s", blackbuf);
-      printf("       Entry was ignored!\n");
-      continue;
-    }
+      case JCL_NO_PATTERN:
+        printf("blackbuf strtok() failed\n");
+        return(FALSE);
 
-    // Get a pointer to the search token in the string
-    if( ( blackbufptr = strtok( blackbuf, "?" ) ) == NULL )
-    {
-      printf("blackbuf strtok() failed\n");
-      return(FALSE);
+      default:
+        continue;
     }
 
-    // Scan the call string for the blacklist entry
-    if( strstr( callstr, blackbufptr ) != NULL )
+    // Scan the call string for the blacklist entry; an anchored
+    // NMBR:/NAME: entry must match its whole field.
+    if( jclist_entry_match( blackpattern, callstr ) )
     {
 #ifdef DEBUG
-      printf("blacklist entry matches: %s\n", blackbuf );
+      printf("blacklist entry matches: %s\n", blackpattern );
+#endif
+      jcstats_verdict( JCS_BLOCKED );
+      jctrace_stage( JCT_BLACKLIST );
+#ifdef DO_STATS
+      startTime = jcstats_now();      // start of the hangup phase
 #endif
       sleep(1);
+      jctrace_stage( JCT_HANGUP_SENT );   // the hangup commands follow
 
 #ifdef DO_FAX_TONE
       // Send an ATA command. Don't wait for a response.
@@ -1025,6 +1074,9 @@ static bool check_blacklist( char *callstr )
       close_open_port();
 #endif                     // end of DO_USR5637_MODEM
 #endif                     // end of DO_FAX_TONE
+      jctrace_stage( JCT_ON_HOOK );
+      jcstats_record( JCS_H_HANGUP, jcstats_now() - startTime );
+
       // Make sure the 'DATE = ' field is present
       if( (dateptr = strstr( callstr, "DATE = " ) ) == NULL )
       {
@@ -1071,6 +1123,8 @@ static bool check_blacklist( char *callstr )
   }                                         // end of while()
 
   /* A blacklist.dat entry was not matched, so return FALSE */
+  jcstats_verdict( JCS_NEUTRAL );
+  jctrace_stage( JCT_BLACKLIST );
   return(FALSE);
 }
 
@@ -47,8 +47,15 @@
 #include <termios.h>
 #include <time.h>
 #include <signal.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
 
 #include "common.h"
+#include "jclist.h"
+#include "jcpattern.h"
+#include "jcdle.h"
 
 #define DEBUG
 
@@ -81,6 +88,129 @@
 #include "radio.h"
 #endif
 
+// Comment out the following define if you don't want jcblock to
+// publish call counters and timing histograms in shared memory
+// (read them with jcstat). Then remove jcstats.c from the gcc
+// compile command (jctrace.c still needs -lrt).
+#define DO_STATS
+#include "jcstats.h"
+
+// Comment out the following define if you don't want jcblock to
+// keep a timeline of the stages of each call (dumped as Chrome trace
+// JSON on SIGUSR1 or by jctimeline). Then remove jctrace.c from the
+// gcc compile command.
+#define DO_TRACE
+#include "jctrace.h"
+
+// Comment out the following define if you don't want the option
+// (-r seconds) of answering blocked calls in voice mode and recording
+// the caller to a WAV file in ./recordings. Then remove jcrecord.c
+// from the gcc compile command.
+#define DO_RECORD
+
+// Comment out the following define if you don't want the option (-s)
+// of answering blocked calls in voice mode and playing them the
+// "number disconnected" special information tones (SIT) before
+// hanging up. Then remove jcplay.c from the gcc compile command.
+#define DO_INTERCEPT
+#define INTERCEPT_REPEATS 2
+
+// Voice mode sample format for both of the above. It must select 8
+// bit unsigned samples at 8000 per second; the code for that varies
+// from modem to modem (see the modem's AT+VSM=? list).
+#define VOICE_FORMAT "AT+VSM=1,8000\r"
+
+// Comment out the following define if you don't want jcblock to
+// remember the verdicts of recent callers, so that a repeat caller
+// is decided without reading the lists. Then remove jccache.c from
+// the gcc compile command.
+#define DO_CACHE
+
+// Comment out the following define if you don't want jcblock to map
+// the lists compiled by jclistc (lists.img) when the image is current,
+// rather than reading and compiling the text lists itself. Then remove
+// jcimage.c from the gcc compile command.
+#define DO_IMAGE
+
+#ifdef DO_IMAGE
+#include "jcimage.h"
+#endif
+
+// Comment out the following define if you don't want jcblock to also
+// block calls from the numbers in the imported number stores
+// (imported*.num, made by jcimport). Then remove jcnumset.c from the
+// gcc compile command.
+#define DO_IMPORTED
+
+#ifdef DO_IMPORTED
+#include "jcnumset.h"
+#endif
+
+// Comment out the following define if you don't want jcblock to keep
+// its changes to the lists (entry dates and '*' key entries) in the
+// list journal (lists.journal), which jcadmin shares, rather than
+// writing them into the list files. Then remove jcjournal.c from the
+// gcc compile command.
+#define DO_JOURNAL
+
+#ifdef DO_JOURNAL
+#include "jcjournal.h"
+#endif
+
+// Comment out the following define if you don't want the option (-u)
+// of answering verdict queries from other programs (jcquery, a PBX
+// script) on a Unix domain socket. Then remove jcservice.c from the
+// gcc compile command.
+#define DO_SERVICE
+
+#ifdef DO_SERVICE
+#include "jcservice.h"
+#endif
+
+// Comment out the following define if you don't want a new jcblock
+// started with -t to take the modem over from the running one, open
+// and initialised, rather than the running one being stopped (which
+// resets the modem) and the new one initialising it again. Then
+// remove jchandover.c from the gcc compile command.
+#define DO_HANDOVER
+
+#ifdef DO_HANDOVER
+#include "jchandover.h"
+#endif
+
+// Comment out the following define if you want the thread deciding
+// calls to write callerID.dat records, the journal's entry dates and
+// the network broadcasts itself, rather than queueing them for stage
+// threads (so that a slow SD card or network can't hold up the next
+// call). Then remove jcstage.c from the gcc compile command.
+#define DO_STAGES
+
+#ifdef DO_STAGES
+#include "jcstage.h"
+#endif
+
+// Comment out the following define if you don't want the option of
+// deciding calls in real time (-f priority, -a cpu: see jcrealtime.h)
+// or the counts of page faults and context switches while calls are
+// decided. Then remove jcrealtime.c from the gcc compile command.
+#define DO_REALTIME
+
+#ifdef DO_REALTIME
+#include "jcrealtime.h"
+#endif
+
+#ifdef DO_RECORD
+#include "jcrecord.h"
+#endif
+
+#ifdef DO_INTERCEPT
+#include "jcplay.h"
+#endif
+
+#ifdef DO_CACHE
+#include "jccache.h"
+#endif
+
 #define OPEN_PORT_BLOCKED 1
 #define OPEN_PORT_POLLED  0
 
@@ -94,8 +224,178 @@ static time_t pollTime, pollStartTime;
 static bool modemInitialized = FALSE;
 static bool inBlockedReadCall = FALSE;
 static int numRings = 0;
-pthread_t threadId;
-bool gotStarKey = FALSE;
+
+// The *-key listener. One thread, started once, reads the serial port
+// while the listener is armed (during the *-key window) and posts to
+// starKeyFd when the modem reports a *-key press, or that the caller
+// has hung up (listenerKey says which). wakeFd tells it to stop
+// reading. listenerArmed, listenerReading and listenerKey are
+// protected by listenerLock.
+static pthread_t listenerId;
+static pthread_mutex_t listenerLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t listenerCond = PTHREAD_COND_INITIALIZER;
+static bool listenerArmed = FALSE;
+static bool listenerReading = FALSE;
+static char listenerKey;
+static int listenerMode;
+
+// What the listener is armed for
+#define LISTEN_STAR_KEY  0
+#define LISTEN_RECORD    1
+
+// Seconds of each blocked call to record (-r); 0 records nothing.
+static int recordSecs = 0;
+
+// Play the intercept message to blocked calls (-s)
+static bool playIntercept = FALSE;
+#ifdef DO_INTERCEPT
+static struct jcplay_message intercept;
+#endif
+static int starKeyFd = -1;
+static int wakeFd = -1;
+
+// A blocked call being answered in voice mode (-s, -r). The main loop
+// moves it on (run_voice_session()) as the modem answers, between its
+// other work, instead of waiting for the message to play.
+#define VOICE_IDLE       0      // no call is being answered in voice mode
+#define VOICE_CONNECT    1      // AT+VTX sent: waiting for CONNECT
+#define VOICE_PLAYING    2      // writing the intercept message
+#define VOICE_PLAYED     3      // waiting for OK, once the modem has played it
+#define VOICE_RECORDING  4      // AT+VRX sent: recording the caller
+#define VOICE_STOPPING   5      // recording stopped: waiting for DLE ETX
+#define VOICE_RESETTING  6      // ATZ sent: giving the modem a second
+
+#define VOICE_SLICE_MS   1000   // longest the session keeps the main loop
+
+struct voice_session
+{
+  int state;
+  char callstr[255];            // the call's caller ID string
+  struct timespec deadline;     // when the state gives up
+  char reply[255];              // what the modem has sent in this state
+  int replyUsed;
+  size_t played;                // bytes of the intercept message written
+  int portFlags;                // the port's flags, while it is non-blocking
+};
+
+static struct voice_session voice;
+
+// The lists, compiled into one automaton (see jcpattern.h). They are
+// loaded again by load_lists() when either file changes; listGen
+// counts the loads, so verdicts cached under older lists go unused.
+static struct jclist whiteList, blackList;
+static struct jcpattern listMatcher;
+static struct jclist_watch whiteWatch = { "./whitelist.dat" };
+static struct jclist_watch blackWatch = { "./blacklist.dat" };
+static uint32_t listGen;
+static int listCounts[JCP_GROUPS];       // entries in each list
+
+#ifdef DO_IMAGE
+// The compiled image, when it was current at the last load; the text
+// lists above are then empty. It is remapped when jclistc replaces it.
+static struct jcimage listImage;
+static bool usingImage = FALSE;
+static struct jclist_watch imageWatch = { JCIMAGE_FILE };
+#endif
+
+#ifdef DO_IMPORTED
+// The imported numbers, blocked unless the whitelist accepts the call:
+// those merged, and those added and removed since (see jcnumset.h).
+// The stores are mapped again when jcimport replaces any of them.
+static struct jcnumset importedSet, addedSet, removedSet;
+static struct jclist_watch importedWatch = { JCNUMSET_FILE };
+static struct jclist_watch addedWatch = { JCNUMSET_ADDED };
+static struct jclist_watch removedWatch = { JCNUMSET_REMOVED };
+#endif
+
+#ifdef DO_JOURNAL
+// The list journal, and the number of entries its records have added
+// or removed since the list files were last read. The image has none
+// of them, so it is only used while there are none.
+static struct jcjournal journal = { -1 };
+static int journalEdits;
+#endif
+
+// The first entry (counting the whitelist's entries before the
+// blacklist's) that could match a call's DATE or TIME digits. Only
+// a verdict reached by an earlier entry, or by no entry when there
+// is no such entry, may be cached.
+static int firstTimeDependent;
+
+#ifdef DO_CACHE
+static struct jccache cache;
+static char cacheKey[JCCACHE_KEY_SIZE];
+static bool cacheKeyed = FALSE;          // cacheKey is the current call's
+#endif
+
+#ifdef DO_SERVICE
+// The verdict service's socket (-u), if it is to be offered. The
+// service thread only reads the lists; the main thread holds listLock
+// for writing while it changes them.
+static char *servicePath = NULL;
+static pthread_rwlock_t listLock = PTHREAD_RWLOCK_INITIALIZER;
+#define LOCK_LISTS()    pthread_rwlock_wrlock( &listLock )
+#define UNLOCK_LISTS()  pthread_rwlock_unlock( &listLock )
+#else
+#define LOCK_LISTS()
+#define UNLOCK_LISTS()
+#endif
+
+// Work for a call that can wait: done by the log stage's thread
+// with DO_STAGES, or straight away without.
+#define LOG_RECORD  'L'                  // append 'text' to callerID.dat
+#define LOG_TOUCH   'T'                  // journal 'text', an entry's new date
+
+struct log_job
+{
+  uint64_t queuedAt;
+  struct jctrace_call *trace;            // the call's trace record
+  uint64_t traceSeq;                     // for LOG_RECORD: to publish it
+  char kind;                             // LOG_RECORD or LOG_TOUCH
+  int list;                              // for LOG_TOUCH
+  char text[256];
+};
+
+#ifdef SEND_ON_NETWORK
+struct broadcast_job
+{
+  uint64_t queuedAt;
+  struct jctrace_call *trace;
+  char text[256];
+};
+#endif
+
+static struct log_job directJob;         // the job, done straight away
+#ifdef DO_JOURNAL
+static struct jcjournal *touchJournal = &journal;
+#endif
+#ifdef DO_STAGES
+static bool stagesRunning = FALSE;
+static struct jcstage logStage;
+#ifdef SEND_ON_NETWORK
+static struct jcstage broadcastStage;
+#endif
+#ifdef DO_JOURNAL
+static struct jcjournal logJournal = { -1 };   // the log stage's own
+#endif
+#endif
+
+#ifdef DO_HANDOVER
+// Take the modem over from the running jcblock (-t); and the socket
+// a new jcblock asks this one for it on.
+static bool takeOver = FALSE;
+static int handoverFd = -1;
+static char takenPort[sizeof( ((struct jchandover_state *)0)->serialPort )];
+#endif
+
+#ifdef DO_REALTIME
+// SCHED_FIFO priority (-f) and CPU (-a) for the thread deciding
+// calls; and its page faults and context switches when the caller ID
+// string arrived.
+static int realtimePriority = 0;
+static int realtimeCpu = -1;
+static struct jcrealtime_usage callUsage;
+#endif
 
 static void cleanup( int signo );
 
@@ -108,8 +408,78 @@ static bool write_blacklist( char *callstr );
 static bool check_whitelist( char * callstr );
 static void open_port( int mode );
 int init_modem(int fd);
+static int init_caller_id( int fd );
 int tag_and_write_callerID_record( char *buffer, char tagChar);
-void* blockForStarKey(void *arg);
+static int write_callerID_record( const char *record );
+static struct log_job *new_log_job( char kind );
+static void queue_log_job( struct log_job *job );
+static void do_log_job( struct log_job *job );
+#ifdef SEND_ON_NETWORK
+static void queue_broadcast( const char *record );
+#endif
+#ifdef DO_STAGES
+static void start_stages( void );
+static void drain_stages( void );
+static void run_log_job( void *arg );
+#ifdef SEND_ON_NETWORK
+static void run_broadcast_job( void *arg );
+#endif
+#endif
+static int start_listener( void );
+static void arm_listener( int mode );
+static char wait_for_listener( int numSecs );
+static void disarm_listener( void );
+static void* listen_for_star_key(void *arg);
+static void answer_in_voice_mode( char *callstr );
+static void end_voice_message( void );
+static void hang_up_voice_call( void );
+static void enter_voice_state( int state, long msecs );
+static void run_voice_session( void );
+static void hang_up_blocked_call( void );
+static void load_lists( void );
+static bool lists_changed( void );
+static void compile_lists( uint64_t startTime );
+#ifdef DO_JOURNAL
+static int read_journal( void );
+static void apply_journal_record( void *arg, const struct jcjournal_record *r );
+#ifdef DO_IMAGE
+static int count_journal_edits( void );
+#endif
+static void fold_journal( bool force );
+#endif
+#ifdef DO_IMAGE
+static int load_image( void );
+#endif
+#ifdef DO_IMPORTED
+static bool load_store( struct jclist_watch *watch, struct jcnumset *set );
+static void load_imported( void );
+static bool imported_number( char *callstr );
+#endif
+static int list_verdict( char *callstr, int *rule );
+static void list_entry( int list, int rule, struct jclist_entry *entry );
+static int read_list( const char *filename, struct jclist *list );
+static void touch_list_date( struct jclist_watch *watch,
+                             const struct jclist_entry *entry,
+                             char *callstr, bool keepPermanent );
+static void remember_verdict( int verdict, int rule );
+#ifdef DO_CACHE
+static int cached_verdict( char *callstr );
+#endif
+#ifdef DO_SERVICE
+static void service_verdict( char *callstr, struct jcservice_answer *answer );
+#endif
+#ifdef DO_HANDOVER
+static int take_over( void );
+static void wait_for_modem_or_handover( void );
+static void hand_over( void );
+#endif
+#ifdef DO_REALTIME
+static void start_call_usage( void );
+static void count_call_usage( void );
+#else
+#define start_call_usage()
+#define count_call_usage()
+#endif
 
 static char *copyright = "\n"
 	"jcblock Copyright (C) 2015 Walter S. Heath\n"
@@ -130,7 +500,7 @@ int main(int argc, char **argv)
   // See if a modem port argument was specified
   if( argc > 1 )
   {
-    while( ( optChar = getopt( argc, argv, "p:h" ) ) != EOF )
+    while( ( optChar = getopt( argc, argv, "p:r:su:tf:a:h" ) ) != EOF )
     {
       switch( optChar )
       {
@@ -138,11 +508,61 @@ int main(int argc, char **argv)
           serialPort = optarg;
           break;
 
+#ifdef DO_RECORD
+        case 'r':
+          recordSecs = atoi( optarg );
+          break;
+#endif
+
+#ifdef DO_INTERCEPT
+        case 's':
+          playIntercept = TRUE;
+          break;
+#endif
+
+#ifdef DO_SERVICE
+        case 'u':
+          servicePath = optarg;
+          break;
+#endif
+
+#ifdef DO_HANDOVER
+        case 't':
+          takeOver = TRUE;
+          break;
+#endif
+
+#ifdef DO_REALTIME
+        case 'f':
+          realtimePriority = atoi( optarg );
+          break;
+
+        case 'a':
+          realtimeCpu = atoi( optarg );
+          break;
+#endif
+
         case 'h':
         default:
-          fprintf( stderr, "Usage: jcblock [-p /dev/<portID>]\n" );
+          fprintf( stderr, "Usage: jcblock [-p /dev/<portID>] [-r seconds] [-s] [-u socket] [-t] [-f priority] [-a cpu]\n" );
           fprintf( stderr, "Default modem port is: /dev/ttyACM0.\n" );
           fprintf( stderr, "For another port, use the -p option.\n" );
+#ifdef DO_RECORD
+          fprintf( stderr, "To record blocked calls, use the -r option.\n" );
+#endif
+#ifdef DO_INTERCEPT
+          fprintf( stderr, "To play blocked calls the intercept tones, use -s.\n" );
+#endif
+#ifdef DO_SERVICE
+          fprintf( stderr, "To answer verdict queries on a socket (%s, say), use -u.\n", JCSERVICE_SOCKET );
+#endif
+#ifdef DO_HANDOVER
+          fprintf( stderr, "To take the modem over from the running jcblock, use -t.\n" );
+#endif
+#ifdef DO_REALTIME
+          fprintf( stderr, "To decide calls at SCHED_FIFO priority 1-99 (as root), use -f;\n" );
+          fprintf( stderr, "to decide them on one CPU, use -a.\n" );
+#endif
           _exit(-1);
       }
     }
@@ -151,6 +571,10 @@ int main(int argc, char **argv)
   // Display copyright notice
   printf( "%s", copyright );
 
+  // Publish statistics for jcstat and jcadmin
+  jcstats_open();
+  jctrace_open();
+
   // Open or create a file to append caller ID strings to
   if( (fpCa = fopen( "./callerID.dat", "a+" ) ) == NULL )
   {
@@ -170,13 +594,42 @@ int main(int argc, char **argv)
     printf("fopen() of blacklist.dat failed. A blacklist must exist.\n" );
     return(-1);
   }
-  // Open the modem port
-  open_port( OPEN_PORT_BLOCKED );
+#ifdef DO_HANDOVER
+  // Take the modem over as it is, with the port already open
+  if( takeOver )
+  {
+    if( take_over() != 0 )
+    {
+      printf("take_over() failed; is jcblock running?\n");
+      return(-1);
+    }
+  }
+  else
+#endif
+  {
+    // Open the modem port
+    open_port( OPEN_PORT_BLOCKED );
+
+    // Initialize the modem
+    if( init_modem(fd) != 0 )
+    {
+      printf("init_modem() failed\n");
+      close(fd);
+      fclose(fpCa);
+      fclose(fpBl);
+      fclose(fpWh);
+      fflush(stdout);
+      sync();
+      return(0);
+    }
+  }
+
+modemInitialized = TRUE;
 
-  // Initialize the modem
-  if( init_modem(fd) != 0 )
+  // Start the *-key listener thread
+  if( start_listener() != 0 )
   {
-    printf("init_modem() failed\n");
+    printf("start_listener() failed\n");
     close(fd);
     fclose(fpCa);
     fclose(fpBl);
@@ -186,7 +639,65 @@ int main(int argc, char **argv)
     return(0);
   }
 
-modemInitialized = TRUE;
+#ifdef DO_RECORD
+  // Start the thread that writes call recordings
+  if( recordSecs > 0 && jcrecord_init() != 0 )
+  {
+    printf("jcrecord_init() failed; calls will not be recorded\n");
+    recordSecs = 0;
+  }
+#endif
+
+#ifdef DO_INTERCEPT
+  // Make the intercept message now, so playing it is just a write
+  if( playIntercept && jcplay_build_sit( &intercept, INTERCEPT_REPEATS ) != 0 )
+  {
+    printf("jcplay_build_sit() failed; blocked calls will just be hung up\n");
+    playIntercept = FALSE;
+  }
+#endif
+
+#ifdef DO_JOURNAL
+  if( jcjournal_open( &journal, JCJOURNAL_FILE ) != 0 )
+  {
+    printf("jcjournal_open() failed; list changes will be written to the files\n");
+    jcjournal_close( &journal );
+  }
+#endif
+
+  // Read and compile the lists now, so the first call doesn't wait
+  load_lists();
+#ifdef DO_JOURNAL
+  // Fold in any journal left from before
+  fold_journal( TRUE );
+#endif
+#ifdef DO_CACHE
+  jccache_init( &cache );
+#endif
+
+#ifdef DO_SERVICE
+  // Answer verdict queries once the lists are loaded
+  if( servicePath != NULL && jcservice_start( servicePath, service_verdict ) != 0 )
+    printf("jcservice_start() failed; verdict queries will not be answered\n");
+#endif
+
+#ifdef DO_HANDOVER
+  // Let a new jcblock take over from this one
+  if( ( handoverFd = jchandover_listen( JCHANDOVER_SOCKET ) ) < 0 )
+    printf("jchandover_listen() failed; jcblock -t will not be able to take over\n");
+#endif
+
+#ifdef DO_STAGES
+  // Start the threads that log and broadcast calls
+  start_stages();
+#endif
+
+#ifdef DO_REALTIME
+  // Last, so that only this thread is made real-time
+  if( ( realtimePriority != 0 || realtimeCpu >= 0 ) &&
+      jcrealtime_start( realtimePriority, realtimeCpu ) != 0 )
+    printf("jcrealtime_start() failed; calls may be decided late\n");
+#endif
 
   printf("Waiting for a call...\n");
 
@@ -218,6 +729,15 @@ int init_modem(int fd )
 
   sleep(1);   // needed
 
+  return( init_caller_id(fd) );
+}
+
+//
+// The rest of init_modem(), once the modem has had a second to
+// get over the ATZ.
+//
+static int init_caller_id( int fd )
+{
 #ifdef DO_COUNTRY_CODE
   // If operating in a non-US telephone system region,
   // insert an appropriate "AT+GCI=XX\r" modem command here.
@@ -258,8 +778,12 @@ int send_modem_command(int fd, char *command )
   char *bufptr;         // Current char in buffer
   int nbytes;           // Number of bytes read
   int tries;            // Number of tries so far
+#ifdef DO_STATS
+  uint64_t startTime = jcstats_now();
+#endif
 
   // Send an AT command followed by a CR
+  jcstats_count( JCS_MODEM_COMMANDS, 1 );
   if( write(fd, command, strlen(command) ) != strlen(command) )
   {
     printf("send_modem_command: write() failed\n" );
@@ -287,12 +811,14 @@ int send_modem_command(int fd, char *command )
 #ifdef DEBUG
       printf("got command OK\n");
 #endif
+      jcstats_record( JCS_H_MODEM_CMD, jcstats_now() - startTime );
       return( 0 );
     }
   }
 #ifdef DEBUG
     printf("did not get command OK\n");
 #endif
+  jcstats_count( JCS_MODEM_FAILURES, 1 );
   return( -1 );
 }
 
@@ -303,6 +829,7 @@ int send_modem_command(int fd, char *command )
 int send_timed_modem_command(int fd, char *command, int numSecs )
 {
   // Send an AT command ending with a CR
+  jcstats_count( JCS_MODEM_COMMANDS, 1 );
   if( write(fd, command, strlen(command) ) != strlen(command) )
   {
     printf("send_timed_modem_command: write() failed\n" );
@@ -327,7 +854,8 @@ int wait_for_response(fd)
   time_t currentTime;
   int currentYear;
   char curYear[4];
-  int err;
+  bool gotStarKey;
+  int verdict;
 
   // Get a string of characters from the modem
   while(1)
@@ -339,6 +867,22 @@ int wait_for_response(fd)
     sync();             // flush kernel buffers to disk
 #endif
 
+#ifdef DO_JOURNAL
+    // Between calls, fold the journal into the list files if it
+    // has grown big enough.
+    LOCK_LISTS();
+    fold_journal( FALSE );
+    UNLOCK_LISTS();
+#endif
+
+    // A call being answered in voice mode has the modem until it is
+    // done: move it on, and come back round.
+    if( voice.state != VOICE_IDLE )
+    {
+      run_voice_session();
+      continue;
+    }
+
     // Block until at least one character is available.
     // After first character is received, continue reading
     // characters until inter-character timeout (VTIME)
@@ -346,9 +890,26 @@ int wait_for_response(fd)
     // shouldn't happen, since VMIN is set larger than
     // the longest string expected).
 
+#ifdef DO_HANDOVER
+    // Until the modem sends something, a new jcblock may take over.
+    if( handoverFd >= 0 )
+      wait_for_modem_or_handover();
+#endif
+
+    // Note when the first character arrives (if tracing).
+    jctrace_wait_input( fd );
+
     inBlockedReadCall = TRUE;
     nbytes = read( fd, buffer, 250 );
     inBlockedReadCall = FALSE;
+    jctrace_frame_read();
+
+    if( nbytes > 0 )
+    {
+      jcstats_count( JCS_SERIAL_READS, 1 );
+      jcstats_count( JCS_SERIAL_BYTES, nbytes );
+      jcstats_record( JCS_H_READ_SIZE, nbytes );
+    }
 
     // Occasionally a call comes in that has a caller ID
     // field that is too long! Example:
@@ -389,6 +950,7 @@ int wait_for_response(fd)
       // comes in BEFORE the first ring. Make code adjustments
       // as necessary for your phone system.
       numRings = 1;                // count the ring
+      jcstats_count( JCS_RINGS, 1 );
       continue;
     }
 
@@ -398,6 +960,9 @@ int wait_for_response(fd)
     {
       continue;                   // If 'DATE' is not present...
     }
+    jcstats_call_start();
+    jctrace_begin();
+    start_call_usage();
 
     // A caller ID string was constructed.
 
@@ -437,29 +1002,56 @@ int wait_for_response(fd)
     // Insert the year characters.
     buffer2[13] = curYear[0];
     buffer2[14] = curYear[1];
+    jctrace_stage( JCT_NORMALISED );
+
+    // Pick up any changes made to the lists since the last call. The
+    // files are only read (and the cache's verdicts dropped) if a
+    // stat of them says they have changed, so an unchanged list costs
+    // a repeat caller nothing.
+    LOCK_LISTS();
+    if( lists_changed() )
+      load_lists();
+    UNLOCK_LISTS();
+
+    // If the same caller called recently and neither list has
+    // changed since, the verdict cache decides the call (a blocked
+    // call is terminated straight away). Otherwise (verdict -1) the
+    // lists are checked.
+#ifdef DO_CACHE
+    verdict = cached_verdict( buffer2 );
+#else
+    verdict = -1;
+#endif
 
     // If a whitelist.dat file was present, compare the
     // caller ID string to entries in the whitelist. If a match
     // is found, accept the call and bypass the blacklist check.
-    if( fpWh != NULL )
+    if( verdict == JCL_SAFE ||
+        ( verdict < 0 && fpWh != NULL && check_whitelist( buffer2 ) == TRUE ) )
     {
-      if( check_whitelist( buffer2 ) == TRUE )
-      {
-        // Caller ID match was found so accept the call
+      // Caller ID match was found so accept the call
+      jcstats_verdict( JCS_SAFE );
+      count_call_usage();
 
-        // Tag and write the call record to the callerID.dat file.
-        tag_and_write_callerID_record( buffer2, 'W');
-        continue;
-      }
+      // Tag and write the call record to the callerID.dat file.
+      tag_and_write_callerID_record( buffer2, 'W');
+      continue;
     }
 
     // Compare the caller ID string to entries in the blacklist. If
     // a match is found, answer (i.e., terminate) the call.
-    if( check_blacklist( buffer2 ) == TRUE )
+    if( verdict == JCL_BLOCKED ||
+        ( verdict < 0 && check_blacklist( buffer2 ) == TRUE ) )
     {
       // Blacklist entry was found.
       //
 #ifdef DO_TRUNCATE
+#ifdef DO_STAGES
+      // Truncating rewrites callerID.dat (and blacklist.dat): the log
+      // stage must be done with them first.
+      if( truncate_due() )
+        drain_stages();
+#endif
       // The following function truncates (removes old) entries
       // in data files -- if thirty days have elapsed since the
       // last time it truncated. Entries in callerID.dat are removed
@@ -470,11 +1062,29 @@ int wait_for_response(fd)
       // main program to operate normally. You may remove it if you
       // don't want automatic file truncation. All of its code is in
       // truncate.c.
+#ifdef DO_JOURNAL
+      // The entry dates in the journal decide which entries are old,
+      // so fold it first, and hold it until blacklist.dat is replaced.
+      if( journal.fd >= 0 && truncate_due() && jcjournal_lock( &journal ) == 0 )
+      {
+        LOCK_LISTS();
+        fold_journal( TRUE );
+        UNLOCK_LISTS();
+        truncate_records();
+        jcjournal_unlock( &journal );
+      }
+      else
+#endif
       truncate_records();
 #endif                            // end DO_TRUNCATE
 
       // Tag and write the call record to the callerID.dat file.
       tag_and_write_callerID_record( buffer2, 'B');
+
+      // If playing the intercept message or recording, the call
+      // has not been terminated yet: answer it now that it is logged.
+      if( playIntercept || recordSecs > 0 )
+        answer_in_voice_mode( buffer2 );
       continue;
     }
     else			// start of *-key check
@@ -573,47 +1183,20 @@ int wait_for_response(fd)
         send_modem_command(fd, "AT+VLS=1\r");
         usleep( 250000 );
 
-        // Get current time (seconds since Unix Epoch)
-        if( (pollStartTime = time( NULL ) ) == -1 )
-        {
-          printf("time() failed(2)\n");
-          continue;
-        }
-
         // For the modem to return a *-key detection, a blocked
-        // read must be performed (don't know why!). Since we want
-        // to time the wait period, we will perform the blocked
-        // read in a thread. The main program (thread) may then
-        // continue to time the detection window and cancel the
-        // blocked read thread if no *-key is entered.
-
-        // Create a thread to block for a *-key press
-        err = pthread_create(&(threadId), NULL,
-					 &blockForStarKey, NULL);
-        if(err != 0) {
-          printf("Can't create thread: %s", strerror(err));
-          continue;
-        }
-
-        // Wait for thread to signal *-key entered or timeout
-        while( (pollTime = time( NULL )) < pollStartTime + 10 )
-        {
-          if( gotStarKey == TRUE ) {
-            break;                 // break if *-key was detected
-          }
-
-          sleep(1);
-        }
+        // read must be performed (don't know why!). The listener
+        // thread does the reading and posts the *-key as soon as
+        // the modem reports it; this thread just times the window.
+        // The window closes early if the caller hangs up.
+        arm_listener( LISTEN_STAR_KEY );
+        gotStarKey = ( wait_for_listener( 10 ) == '*' );
 
-        // Cancel the thread
-        err = pthread_cancel(threadId );
-        if(err != 0) {
-          printf("Can't cancel thread: %s", strerror(err));
-          continue;
-        }
+        // The listener must let go of the port before the modem
+        // is sent any more commands.
+        disarm_listener();
 
         // If *-key window poll time expired...
-        if(pollTime >= pollStartTime + 10 )
+        if( !gotStarKey )
         {
           // Tag and write the call record to the callerID.dat file.
           // (tag '-' just overwrites the existing same char).
@@ -621,14 +1204,14 @@ int wait_for_response(fd)
         }
 
         // If a *-key entry was detected...
-        else if(gotStarKey)
+        else
         {
-          gotStarKey = FALSE;
           // Write a caller ID entry to the blacklist.dat.
           if( write_blacklist( buffer2 ) == TRUE)
           {
             // Tag and write call record to callerID.dat file.
             tag_and_write_callerID_record( buffer2, '*');
+            jcstats_count( JCS_STAR_KEY, 1 );
           }
         }
 
@@ -658,12 +1241,34 @@ int wait_for_response(fd)
 //
 int tag_and_write_callerID_record( char *buffer, char tagChar)
 {
+  struct log_job *job;
+
   // Overwrite the first character in the buffer with the tag.
   buffer[0] = tagChar;
 
 #ifdef SEND_ON_NETWORK
     // Socket broadcast the buffer's contents.
-    broadcast(buffer);
+    queue_broadcast( buffer );
+#endif
+
+  // Write the record to the file (or have the log stage do it)
+  // The log stage finishes the call's trace record once it has
+  // written the call record.
+  job = new_log_job( LOG_RECORD );
+  snprintf( job->text, sizeof( job->text ), "%s", buffer );
+  job->traceSeq = jctrace_close( buffer );
+  queue_log_job( job );
+  return(0);
+}
+
+//
+// Append a tagged caller ID record to callerID.dat. Returns 0 on
+// success.
+//
+static int write_callerID_record( const char *record )
+{
+#ifdef DO_STATS
+  uint64_t startTime = jcstats_now();
 #endif
 
   // Close and re-open file 'callerID.dat' (in case it was
@@ -675,9 +1280,9 @@ int tag_and_write_callerID_record( char *buffer, char tagChar)
     return(-1);
   }
   // Write the record to the file
-  if( fputs( (const char *)buffer, fpCa ) == EOF )
+  if( fputs( record, fpCa ) == EOF )
   {
-    printf("fputs( (const char *)buffer, fpCa ) failed\n");
+    printf("fputs( record, fpCa ) failed\n");
     return(-1);
   }
 
@@ -687,335 +1292,1002 @@ int tag_and_write_callerID_record( char *buffer, char tagChar)
     printf("fflush(fpCa) failed\n");
     return(-1);
   }
+  jcstats_count( JCS_LOG_WRITES, 1 );
+  jcstats_record( JCS_H_LOG_WRITE, jcstats_now() - startTime );
   return(0);
 }
 
 //
-// Compare strings in the 'whitelist.dat' file to fields in the
-// received caller ID string. If a whitelist string is present
-// (or an error occurred), return TRUE; otherwise return FALSE.
+// A job for the log stage, to be filled in and passed to
+// queue_log_job(). If the stage is behind by a whole queue, this
+// waits for it rather than lose a record.
 //
-static bool check_whitelist( char *callstr )
+static struct log_job *new_log_job( char kind )
 {
-  char whitebuf[100];
-  char whitebufsave[100];
-  char *whitebufptr;
-  char call_date[10];
-  char *dateptr;
-  char *strptr;
-  long file_pos_last, file_pos_next;
+  struct log_job *job = &directJob;
 
-  // Close and re-open the whitelist.dat file. Note: this
-  // seems to be necessary to be able to write records
-  // back into the file. The write works the first time
-  // after the file is opened but not subsequently! :-(
-  // This also allows whitelist changes made while the
-  // program is running to be recognized.
-  //
-  fclose( fpWh );
-  // Re-open for reading and writing
-  if( (fpWh = fopen( "./whitelist.dat", "r+" ) ) == NULL )
+#ifdef DO_STAGES
+  if( stagesRunning && ( job = jcstage_slot( &logStage ) ) == NULL )
   {
-    printf("Re-open of whitelist.dat file failed\n" );
-    return(TRUE);           // accept the call
+    jcstats_count( JCS_STAGE_WAITS, 1 );
+    job = jcstage_wait_slot( &logStage );
   }
+#endif
+  job->kind = kind;
+  job->queuedAt = jcstats_now();
+  job->trace = jctrace_current();
+  return(job);
+}
 
-  // Disable buffering for whitelist.dat writes
-  setbuf( fpWh, NULL );
-
-  // Seek to beginning of list
-  fseek( fpWh, 0, SEEK_SET );
-
-  // Save the file's current access location
-  if( (file_pos_next = ftell( fpWh )) == -1L )
+static void queue_log_job( struct log_job *job )
+{
+#ifdef DO_STAGES
+  if( stagesRunning )
   {
-    printf("ftell(fpWh) failed\n");
-    return(TRUE);           // accept the call
+    jcstats_record( JCS_H_STAGE_DEPTH, jcstage_push( &logStage ) );
+    return;
   }
+#endif
+  do_log_job( job );
+}
 
-  // Read and process records from the file
-  while( fgets( whitebuf, sizeof( whitebuf ), fpWh ) != NULL )
+static void do_log_job( struct log_job *job )
+{
+  switch( job->kind )
   {
-    // Save the start location of the string just read and get
-    // the location of the start of the next string in the file.
-    file_pos_last = file_pos_next;
-    file_pos_next = ftell( fpWh );
-
-    // Ignore lines that start with a '#' character (comment lines)
-    if( whitebuf[0] == '#' )
-      continue;
-
-    // Ignore lines containing just a '\n'
-    if( whitebuf[0] == '\n' )
-    {
-      continue;
-    }
-
-    // Ignore records that are too short (don't have room for the date)
-    if( strlen( whitebuf ) < 26 )
+    case LOG_RECORD:
+      write_callerID_record( job->text );
+      jctrace_stage_of( job->trace, JCT_LOG_WRITTEN );
+      jctrace_publish( job->trace, job->traceSeq );
+      break;
+
+#ifdef DO_JOURNAL
+    case LOG_TOUCH:
     {
-      printf("ERROR: whitelist.dat record is too short to hold date field.\n");
-      printf("       record: %s", whitebuf);
-      printf("       record is ignored (edit file and fix it).\n");
-      continue;
+      struct jcjournal_record r;
+
+      r.op = JCJ_TOUCH;
+      r.list = job->list;
+      r.text = job->text;
+      if( jcjournal_append( touchJournal, &r, 1 ) != 0 )
+        printf("touch_list_date: jcjournal_append() failed\n");
+      break;
     }
+#endif
+  }
+}
 
-    // Save the string (for writing back to the file later)
-    strcpy( whitebufsave, whitebuf );
-
-    // Make sure a '?' char is present in the string
-    if( ( strptr = strstr( whitebuf, "?" ) ) == NULL )
-    {
-      printf("ERROR: all whitelist.dat entry first fields *must be*\n");
-      printf("       terminated with a \'?\' character!! Entry is:\n");
-      printf("       %s", whitebuf);
-      printf("       Entry was ignored!\n");
-      continue;
-    }
+#ifdef SEND_ON_NETWORK
+//
+// Broadcast a call record, or have the broadcast stage do it. A
+// broadcast isn't worth holding up the next call for, so one that
+// finds the stage's queue full is dropped.
+//
+static void queue_broadcast( const char *record )
+{
+#ifdef DO_STAGES
+  struct broadcast_job *job;
 
-    // Make sure the '?' character is within the first twenty characters
-    if( (int)( strptr - whitebuf ) > 18 )
+  if( stagesRunning )
+  {
+    if( ( job = jcstage_slot( &broadcastStage ) ) == NULL )
     {
-      printf("ERROR: terminator '?' is not within first 20 characters\n" );
-      printf("       %s", whitebuf);
-      printf("       Entry was ignored!\n");
-      continue;
+      jcstats_count( JCS_STAGE_DROPS, 1 );
+      return;
     }
+    job->queuedAt = jcstats_now();
+    job->trace = jctrace_current();
+    snprintf( job->text, sizeof( job->text ), "%s", record );
+    jcstats_record( JCS_H_STAGE_DEPTH, jcstage_push( &broadcastStage ) );
+    return;
+  }
+#endif
+  broadcast( record );
+  jctrace_stage( JCT_BROADCAST );
+}
+#endif
 
-    // Get a pointer to the search token in the string
-    if( ( whitebufptr = strtok( whitebuf, "?" ) ) == NULL )
+#ifdef DO_STAGES
+//
+// Start the log stage and (with SEND_ON_NETWORK) the broadcast stage.
+// If they can't be started, their work is done straight away instead.
+// The log stage journals entry dates through a journal of its own, so
+// it never shares one with the thread deciding calls.
+//
+static void start_stages( void )
+{
+#ifdef DO_JOURNAL
+  if( journal.fd >= 0 )
+  {
+    if( jcjournal_open( &logJournal, JCJOURNAL_FILE ) != 0 )
     {
-      printf("whitebuf strtok() failed\n");
-      return(TRUE);         // accept the call
+      printf("start_stages: jcjournal_open() failed\n");
+      return;
     }
-
-    // Scan the call string for the whitelist entry
-    if( strstr( callstr, whitebufptr ) != NULL )
-    {
-#ifdef DEBUG
-      printf("whitelist entry matches: %s\n", whitebuf );
+    touchJournal = &logJournal;
+  }
 #endif
-      // Make sure the 'DATE = ' field is present
-      if( (dateptr = strstr( callstr, "DATE = " ) ) == NULL )
-      {
-        printf( "DATE field not found in caller ID!\n" );
-        return(TRUE);     // accept the call
-      }
+  if( jcstage_start( &logStage, "log", sizeof( struct log_job ), run_log_job ) != 0 )
+    goto failed;
+#ifdef SEND_ON_NETWORK
+  if( jcstage_start( &broadcastStage, "broadcast", sizeof( struct broadcast_job ),
+                     run_broadcast_job ) != 0 )
+    goto failed;
+#endif
+  stagesRunning = TRUE;
+  return;
+
+failed:
+  // The log stage may be running, but is never given a job.
+  printf("start_stages() failed; calls will be logged straight away\n");
+#ifdef DO_JOURNAL
+  touchJournal = &journal;
+#endif
+}
 
-      // Get the current date from the caller ID string
-      strncpy( call_date, &dateptr[7], 6 );
+//
+// Wait for the stages to finish the jobs they have been given.
+//
+static void drain_stages( void )
+{
+  if( !stagesRunning )
+    return;
+  jcstage_drain( &logStage );
+#ifdef SEND_ON_NETWORK
+  jcstage_drain( &broadcastStage );
+#endif
+}
 
-      // Terminate the string
-      call_date[6] = 0;
+// The log stage's work
+static void run_log_job( void *arg )
+{
+  struct log_job *job = arg;
 
-      // Update the date in the whitebufsave record
-      strncpy( &whitebufsave[19], call_date, 6 );
+  do_log_job( job );
+  jcstats_record( JCS_H_STAGE_LAG, jcstats_now() - job->queuedAt );
+}
 
-      // Write the record back to the whitelist.dat file
-      fseek( fpWh, file_pos_last, SEEK_SET );
-      if( fputs( whitebufsave, fpWh ) == EOF )
-      {
-        printf("fputs(whitebufsave, fpWh) failed\n" );
-        return(TRUE);         // accept the call
-      }
+#ifdef SEND_ON_NETWORK
+// The broadcast stage's work
+static void run_broadcast_job( void *arg )
+{
+  struct broadcast_job *job = arg;
 
-      // Flush the string to the file
-      if( fflush(fpWh) == EOF )
-      {
-        printf("fflush(fpWh) failed\n");
-        return(TRUE);         // accept the call
-      }
+  broadcast( job->text );
+  jctrace_stage_of( job->trace, JCT_BROADCAST );
+  jcstats_record( JCS_H_STAGE_LAG, jcstats_now() - job->queuedAt );
+}
+#endif
+#endif
 
-      // Force kernel file buffers to the disk
-      // (probably not necessary)
-      sync();
+//
+// Compare the entries in the 'whitelist.dat' file to the received
+// caller ID string. If one matches, update its date and return TRUE
+// (accept the call); otherwise return FALSE.
+//
+static bool check_whitelist( char *callstr )
+{
+  struct jclist_entry entry;
+  int rule;
 
-      // A whitelist.dat entry matched, so return TRUE
-      return(TRUE);             // accept the call
-    }
-  }                               // end of while()
+  if( list_verdict( callstr, &rule ) != JCL_SAFE )
+  {
+    // No whitelist.dat entry matched, so return FALSE.
+    jctrace_stage( JCT_WHITELIST );
+    return(FALSE);
+  }
 
-  // No whitelist.dat entry matched, so return FALSE.
-  return(FALSE);
+  list_entry( JCP_WHITE, rule, &entry );
+#ifdef DEBUG
+  printf("whitelist entry matches: %s\n", entry.pattern );
+#endif
+  jctrace_stage( JCT_WHITELIST );
+  touch_list_date( &whiteWatch, &entry, callstr, FALSE );
+  remember_verdict( JCL_SAFE, rule );
+  return(TRUE);
 }
 
 //
-// Compare strings in the 'blacklist.dat' file to fields in the
-// received caller ID string. If a blacklist string is present,
-// send commands to the modem to that will terminate the call...
+// Compare the entries in the 'blacklist.dat' file to the received
+// caller ID string. If one matches, send commands to the modem that
+// will terminate the call, update the entry's date and return TRUE.
 //
 static bool check_blacklist( char *callstr )
 {
-  char blackbuf[100];
-  char blackbufsave[100];
-  char *blackbufptr;
-  char call_date[10];
-  char *dateptr;
-  char *strptr;
-  long file_pos_last, file_pos_next;
-
-  // Close and re-open the blacklist.dat file. Note: this
-  // seems to be necessary to be able to write records
-  // back into the file. The write works the first time
-  // after the file is opened but not subsequently! :-(
-  // This also allows blacklist changes made while the
-  // program is running to be recognized.
-  //
-  fclose( fpBl );
-  // Re-open for reading and writing
-  if( (fpBl = fopen( "./blacklist.dat", "r+" ) ) == NULL )
+  struct jclist_entry entry;
+  int verdict, rule;
+
+  // The whitelist was checked first, so the verdict can't be JCL_SAFE.
+  verdict = list_verdict( callstr, &rule );
+#ifdef DO_IMPORTED
+  // A number in the imported store is blocked as though blacklisted,
+  // but there is no entry to update (rule -1).
+  if( verdict != JCL_BLOCKED && imported_number( callstr ) )
   {
-    printf("re-open fopen( blacklist) failed\n" );
+    verdict = JCL_BLOCKED;
+    rule = -1;
+  }
+#endif
+  if( verdict != JCL_BLOCKED )
+  {
+    /* A blacklist.dat entry was not matched, so return FALSE */
+    jcstats_verdict( JCS_NEUTRAL );
+    count_call_usage();
+    jctrace_stage( JCT_BLACKLIST );
+    remember_verdict( JCL_NEUTRAL, -1 );
     return(FALSE);
   }
 
-  // Disable buffering for blacklist.dat writes
-  setbuf( fpBl, NULL );
+  if( rule >= 0 )
+  {
+    list_entry( JCP_BLACK, rule, &entry );
+#ifdef DEBUG
+    printf("blacklist entry matches: %s\n", entry.pattern );
+#endif
+  }
+  else
+  {
+#ifdef DEBUG
+    printf("number is in the imported stores\n");
+#endif
+    jcstats_count( JCS_IMPORTED, 1 );
+  }
+  jcstats_verdict( JCS_BLOCKED );
+  count_call_usage();
+  jctrace_stage( JCT_BLACKLIST );
+  // When playing the intercept message or recording, the call
+  // is answered later (answer_in_voice_mode()).
+  if( !playIntercept && recordSecs == 0 )
+    hang_up_blocked_call();
+
+  // Change the entry's date, unless it is '++++++' (a permanent entry).
+  if( rule >= 0 )
+    touch_list_date( &blackWatch, &entry, callstr, TRUE );
+  remember_verdict( JCL_BLOCKED, rule );
+  return(TRUE);
+}
+
+//
+// Terminate a blacklisted call: answer it with a fax tone and
+// hang up, then get the modem ready for the next call.
+//
+static void hang_up_blocked_call( void )
+{
+#ifdef DO_STATS
+  uint64_t startTime = jcstats_now();
+#endif
+
+  sleep(1);
+  jctrace_stage( JCT_HANGUP_SENT );   // the hangup commands follow
+
+  // Take the modem off hook
+  send_modem_command(fd, "ATH1\r");
+  usleep( 250000 );
 
-  // Seek to beginning of list
-  fseek( fpBl, 0, SEEK_SET );
+  // Send an ATA command. Don't wait for a response.
+  // Wait five seconds and return. This command starts
+  // with a CED tone (see UPDATES file for CED
+  // definition). This simulates a FAX initial response.
+#ifdef DEBUG
+  printf("sending CED tone ATA command\n");
+#endif
+  send_timed_modem_command(fd, "ATA\r", 5);
+
+  usleep( 250000 );               // quarter second
+#ifdef DEBUG
+  printf("sending on-hook command...\n");
+#endif
+  send_modem_command(fd, "ATH0\r");  // on hook
+  jctrace_stage( JCT_ON_HOOK );
+  usleep( 250000 );               // quarter second
+  init_modem(fd);
+  jcstats_record( JCS_H_HANGUP, jcstats_now() - startTime );
+}
+
+//
+// Load and compile the lists if either file has changed since they
+// were last loaded (or map the image of them, if it is current). If
+// that fails, the lists loaded before stay in use and loading is
+// tried again at the next call. Otherwise just the journal's new
+// records are applied.
+//
+static void load_lists( void )
+{
+  struct jclist white, black;
+  uint64_t startTime;
+  int listsChanged;
+#ifdef DO_JOURNAL
+  struct jclist *lists[JCP_GROUPS] = { &white, &black };
+  bool held;
+#endif
 
-  // Save the file's current access location
-  if( (file_pos_next = ftell( fpBl )) == -1L )
+#ifdef DO_IMPORTED
+  load_imported();
+#endif
+  listsChanged = jclist_watch_check( &whiteWatch, FALSE );
+  listsChanged |= jclist_watch_check( &blackWatch, FALSE );
+#ifdef DO_JOURNAL
+  if( !listsChanged && read_journal() != 0 )
+    listsChanged = TRUE;
+#endif
+#ifdef DO_IMAGE
+  if( jclist_watch_check( &imageWatch, FALSE ) || listsChanged )
   {
-    printf("ftell(fpBl) failed\n");
-    return(FALSE);
+    if( load_image() == 0 )
+      return;
+    // The text lists are still current if they were in use already.
+    if( !usingImage && !listsChanged )
+      return;
   }
+  else
+    return;
+#else
+  if( !listsChanged )
+    return;
+#endif
 
-  // Read and process records from the file
-  while( fgets( blackbuf, sizeof( blackbuf ), fpBl ) != NULL )
+  startTime = jcstats_now();
+  jclist_init( &white );
+  jclist_init( &black );
+#ifdef DO_JOURNAL
+  // Hold the journal while the files are read, so it can't be folded
+  // into them meanwhile.
+  if( ( held = journal.locked ) == FALSE && journal.fd >= 0 )
+    jcjournal_lock( &journal );
+#endif
+  // Like the whitelist check, the whitelist is only used if there
+  // was one when jcblock started.
+  if( ( fpWh != NULL && read_list( whiteWatch.name, &white ) != 0 ) ||
+      read_list( blackWatch.name, &black ) != 0 )
   {
-    // Save the start location of the string just read and get
-    // the location of the start of the next string in the file.
-    file_pos_last = file_pos_next;
-    file_pos_next = ftell( fpBl );
+#ifdef DO_JOURNAL
+    if( !held && journal.fd >= 0 )
+      jcjournal_unlock( &journal );
+#endif
+    jclist_free( &white );
+    jclist_free( &black );
+    whiteWatch.seen = blackWatch.seen = 0;
+    return;
+  }
+#ifdef DO_JOURNAL
+  if( journal.fd >= 0 )
+  {
+    journalEdits = 0;
+    jcjournal_rewind( &journal );
+    jcjournal_read( &journal, apply_journal_record, lists );
+    if( !held )
+      jcjournal_unlock( &journal );
+  }
+#endif
 
-    // Ignore lines that start with a '#' character (comment lines)
-    if( blackbuf[0] == '#' )
-      continue;
+#ifdef DO_IMAGE
+  if( usingImage )
+  {
+    jcimage_close( &listImage );
+    usingImage = FALSE;
+  }
+#endif
+  jclist_free( &whiteList );
+  jclist_free( &blackList );
+  whiteList = white;
+  blackList = black;
+  compile_lists( startTime );
+}
 
-    // Ignore lines containing just a '\n'
-    if( blackbuf[0] == '\n' )
-    {
-      continue;
-    }
+//
+// Return TRUE if load_lists() has changes to read: a list file, the
+// image or an imported store replaced or written to, or records in the
+// journal it hasn't read. Only stats the files; the watches are copied
+// so that load_lists() still sees the change.
+//
+static bool lists_changed( void )
+{
+  struct jclist_watch *watches[] = {
+    &whiteWatch, &blackWatch,
+#ifdef DO_IMAGE
+    &imageWatch,
+#endif
+#ifdef DO_IMPORTED
+    &importedWatch, &addedWatch, &removedWatch,
+#endif
+  };
+  struct jclist_watch w;
+  int i;
 
-    // Ignore records that are too short (don't have room for the date)
-    if( strlen( blackbuf ) < 26 )
-    {
-       printf("ERROR: blacklist.dat record is too short to hold date field.\n");
-       printf("       record: %s", blackbuf );
-       printf("       record is ignored (edit file and fix it).\n");
-       continue;
-    }
+  for( i = 0; i < sizeof( watches ) / sizeof( watches[0] ); i++ )
+  {
+    w = *watches[i];
+    if( jclist_watch_check( &w, FALSE ) )
+      return(TRUE);
+  }
+#ifdef DO_JOURNAL
+  if( journal.fd >= 0 &&
+      jcjournal_size( &journal ) + JCJOURNAL_HEADER_SIZE != journal.offset )
+    return(TRUE);
+#endif
+  return(FALSE);
+}
 
-    // Save the string (for writing back to the file later)
-    strcpy( blackbufsave, blackbuf );
+//
+// Compile the text lists, after they were loaded or changed.
+//
+static void compile_lists( uint64_t startTime )
+{
+  int i;
 
-    // Make sure a '?' char is present in the string
-    if( ( strptr = strstr( blackbuf, "?" ) ) == NULL )
-    {
-      printf("ERROR: all blacklist.dat entry first fields *must be*\n");
-      printf("       terminated with a \'?\' character!! Entry is:\n");
-      printf("       %s", blackbuf);
-      printf("       Entry was ignored!\n");
-      continue;
-    }
+  jcpattern_free( &listMatcher );
+  if( jcpattern_compile( &listMatcher, &whiteList, &blackList ) != 0 )
+    printf("load_lists: lists too big to compile; checking entries in turn\n");
+  listGen++;
+  listCounts[JCP_WHITE] = whiteList.count;
+  listCounts[JCP_BLACK] = blackList.count;
 
-    // Make sure the '?' character is within the first twenty characters
-    // (could not be if the previous record was only partially written).
-    if( (int)( strptr - blackbuf ) > 18 )
-    {
-      printf("ERROR: terminator '?' is not within first 20 characters\n" );
-      printf("       %s", blackbuf);
-      printf("       Entry was ignored!\n");
-      continue;
-    }
+  firstTimeDependent = whiteList.count + blackList.count + 1;
+  for( i = whiteList.count + blackList.count - 1; i >= 0; i-- )
+  {
+    if( jclist_time_dependent( i < whiteList.count ? whiteList.entries[i].pattern :
+                               blackList.entries[i - whiteList.count].pattern ) )
+      firstTimeDependent = i;
+  }
+  jcstats_record( JCS_H_LIST_RELOAD, jcstats_now() - startTime );
 
-    // Get a pointer to the search token in the string
-    if( ( blackbufptr = strtok( blackbuf, "?" ) ) == NULL )
+#ifdef DEBUG
+  printf("loaded %d whitelist and %d blacklist entries (%d states)\n",
+         whiteList.count, blackList.count, listMatcher.numStates );
+#endif
+}
+
+#ifdef DO_JOURNAL
+//
+// Apply the journal's new records to the lists. Returns 0, or -1 if
+// the lists must be loaded again: the journal has been folded into the
+// files since they were read, or it adds or removes entries and the
+// image is in use.
+//
+static int read_journal( void )
+{
+  struct jclist *lists[JCP_GROUPS] = { &whiteList, &blackList };
+  uint64_t startTime = jcstats_now();
+  int edits = journalEdits;
+  bool image = FALSE;
+
+  if( journal.fd < 0 )
+    return(0);
+#ifdef DO_IMAGE
+  image = usingImage;
+#endif
+  if( jcjournal_read( &journal, apply_journal_record, image ? NULL : lists ) < 0 )
+    return(-1);
+  if( journalEdits == edits )
+    return(0);
+  if( image )
+    return(-1);
+  compile_lists( startTime );
+  return(0);
+}
+
+//
+// Apply a journal record to the lists lists[JCP_WHITE] and
+// lists[JCP_BLACK] (or, with lists NULL, just count it).
+//
+static void apply_journal_record( void *arg, const struct jcjournal_record *r )
+{
+  struct jclist **lists = arg;
+  struct jclist *list;
+  char record[JCL_RECORD_SIZE];
+  char pattern[JCL_RECORD_SIZE];
+  char key[JCJOURNAL_LINE_SIZE];
+  int i;
+
+  // Dates don't change what the lists match, and the whitelist is
+  // only used if there was one when jcblock started.
+  if( r->op == JCJ_TOUCH || ( r->list == JCP_WHITE && fpWh == NULL ) )
+    return;
+  journalEdits++;
+  if( lists == NULL )
+    return;
+  list = lists[r->list];
+
+  if( r->op == JCJ_REMOVE )
+  {
+    for( i = list->count - 1; i >= 0; i-- )
     {
-      printf("blackbuf strtok() failed\n");
-      return(FALSE);
+      if( jcjournal_same_pattern( list->entries[i].pattern, r->text ) )
+        jclist_remove( list, i );
     }
+    return;
+  }
 
-    // Scan the call string for the blacklist entry
-    if( strstr( callstr, blackbufptr ) != NULL )
-    {
+  // An entry added is read as read_list() would read it from the
+  // file, but it isn't there yet, so it has no record offset.
+  snprintf( record, sizeof( record ), "%s\n", r->text );
+  if( jclist_parse_record( record, pattern ) != JCL_ENTRY ||
+      jcjournal_record_pattern( r->text, key ) != 0 )
+    return;
+  for( i = 0; i < list->count; i++ )
+  {
+    if( jcjournal_same_pattern( list->entries[i].pattern, key ) )
+      return;
+  }
+  if( jclist_add( list, pattern, -1 ) != 0 )
+    printf("load_lists: out of memory\n");
+}
+
+#ifdef DO_IMAGE
+//
+// Read the whole journal and return the number of entries it adds or
+// removes; the journal is left read to the end.
+//
+static int count_journal_edits( void )
+{
+  journalEdits = 0;
+  if( journal.fd >= 0 )
+  {
+    jcjournal_rewind( &journal );
+    jcjournal_read( &journal, apply_journal_record, NULL );
+  }
+  return(journalEdits);
+}
+#endif
+
+//
+// Fold the journal into the list files once it has grown to
+// JCJOURNAL_FOLD_SIZE, or with 'force' if it has anything in it. The
+// lists are brought up to date with it first, so they stay in use;
+// the files are then just the lists in use, written out.
+//
+static void fold_journal( bool force )
+{
+  struct jclist *lists[JCP_GROUPS] = { &whiteList, &blackList };
+  const char *files[JCP_GROUPS] = { whiteWatch.name, blackWatch.name };
+  uint64_t startTime;
+  long size;
+  int edits;
+  bool image = FALSE;
+
+  if( journal.fd < 0 || ( size = jcjournal_size( &journal ) ) == 0 ||
+      ( !force && size < JCJOURNAL_FOLD_SIZE ) )
+    return;
+
+  load_lists();
+  startTime = jcstats_now();
+  edits = journalEdits;
+#ifdef DO_IMAGE
+  image = usingImage;
+#endif
+  if( jcjournal_fold( &journal, files, apply_journal_record, image ? NULL : lists ) < 0 )
+  {
+    printf("fold_journal: jcjournal_fold() failed\n");
+    return;
+  }
+  if( journalEdits != edits )
+  {
+    // Records came in since load_lists(): the image can't have them,
+    // so the lists will be read at the next call.
+    if( image )
+      return;
+    compile_lists( startTime );
+  }
+  journalEdits = 0;
+
+  // The files were replaced, but with what is in use already.
+  whiteWatch.seen = blackWatch.seen = 0;
+  jclist_watch_check( &whiteWatch, FALSE );
+  jclist_watch_check( &blackWatch, FALSE );
+#ifdef DO_IMAGE
+  if( image )
+  {
+    if( jcimage_restamp( JCIMAGE_FILE, JCP_WHITE, whiteWatch.name ) != 0 ||
+        jcimage_restamp( JCIMAGE_FILE, JCP_BLACK, blackWatch.name ) != 0 )
+      printf("fold_journal: jcimage_restamp() failed\n");
+    jclist_watch_check( &imageWatch, TRUE );
+  }
+#endif
 #ifdef DEBUG
-      printf("blacklist entry matches: %s\n", blackbuf );
+  printf("folded %ld bytes of list journal\n", size );
+#endif
+}
 #endif
-      sleep(1);
 
-      // Take the modem off hook
-      send_modem_command(fd, "ATH1\r");
-      usleep( 250000 );
+#ifdef DO_IMAGE
+//
+// Map the image compiled by jclistc in place of the text lists, if it
+// is current. Returns 0 if it is now in use, or -1 if the text lists
+// must be read.
+//
+static int load_image( void )
+{
+  static const char *problems[] = { "", "missing", "damaged or of another version", "stale" };
+  const char *sources[JCP_GROUPS];
+  struct jcimage img;
+#ifdef DO_STATS
+  uint64_t startTime = jcstats_now();
+#endif
+  int rc;
+
+  // As for the text lists, the whitelist is only used if there was
+  // one when jcblock started.
+  sources[JCP_WHITE] = ( fpWh != NULL ? whiteWatch.name : NULL );
+  sources[JCP_BLACK] = blackWatch.name;
+#ifdef DO_JOURNAL
+  // The image has none of the entries added or removed in the journal.
+  if( count_journal_edits() > 0 )
+    return(-1);
+#endif
+  if( ( rc = jcimage_open( &img, JCIMAGE_FILE, sources ) ) != JCIMAGE_OK )
+  {
+    if( rc != JCIMAGE_MISSING )
+      printf("load_lists: %s is %s; reading the lists\n", imageWatch.name + 2,
+             problems[rc] );
+    return(-1);
+  }
+
+  if( usingImage )
+    jcimage_close( &listImage );
+  jcpattern_free( &listMatcher );
+  jclist_free( &whiteList );
+  jclist_free( &blackList );
+  listImage = img;
+  usingImage = TRUE;
+  listGen++;
+  listCounts[JCP_WHITE] = img.header->counts[JCP_WHITE];
+  listCounts[JCP_BLACK] = img.header->counts[JCP_BLACK];
+  firstTimeDependent = img.header->firstTimeDependent;
+  jcstats_record( JCS_H_LIST_RELOAD, jcstats_now() - startTime );
 
-      // Send an ATA command. Don't wait for a response.
-      // Wait five seconds and return. This command starts
-      // with a CED tone (see UPDATES file for CED
-      // definition). This simulates a FAX initial response.
 #ifdef DEBUG
-      printf("sending CED tone ATA command\n");
+  printf("mapped %d whitelist and %d blacklist entries from %s\n",
+         listCounts[JCP_WHITE], listCounts[JCP_BLACK], imageWatch.name + 2 );
 #endif
-      send_timed_modem_command(fd, "ATA\r", 5);
+  return(0);
+}
+#endif
+
+#ifdef DO_IMPORTED
+//
+// Map an imported number store again if it has been replaced (or
+// removed) since it was last mapped. Returns TRUE if it was.
+//
+static bool load_store( struct jclist_watch *watch, struct jcnumset *set )
+{
+  if( !jclist_watch_check( watch, FALSE ) )
+    return(FALSE);
 
-      usleep( 250000 );               // quarter second
+  jcnumset_close( set );
+  if( jcnumset_open( set, watch->name ) != 0 )
+  {
+    if( errno != ENOENT )
+      printf("load_imported: %s is damaged or of another version\n",
+             watch->name + 2 );
+    return(TRUE);
+  }
 #ifdef DEBUG
-      printf("sending on-hook command...\n");
+  printf("mapped %llu numbers from %s (%zu bytes)\n",
+         (unsigned long long)set->header->count, watch->name + 2, set->size );
 #endif
-      send_modem_command(fd, "ATH0\r");  // on hook
-      usleep( 250000 );               // quarter second
-      init_modem(fd);
+  return(TRUE);
+}
 
-      // Make sure the 'DATE = ' field is present
-      if( (dateptr = strstr( callstr, "DATE = " ) ) == NULL )
-      {
-        printf( "DATE field not found in caller ID!\n" );
-        return(FALSE);
-      }
+static void load_imported( void )
+{
+  bool changed;
+
+  changed = load_store( &importedWatch, &importedSet );
+  changed |= load_store( &addedWatch, &addedSet );
+  changed |= load_store( &removedWatch, &removedSet );
+  // Verdicts cached with the old numbers may be wrong now.
+  if( changed )
+    listGen++;
+}
 
-      // Check the date field in blackbufsave. If it is not
-      // '++++++' (not a permanent record), change it.
-      if( strncmp( &blackbufsave[19], "++++++", 6 ) != 0 )
-      {
-        // Get the current date from the caller ID string
-        strncpy( call_date, &dateptr[7], 6 );
+//
+// Return TRUE if the call's number is in the imported store.
+//
+static bool imported_number( char *callstr )
+{
+  char *nmbr, *end;
+  uint64_t key;
 
-        // Terminate the string
-        call_date[6] = 0;
+  if( ( nmbr = strstr( callstr, "NMBR = " ) ) == NULL )
+    return(FALSE);
+  nmbr += 7;
+  if( ( end = strstr( nmbr, "--" ) ) == NULL )
+    end = nmbr + strlen( nmbr );
+  if( ( key = jcnumset_parse( nmbr, end - nmbr ) ) == 0 )
+    return(FALSE);
+  return( jcnumset_contains( &addedSet, key ) ||
+          ( jcnumset_contains( &importedSet, key ) &&
+            !jcnumset_contains( &removedSet, key ) ) );
+}
+#endif
+
+#ifdef DO_SERVICE
+//
+// Answer a verdict query (on the service thread) as the whitelist and
+// blacklist checks would decide the call, but with none of what they
+// do besides: no entry's date changes and nothing is remembered.
+//
+static void service_verdict( char *callstr, struct jcservice_answer *answer )
+{
+  int verdict, rule;
+
+  pthread_rwlock_rdlock( &listLock );
+  verdict = list_verdict( callstr, &rule );
+  answer->list = ( verdict == JCL_SAFE ? JCSERVICE_WHITE :
+                   verdict == JCL_BLOCKED ? JCSERVICE_BLACK : JCSERVICE_NONE );
+#ifdef DO_IMPORTED
+  if( verdict == JCL_NEUTRAL && imported_number( callstr ) )
+  {
+    verdict = JCL_BLOCKED;
+    rule = -1;
+    answer->list = JCSERVICE_IMPORTED;
+  }
+#endif
+  answer->generation = listGen;
+  pthread_rwlock_unlock( &listLock );
 
-        // Update the date in the blackbufsave record
-        strncpy( &blackbufsave[19], call_date, 6 );
+  answer->verdict = verdict;
+  answer->rule = rule;
+  jcstats_count( JCS_QUERIES, 1 );
+}
+#endif
 
-        // Write the record back to the blacklist.dat file
-        fseek( fpBl, file_pos_last, SEEK_SET );
-        if( fputs( blackbufsave, fpBl ) == EOF )
-        {
-          printf("fputs(blackbufsave, fpBl) failed\n" );
-          return(FALSE);
-        }
+//
+// Decide a call with whichever form of the lists is loaded; as
+// jcpattern_verdict().
+//
+static int list_verdict( char *callstr, int *rule )
+{
+#ifdef DO_IMAGE
+  if( usingImage )
+    return jcimage_verdict( &listImage, callstr, rule );
+#endif
+  return jcpattern_verdict( &listMatcher, callstr, rule );
+}
+
+// Fill in 'entry' for entry 'rule' of the list 'list' (JCP_WHITE or
+// JCP_BLACK).
+static void list_entry( int list, int rule, struct jclist_entry *entry )
+{
+#ifdef DO_IMAGE
+  if( usingImage )
+  {
+    jcimage_entry( &listImage, list, rule, entry );
+    return;
+  }
+#endif
+  *entry = ( list == JCP_WHITE ? whiteList : blackList ).entries[rule];
+}
+
+//
+// Read the entries of a list file into 'list', reporting records
+// that are ignored. Returns 0 on success or -1 on an error.
+//
+static int read_list( const char *filename, struct jclist *list )
+{
+  char record[JCL_RECORD_SIZE];
+  char pattern[JCL_RECORD_SIZE];
+  const char *name = filename + 2;         // without the "./"
+  FILE *fp;
+  long offset;
+
+  if( (fp = fopen( filename, "r" ) ) == NULL )
+  {
+    printf("fopen() of %s failed\n", name );
+    return(-1);
+  }
 
-        // Flush the string to the file
-        if( fflush(fpBl) == EOF )
+  for( offset = 0; fgets( record, sizeof( record ), fp ) != NULL;
+       offset = ftell( fp ) )
+  {
+    // Comment lines (starting with '#') and lines containing
+    // just a '\n' are silently ignored.
+    switch( jclist_parse_record( record, pattern ) )
+    {
+      case JCL_ENTRY:
+        if( jclist_add( list, pattern, offset ) != 0 )
         {
-          printf("fflush(fpBl) failed\n");
-          return(FALSE);
+          printf("read_list: out of memory\n");
+          fclose( fp );
+          return(-1);
         }
+        break;
 
-        // Force kernel file buffers to the disk
-        // (probably not necessary)
-        sync();
-      }
+      case JCL_TOO_SHORT:
+        printf("ERROR: %s record is too short to hold date field.\n", name );
+        printf("       record: %s", record);
+        printf("       record is ignored (edit file and fix it).\n");
+        break;
 
-      // A blacklist.dat entry matched, so return TRUE
-      return(TRUE);
+      case JCL_NO_TERMINATOR:
+        printf("ERROR: all %s entry first fields *must be*\n", name );
+        printf("       terminated with a \'?\' character!! Entry is:\n");
+        printf("       %s", record);
+        printf("       Entry was ignored!\n");
+        break;
+
+      case JCL_TERMINATOR_TOO_FAR:
+        printf("ERROR: terminator '?' is not within first 20 characters\n" );
+        printf("       %s", record);
+        printf("       Entry was ignored!\n");
+        break;
+
+      case JCL_NO_PATTERN:
+        printf("ERROR: %s entry has no search string\n", name );
+        printf("       %s", record);
+        printf("       Entry was ignored!\n");
+        break;
+
+      case JCL_BAD_PATTERN:
+        printf("ERROR: %s pattern entry can't be understood\n", name );
+        printf("       %s", record);
+        printf("       Entry was ignored!\n");
+        break;
+
+      default:
+        break;
     }
-  }                                         // end of while()
+  }
+
+  fclose( fp );
+  return(0);
+}
+
+//
+// Set the date field of a list entry to the call's date. With
+// keepPermanent, a '++++++' date is left alone. The record is
+// checked first, in case the file changed since it was loaded.
+//
+static void touch_list_date( struct jclist_watch *watch,
+                             const struct jclist_entry *entry,
+                             char *callstr, bool keepPermanent )
+{
+  char record[JCL_RECORD_SIZE];
+  char pattern[JCL_RECORD_SIZE];
+  char *dateptr;
+  FILE *fp;
+
+  // Make sure the 'DATE = ' field is present
+  if( (dateptr = strstr( callstr, "DATE = " ) ) == NULL )
+  {
+    printf( "DATE field not found in caller ID!\n" );
+    return;
+  }
+
+#ifdef DO_JOURNAL
+  // With the journal, the date goes in it rather than in the file
+  // (keepPermanent is what folding it does for each list).
+  if( journal.fd >= 0 )
+  {
+    struct log_job *job = new_log_job( LOG_TOUCH );
+
+    snprintf( job->text, sizeof( job->text ), "%.6s %s", &dateptr[7], entry->pattern );
+    job->list = ( watch == &whiteWatch ? JCP_WHITE : JCP_BLACK );
+    queue_log_job( job );
+    return;
+  }
+#endif
+  if( (fp = fopen( watch->name, "r+" ) ) == NULL )
+  {
+    printf("touch_list_date: fopen() of %s failed\n", watch->name );
+    return;
+  }
+  setbuf( fp, NULL );
+
+  if( fseek( fp, entry->offset, SEEK_SET ) == 0 &&
+      fgets( record, sizeof( record ), fp ) != NULL &&
+      jclist_parse_record( record, pattern ) == JCL_ENTRY &&
+      strcmp( pattern, entry->pattern ) == 0 &&
+      !( keepPermanent && strncmp( &record[19], "++++++", 6 ) == 0 ) )
+  {
+    fseek( fp, entry->offset + 19, SEEK_SET );
+    if( fwrite( &dateptr[7], 1, 6, fp ) != 6 )
+      printf("touch_list_date: fwrite() to %s failed\n", watch->name );
+  }
+  fclose( fp );
+
+  // This change doesn't mean the list has to be loaded again, nor
+  // that the image is stale.
+  if( jclist_watch_check( watch, TRUE ) == 0 )
+  {
+#ifdef DO_IMAGE
+    if( usingImage )
+    {
+      if( jcimage_restamp( JCIMAGE_FILE, watch == &whiteWatch ? JCP_WHITE : JCP_BLACK,
+                           watch->name ) != 0 )
+        printf("touch_list_date: jcimage_restamp() failed\n");
+      jclist_watch_check( &imageWatch, TRUE );
+    }
+#endif
+  }
+}
+
+//
+// Store the verdict check_whitelist() or check_blacklist() reached,
+// and the entry that decided it, in the verdict cache if it can't
+// depend on the call's date and time.
+//
+static void remember_verdict( int verdict, int rule )
+{
+#ifdef DO_CACHE
+  int position;
+
+  if( verdict == JCL_SAFE )
+    position = rule;
+  else if( verdict == JCL_BLOCKED )
+    position = listCounts[JCP_WHITE] + ( rule >= 0 ? rule : listCounts[JCP_BLACK] );
+  else
+    position = listCounts[JCP_WHITE] + listCounts[JCP_BLACK];
+
+  if( cacheKeyed && position < firstTimeDependent )
+    jccache_store( &cache, cacheKey, listGen, verdict, rule );
+  cacheKeyed = FALSE;
+#endif
+}
+
+#ifdef DO_CACHE
+//
+// Look the call up in the verdict cache. If it is there, finish
+// deciding it the way check_whitelist() and check_blacklist() would
+// have: update the date of the entry that decides it and, for a
+// blacklisted call, terminate the call. Returns the verdict, or -1
+// if the lists must be checked.
+//
+static int cached_verdict( char *callstr )
+{
+  struct jclist_entry entry;
+  int verdict, rule;
+
+  cacheKeyed = jccache_key( callstr, cacheKey );
+  if( !cacheKeyed || !jccache_lookup( &cache, cacheKey, listGen, &verdict, &rule ) )
+  {
+    jcstats_count( JCS_CACHE_MISSES, 1 );
+    return(-1);
+  }
+  cacheKeyed = FALSE;
+  jcstats_count( JCS_CACHE_HITS, 1 );
+  jctrace_stage( JCT_WHITELIST );
+
+  switch( verdict )
+  {
+    case JCL_SAFE:
+#ifdef DEBUG
+      printf("verdict cache: whitelisted\n");
+#endif
+      list_entry( JCP_WHITE, rule, &entry );
+      touch_list_date( &whiteWatch, &entry, callstr, FALSE );
+      break;
+
+    case JCL_BLOCKED:
+#ifdef DEBUG
+      printf("verdict cache: blacklisted\n");
+#endif
+      if( rule < 0 )
+        jcstats_count( JCS_IMPORTED, 1 );
+      jcstats_verdict( JCS_BLOCKED );
+      count_call_usage();
+      jctrace_stage( JCT_BLACKLIST );
+      if( !playIntercept && recordSecs == 0 )
+        hang_up_blocked_call();
+      if( rule >= 0 )
+      {
+        list_entry( JCP_BLACK, rule, &entry );
+        touch_list_date( &blackWatch, &entry, callstr, TRUE );
+      }
+      break;
 
-  /* A blacklist.dat entry was not matched, so return FALSE */
-  return(FALSE);
+    default:
+#ifdef DEBUG
+      printf("verdict cache: not on either list\n");
+#endif
+      jcstats_verdict( JCS_NEUTRAL );
+      count_call_usage();
+      jctrace_stage( JCT_BLACKLIST );
+      break;
+  }
+  return(verdict);
 }
+#endif
 
 //
 // Add a record to the blacklist.dat file.
@@ -1135,6 +2407,24 @@ bool write_blacklist( char *callstr )
   // Add the source descriptor string ("KEY-* ENTRY").
   strncpy( &blacklistEntry[34], srcDesc, strlen(srcDesc) + 1 );
 
+#ifdef DO_JOURNAL
+  // With the journal, the record is added there (without the '\n').
+  if( journal.fd >= 0 )
+  {
+    struct jcjournal_record r;
+
+    r.op = JCJ_ADD;
+    r.list = JCP_BLACK;
+    r.text = &blacklistEntry[1];
+    if( jcjournal_append( &journal, &r, 1 ) != 0 )
+    {
+      printf("write_blacklist: jcjournal_append() failed\n");
+      return FALSE;
+    }
+    return TRUE;
+  }
+#endif
+
   // Read the last two characters in the file. If either is a '\n',
   // seek to its position so the following write will overwrite it.
   // If a '\n' is not found, seek to the end of the file.
@@ -1242,6 +2532,17 @@ static void cleanup( int signo )
     send_modem_command(fd, "ATZ\r");
   }
 
+#ifdef DO_SERVICE
+  jcservice_stop();
+#endif
+#ifdef DO_HANDOVER
+  if( handoverFd >= 0 )
+    unlink( JCHANDOVER_SOCKET );
+#endif
+#ifdef DO_STAGES
+  drain_stages();
+#endif
+
   // Close everything
   close(fd);
   fclose(fpCa);
@@ -1261,55 +2562,680 @@ static void cleanup( int signo )
   _exit(0);
 }
 
+#ifdef DO_HANDOVER
 //
-// This is the method that runs in the created thread. It
-// does a blocked read waiting for a touchtone key entry.
-// If the entry is the *-key, it signals the main thread.
+// Take the open serial port and the state that goes with it over from
+// the running jcblock. The modem is left as the running jcblock had
+// it: initialised, and waiting for the next call. Returns 0 on success.
 //
-void* blockForStarKey(void *arg)
+static int take_over( void )
 {
-  char testBuf[80];
-  int nbytes;
-  int k;
+  struct jchandover_state state;
+  struct stat st;
+
+  if( jchandover_take( JCHANDOVER_SOCKET, &fd, &state ) != 0 )
+    return(-1);
+
+  // The port is the one the modem was opened on, whatever -p says.
+  strncpy( takenPort, state.serialPort, sizeof( takenPort ) - 1 );
+  serialPort = takenPort;
+  tcgetattr( fd, &options );
+  numRings = state.numRings;
+
+  // Everything the old jcblock logged is in callerID.dat already.
+  fseek( fpCa, 0, SEEK_END );
+  if( fstat( fileno( fpCa ), &st ) == 0 && st.st_size != state.logSize )
+    printf("take_over: callerID.dat is %lld bytes, not %lld\n",
+           (long long)st.st_size, (long long)state.logSize );
+
+  printf("took the modem over from jcblock %d\n", state.pid );
+  return(0);
+}
+
+//
+// Wait for the modem to send something, handing it over to a new
+// jcblock meanwhile if one asks (in which case this doesn't return).
+//
+static void wait_for_modem_or_handover( void )
+{
+  struct pollfd fds[2];
+
+  fds[0].fd = fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = handoverFd;
+  fds[1].events = POLLIN;
+  while( 1 )
+  {
+    if( poll( fds, 2, -1 ) < 0 )
+    {
+      if( errno != EINTR )
+        return;
+      jctrace_signalled();
+      continue;
+    }
+    if( fds[0].revents != 0 )
+      return;
+    if( ( fds[1].revents & POLLIN ) != 0 )
+      hand_over();
+  }
+}
+
+//
+// Hand the modem over to the jcblock connecting to the handover
+// socket and exit, leaving the modem as it is: unlike cleanup(), no
+// ATZ, and the port stays open in the new jcblock. Returns if the new
+// jcblock didn't take over.
+//
+static void hand_over( void )
+{
+  struct jchandover_state state;
+  struct stat st;
+
+#ifdef DO_STAGES
+  // Everything logged so far must be in callerID.dat.
+  drain_stages();
+#endif
+  memset( &state, 0, sizeof( state ) );
+  state.magic = JCHANDOVER_MAGIC;
+  state.version = JCHANDOVER_VERSION;
+  state.pid = getpid();
+  state.numRings = numRings;
+  fflush( fpCa );
+  if( fstat( fileno( fpCa ), &st ) == 0 )
+    state.logSize = st.st_size;
+  strncpy( state.serialPort, serialPort, sizeof( state.serialPort ) - 1 );
+
+  if( jchandover_give( handoverFd, fd, &state ) != 0 )
+    return;
+
+  printf("handed the modem over; exiting\n");
+  fclose(fpCa);
+  fclose(fpBl);
+  if( fpWh != NULL )
+    fclose(fpWh);
+  fflush(stdout);
+  sync();
+  _exit(0);
+}
+#endif
+
+//
+// Create the *-key listener thread. It lives as long as the program
+// and only touches the serial port while it is armed. Signals are
+// blocked in it so that they are always handled by the main thread.
+// Returns 0 on success.
+//
+static int start_listener( void )
+{
+  sigset_t allSignals, oldSignals;
   int err;
-  int oldType;
 
-  // The *-key string delivered by the modem:
-  static char starStr[] = { DLE, '/', DLE, '*', DLE, '~', '\0' };
+  if( ( starKeyFd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) < 0 ||
+      ( wakeFd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) < 0 )
+  {
+    perror( "eventfd" );
+    return(-1);
+  }
 
-  // Set the cancel type
-  err = pthread_setcanceltype( PTHREAD_CANCEL_ASYNCHRONOUS, &oldType );
-  if( err != 0 ) {
-    printf("Can't set cancel type: %s\n", strerror(err));
+  sigfillset( &allSignals );
+  pthread_sigmask( SIG_SETMASK, &allSignals, &oldSignals );
+  err = pthread_create( &listenerId, NULL, &listen_for_star_key, NULL );
+  pthread_sigmask( SIG_SETMASK, &oldSignals, NULL );
+  if( err != 0 )
+  {
+    printf("Can't create thread: %s\n", strerror(err));
+    return(-1);
   }
+  return(0);
+}
 
-  while(TRUE)
+//
+// Let the listener read the serial port, for a *-key window or to
+// record the caller (LISTEN_STAR_KEY or LISTEN_RECORD). Anything
+// left over from an earlier window is discarded first.
+//
+static void arm_listener( int mode )
+{
+  uint64_t count;
+
+  pthread_mutex_lock( &listenerLock );
+  listenerKey = 0;
+  pthread_mutex_unlock( &listenerLock );
+  if( read( starKeyFd, &count, sizeof( count ) ) < 0 && errno != EAGAIN )
+    perror( "arm_listener" );
+
+  pthread_mutex_lock( &listenerLock );
+  listenerArmed = TRUE;
+  listenerMode = mode;
+  pthread_cond_signal( &listenerCond );
+  pthread_mutex_unlock( &listenerLock );
+}
+
+//
+// Wait up to numSecs seconds for the listener to report a *-key
+// press. Returns '*' as soon as one is reported, or 0 if the caller
+// hung up or the time ran out.
+//
+static char wait_for_listener( int numSecs )
+{
+  struct pollfd pfd;
+  struct timespec now, deadline;
+  uint64_t count;
+  long msecs;
+  char key;
+
+  clock_gettime( CLOCK_MONOTONIC, &deadline );
+  deadline.tv_sec += numSecs;
+
+  pfd.fd = starKeyFd;
+  pfd.events = POLLIN;
+  for( ;; )
   {
-    if( ( nbytes = read( fd, testBuf, 80 ) ) > 0 )
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    msecs = ( deadline.tv_sec - now.tv_sec ) * 1000 +
+            ( deadline.tv_nsec - now.tv_nsec ) / 1000000;
+    if( msecs < 0 )
+      msecs = 0;
+
+    // A signal (e.g. SIGUSR1 for a trace dump) just restarts the wait.
+    if( poll( &pfd, 1, msecs ) > 0 &&
+        read( starKeyFd, &count, sizeof( count ) ) == sizeof( count ) )
     {
+      pthread_mutex_lock( &listenerLock );
+      key = listenerKey;
+      pthread_mutex_unlock( &listenerLock );
+      return(key);
+    }
+    if( msecs == 0 )
+      return(0);
+  }
+}
+
+//
+// Stop the listener reading the serial port. Returns once it has let
+// go of the port, so the caller may read and write it again.
+//
+static void disarm_listener( void )
+{
+  uint64_t one = 1;
+
+  pthread_mutex_lock( &listenerLock );
+  listenerArmed = FALSE;
+  if( listenerReading )
+  {
+    while( write( wakeFd, &one, sizeof( one ) ) < 0 && errno == EINTR )
+      ;
+    while( listenerReading )
+      pthread_cond_wait( &listenerCond, &listenerLock );
+  }
+  pthread_mutex_unlock( &listenerLock );
+}
+
+// What the listener's decoder callbacks need to know
+struct listen_state
+{
+  int mode;                  // LISTEN_STAR_KEY or LISTEN_RECORD
+  int connectMatched;        // characters of "CONNECT\r\n" seen so far
+  bool receiving;            // voice data is arriving
+  bool ended;                // DLE ETX seen
+};
+
+//
+// Hand a key (or 0 for a hang up) to wait_for_listener(). The first
+// one posted in a window is the one that counts.
+//
+static void post_key( char key )
+{
+  uint64_t one = 1;
+
+  pthread_mutex_lock( &listenerLock );
+  if( listenerKey == 0 )
+  {
+    listenerKey = key;
+    while( write( starKeyFd, &one, sizeof( one ) ) < 0 && errno == EINTR )
+      ;
+  }
+  pthread_mutex_unlock( &listenerLock );
+}
+
+// Keypad keys reported by the modem while the listener is armed.
+static void on_digit( void *context, char key )
+{
+  struct listen_state *state = context;
+
 #ifdef DEBUG
-      // Print the string received
-      printf("Got touchtone key string: ");
-      for(k = 0; k < nbytes; k++)
-      {
-        printf("0x%x ", testBuf[k] );
-      }
-      printf("\n");
+  printf("Got touchtone key: %c\n", key );
 #endif
+  if( key == '*' && state->mode == LISTEN_STAR_KEY )
+    post_key( key );
+}
+
+// Tones and line conditions. Busy, dial tone or a loop current break
+// mean the caller has gone, so there is no point waiting any longer.
+static void on_tone( void *context, int tone )
+{
+#ifdef DEBUG
+  printf("Got modem event: %s\n", jcdleToneNames[tone] );
+#endif
+  if( tone == JCDLE_BUSY || tone == JCDLE_DIAL_TONE || tone == JCDLE_LOOP_BREAK )
+    post_key( 0 );
+}
 
-      // Terminate the string
-      testBuf[nbytes] = 0;
+// DLE ETX: the modem has stopped sending voice data.
+static void on_end( void *context )
+{
+  struct listen_state *state = context;
 
-      // Test for the *-key string
-      if( strstr( testBuf, starStr) != NULL )
-      {
+  state->ended = TRUE;
+  post_key( 0 );
+}
+
+//
+// Voice data. When recording, everything after the modem's CONNECT
+// response to AT+VRX (and before DLE ETX) is the caller.
+//
+static void on_data( void *context, const char *data, size_t length )
+{
+  static const char connect[] = "CONNECT\r\n";
+  struct listen_state *state = context;
+  size_t i;
+
+  if( state->mode != LISTEN_RECORD || state->ended )
+    return;
+
+  for( i = 0; !state->receiving && i < length; i++ )
+  {
+    if( data[i] == connect[state->connectMatched] )
+    {
+      if( connect[++state->connectMatched] == 0 )
+        state->receiving = TRUE;
+    }
+    else
+      state->connectMatched = ( data[i] == connect[0] );
+  }
+#ifdef DO_RECORD
+  if( state->receiving && i < length )
+    jcrecord_data( data + i, length - i );
+#endif
+}
+
+static void on_unknown( void *context, char code )
+{
 #ifdef DEBUG
-        printf("Got *-key\n");
+  printf("Got unknown modem event: 0x%x\n", code );
 #endif
-        // Signal the main thread
-        gotStarKey = TRUE;
+}
+
+static const struct jcdle_callbacks listenerCallbacks =
+{
+  on_digit, on_tone, on_end, on_data, on_unknown
+};
+
+//
+// This is the method that runs in the listener thread. While armed
+// it reads whatever the modem sends in voice mode and feeds it to a
+// DLE event decoder, whose callbacks (above) post to starKeyFd. When
+// recording, it reads straight into the recording's ring buffer.
+//
+void* listen_for_star_key(void *arg)
+{
+  struct jcdle_decoder decoder;
+  struct listen_state state;
+  struct pollfd pfd[2];
+  char testBuf[80];
+  uint64_t count;
+  int serialFd;
+  int flags;
+  int nbytes;
+
+  while(TRUE)
+  {
+    // Sleep until armed
+    pthread_mutex_lock( &listenerLock );
+    while( !listenerArmed )
+      pthread_cond_wait( &listenerCond, &listenerLock );
+    listenerReading = TRUE;
+    serialFd = fd;
+    memset( &state, 0, sizeof( state ) );
+    state.mode = listenerMode;
+    pthread_mutex_unlock( &listenerLock );
+
+    // Non-blocking reads return what has arrived at once, instead
+    // of waiting out VMIN/VTIME. The flags are restored below.
+    flags = fcntl( serialFd, F_GETFL );
+    fcntl( serialFd, F_SETFL, flags | O_NONBLOCK );
+
+    pfd[0].fd = serialFd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = wakeFd;
+    pfd[1].events = POLLIN;
+    jcdle_init( &decoder, &listenerCallbacks, &state );
+
+    // Read until disarmed. The decoder completes sequences that
+    // are split across reads.
+    while(TRUE)
+    {
+      // Signals are blocked in this thread, so poll() can't be
+      // interrupted.
+      if( poll( pfd, 2, -1 ) < 0 )
+      {
+        perror( "listener: poll" );
+        usleep( 100000 );
+        continue;
+      }
+      if( pfd[1].revents & POLLIN )
+        break;
+      if( pfd[0].revents & ( POLLERR | POLLHUP | POLLNVAL ) )
+      {
+        printf("listener: serial port error\n");
+        pfd[0].fd = -1;       // wait for disarm
+        continue;
+      }
+      if( !( pfd[0].revents & POLLIN ) )
+        continue;
+
+#ifdef DO_RECORD
+      if( state.mode == LISTEN_RECORD )
+      {
+        jcrecord_read( serialFd, &decoder );
+        continue;
       }
+#endif
+      if( ( nbytes = read( serialFd, testBuf, sizeof( testBuf ) ) ) > 0 )
+        jcdle_feed( &decoder, testBuf, nbytes );
     }
-  }                         // end of while(TRUE)
+
+    fcntl( serialFd, F_SETFL, flags );
+
+    // Let disarm_listener() return
+    pthread_mutex_lock( &listenerLock );
+    if( read( wakeFd, &count, sizeof( count ) ) < 0 )
+      perror( "listener: read" );
+    listenerReading = FALSE;
+    pthread_cond_broadcast( &listenerCond );
+    pthread_mutex_unlock( &listenerLock );
+  }
   return NULL;
 }
+
+//
+// Answer a blocked call in voice mode, to play it the intercept
+// message (-s) and record the caller (-r) before hanging up. This
+// starts the session; run_voice_session() does the rest.
+//
+static void answer_in_voice_mode( char *callstr )
+{
+  // Voice mode, VOICE_FORMAT samples, off hook on the line
+#ifdef DEBUG
+  printf("answering in voice mode...\n");
+#endif
+  send_modem_command(fd, "AT+FCLASS=8\r");
+  send_modem_command(fd, VOICE_FORMAT);
+  send_modem_command(fd, "AT+VLS=1\r");
+  strncpy( voice.callstr, callstr, sizeof( voice.callstr ) - 1 );
+
+#ifdef DO_INTERCEPT
+  if( playIntercept )
+  {
+    // The message is ready to go as it is, once the modem says
+    // CONNECT.
+    jcstats_count( JCS_MODEM_COMMANDS, 1 );
+    if( write( fd, "AT+VTX\r", 7 ) != 7 )
+      printf("answer_in_voice_mode: write() failed\n" );
+    enter_voice_state( VOICE_CONNECT, 5000 );
+    return;
+  }
+#endif
+  end_voice_message();
+}
+
+//
+// The intercept message is done with (or isn't played): record the
+// caller, if asked to, then hang up.
+//
+static void end_voice_message( void )
+{
+#ifdef DO_RECORD
+  if( recordSecs > 0 && jcrecord_start( voice.callstr ) == 0 )
+  {
+    // The listener saves what the modem sends, and posts to
+    // starKeyFd if the caller hangs up.
+    arm_listener( LISTEN_RECORD );
+    jcstats_count( JCS_MODEM_COMMANDS, 1 );
+    if( write( fd, "AT+VRX\r", 7 ) != 7 )
+      printf("answer_in_voice_mode: write() failed\n" );
+    enter_voice_state( VOICE_RECORDING, recordSecs * 1000L );
+    return;
+  }
+#endif
+  hang_up_voice_call();
+}
+
+//
+// On hook, and back to caller ID operation once the modem has had a
+// second to get over the ATZ (as init_modem() does).
+//
+static void hang_up_voice_call( void )
+{
+  send_modem_command(fd, "ATH0\r");
+#ifdef DEBUG
+  printf("sending ATZ command...\n");
+#endif
+  send_modem_command(fd, "ATZ\r");
+  enter_voice_state( VOICE_RESETTING, 1000 );
+}
+
+static void enter_voice_state( int state, long msecs )
+{
+  voice.state = state;
+  voice.replyUsed = 0;
+  voice.reply[0] = 0;
+  clock_gettime( CLOCK_MONOTONIC, &voice.deadline );
+  voice.deadline.tv_sec += msecs / 1000;
+  voice.deadline.tv_nsec += ( msecs % 1000 ) * 1000000L;
+  if( voice.deadline.tv_nsec >= 1000000000L )
+  {
+    voice.deadline.tv_sec++;
+    voice.deadline.tv_nsec -= 1000000000L;
+  }
+}
+
+// Milliseconds until the state gives up (0 once it has)
+static long voice_msecs_left( void )
+{
+  struct timespec now;
+  long msecs;
+
+  clock_gettime( CLOCK_MONOTONIC, &now );
+  msecs = ( voice.deadline.tv_sec - now.tv_sec ) * 1000 +
+          ( voice.deadline.tv_nsec - now.tv_nsec ) / 1000000;
+  return( msecs > 0 ? msecs : 0 );
+}
+
+#ifdef DO_INTERCEPT
+//
+// Read what the modem has sent, looking for 'reply'. Returns 1 once
+// it has come, -1 on "ERROR", or 0 if neither has yet.
+//
+static int read_voice_reply( const char *reply )
+{
+  int nbytes;
+
+  nbytes = read( fd, voice.reply + voice.replyUsed,
+                 sizeof( voice.reply ) - voice.replyUsed - 1 );
+  if( nbytes <= 0 )
+    return(0);
+  voice.replyUsed += nbytes;
+  voice.reply[voice.replyUsed] = 0;
+  if( strstr( voice.reply, reply ) != NULL )
+    return(1);
+  if( strstr( voice.reply, "ERROR" ) != NULL )
+    return(-1);
+
+  // Keep the tail, in case the reply is split across reads
+  if( voice.replyUsed > sizeof( voice.reply ) / 2 )
+  {
+    memmove( voice.reply, voice.reply + voice.replyUsed - 16, 16 );
+    voice.replyUsed = 16;
+  }
+  return(0);
+}
+#endif
+
+//
+// Move the call being answered in voice mode on: wait (for up to
+// VOICE_SLICE_MS) for what its state is waiting for, and act on it.
+// Returns when the state changes, or when the time is up, so that the
+// main loop gets its turn.
+//
+static void run_voice_session( void )
+{
+  struct timespec start, now;
+  struct pollfd pfd;
+  int state = voice.state;
+  long msecs, elapsed;
+  int ready;
+#ifdef DO_INTERCEPT
+  int got;
+#endif
+#ifdef DO_RECORD
+  static char stopCommand[] = { DLE, '!' };   // stop AT+VRX
+#endif
+  uint64_t count;
+
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  while( voice.state == state )
+  {
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    elapsed = ( now.tv_sec - start.tv_sec ) * 1000 +
+              ( now.tv_nsec - start.tv_nsec ) / 1000000;
+    if( elapsed >= VOICE_SLICE_MS )
+      return;
+    msecs = voice_msecs_left();
+    if( msecs > VOICE_SLICE_MS - elapsed )
+      msecs = VOICE_SLICE_MS - elapsed;
+
+    // While recording, the listener has the port.
+    if( state == VOICE_RECORDING || state == VOICE_STOPPING )
+      pfd.fd = starKeyFd;
+    else
+      pfd.fd = ( state == VOICE_RESETTING ? -1 : fd );
+    pfd.events = ( state == VOICE_PLAYING ? POLLOUT : POLLIN );
+    if( ( ready = poll( &pfd, 1, msecs ) ) < 0 )
+    {
+      if( errno == EINTR )
+        jctrace_signalled();
+      continue;
+    }
+    if( ready > 0 && pfd.fd == starKeyFd &&
+        read( starKeyFd, &count, sizeof( count ) ) != sizeof( count ) )
+      ready = 0;
+
+    switch( state )
+    {
+#ifdef DO_INTERCEPT
+      case VOICE_CONNECT:
+        if( ready > 0 && ( got = read_voice_reply( "CONNECT" ) ) > 0 )
+        {
+#ifdef DEBUG
+          printf("playing the intercept message...\n");
+#endif
+          // Non-blocking while playing: write what the modem takes.
+          voice.played = 0;
+          voice.portFlags = fcntl( fd, F_GETFL );
+          fcntl( fd, F_SETFL, voice.portFlags | O_NONBLOCK );
+          enter_voice_state( VOICE_PLAYING,
+                             intercept.samples * 1000 / JCPLAY_RATE + 5000 );
+        }
+        else if( ( ready > 0 && got < 0 ) || voice_msecs_left() == 0 )
+        {
+#ifdef DEBUG
+          printf("did not get CONNECT\n");
+#endif
+          end_voice_message();
+        }
+        break;
+
+      case VOICE_PLAYING:
+        if( ready > 0 && jcplay_write( fd, &intercept, &voice.played ) != 0 )
+        {
+          fcntl( fd, F_SETFL, voice.portFlags );
+          end_voice_message();
+        }
+        else if( voice.played == intercept.length )
+        {
+          // The modem says OK once it has played it all.
+          fcntl( fd, F_SETFL, voice.portFlags );
+          enter_voice_state( VOICE_PLAYED, intercept.samples * 1000 / JCPLAY_RATE + 3000 );
+        }
+        else if( voice_msecs_left() == 0 )
+        {
+          printf("jcplay: modem stopped taking data\n");
+          jcplay_cancel( fd );
+          fcntl( fd, F_SETFL, voice.portFlags );
+          end_voice_message();
+        }
+        break;
+
+      case VOICE_PLAYED:
+        if( ( ready > 0 && read_voice_reply( "OK" ) != 0 ) || voice_msecs_left() == 0 )
+          end_voice_message();
+        break;
+#endif
+
+#ifdef DO_RECORD
+      case VOICE_RECORDING:
+        // The time is up or the caller hung up: stop the modem
+        // sending; it ends the data with DLE ETX.
+        if( ready > 0 || voice_msecs_left() == 0 )
+        {
+          if( write( fd, stopCommand, sizeof( stopCommand ) ) != sizeof( stopCommand ) )
+            printf("answer_in_voice_mode: write() failed\n" );
+          enter_voice_state( VOICE_STOPPING, 1000 );
+        }
+        break;
+
+      case VOICE_STOPPING:
+        if( ready > 0 || voice_msecs_left() == 0 )
+        {
+          disarm_listener();
+          jcrecord_stop();
+          hang_up_voice_call();
+        }
+        break;
+#endif
+
+      case VOICE_RESETTING:
+        if( voice_msecs_left() == 0 )
+        {
+          init_caller_id( fd );
+          voice.state = VOICE_IDLE;
+        }
+        break;
+    }
+  }
+}
+
+#ifdef DO_REALTIME
+// Note the page faults and context switches of the thread deciding
+// calls so far, as a caller ID string arrives.
+static void start_call_usage( void )
+{
+  jcrealtime_usage( &callUsage );
+}
+
+//
+// Count the page faults and context switches since the caller ID
+// string arrived, once the call is decided.
+//
+static void count_call_usage( void )
+{
+  struct jcrealtime_usage now;
+
+  jcrealtime_usage( &now );
+  jcstats_count( JCS_CALL_MINOR_FAULTS, now.minorFaults - callUsage.minorFaults );
+  jcstats_count( JCS_CALL_MAJOR_FAULTS, now.majorFaults - callUsage.majorFaults );
+  jcstats_count( JCS_CALL_YIELDS, now.voluntarySwitches - callUsage.voluntarySwitches );
+  jcstats_count( JCS_CALL_PREEMPTIONS, now.involuntarySwitches - callUsage.involuntarySwitches );
+}
+#endif
@@ -0,0 +1,179 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: jccache.c
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	Description:
+ *	The recent-verdict cache (see jccache.h). Entries live in a fixed
+ *	array, chained from a hash table and linked in LRU order, so there
+ *	is no allocation after startup.
+ */
+#include <string.h>
+#include <ctype.h>
+
+#include "jclist.h"
+#include "jccache.h"
+
+static uint32_t hash_key( const char *key )
+{
+  uint32_t h = 2166136261u;             // FNV-1a
+
+  while( *key )
+    h = ( h ^ (unsigned char)*key++ ) * 16777619u;
+  return h;
+}
+
+void jccache_init( struct jccache *c )
+{
+  memset( c, 0, sizeof( *c ) );
+  memset( c->buckets, -1, sizeof( c->buckets ) );
+  c->newest = c->oldest = -1;
+}
+
+//
+// Build the cache key for a caller ID string: everything after its
+// DATE and TIME fields, normally the NMBR and NAME fields. Returns 0
+// if the string is not laid out as usual or the rest is too long.
+//
+int jccache_key( const char *callstr, char *key )
+{
+  static const char layout[] = JCL_CALL_LAYOUT;
+  size_t n;
+  int i;
+
+  // The first character is where the call's tag goes.
+  for( i = 1; layout[i]; i++ )
+  {
+    if( layout[i] == '#' ? !isdigit( (unsigned char)callstr[i] )
+                         : callstr[i] != layout[i] )
+      return 0;
+  }
+
+  n = strcspn( &callstr[i], "\r\n" );
+  if( n == 0 || n >= JCCACHE_KEY_SIZE )
+    return 0;
+  memcpy( key, &callstr[i], n );
+  key[n] = 0;
+  return 1;
+}
+
+static int find( struct jccache *c, const char *key, uint32_t hash )
+{
+  int i;
+
+  for( i = c->buckets[hash % JCCACHE_BUCKETS]; i >= 0; i = c->entries[i].chain )
+    if( c->entries[i].hash == hash && strcmp( c->entries[i].key, key ) == 0 )
+      return i;
+  return -1;
+}
+
+static void unlink_lru( struct jccache *c, int i )
+{
+  struct jccache_entry *e = &c->entries[i];
+
+  if( e->newer >= 0 )
+    c->entries[e->newer].older = e->older;
+  else
+    c->newest = e->older;
+  if( e->older >= 0 )
+    c->entries[e->older].newer = e->newer;
+  else
+    c->oldest = e->newer;
+}
+
+static void make_newest( struct jccache *c, int i )
+{
+  struct jccache_entry *e = &c->entries[i];
+
+  e->newer = -1;
+  e->older = c->newest;
+  if( c->newest >= 0 )
+    c->entries[c->newest].newer = i;
+  c->newest = i;
+  if( c->oldest < 0 )
+    c->oldest = i;
+}
+
+//
+// Look a call up. Returns 1, with the verdict and the entry that
+// decided it, if the call was seen under list generation 'gen';
+// otherwise 0.
+//
+int jccache_lookup( struct jccache *c, const char *key, uint32_t gen,
+                    int *verdict, int *rule )
+{
+  struct jccache_entry *e;
+  int i;
+
+  if( ( i = find( c, key, hash_key( key ) ) ) < 0 )
+  {
+    c->misses++;
+    return 0;
+  }
+  e = &c->entries[i];
+  if( e->gen != gen )
+  {
+    c->misses++;
+    return 0;
+  }
+
+  unlink_lru( c, i );
+  make_newest( c, i );
+  *verdict = e->verdict;
+  *rule = e->rule;
+  c->hits++;
+  return 1;
+}
+
+//
+// Remember the verdict for a call, decided under list generation 'gen'.
+//
+void jccache_store( struct jccache *c, const char *key, uint32_t gen,
+                    int verdict, int rule )
+{
+  struct jccache_entry *e;
+  uint32_t hash = hash_key( key );
+  int *link;
+  int i;
+
+  if( ( i = find( c, key, hash ) ) >= 0 )
+    unlink_lru( c, i );
+  else
+  {
+    if( c->used < JCCACHE_ENTRIES )
+      i = c->used++;
+    else
+    {
+      // Evict the least recently used entry
+      i = c->oldest;
+      unlink_lru( c, i );
+      for( link = &c->buckets[c->entries[i].hash % JCCACHE_BUCKETS];
+           *link != i; link = &c->entries[*link].chain )
+        ;
+      *link = c->entries[i].chain;
+    }
+    e = &c->entries[i];
+    strncpy( e->key, key, sizeof( e->key ) - 1 );
+    e->key[sizeof( e->key ) - 1] = 0;
+    e->hash = hash;
+    e->chain = c->buckets[hash % JCCACHE_BUCKETS];
+    c->buckets[hash % JCCACHE_BUCKETS] = i;
+  }
+
+  e = &c->entries[i];
+  e->verdict = verdict;
+  e->rule = rule;
+  e->gen = gen;
+  make_newest( c, i );
+}
@@ -0,0 +1,71 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: jccache.h
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	A cache of recent verdicts, so that a repeat caller is answered
+ *	with a hash lookup instead of a scan of both lists. Entries are
+ *	keyed on what follows the call's DATE and TIME fields (its NMBR
+ *	and NAME) and remember the list entry that decided the call, so
+ *	its date can still be updated. jcblock only stores verdicts that
+ *	no list entry matching the DATE or TIME digits could change (see
+ *	jclist_time_dependent()).
+ *
+ *	Entries are stamped with the generation of the lists they were
+ *	decided under. jcblock moves the generation on whenever it loads
+ *	the lists again because a file changed (other than by jcblock
+ *	updating an entry's date in place), and an entry made under an
+ *	older generation is not used. The least recently used entry makes
+ *	way for a new one when the cache is full.
+ */
+#ifndef JCCACHE_H
+#define JCCACHE_H
+
+#include <stdint.h>
+
+#define JCCACHE_ENTRIES   256         // calls remembered
+#define JCCACHE_BUCKETS   512         // hash chains; a power of 2
+#define JCCACHE_KEY_SIZE  80
+
+struct jccache_entry
+{
+  char key[JCCACHE_KEY_SIZE];         // "NMBR = ...--NAME = ...--"
+  uint32_t hash;
+  int verdict;                        // JCL_SAFE, JCL_BLOCKED or JCL_NEUTRAL
+  int rule;                           // the deciding entry, or -1
+  uint32_t gen;                       // list generation it was made under
+  int chain;                          // next entry in the hash chain
+  int newer, older;                   // LRU order
+};
+
+struct jccache
+{
+  struct jccache_entry entries[JCCACHE_ENTRIES];
+  int buckets[JCCACHE_BUCKETS];
+  int used;
+  int newest, oldest;
+  uint64_t hits, misses;
+};
+
+void jccache_init( struct jccache *c );
+int jccache_key( const char *callstr, char *key );
+int jccache_lookup( struct jccache *c, const char *key, uint32_t gen,
+                    int *verdict, int *rule );
+void jccache_store( struct jccache *c, const char *key, uint32_t gen,
+                    int verdict, int rule );
+
+#endif
@@ -0,0 +1,152 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: jcdle.c
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	Description:
+ *	The DLE event decoder (see jcdle.h). The only state carried from
+ *	one jcdle_feed() to the next is whether the previous byte was a
+ *	DLE, so a sequence split anywhere is still decoded once. Runs of
+ *	voice data between events are passed on without copying.
+ */
+#include <string.h>
+
+#include "jcdle.h"
+
+const char *jcdleToneNames[JCDLE_NUM_TONES] =
+{
+  "busy", "dial tone", "silence", "quiet", "fax calling", "data calling",
+  "answer tone", "ringback", "ring", "loop break", "overrun", "underrun"
+};
+
+void jcdle_init( struct jcdle_decoder *d, const struct jcdle_callbacks *callbacks,
+                 void *context )
+{
+  memset( d, 0, sizeof( *d ) );
+  d->callbacks = callbacks;
+  d->context = context;
+}
+
+static void tone( struct jcdle_decoder *d, int which )
+{
+  if( d->callbacks->tone != NULL )
+    d->callbacks->tone( d->context, which );
+}
+
+//
+// Act on the code that followed a DLE.
+//
+static void decode( struct jcdle_decoder *d, char code )
+{
+  static const char dle = JCDLE_DLE;
+  const struct jcdle_callbacks *cb = d->callbacks;
+
+  d->events++;
+  switch( code )
+  {
+    case JCDLE_DLE:             // an escaped DLE in the voice data
+      d->events--;
+      if( cb->data != NULL )
+        cb->data( d->context, &dle, 1 );
+      break;
+
+    case JCDLE_ETX:
+      d->shielded = 0;
+      if( cb->end != NULL )
+        cb->end( d->context );
+      break;
+
+    // Some modems bracket each key with DLE '/' and DLE '~' (and may
+    // repeat the key in between); only the first report counts.
+    case '/':
+      d->shielded = 1;
+      d->events--;
+      break;
+
+    case '~':
+      d->shielded = 0;
+      d->events--;
+      break;
+
+    case '0': case '1': case '2': case '3': case '4':
+    case '5': case '6': case '7': case '8': case '9':
+    case '*': case '#': case 'A': case 'B': case 'C': case 'D':
+      if( d->shielded == 2 )
+      {
+        d->events--;
+        break;
+      }
+      if( d->shielded )
+        d->shielded = 2;
+      if( cb->digit != NULL )
+        cb->digit( d->context, code );
+      break;
+
+    case 'b': tone( d, JCDLE_BUSY );           break;
+    case 'd': tone( d, JCDLE_DIAL_TONE );      break;
+    case 's': tone( d, JCDLE_SILENCE );        break;
+    case 'q': tone( d, JCDLE_QUIET );          break;
+    case 'c': tone( d, JCDLE_FAX_CALLING );    break;
+    case 'e': tone( d, JCDLE_DATA_CALLING );   break;
+    case 'a': tone( d, JCDLE_ANSWER_TONE );    break;
+    case 'r': tone( d, JCDLE_RINGBACK );       break;
+    case 'R': tone( d, JCDLE_RING );           break;
+    case 'h': case 'l': case 'I':
+              tone( d, JCDLE_LOOP_BREAK );     break;
+    case 'o': tone( d, JCDLE_OVERRUN );        break;
+    case 'u': tone( d, JCDLE_UNDERRUN );       break;
+
+    default:
+      if( cb->unknown != NULL )
+        cb->unknown( d->context, code );
+      break;
+  }
+}
+
+void jcdle_feed( struct jcdle_decoder *d, const char *buf, size_t length )
+{
+  const char *end = buf + length;
+  const char *run;
+  const char *p = buf;
+
+  if( length == 0 )
+    return;
+
+  // Complete a DLE left over from the last piece
+  if( d->sawDle )
+  {
+    d->sawDle = 0;
+    decode( d, *p++ );
+  }
+
+  while( p < end )
+  {
+    // Pass on the voice data up to the next DLE in one piece
+    run = p;
+    p = memchr( p, JCDLE_DLE, end - p );
+    if( p == NULL )
+      p = end;
+    if( p > run && d->callbacks->data != NULL )
+      d->callbacks->data( d->context, run, p - run );
+
+    if( p == end )
+      break;
+    if( ++p == end )
+    {
+      d->sawDle = 1;
+      break;
+    }
+    decode( d, *p++ );
+  }
+}
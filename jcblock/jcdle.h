@@ -0,0 +1,86 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: jcdle.h
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	A streaming decoder for what a voice modem sends in voice mode
+ *	(AT+FCLASS=8). Events are shielded by DLE (0x10): DLE followed by
+ *	a code character (ITU-T V.253). Bytes are fed in as they are read,
+ *	in pieces of any size; a DLE at the end of one piece is completed
+ *	by the start of the next. Each event is handed to a callback of
+ *	its own type, and everything else is handed on as (unescaped)
+ *	voice data.
+ */
+#ifndef JCDLE_H
+#define JCDLE_H
+
+#include <stddef.h>
+
+#define JCDLE_DLE  0x10
+#define JCDLE_ETX  0x03
+
+// Tones and line conditions reported by the modem (besides DTMF).
+#define JCDLE_BUSY           0   // DLE b  busy tone
+#define JCDLE_DIAL_TONE      1   // DLE d  dial tone
+#define JCDLE_SILENCE        2   // DLE s  silence (caller gone quiet)
+#define JCDLE_QUIET          3   // DLE q  quiet after voice
+#define JCDLE_FAX_CALLING    4   // DLE c  fax calling tone (CNG, 1100 Hz)
+#define JCDLE_DATA_CALLING   5   // DLE e  data calling tone (1300 Hz)
+#define JCDLE_ANSWER_TONE    6   // DLE a  fax/data answer tone (2100 Hz)
+#define JCDLE_RINGBACK       7   // DLE r  ringback
+#define JCDLE_RING           8   // DLE R  ring
+#define JCDLE_LOOP_BREAK     9   // DLE h, DLE l, DLE I  line current lost
+#define JCDLE_OVERRUN       10   // DLE o  modem receive buffer overrun
+#define JCDLE_UNDERRUN      11   // DLE u  modem transmit buffer underrun
+#define JCDLE_NUM_TONES     12
+
+struct jcdle_callbacks
+{
+  // A keypad key: '0'-'9', '*', '#' or 'A'-'D'. Reported once per
+  // press, however the modem brackets it.
+  void (*digit)( void *context, char key );
+
+  // One of the JCDLE_ tones or line conditions above.
+  void (*tone)( void *context, int tone );
+
+  // DLE ETX: the modem has ended the voice data stream.
+  void (*end)( void *context );
+
+  // Voice data. 'data' points into the buffer given to jcdle_feed()
+  // wherever possible, so it is only valid during the call.
+  void (*data)( void *context, const char *data, size_t length );
+
+  // A code this decoder doesn't know.
+  void (*unknown)( void *context, char code );
+};
+
+struct jcdle_decoder
+{
+  const struct jcdle_callbacks *callbacks;   // any member may be NULL
+  void *context;
+  int sawDle;                // the last byte fed was an unpaired DLE
+  int shielded;              // 1 after DLE '/', 2 once its key is reported
+  unsigned long events;      // events decoded so far
+};
+
+extern const char *jcdleToneNames[JCDLE_NUM_TONES];
+
+void jcdle_init( struct jcdle_decoder *d, const struct jcdle_callbacks *callbacks,
+                 void *context );
+void jcdle_feed( struct jcdle_decoder *d, const char *buf, size_t length );
+
+#endif
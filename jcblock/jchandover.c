@@ -0,0 +1,206 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: jchandover.c
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Description:
+ *	Handing the serial port over between jcblocks (see jchandover.h).
+ *	The state and the descriptor go in one message on a Unix domain
+ *	stream socket.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "jchandover.h"
+
+static int make_address( const char *path, struct sockaddr_un *addr )
+{
+  if( strlen( path ) >= sizeof( addr->sun_path ) )
+  {
+    printf("jchandover: %s: path too long\n", path);
+    return(-1);
+  }
+  memset( addr, 0, sizeof( *addr ) );
+  addr->sun_family = AF_UNIX;
+  strcpy( addr->sun_path, path );
+  return(0);
+}
+
+//
+// Listen for a new jcblock on 'path', replacing any socket left
+// there. Only the user jcblock runs as may connect: whoever does is
+// given the modem. Returns the socket, or -1.
+//
+int jchandover_listen( const char *path )
+{
+  struct sockaddr_un addr;
+  int listenFd;
+
+  if( make_address( path, &addr ) != 0 )
+    return(-1);
+  if( ( listenFd = socket( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 ) ) < 0 )
+  {
+    printf("jchandover: socket() failed: %s\n", strerror(errno));
+    return(-1);
+  }
+  unlink( path );
+  if( bind( listenFd, (struct sockaddr *)&addr, sizeof( addr ) ) != 0 ||
+      chmod( path, S_IRUSR | S_IWUSR ) != 0 ||
+      listen( listenFd, 1 ) != 0 )
+  {
+    printf("jchandover: %s: %s\n", path, strerror(errno));
+    close( listenFd );
+    return(-1);
+  }
+  return(listenFd);
+}
+
+//
+// Hand 'serialFd' and 'state' to the jcblock connecting on 'listenFd'.
+// Returns 0 once it has them, when this jcblock must leave the modem
+// alone and exit; or -1 if it didn't take them, when this jcblock
+// carries on.
+//
+int jchandover_give( int listenFd, int serialFd, const struct jchandover_state *state )
+{
+  union
+  {
+    struct cmsghdr align;
+    char buffer[CMSG_SPACE( sizeof( int ) )];
+  } control;
+  struct cmsghdr *cmsg;
+  struct msghdr msg;
+  struct iovec iov;
+  struct pollfd pfd;
+  char answer = 0;
+  int peerFd;
+
+  if( ( peerFd = accept( listenFd, NULL, NULL ) ) < 0 )
+    return(-1);
+  fcntl( peerFd, F_SETFD, FD_CLOEXEC );
+
+  memset( &msg, 0, sizeof( msg ) );
+  memset( &control, 0, sizeof( control ) );
+  iov.iov_base = (void *)state;
+  iov.iov_len = sizeof( *state );
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buffer;
+  msg.msg_controllen = sizeof( control.buffer );
+  cmsg = CMSG_FIRSTHDR( &msg );
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN( sizeof( int ) );
+  memcpy( CMSG_DATA( cmsg ), &serialFd, sizeof( int ) );
+
+  if( sendmsg( peerFd, &msg, MSG_NOSIGNAL ) != sizeof( *state ) )
+  {
+    printf("jchandover: sendmsg() failed: %s\n", strerror(errno));
+    close( peerFd );
+    return(-1);
+  }
+
+  // The new jcblock has the port once it says so.
+  pfd.fd = peerFd;
+  pfd.events = POLLIN;
+  if( poll( &pfd, 1, JCHANDOVER_TIMEOUT ) != 1 ||
+      read( peerFd, &answer, 1 ) != 1 || answer != JCHANDOVER_ACCEPTED )
+  {
+    printf("jchandover: the new jcblock didn't take over\n");
+    close( peerFd );
+    return(-1);
+  }
+  close( peerFd );
+  return(0);
+}
+
+//
+// Take the serial port and state over from the jcblock listening on
+// 'path', waiting for it to finish any call it is handling. Returns 0
+// on success.
+//
+int jchandover_take( const char *path, int *serialFd, struct jchandover_state *state )
+{
+  union
+  {
+    struct cmsghdr align;
+    char buffer[CMSG_SPACE( sizeof( int ) )];
+  } control;
+  struct sockaddr_un addr;
+  struct cmsghdr *cmsg;
+  struct msghdr msg;
+  struct iovec iov;
+  char answer = JCHANDOVER_ACCEPTED;
+  ssize_t n;
+  int peerFd;
+
+  if( make_address( path, &addr ) != 0 )
+    return(-1);
+  if( ( peerFd = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 ) ) < 0 ||
+      connect( peerFd, (struct sockaddr *)&addr, sizeof( addr ) ) != 0 )
+  {
+    printf("jchandover: %s: %s\n", path, strerror(errno));
+    if( peerFd >= 0 )
+      close( peerFd );
+    return(-1);
+  }
+
+  memset( &msg, 0, sizeof( msg ) );
+  iov.iov_base = state;
+  iov.iov_len = sizeof( *state );
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buffer;
+  msg.msg_controllen = sizeof( control.buffer );
+  while( ( n = recvmsg( peerFd, &msg, 0 ) ) < 0 && errno == EINTR )
+    ;
+  cmsg = CMSG_FIRSTHDR( &msg );
+  if( n != sizeof( *state ) || cmsg == NULL ||
+      cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN( sizeof( int ) ) )
+  {
+    printf("jchandover: no serial port from the running jcblock\n");
+    close( peerFd );
+    return(-1);
+  }
+  memcpy( serialFd, CMSG_DATA( cmsg ), sizeof( int ) );
+  if( state->magic != JCHANDOVER_MAGIC || state->version != JCHANDOVER_VERSION )
+  {
+    // It will carry on with the modem when no answer comes.
+    printf("jchandover: the running jcblock is of another version\n");
+    close( *serialFd );
+    close( peerFd );
+    return(-1);
+  }
+
+  if( write( peerFd, &answer, 1 ) != 1 )
+  {
+    printf("jchandover: write() failed: %s\n", strerror(errno));
+    close( *serialFd );
+    close( peerFd );
+    return(-1);
+  }
+  close( peerFd );
+  return(0);
+}
@@ -0,0 +1,58 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: jchandover.h
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Handing the modem over from a running jcblock to a new one
+ *	(jcblockAT.c, DO_HANDOVER). Restarting jcblock the ordinary way
+ *	resets the modem (ATZ), closes the port and has the new jcblock
+ *	initialise the modem again, which takes seconds; a call arriving
+ *	meanwhile is missed. Instead, the new jcblock (started with -t)
+ *	connects to the old one's handover socket and is sent the open
+ *	serial port (SCM_RIGHTS) and a struct jchandover_state. It answers
+ *	with one byte once it has them, and the old jcblock exits without
+ *	touching the modem. Anything the modem sends meanwhile waits in the
+ *	port for the new jcblock to read.
+ *
+ *	The old jcblock only hands over between calls, while it waits for
+ *	the modem, so no call is ever half handled by either.
+ */
+#ifndef JCHANDOVER_H
+#define JCHANDOVER_H
+
+#include <stdint.h>
+
+#define JCHANDOVER_SOCKET   "./jcblock.handover"
+#define JCHANDOVER_MAGIC    0x4e44484a   // "JHDN"
+#define JCHANDOVER_VERSION  1
+#define JCHANDOVER_TIMEOUT  2000         // ms the old jcblock waits for the answer
+#define JCHANDOVER_ACCEPTED 'K'          // the new jcblock's answer
+
+struct jchandover_state
+{
+  uint32_t magic, version;
+  int32_t pid;                  // of the jcblock handing over
+  int32_t numRings;             // rings counted since the last call
+  int64_t logSize;              // bytes in callerID.dat, all written
+  char serialPort[64];          // the port the descriptor is open on
+};
+
+int jchandover_listen( const char *path );
+int jchandover_give( int listenFd, int serialFd, const struct jchandover_state *state );
+int jchandover_take( const char *path, int *serialFd, struct jchandover_state *state );
+
+#endif
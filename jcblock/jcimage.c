@@ -0,0 +1,480 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: jcimage.c
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Description:
+ *	Writes and maps the compiled list image (see jcimage.h). Opening
+ *	an image checks the header and that the list files haven't changed,
+ *	but doesn't read the rest of it: that is what keeps opening cheap
+ *	however many entries there are. jcimage_write() renames a complete
+ *	image into place, so a half written one is never seen; the body
+ *	checksum is for jclistc -t to find one damaged since.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "jcimage.h"
+
+#define ALIGN(n)  ( ( (n) + 7 ) & ~(uint64_t)7 )
+
+// FNV-1a, a 64 bit word at a time.
+static uint64_t checksum( const void *data, size_t length )
+{
+  const unsigned char *p = data;
+  uint64_t h = 0xcbf29ce484222325ULL;
+  uint64_t word;
+
+  for( ; length >= 8; p += 8, length -= 8 )
+  {
+    memcpy( &word, p, 8 );
+    h = ( h ^ word ) * 0x100000001b3ULL;
+  }
+  for( ; length > 0; p++, length-- )
+    h = ( h ^ *p ) * 0x100000001b3ULL;
+  return(h);
+}
+
+static uint64_t header_checksum( const struct jcimage_header *header )
+{
+  struct jcimage_header copy = *header;
+
+  copy.headerChecksum = 0;
+  return checksum( &copy, sizeof( copy ) );
+}
+
+static void note_source( struct jcimage_source *s, const char *filename )
+{
+  struct stat st;
+
+  memset( s, 0, sizeof( *s ) );
+  if( filename == NULL || stat( filename, &st ) != 0 )
+    return;
+  s->present = 1;
+  s->dev = st.st_dev;
+  s->ino = st.st_ino;
+  s->size = st.st_size;
+  s->mtimeSec = st.st_mtim.tv_sec;
+  s->mtimeNsec = st.st_mtim.tv_nsec;
+}
+
+// An entry for the number table: a literal of digits only.
+static int number_entry( const char *pattern, uint64_t *value )
+{
+  size_t n = strlen( pattern );
+  size_t i;
+
+  if( n < JCIMAGE_MIN_DIGITS || n > 18 )
+    return(0);
+  for( *value = 0, i = 0; i < n; i++ )
+  {
+    if( pattern[i] < '0' || pattern[i] > '9' )
+      return(0);
+    *value = *value * 10 + ( pattern[i] - '0' );
+  }
+  return(1);
+}
+
+static int compare_numbers( const void *a, const void *b )
+{
+  const struct jcimage_number *x = a, *y = b;
+
+  if( x->length != y->length )
+    return( x->length < y->length ? -1 : 1 );
+  if( x->value != y->value )
+    return( x->value < y->value ? -1 : 1 );
+  if( x->list != y->list )
+    return( x->list < y->list ? -1 : 1 );
+  return( x->entry < y->entry ? -1 : x->entry > y->entry );
+}
+
+//
+// Compile the list files 'sources' (the whitelist may be NULL) into
+// an image file. The files' details are noted before they are read,
+// so a change made meanwhile leaves the image stale. Returns 0 on
+// success, or -1 with errno set (EFBIG if the automaton is too big).
+//
+int jcimage_write( const char *filename, const char *sources[JCP_GROUPS] )
+{
+  struct jclist white, black;
+  const struct jclist *lists[JCP_GROUPS] = { &white, &black };
+  struct jclist rest[JCP_GROUPS];
+  int *restIndex[JCP_GROUPS] = { NULL, NULL };
+  struct jcimage_header h;
+  struct jcimage_entry *entries;
+  struct jcimage_number *numbers;
+  struct jcpattern matcher;
+  char tmpName[1024];
+  char *image = NULL;
+  int32_t *accept;
+  uint64_t value;
+  size_t strings = 0;
+  int total, n, g, i, j;
+  int result = -1;
+  int fd;
+
+  memset( &h, 0, sizeof( h ) );
+  memset( &matcher, 0, sizeof( matcher ) );
+  for( g = 0; g < JCP_GROUPS; g++ )
+  {
+    jclist_init( &rest[g] );
+    note_source( &h.sources[g], sources[g] );
+  }
+  jclist_init( &white );
+  jclist_init( &black );
+  if( ( sources[JCP_WHITE] != NULL && jclist_load_file( &white, sources[JCP_WHITE] ) != 0 ) ||
+      jclist_load_file( &black, sources[JCP_BLACK] ) != 0 )
+    goto done;
+
+  h.magic = JCIMAGE_MAGIC;
+  h.version = JCIMAGE_VERSION;
+  h.counts[JCP_WHITE] = white.count;
+  h.counts[JCP_BLACK] = black.count;
+  total = white.count + black.count;
+  h.firstTimeDependent = total + 1;
+
+  // Sort the entries into the number table and the rest.
+  for( g = 0; g < JCP_GROUPS; g++ )
+  {
+    if( ( restIndex[g] = malloc( ( lists[g]->count + 1 ) * sizeof( int ) ) ) == NULL )
+      goto done;
+    for( i = 0; i < lists[g]->count; i++ )
+    {
+      const char *pattern = lists[g]->entries[i].pattern;
+
+      strings += strlen( pattern ) + 1;
+      if( jclist_time_dependent( pattern ) &&
+          i + ( g ? white.count : 0 ) < h.firstTimeDependent )
+        h.firstTimeDependent = i + ( g ? white.count : 0 );
+      if( number_entry( pattern, &value ) )
+      {
+        h.numNumbers++;
+        continue;
+      }
+      restIndex[g][rest[g].count] = i;
+      if( jclist_add( &rest[g], pattern, lists[g]->entries[i].offset ) != 0 )
+        goto done;
+    }
+  }
+  if( jcpattern_compile( &matcher, &rest[JCP_WHITE], &rest[JCP_BLACK] ) != 0 ||
+      matcher.numStates == 0 )
+  {
+    errno = EFBIG;
+    goto done;
+  }
+  h.numStates = matcher.numStates;
+  h.numClasses = matcher.numClasses;
+
+  h.entriesOffset = ALIGN( sizeof( h ) );
+  h.stringsOffset = h.entriesOffset + total * sizeof( struct jcimage_entry );
+  h.stringsSize = strings;
+  h.numbersOffset = ALIGN( h.stringsOffset + strings );
+  h.classesOffset = h.numbersOffset + h.numNumbers * sizeof( struct jcimage_number );
+  h.nextOffset = h.classesOffset + 256;
+  h.acceptOffset = h.nextOffset + (uint64_t)h.numStates * h.numClasses * sizeof( int32_t );
+  h.imageSize = h.acceptOffset + (uint64_t)h.numStates * JCP_GROUPS * sizeof( int32_t );
+  if( ( image = calloc( 1, h.imageSize ) ) == NULL )
+    goto done;
+
+  // Entries and their patterns, and the number table.
+  entries = (struct jcimage_entry *)( image + h.entriesOffset );
+  numbers = (struct jcimage_number *)( image + h.numbersOffset );
+  strings = 0;
+  for( g = 0, n = 0, j = 0; g < JCP_GROUPS; g++ )
+  {
+    for( i = 0; i < lists[g]->count; i++, j++ )
+    {
+      const char *pattern = lists[g]->entries[i].pattern;
+
+      entries[j].offset = lists[g]->entries[i].offset;
+      entries[j].pattern = strings;
+      strcpy( image + h.stringsOffset + strings, pattern );
+      strings += strlen( pattern ) + 1;
+      if( number_entry( pattern, &value ) )
+      {
+        numbers[n].value = value;
+        numbers[n].entry = i;
+        numbers[n].length = strlen( pattern );
+        numbers[n].list = g;
+        h.numberLengths |= 1U << numbers[n].length;
+        n++;
+      }
+    }
+  }
+  qsort( numbers, n, sizeof( *numbers ), compare_numbers );
+
+  // The automaton, with entry numbers of the whole lists.
+  memcpy( image + h.classesOffset, matcher.classes, 256 );
+  memcpy( image + h.nextOffset, matcher.next,
+          (size_t)h.numStates * h.numClasses * sizeof( int32_t ) );
+  accept = (int32_t *)( image + h.acceptOffset );
+  for( i = 0; i < h.numStates * JCP_GROUPS; i++ )
+  {
+    g = i % JCP_GROUPS;
+    accept[i] = ( matcher.accept[i] < 0 ) ? -1 : restIndex[g][matcher.accept[i]];
+  }
+
+  h.bodyChecksum = checksum( image + sizeof( h ), h.imageSize - sizeof( h ) );
+  h.headerChecksum = header_checksum( &h );
+  memcpy( image, &h, sizeof( h ) );
+
+  // Write it beside the old image and rename it into place.
+  snprintf( tmpName, sizeof( tmpName ), "%s.tmp", filename );
+  if( ( fd = open( tmpName, O_WRONLY | O_CREAT | O_TRUNC, 0644 ) ) < 0 )
+    goto done;
+  if( write( fd, image, h.imageSize ) != (ssize_t)h.imageSize || fsync( fd ) != 0 )
+  {
+    close( fd );
+    unlink( tmpName );
+    goto done;
+  }
+  close( fd );
+  if( rename( tmpName, filename ) != 0 )
+  {
+    unlink( tmpName );
+    goto done;
+  }
+  result = 0;
+
+done:
+  for( g = 0; g < JCP_GROUPS; g++ )
+  {
+    jclist_free( &rest[g] );
+    free( restIndex[g] );
+  }
+  jcpattern_free( &matcher );
+  jclist_free( &white );
+  jclist_free( &black );
+  free( image );
+  return(result);
+}
+
+static int same_source( const struct jcimage_source *s, const char *filename )
+{
+  struct jcimage_source now;
+
+  note_source( &now, filename );
+  return( now.present == s->present && now.dev == s->dev && now.ino == s->ino &&
+          now.size == s->size && now.mtimeSec == s->mtimeSec &&
+          now.mtimeNsec == s->mtimeNsec );
+}
+
+//
+// Map an image, if there is a usable one for the list files 'sources'.
+// Returns JCIMAGE_OK, or why not.
+//
+int jcimage_open( struct jcimage *img, const char *filename,
+                  const char *sources[JCP_GROUPS] )
+{
+  const struct jcimage_header *h;
+  struct stat st;
+  uint64_t total;
+  int fd, g;
+
+  memset( img, 0, sizeof( *img ) );
+  if( ( fd = open( filename, O_RDONLY ) ) < 0 )
+    return( errno == ENOENT ? JCIMAGE_MISSING : JCIMAGE_BAD );
+  if( fstat( fd, &st ) != 0 || st.st_size < (off_t)sizeof( *h ) )
+  {
+    close( fd );
+    return(JCIMAGE_BAD);
+  }
+  img->size = st.st_size;
+  img->map = mmap( NULL, img->size, PROT_READ, MAP_SHARED, fd, 0 );
+  close( fd );
+  if( img->map == MAP_FAILED )
+  {
+    img->map = NULL;
+    return(JCIMAGE_BAD);
+  }
+
+  // The header, and that the sections it describes are in the file.
+  h = img->header = img->map;
+  total = (uint64_t)h->counts[JCP_WHITE] + h->counts[JCP_BLACK];
+  if( h->magic != JCIMAGE_MAGIC || h->version != JCIMAGE_VERSION ||
+      h->imageSize != img->size || h->headerChecksum != header_checksum( h ) ||
+      h->counts[JCP_WHITE] < 0 || h->counts[JCP_BLACK] < 0 ||
+      h->numNumbers < 0 || h->numStates <= 0 || h->numClasses <= 0 ||
+      h->entriesOffset + total * sizeof( struct jcimage_entry ) > h->stringsOffset ||
+      h->stringsOffset + h->stringsSize > h->numbersOffset ||
+      h->numbersOffset + h->numNumbers * sizeof( struct jcimage_number ) > h->classesOffset ||
+      h->classesOffset + 256 > h->nextOffset ||
+      h->nextOffset + (uint64_t)h->numStates * h->numClasses * sizeof( int32_t ) > h->acceptOffset ||
+      h->acceptOffset + (uint64_t)h->numStates * JCP_GROUPS * sizeof( int32_t ) > h->imageSize ||
+      ( h->stringsSize > 0 && ( (const char *)img->map )[h->stringsOffset + h->stringsSize - 1] != 0 ) )
+  {
+    jcimage_close( img );
+    return(JCIMAGE_BAD);
+  }
+
+  for( g = 0; g < JCP_GROUPS; g++ )
+  {
+    if( !same_source( &h->sources[g], sources[g] ) )
+    {
+      jcimage_close( img );
+      return(JCIMAGE_STALE);
+    }
+  }
+
+  img->entries = (const void *)( (const char *)img->map + h->entriesOffset );
+  img->strings = (const char *)img->map + h->stringsOffset;
+  img->numbers = (const void *)( (const char *)img->map + h->numbersOffset );
+  img->matcher.numStates = h->numStates;
+  img->matcher.numClasses = h->numClasses;
+  memcpy( img->matcher.classes, (const char *)img->map + h->classesOffset, 256 );
+  img->matcher.next = (int32_t *)( (char *)img->map + h->nextOffset );
+  img->matcher.accept = (int32_t *)( (char *)img->map + h->acceptOffset );
+  return(JCIMAGE_OK);
+}
+
+// Check the body checksum: 0 if the image is intact.
+int jcimage_check( const struct jcimage *img )
+{
+  const struct jcimage_header *h = img->header;
+
+  return( checksum( (const char *)img->map + sizeof( *h ), h->imageSize - sizeof( *h ) ) ==
+          h->bodyChecksum ? 0 : -1 );
+}
+
+// Find the first entry of each list with this number, if any.
+static void find_number( const struct jcimage *img, uint64_t value, int length,
+                         int rules[JCP_GROUPS] )
+{
+  const struct jcimage_number *numbers = img->numbers;
+  int lo = 0, hi = img->header->numNumbers;
+  int mid;
+
+  while( lo < hi )
+  {
+    mid = lo + ( hi - lo ) / 2;
+    if( numbers[mid].length < length ||
+        ( numbers[mid].length == length && numbers[mid].value < value ) )
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  for( ; lo < img->header->numNumbers && numbers[lo].length == length &&
+         numbers[lo].value == value; lo++ )
+  {
+    if( rules[numbers[lo].list] < 0 || (int)numbers[lo].entry < rules[numbers[lo].list] )
+      rules[numbers[lo].list] = numbers[lo].entry;
+  }
+}
+
+//
+// The first entry of each list that matches the call, or -1: the
+// automaton's answer, and any earlier entry from the number table.
+//
+void jcimage_run( const struct jcimage *img, const char *callstr,
+                  int rules[JCP_GROUPS] )
+{
+  uint32_t lengths = img->header->numberLengths;
+  const char *run, *end, *p;
+  uint64_t value;
+  int length, i;
+
+  jcpattern_run( &img->matcher, callstr, rules );
+  if( lengths == 0 )
+    return;
+
+  // Every digit string of a length in the table is a possible match.
+  for( run = callstr; *run; run = end )
+  {
+    if( *run < '0' || *run > '9' )
+    {
+      end = run + 1;
+      continue;
+    }
+    for( end = run; *end >= '0' && *end <= '9'; end++ )
+      ;
+    for( length = JCIMAGE_MIN_DIGITS; length <= end - run && length <= 18; length++ )
+    {
+      if( !( lengths & ( 1U << length ) ) )
+        continue;
+      for( p = run; p + length <= end; p++ )
+      {
+        for( value = 0, i = 0; i < length; i++ )
+          value = value * 10 + ( p[i] - '0' );
+        find_number( img, value, length, rules );
+      }
+    }
+  }
+}
+
+// Decide a call the way jclist_verdict() does.
+int jcimage_verdict( const struct jcimage *img, const char *callstr, int *rule )
+{
+  int rules[JCP_GROUPS];
+
+  jcimage_run( img, callstr, rules );
+  if( rules[JCP_WHITE] >= 0 )
+  {
+    *rule = rules[JCP_WHITE];
+    return(JCL_SAFE);
+  }
+  *rule = rules[JCP_BLACK];
+  return( *rule >= 0 ? JCL_BLOCKED : JCL_NEUTRAL );
+}
+
+// An entry, as jclist has it; the pattern points into the image.
+void jcimage_entry( const struct jcimage *img, int list, int index,
+                    struct jclist_entry *entry )
+{
+  const struct jcimage_entry *e;
+
+  e = &img->entries[( list == JCP_BLACK ? img->header->counts[JCP_WHITE] : 0 ) + index];
+  entry->pattern = (char *)img->strings + e->pattern;
+  entry->offset = e->offset;
+}
+
+//
+// Note the current details of a list file in the image header, after
+// a change to it that doesn't alter its entries (a date updated in
+// place). Returns 0 on success.
+//
+int jcimage_restamp( const char *filename, int list, const char *source )
+{
+  struct jcimage_header h;
+  int fd;
+  int result = -1;
+
+  if( ( fd = open( filename, O_RDWR ) ) < 0 )
+    return(-1);
+  if( pread( fd, &h, sizeof( h ), 0 ) == sizeof( h ) && h.magic == JCIMAGE_MAGIC &&
+      h.version == JCIMAGE_VERSION && h.headerChecksum == header_checksum( &h ) )
+  {
+    note_source( &h.sources[list], source );
+    h.headerChecksum = header_checksum( &h );
+    if( pwrite( fd, &h, sizeof( h ), 0 ) == sizeof( h ) )
+      result = 0;
+  }
+  close( fd );
+  return(result);
+}
+
+void jcimage_close( struct jcimage *img )
+{
+  if( img->map != NULL )
+    munmap( img->map, img->size );
+  memset( img, 0, sizeof( *img ) );
+}
@@ -0,0 +1,130 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: jcimage.h
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	The compiled list image written by jclistc (see jclistc.c). It holds
+ *	both lists ready to use where they lie, so jcblock maps it with one
+ *	mmap() and reads no text:
+ *
+ *	    header      version, checksums, and the size, inode and mtime
+ *	                of whitelist.dat and blacklist.dat when compiled
+ *	    entries     every entry's pattern and record offset, whitelist
+ *	                entries first
+ *	    numbers     entries that are just a number of JCIMAGE_MIN_DIGITS
+ *	                or more digits, sorted, for binary search
+ *	    automaton   the other entries compiled by jcpattern.c, with
+ *	                entry numbers as in 'entries'
+ *
+ *	Numbers are looked up by trying every digit run of the caller ID
+ *	string of the lengths in the table, so an entry still matches
+ *	anywhere in the string, as in the text lists.
+ *
+ *	The image is stale, and jcblock reads the text lists instead, when
+ *	either list file has changed since it was compiled. jcblock's own
+ *	updates of entry dates don't count: it records the new file details
+ *	in the image header (jcimage_restamp()).
+ */
+#ifndef JCIMAGE_H
+#define JCIMAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "jclist.h"
+#include "jcpattern.h"
+
+#define JCIMAGE_FILE        "./lists.img"
+#define JCIMAGE_MAGIC       0x494c434a     // "JCLI"
+#define JCIMAGE_VERSION     1
+#define JCIMAGE_MIN_DIGITS  7
+
+// Results of jcimage_open().
+#define JCIMAGE_OK        0
+#define JCIMAGE_MISSING   1   // no image file
+#define JCIMAGE_BAD       2   // not an image of this version, or damaged
+#define JCIMAGE_STALE     3   // a list file has changed since
+
+struct jcimage_source
+{
+  int32_t present;              // the file existed
+  int32_t pad;
+  uint64_t dev, ino, size;
+  int64_t mtimeSec, mtimeNsec;
+};
+
+struct jcimage_header
+{
+  uint32_t magic, version;
+  uint64_t imageSize;           // of the whole file
+  uint64_t headerChecksum;      // of this header, with this field 0
+  uint64_t bodyChecksum;        // of everything after the header
+  struct jcimage_source sources[JCP_GROUPS];
+  int32_t counts[JCP_GROUPS];   // entries in each list
+  int32_t firstTimeDependent;   // as in jcblock: counting whitelist entries first
+  int32_t numNumbers;
+  uint32_t numberLengths;       // bit n set: some number has n digits
+  int32_t numStates, numClasses;
+  int32_t pad;
+  uint64_t entriesOffset;       // struct jcimage_entry[counts[0] + counts[1]]
+  uint64_t stringsOffset, stringsSize;
+  uint64_t numbersOffset;       // struct jcimage_number[numNumbers]
+  uint64_t classesOffset;       // unsigned char[256]
+  uint64_t nextOffset;          // int32_t[numStates * numClasses]
+  uint64_t acceptOffset;        // int32_t[numStates * JCP_GROUPS]
+};
+
+struct jcimage_entry
+{
+  int64_t offset;               // of the record in its list file
+  uint32_t pattern;             // offset of the '\0' terminated pattern in strings
+  uint32_t pad;
+};
+
+struct jcimage_number
+{
+  uint64_t value;
+  uint32_t entry;               // within its list
+  uint8_t length;               // digits, counting leading zeros
+  uint8_t list;
+  uint16_t pad;
+};
+
+struct jcimage
+{
+  void *map;
+  size_t size;
+  const struct jcimage_header *header;
+  const struct jcimage_entry *entries;
+  const char *strings;
+  const struct jcimage_number *numbers;
+  struct jcpattern matcher;     // its tables point into the map
+};
+
+int jcimage_write( const char *filename, const char *sources[JCP_GROUPS] );
+int jcimage_open( struct jcimage *img, const char *filename,
+                  const char *sources[JCP_GROUPS] );
+int jcimage_check( const struct jcimage *img );
+void jcimage_run( const struct jcimage *img, const char *callstr,
+                  int rules[JCP_GROUPS] );
+int jcimage_verdict( const struct jcimage *img, const char *callstr, int *rule );
+void jcimage_entry( const struct jcimage *img, int list, int index,
+                    struct jclist_entry *entry );
+int jcimage_restamp( const char *filename, int list, const char *source );
+void jcimage_close( struct jcimage *img );
+
+#endif
@@ -0,0 +1,809 @@
+/*
+ *	Program name: jcimport
+ *
+ *	File name: jcimport.c
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Description:
+ *	Imports a list of numbers to block (a public complaint list, say)
+ *	into the imported number stores jcblock reads (see jcnumset.h),
+ *	kept apart from blacklist.dat. Run it in jcblock's directory.
+ *
+ *	The list is a CSV file or just numbers, one to a line, of any size
+ *	("-" reads standard input). Numbers are taken from column -c, or
+ *	else from the first field that is a number of at least MIN_DIGITS
+ *	digits, and normalised as by jcnumset_parse(). Lines without one
+ *	(headings, say) are counted and skipped.
+ *
+ *	The numbers are sorted in runs of at most -m megabytes, written to
+ *	temporary files and merged, dropping repeats. Memory use is that
+ *	and about 2 bytes for each number in the largest store written.
+ *
+ *	Each list is kept as a store of its own under its name (-n, or the
+ *	file name without its extension). Importing a list again compares
+ *	it with that store and writes only the numbers added and removed
+ *	since, to the small stores jcblock checks beside the merged one;
+ *	when they grow past an eighth of it, all the lists are merged
+ *	again instead (or with -C).
+ *
+ *	Compile with:
+ *	    gcc -Wall -O2 -o jcimport jcimport.c jcnumset.c -lm
+ *
+ *	Usage:
+ *	    jcimport [-n name] [-c column] [-m megabytes] [-C] file
+ *	    jcimport -r name
+ *	    jcimport -l
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "jcnumset.h"
+
+#define MIN_DIGITS     7
+#define RUN_BUFFER     4096      // keys read from a run at a time
+#define MAX_SOURCES    64
+
+// Something sorted to merge: a run of keys in a temporary file, or a
+// store.
+struct stream
+{
+  FILE *fp;                      // a run, or NULL for a store
+  uint64_t buffer[RUN_BUFFER];
+  size_t count, next;
+  struct jcnumset_cursor cursor;
+  uint64_t head;                 // the smallest key not yet taken
+  int live;                      // head is valid
+};
+
+// What importing one list again changes, beside its own store.
+struct delta
+{
+  struct jcnumset old, new;      // the list's store before, and now
+  struct jcnumset merged, added, removed;
+  struct jcnumset others[MAX_SOURCES];
+  int numOthers;
+  long plus, minus;              // numbers the list gained and lost
+};
+
+static void advance( struct stream *s )
+{
+  if( s->fp == NULL )
+  {
+    s->live = jcnumset_next( &s->cursor, &s->head );
+    return;
+  }
+  if( s->next == s->count )
+  {
+    s->count = fread( s->buffer, sizeof( uint64_t ), RUN_BUFFER, s->fp );
+    s->next = 0;
+  }
+  s->live = ( s->next < s->count );
+  if( s->live )
+    s->head = s->buffer[s->next++];
+}
+
+// Keep the heap of live streams ordered by head, from position 'i' down.
+static void sift_down( struct stream **heap, int n, int i )
+{
+  struct stream *t;
+  int child;
+
+  for( ; ( child = 2 * i + 1 ) < n; i = child )
+  {
+    if( child + 1 < n && heap[child + 1]->head < heap[child]->head )
+      child++;
+    if( heap[i]->head <= heap[child]->head )
+      break;
+    t = heap[i];
+    heap[i] = heap[child];
+    heap[child] = t;
+  }
+}
+
+//
+// Merge sorted streams into a store being written, dropping repeats.
+// Returns 0 on success, or -1 with errno set.
+//
+static int merge( struct stream *streams, int numStreams, struct jcnumset_writer *w )
+{
+  struct stream **heap;
+  int n = 0, i, result = 0;
+
+  if( ( heap = malloc( ( numStreams + 1 ) * sizeof( *heap ) ) ) == NULL )
+    return(-1);
+  for( i = 0; i < numStreams; i++ )
+  {
+    advance( &streams[i] );
+    if( streams[i].live )
+      heap[n++] = &streams[i];
+  }
+  for( i = n / 2 - 1; i >= 0; i-- )
+    sift_down( heap, n, i );
+
+  while( n > 0 && result == 0 )
+  {
+    result = jcnumset_add( w, heap[0]->head );
+    advance( heap[0] );
+    if( !heap[0]->live )
+      heap[0] = heap[--n];
+    sift_down( heap, n, 0 );
+  }
+  free( heap );
+  return(result);
+}
+
+static int compare_keys( const void *a, const void *b )
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+  return( x < y ? -1 : x > y );
+}
+
+//
+// The key of the number in a line of the list: from CSV column
+// 'column' (counting from 1), or with 'column' 0 from the first field
+// that is a long enough number. Returns 0 if there isn't one.
+//
+static uint64_t line_number( const char *line, int column )
+{
+  char field[256];
+  const char *p = line;
+  size_t n;
+  int quoted, col;
+  uint64_t key;
+
+  for( col = 1; ; col++ )
+  {
+    // One field, without its quotes.
+    n = 0;
+    quoted = 0;
+    for( ; *p != 0 && *p != '\n' && *p != '\r' && ( quoted || *p != ',' ); p++ )
+    {
+      if( *p == '"' )
+        quoted = !quoted;
+      else if( n + 1 < sizeof( field ) )
+        field[n++] = *p;
+    }
+    while( n > 0 && field[n - 1] == ' ' )
+      n--;
+    field[n] = 0;
+
+    // A key of MIN_DIGITS digits is at least 10^MIN_DIGITS.
+    if( column == 0 || column == col )
+    {
+      key = jcnumset_parse( field, n );
+      if( column == col || key >= 10000000 )
+        return(key);
+    }
+    if( *p != ',' )
+      return(0);
+    p++;
+  }
+}
+
+static void run_name( char *name, size_t size, int run )
+{
+  snprintf( name, size, "%s/.run%d", JCNUMSET_SOURCES, run );
+}
+
+static void remove_runs( int numRuns )
+{
+  char name[256];
+  int i;
+
+  for( i = 0; i < numRuns; i++ )
+  {
+    run_name( name, sizeof( name ), i );
+    unlink( name );
+  }
+}
+
+//
+// Sort a chunk, drop its repeats, and write it as run 'run'. Returns
+// how many keys were written, or -1.
+//
+static long write_run( uint64_t *keys, size_t count, int run )
+{
+  char name[256];
+  size_t i, n;
+  FILE *fp;
+
+  qsort( keys, count, sizeof( *keys ), compare_keys );
+  for( i = 0, n = 0; i < count; i++ )
+  {
+    if( n == 0 || keys[i] != keys[n - 1] )
+      keys[n++] = keys[i];
+  }
+  run_name( name, sizeof( name ), run );
+  if( ( fp = fopen( name, "w" ) ) == NULL ||
+      fwrite( keys, sizeof( *keys ), n, fp ) != n || fclose( fp ) != 0 )
+  {
+    fprintf( stderr, "jcimport: %s: %s\n", name, strerror( errno ) );
+    return(-1);
+  }
+  return(n);
+}
+
+//
+// Read a list into a new store 'storeFile', in sorted runs of at most
+// 'chunkKeys' keys. Returns 0 on success.
+//
+static int read_list( const char *listFile, int column, size_t chunkKeys,
+                      const char *storeFile )
+{
+  char name[256];
+  char *line = NULL;
+  size_t lineSize = 0;
+  uint64_t *chunk;
+  size_t used = 0;
+  long lines = 0, skipped = 0, written, total = 0;
+  int numRuns = 0, i, result = -1;
+  struct jcnumset_writer w;
+  struct stream *streams = NULL;
+  uint64_t key;
+  FILE *fp;
+
+  if( strcmp( listFile, "-" ) == 0 )
+    fp = stdin;
+  else if( ( fp = fopen( listFile, "r" ) ) == NULL )
+  {
+    fprintf( stderr, "jcimport: %s: %s\n", listFile, strerror( errno ) );
+    return(-1);
+  }
+  if( ( chunk = malloc( chunkKeys * sizeof( *chunk ) ) ) == NULL )
+  {
+    fprintf( stderr, "jcimport: out of memory\n" );
+    return(-1);
+  }
+
+  while( getline( &line, &lineSize, fp ) >= 0 )
+  {
+    lines++;
+    if( ( key = line_number( line, column ) ) == 0 )
+    {
+      skipped++;
+      continue;
+    }
+    chunk[used++] = key;
+    if( used == chunkKeys )
+    {
+      if( ( written = write_run( chunk, used, numRuns++ ) ) < 0 )
+        goto done;
+      total += written;
+      used = 0;
+    }
+  }
+  if( used > 0 || numRuns == 0 )
+  {
+    if( ( written = write_run( chunk, used, numRuns++ ) ) < 0 )
+      goto done;
+    total += written;
+  }
+  free( chunk );
+  chunk = NULL;
+  printf( "jcimport: %s: %ld lines, %ld numbers", listFile, lines, lines - skipped );
+  if( skipped > 0 )
+    printf( " (%ld lines without one skipped)", skipped );
+  printf( " in %d run%s\n", numRuns, numRuns == 1 ? "" : "s" );
+
+  if( ( streams = calloc( numRuns, sizeof( *streams ) ) ) == NULL )
+    goto done;
+  for( i = 0; i < numRuns; i++ )
+  {
+    run_name( name, sizeof( name ), i );
+    if( ( streams[i].fp = fopen( name, "r" ) ) == NULL )
+      goto done;
+  }
+  if( jcnumset_create( &w, storeFile, total, JCNUMSET_BITS ) != 0 )
+    goto done;
+  if( merge( streams, numRuns, &w ) != 0 )
+    jcnumset_abandon( &w );
+  else if( jcnumset_finish( &w ) == 0 )
+    result = 0;
+
+done:
+  if( result != 0 )
+    fprintf( stderr, "jcimport: %s: %s\n", storeFile, strerror( errno ) );
+  if( streams != NULL )
+  {
+    for( i = 0; i < numRuns; i++ )
+    {
+      if( streams[i].fp != NULL )
+        fclose( streams[i].fp );
+    }
+    free( streams );
+  }
+  remove_runs( numRuns );
+  free( chunk );
+  free( line );
+  if( fp != stdin )
+    fclose( fp );
+  return(result);
+}
+
+static int in_others( const struct delta *d, uint64_t key )
+{
+  int i;
+
+  for( i = 0; i < d->numOthers; i++ )
+  {
+    if( jcnumset_contains( &d->others[i], key ) )
+      return(1);
+  }
+  return(0);
+}
+
+// Put a key in a new added or removed store, or just count it.
+static int emit( struct jcnumset_writer *w, uint64_t key, uint64_t *count )
+{
+  (*count)++;
+  return( w == NULL ? 0 : jcnumset_add( w, key ) );
+}
+
+//
+// Walk the list's old and new stores together and work out the new
+// added and removed stores, writing them with 'addW' and 'delW' or,
+// if those are NULL, just counting their numbers. Everything is in
+// order, so nothing is held in memory. Returns 0 on success.
+//
+static int apply_delta( struct delta *d, struct jcnumset_writer *addW,
+                        struct jcnumset_writer *delW,
+                        uint64_t *numAdded, uint64_t *numRemoved )
+{
+  struct jcnumset_cursor oc, nc, ac, dc;
+  uint64_t o, n, a, r, key;
+  int oLive, nLive, aLive, dLive;
+  int plus, inMerged, aHas, dHas, keepA, keepD;
+
+  jcnumset_first( &d->old, &oc );
+  jcnumset_first( &d->new, &nc );
+  jcnumset_first( &d->added, &ac );
+  jcnumset_first( &d->removed, &dc );
+  oLive = jcnumset_next( &oc, &o );
+  nLive = jcnumset_next( &nc, &n );
+  aLive = jcnumset_next( &ac, &a );
+  dLive = jcnumset_next( &dc, &r );
+  *numAdded = *numRemoved = 0;
+  d->plus = d->minus = 0;
+
+  while( oLive || nLive )
+  {
+    if( oLive && nLive && o == n )
+    {
+      oLive = jcnumset_next( &oc, &o );
+      nLive = jcnumset_next( &nc, &n );
+      continue;
+    }
+    plus = ( nLive && ( !oLive || n < o ) );
+    if( plus )
+    {
+      key = n;
+      nLive = jcnumset_next( &nc, &n );
+      d->plus++;
+    }
+    else
+    {
+      key = o;
+      oLive = jcnumset_next( &oc, &o );
+      d->minus++;
+    }
+
+    // Numbers already added or removed before this one stay so.
+    for( ; aLive && a < key; aLive = jcnumset_next( &ac, &a ) )
+    {
+      if( emit( addW, a, numAdded ) != 0 )
+        return(-1);
+    }
+    for( ; dLive && r < key; dLive = jcnumset_next( &dc, &r ) )
+    {
+      if( emit( delW, r, numRemoved ) != 0 )
+        return(-1);
+    }
+
+    aHas = keepA = ( aLive && a == key );
+    dHas = keepD = ( dLive && r == key );
+    inMerged = jcnumset_contains( &d->merged, key );
+    if( plus )
+    {
+      if( inMerged && dHas )
+        keepD = 0;
+      else if( !inMerged && !aHas && emit( addW, key, numAdded ) != 0 )
+        return(-1);
+    }
+    else if( !in_others( d, key ) )
+    {
+      if( aHas )
+        keepA = 0;
+      else if( inMerged && !dHas && emit( delW, key, numRemoved ) != 0 )
+        return(-1);
+    }
+
+    if( aHas )
+    {
+      if( keepA && emit( addW, key, numAdded ) != 0 )
+        return(-1);
+      aLive = jcnumset_next( &ac, &a );
+    }
+    if( dHas )
+    {
+      if( keepD && emit( delW, key, numRemoved ) != 0 )
+        return(-1);
+      dLive = jcnumset_next( &dc, &r );
+    }
+  }
+
+  for( ; aLive; aLive = jcnumset_next( &ac, &a ) )
+  {
+    if( emit( addW, a, numAdded ) != 0 )
+      return(-1);
+  }
+  for( ; dLive; dLive = jcnumset_next( &dc, &r ) )
+  {
+    if( emit( delW, r, numRemoved ) != 0 )
+      return(-1);
+  }
+  return(0);
+}
+
+//
+// Write the added (or removed) store anew with 'count' numbers, or
+// remove it if there are none. Returns 0 on success.
+//
+static int create_delta_store( struct jcnumset_writer *w, const char *filename,
+                               uint64_t count )
+{
+  if( count > 0 )
+    return jcnumset_create( w, filename, count, JCNUMSET_BITS );
+  w->fd = -1;
+  return( unlink( filename ) == 0 || errno == ENOENT ? 0 : -1 );
+}
+
+static int write_deltas( struct delta *d, uint64_t numAdded, uint64_t numRemoved )
+{
+  struct jcnumset_writer addW, delW;
+  int result = -1;
+
+  if( create_delta_store( &addW, JCNUMSET_ADDED, numAdded ) != 0 )
+    return(-1);
+  if( create_delta_store( &delW, JCNUMSET_REMOVED, numRemoved ) != 0 )
+  {
+    if( addW.fd >= 0 )
+      jcnumset_abandon( &addW );
+    return(-1);
+  }
+  if( apply_delta( d, addW.fd >= 0 ? &addW : NULL, delW.fd >= 0 ? &delW : NULL,
+                   &numAdded, &numRemoved ) == 0 &&
+      ( delW.fd < 0 || jcnumset_finish( &delW ) == 0 ) &&
+      ( addW.fd < 0 || jcnumset_finish( &addW ) == 0 ) )
+    result = 0;
+  if( addW.fd >= 0 )
+    jcnumset_abandon( &addW );
+  if( delW.fd >= 0 )
+    jcnumset_abandon( &delW );
+  return(result);
+}
+
+//
+// Merge the stores of all the lists (with 'exceptName' replaced by
+// 'newStore', or left out if it isn't mapped) into JCNUMSET_FILE, and
+// remove the added and removed stores. Returns 0 on success.
+//
+static int merge_all( struct delta *d )
+{
+  struct stream *streams;
+  struct jcnumset_writer w;
+  uint64_t total = 0;
+  int n = 0, i, result = -1;
+
+  if( ( streams = calloc( d->numOthers + 1, sizeof( *streams ) ) ) == NULL )
+    return(-1);
+  for( i = 0; i < d->numOthers; i++ )
+  {
+    jcnumset_first( &d->others[i], &streams[n++].cursor );
+    total += d->others[i].header->count;
+  }
+  if( d->new.map != NULL )
+  {
+    jcnumset_first( &d->new, &streams[n++].cursor );
+    total += d->new.header->count;
+  }
+
+  if( jcnumset_create( &w, JCNUMSET_FILE, total, JCNUMSET_BITS ) == 0 )
+  {
+    if( merge( streams, n, &w ) != 0 )
+      jcnumset_abandon( &w );
+    else if( jcnumset_finish( &w ) == 0 &&
+             ( unlink( JCNUMSET_ADDED ) == 0 || errno == ENOENT ) &&
+             ( unlink( JCNUMSET_REMOVED ) == 0 || errno == ENOENT ) )
+      result = 0;
+  }
+  free( streams );
+  return(result);
+}
+
+// Map the stores of every list but 'name'. Returns 0 on success.
+static int open_others( struct delta *d, const char *name )
+{
+  char path[512];
+  struct dirent *de;
+  size_t n;
+  DIR *dir;
+
+  if( ( dir = opendir( JCNUMSET_SOURCES ) ) == NULL )
+    return(-1);
+  while( ( de = readdir( dir ) ) != NULL )
+  {
+    n = strlen( de->d_name );
+    if( de->d_name[0] == '.' || n < 5 || strcmp( de->d_name + n - 4, ".num" ) != 0 ||
+        ( strncmp( de->d_name, name, n - 4 ) == 0 && strlen( name ) == n - 4 ) )
+      continue;
+    if( d->numOthers == MAX_SOURCES )
+    {
+      errno = EMFILE;
+      closedir( dir );
+      return(-1);
+    }
+    snprintf( path, sizeof( path ), "%s/%s", JCNUMSET_SOURCES, de->d_name );
+    if( jcnumset_open( &d->others[d->numOthers], path ) != 0 )
+    {
+      fprintf( stderr, "jcimport: %s: %s\n", path, strerror( errno ) );
+      closedir( dir );
+      return(-1);
+    }
+    d->numOthers++;
+  }
+  closedir( dir );
+  return(0);
+}
+
+static void close_all( struct delta *d )
+{
+  int i;
+
+  jcnumset_close( &d->old );
+  jcnumset_close( &d->new );
+  jcnumset_close( &d->merged );
+  jcnumset_close( &d->added );
+  jcnumset_close( &d->removed );
+  for( i = 0; i < d->numOthers; i++ )
+    jcnumset_close( &d->others[i] );
+}
+
+// Map a store that may not exist yet. Returns 0 on success.
+static int open_optional( struct jcnumset *set, const char *filename )
+{
+  if( jcnumset_open( set, filename ) == 0 || errno == ENOENT )
+    return(0);
+  fprintf( stderr, "jcimport: %s: %s\n", filename,
+           errno == EINVAL ? "not a number store of this version" : strerror( errno ) );
+  return(-1);
+}
+
+//
+// Bring the stores jcblock reads up to date with list 'name', whose
+// numbers are now in 'newStore' (NULL if the list is being removed).
+// Returns 0 on success.
+//
+static int update( const char *name, const char *newStore, int compact )
+{
+  char storeFile[512];
+  struct delta d;
+  uint64_t numAdded, numRemoved, merged;
+  int result = -1;
+
+  memset( &d, 0, sizeof( d ) );
+  snprintf( storeFile, sizeof( storeFile ), "%s/%s.num", JCNUMSET_SOURCES, name );
+  if( open_optional( &d.old, storeFile ) != 0 ||
+      ( newStore != NULL && open_optional( &d.new, newStore ) != 0 ) ||
+      open_optional( &d.merged, JCNUMSET_FILE ) != 0 ||
+      open_optional( &d.added, JCNUMSET_ADDED ) != 0 ||
+      open_optional( &d.removed, JCNUMSET_REMOVED ) != 0 ||
+      open_others( &d, name ) != 0 )
+    goto done;
+
+  // Count first, to choose between writing the changes and merging.
+  if( apply_delta( &d, NULL, NULL, &numAdded, &numRemoved ) != 0 )
+    goto done;
+  printf( "jcimport: %s: %ld numbers added, %ld removed since last imported\n",
+          name, d.plus, d.minus );
+  merged = ( d.merged.map != NULL ? d.merged.header->count : 0 );
+  if( d.plus == 0 && d.minus == 0 && !compact )
+  {
+    result = 0;
+    goto done;
+  }
+
+  if( compact || d.merged.map == NULL || ( numAdded + numRemoved ) * 8 > merged )
+  {
+    if( merge_all( &d ) != 0 )
+      goto done;
+    printf( "jcimport: merged all lists into %s\n", JCNUMSET_FILE + 2 );
+  }
+  else
+  {
+    if( write_deltas( &d, numAdded, numRemoved ) != 0 )
+      goto done;
+    printf( "jcimport: %s now has %llu added and %llu removed numbers\n",
+            JCNUMSET_FILE + 2, (unsigned long long)numAdded,
+            (unsigned long long)numRemoved );
+  }
+
+  // Last, so that if anything above failed, importing the list again
+  // starts from the same place.
+  if( newStore != NULL ? rename( newStore, storeFile ) != 0 :
+                         ( unlink( storeFile ) != 0 && errno != ENOENT ) )
+    goto done;
+  result = 0;
+
+done:
+  if( result != 0 )
+    fprintf( stderr, "jcimport: %s: %s\n", name, strerror( errno ) );
+  close_all( &d );
+  return(result);
+}
+
+static int list_sources( void )
+{
+  static const char *stores[] = { JCNUMSET_FILE, JCNUMSET_ADDED, JCNUMSET_REMOVED };
+  char path[512], when[32];
+  struct jcnumset set;
+  struct dirent *de;
+  time_t created;
+  size_t n;
+  DIR *dir;
+  int i;
+
+  if( ( dir = opendir( JCNUMSET_SOURCES ) ) != NULL )
+  {
+    while( ( de = readdir( dir ) ) != NULL )
+    {
+      n = strlen( de->d_name );
+      if( de->d_name[0] == '.' || n < 5 || strcmp( de->d_name + n - 4, ".num" ) != 0 )
+        continue;
+      snprintf( path, sizeof( path ), "%s/%s", JCNUMSET_SOURCES, de->d_name );
+      if( jcnumset_open( &set, path ) != 0 )
+        continue;
+      created = set.header->created;
+      strftime( when, sizeof( when ), "%Y-%m-%d %H:%M", localtime( &created ) );
+      printf( "%-24.*s %10llu numbers, imported %s\n", (int)( n - 4 ), de->d_name,
+              (unsigned long long)set.header->count, when );
+      jcnumset_close( &set );
+    }
+    closedir( dir );
+  }
+  for( i = 0; i < 3; i++ )
+  {
+    if( jcnumset_open( &set, stores[i] ) == 0 )
+    {
+      printf( "%-24s %10llu numbers, %zu bytes\n", stores[i] + 2,
+              (unsigned long long)set.header->count, set.size );
+      jcnumset_close( &set );
+    }
+  }
+  return(0);
+}
+
+static int valid_name( const char *name )
+{
+  return( name[0] != 0 && name[0] != '.' && strlen( name ) < 200 &&
+          strspn( name, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"
+                        "0123456789-_." ) == strlen( name ) );
+}
+
+int main( int argc, char **argv )
+{
+  char name[256], newStore[512];
+  const char *base;
+  char *removeName = NULL;
+  int column = 0, megabytes = 16, compact = 0, list = 0;
+  int optChar;
+
+  name[0] = 0;
+  while( ( optChar = getopt( argc, argv, "n:c:m:Cr:lh" ) ) != EOF )
+  {
+    switch( optChar )
+    {
+      case 'n':
+        snprintf( name, sizeof( name ), "%s", optarg );
+        break;
+
+      case 'c':
+        column = atoi( optarg );
+        break;
+
+      case 'm':
+        megabytes = atoi( optarg );
+        break;
+
+      case 'C':
+        compact = 1;
+        break;
+
+      case 'r':
+        removeName = optarg;
+        break;
+
+      case 'l':
+        list = 1;
+        break;
+
+      case 'h':
+      default:
+        fprintf( stderr, "Usage: jcimport [-n name] [-c column] [-m megabytes] [-C] file\n" );
+        fprintf( stderr, "       jcimport -r name\n" );
+        fprintf( stderr, "       jcimport -l\n" );
+        fprintf( stderr, "  -n   the list's name (default: the file name without extension)\n" );
+        fprintf( stderr, "  -c   CSV column of the numbers (default: the first with a number)\n" );
+        fprintf( stderr, "  -m   sort in runs of this many megabytes (default 16)\n" );
+        fprintf( stderr, "  -C   merge all lists, however few numbers changed\n" );
+        fprintf( stderr, "  -r   remove a list\n" );
+        fprintf( stderr, "  -l   show the lists and stores\n" );
+        return(1);
+    }
+  }
+
+  if( list )
+    return list_sources();
+  if( mkdir( JCNUMSET_SOURCES, 0755 ) != 0 && errno != EEXIST )
+  {
+    fprintf( stderr, "jcimport: %s: %s\n", JCNUMSET_SOURCES, strerror( errno ) );
+    return(1);
+  }
+  if( removeName != NULL )
+  {
+    if( !valid_name( removeName ) )
+    {
+      fprintf( stderr, "jcimport: %s: not a list name\n", removeName );
+      return(1);
+    }
+    return( update( removeName, NULL, compact ) != 0 );
+  }
+
+  if( argc - optind != 1 || megabytes <= 0 || column < 0 )
+  {
+    fprintf( stderr, "Usage: jcimport [-n name] [-c column] [-m megabytes] [-C] file\n" );
+    return(1);
+  }
+  if( name[0] == 0 )
+  {
+    base = strrchr( argv[optind], '/' );
+    snprintf( name, sizeof( name ), "%s", base != NULL ? base + 1 : argv[optind] );
+    name[strcspn( name, "." )] = 0;
+  }
+  if( !valid_name( name ) )
+  {
+    fprintf( stderr, "jcimport: %s: not a list name; give one with -n\n", name );
+    return(1);
+  }
+
+  snprintf( newStore, sizeof( newStore ), "%s/.%s.new", JCNUMSET_SOURCES, name );
+  if( read_list( argv[optind], column, (size_t)megabytes * 1024 * 1024 / sizeof( uint64_t ),
+                 newStore ) != 0 )
+    return(1);
+  if( update( name, newStore, compact ) != 0 )
+  {
+    unlink( newStore );
+    return(1);
+  }
+  unlink( newStore );
+  return(0);
+}
@@ -0,0 +1,596 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: jcjournal.c
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Description:
+ *	Reads, appends to and folds the list journal (see jcjournal.h).
+ *	Records are appended with one write() on a descriptor opened with
+ *	O_APPEND, so a reader sees a record whole or not at all; one cut
+ *	short by a crash is cut off by the next writer.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "jcjournal.h"
+
+// A list file, line by line, without the '\n's.
+struct lines
+{
+  char **line;
+  int count;
+  int capacity;
+};
+
+int jcjournal_open( struct jcjournal *j, const char *filename )
+{
+  j->base = j->lastSeq = 0;
+  j->offset = 0;
+  j->locked = 0;
+  if( ( j->fd = open( filename, O_RDWR | O_CREAT | O_APPEND, 0666 ) ) < 0 )
+    return(-1);
+  // Appending nothing writes the header of a new journal.
+  return( jcjournal_append( j, NULL, 0 ) );
+}
+
+//
+// Hold the journal exclusively until jcjournal_unlock(), so that a
+// change to the list files can be made with nothing appended or
+// folded meanwhile. The functions below don't lock it again.
+//
+int jcjournal_lock( struct jcjournal *j )
+{
+  if( flock( j->fd, LOCK_EX ) != 0 )
+    return(-1);
+  j->locked = 1;
+  return(0);
+}
+
+void jcjournal_unlock( struct jcjournal *j )
+{
+  j->locked = 0;
+  flock( j->fd, LOCK_UN );
+}
+
+static int lock( struct jcjournal *j, int how )
+{
+  return( j->locked ? 0 : flock( j->fd, how ) );
+}
+
+static void unlock( struct jcjournal *j )
+{
+  if( !j->locked )
+    flock( j->fd, LOCK_UN );
+}
+
+// Read the header's sequence number and the size of the journal. A
+// journal too short for a header (just made, or emptied by a fold
+// that went no further) counts as empty, with nothing folded.
+static int read_header( int fd, uint64_t *base, off_t *size )
+{
+  char header[JCJOURNAL_HEADER_SIZE + 1];
+  unsigned long long seq;
+  struct stat st;
+
+  if( fstat( fd, &st ) != 0 )
+    return(-1);
+  if( st.st_size < JCJOURNAL_HEADER_SIZE )
+  {
+    *base = 0;
+    *size = JCJOURNAL_HEADER_SIZE;
+    return(0);
+  }
+  if( pread( fd, header, JCJOURNAL_HEADER_SIZE, 0 ) != JCJOURNAL_HEADER_SIZE )
+    return(-1);
+  header[JCJOURNAL_HEADER_SIZE] = 0;
+  if( sscanf( header, JCJOURNAL_HEADER, &seq ) != 1 )
+  {
+    errno = EINVAL;
+    return(-1);
+  }
+  *base = seq;
+  *size = st.st_size;
+  return(0);
+}
+
+static int write_header( int fd, uint64_t base )
+{
+  char header[JCJOURNAL_HEADER_SIZE + 1];
+
+  snprintf( header, sizeof( header ), JCJOURNAL_HEADER, (unsigned long long)base );
+  if( ftruncate( fd, 0 ) != 0 ||
+      write( fd, header, JCJOURNAL_HEADER_SIZE ) != JCJOURNAL_HEADER_SIZE )
+    return(-1);
+  return(0);
+}
+
+// Split a record line ('\0' terminated, without the '\n').
+static int parse_record( char *line, struct jcjournal_record *r )
+{
+  unsigned long long seq;
+  char op, list;
+  int n = 0;
+
+  if( sscanf( line, "%llu %c %c %n", &seq, &op, &list, &n ) != 3 || n == 0 ||
+      ( op != JCJ_ADD && op != JCJ_REMOVE && op != JCJ_TOUCH ) ||
+      ( list != 'W' && list != 'B' ) )
+    return(-1);
+  r->seq = seq;
+  r->op = op;
+  r->list = ( list == 'W' ? JCP_WHITE : JCP_BLACK );
+  r->text = line + n;
+  return(0);
+}
+
+//
+// Get the journal ready for appending, with the exclusive lock held:
+// write the header if there is none, cut off a record left partly
+// written, and find the sequence number of the last record.
+//
+static int prepare( struct jcjournal *j, uint64_t *last )
+{
+  char tail[2 * JCJOURNAL_LINE_SIZE + 1];
+  struct jcjournal_record r;
+  uint64_t base;
+  off_t size, start;
+  char *nl, *line;
+  ssize_t n;
+
+  if( read_header( j->fd, &base, &size ) != 0 )
+    return(-1);
+  *last = base;
+  if( size == JCJOURNAL_HEADER_SIZE )
+  {
+    struct stat st;
+
+    if( fstat( j->fd, &st ) != 0 )
+      return(-1);
+    if( st.st_size < JCJOURNAL_HEADER_SIZE )
+      return( write_header( j->fd, 0 ) );
+    return(0);
+  }
+
+  start = size - ( sizeof( tail ) - 1 );
+  if( start < JCJOURNAL_HEADER_SIZE )
+    start = JCJOURNAL_HEADER_SIZE;
+  if( ( n = pread( j->fd, tail, size - start, start ) ) != size - start )
+    return(-1);
+  tail[n] = 0;
+
+  if( tail[n - 1] != '\n' )
+  {
+    while( n > 0 && tail[n - 1] != '\n' )
+      n--;
+    if( ftruncate( j->fd, start + n ) != 0 )
+      return(-1);
+    tail[n] = 0;
+  }
+  if( n == 0 )
+    return(0);
+
+  // The last line is the one after the last '\n' but one.
+  tail[n - 1] = 0;
+  line = ( ( nl = strrchr( tail, '\n' ) ) == NULL ? tail : nl + 1 );
+  if( parse_record( line, &r ) == 0 && r.seq > base )
+    *last = r.seq;
+  return(0);
+}
+
+//
+// Pass the records added since the last read to apply(), in order.
+// Returns how many there were, JCJOURNAL_FOLDED if the journal has been
+// folded since (and nothing was read), or -1 on an error.
+//
+int jcjournal_read( struct jcjournal *j, jcjournal_apply apply, void *arg )
+{
+  char buf[65536];
+  struct jcjournal_record r;
+  uint64_t base;
+  off_t size;
+  char *line, *nl;
+  ssize_t n;
+  int count = 0;
+  int rc;
+
+  if( lock( j, LOCK_SH ) != 0 )
+    return(-1);
+  if( ( rc = read_header( j->fd, &base, &size ) ) == 0 )
+  {
+    if( j->offset == 0 )
+    {
+      j->base = j->lastSeq = base;
+      j->offset = JCJOURNAL_HEADER_SIZE;
+    }
+    else if( base != j->base || size < j->offset )
+      rc = JCJOURNAL_FOLDED;
+  }
+
+  while( rc == 0 && j->offset < size )
+  {
+    n = size - j->offset;
+    if( n > (ssize_t)sizeof( buf ) - 1 )
+      n = sizeof( buf ) - 1;
+    if( ( n = pread( j->fd, buf, n, j->offset ) ) <= 0 )
+    {
+      rc = -1;
+      break;
+    }
+    buf[n] = 0;
+
+    for( line = buf; ( nl = memchr( line, '\n', buf + n - line ) ) != NULL; line = nl + 1 )
+    {
+      *nl = 0;
+      if( parse_record( line, &r ) != 0 )
+        continue;
+      if( r.seq > j->lastSeq )
+        j->lastSeq = r.seq;
+      if( apply != NULL )
+        apply( arg, &r );
+      count++;
+    }
+
+    // A record not finished yet is read next time; a line too long
+    // to be a record is skipped.
+    if( line == buf && n < (ssize_t)sizeof( buf ) - 1 )
+      break;
+    j->offset += ( line == buf ? n : line - buf );
+  }
+
+  unlock( j );
+  return( rc != 0 ? rc : count );
+}
+
+//
+// Read the whole journal again at the next jcjournal_read(), after the
+// list files have been read again.
+//
+void jcjournal_rewind( struct jcjournal *j )
+{
+  j->offset = 0;
+}
+
+//
+// Append records, numbering them (their 'seq' is filled in). The text
+// must be a single line. Returns 0, or -1 on an error.
+//
+int jcjournal_append( struct jcjournal *j, struct jcjournal_record *records,
+                      int count )
+{
+  uint64_t seq;
+  char *buf = NULL;
+  size_t used = 0;
+  int rc = -1;
+  int i, n;
+
+  if( lock( j, LOCK_EX ) != 0 )
+    return(-1);
+  if( prepare( j, &seq ) != 0 )
+    goto done;
+  if( count > 0 && ( buf = malloc( count * JCJOURNAL_LINE_SIZE ) ) == NULL )
+    goto done;
+  for( i = 0; i < count; i++ )
+  {
+    records[i].seq = ++seq;
+    n = snprintf( buf + used, JCJOURNAL_LINE_SIZE, "%llu %c %c %s\n",
+                  (unsigned long long)records[i].seq, records[i].op,
+                  records[i].list == JCP_WHITE ? 'W' : 'B', records[i].text );
+    if( n >= JCJOURNAL_LINE_SIZE || strchr( records[i].text, '\n' ) != NULL )
+    {
+      errno = EINVAL;
+      goto done;
+    }
+    used += n;
+  }
+  if( used > 0 && write( j->fd, buf, used ) != (ssize_t)used )
+    goto done;
+  rc = 0;
+
+done:
+  free( buf );
+  unlock( j );
+  return(rc);
+}
+
+//
+// The bytes of records in the journal, to decide when to fold it.
+//
+long jcjournal_size( struct jcjournal *j )
+{
+  struct stat st;
+
+  if( fstat( j->fd, &st ) != 0 || st.st_size < JCJOURNAL_HEADER_SIZE )
+    return(0);
+  return( st.st_size - JCJOURNAL_HEADER_SIZE );
+}
+
+//
+// Copy an entry's pattern, without the spaces around it, into
+// 'pattern' (JCJOURNAL_LINE_SIZE characters). This is the pattern
+// jcadmin sees in a record (ParseRecord() in jcadmin.js). Returns 0, or
+// -1 if the line is not an entry.
+//
+int jcjournal_record_pattern( const char *record, char *pattern )
+{
+  const char *start = record, *end;
+  size_t length;
+
+  if( record[0] == '#' || strcspn( record, "\n" ) < 25 )
+    return(-1);
+  if( ( end = strchr( record, '?' ) ) == NULL )
+    end = record + 19;
+  while( start < end && isspace( (unsigned char)*start ) )
+    start++;
+  while( end > start && isspace( (unsigned char)end[-1] ) )
+    end--;
+  length = end - start;
+  if( length >= JCJOURNAL_LINE_SIZE )
+    length = JCJOURNAL_LINE_SIZE - 1;
+  memcpy( pattern, start, length );
+  pattern[length] = 0;
+  return(0);
+}
+
+//
+// Return 1 if two patterns are the same but for spaces around them.
+//
+int jcjournal_same_pattern( const char *pattern, const char *text )
+{
+  size_t a, b;
+
+  while( isspace( (unsigned char)*pattern ) )
+    pattern++;
+  while( isspace( (unsigned char)*text ) )
+    text++;
+  for( a = strlen( pattern ); a > 0 && isspace( (unsigned char)pattern[a - 1] ); a-- )
+    ;
+  for( b = strlen( text ); b > 0 && isspace( (unsigned char)text[b - 1] ); b-- )
+    ;
+  return( a == b && strncmp( pattern, text, a ) == 0 );
+}
+
+static int find_line( const struct lines *l, const char *pattern )
+{
+  char p[JCJOURNAL_LINE_SIZE];
+  int i;
+
+  for( i = 0; i < l->count; i++ )
+  {
+    if( jcjournal_record_pattern( l->line[i], p ) == 0 &&
+        jcjournal_same_pattern( p, pattern ) )
+      return(i);
+  }
+  return(-1);
+}
+
+static int add_line( struct lines *l, const char *text, size_t length )
+{
+  char **line;
+
+  if( l->count == l->capacity )
+  {
+    l->capacity = ( l->capacity ? 2 * l->capacity : 256 );
+    if( ( line = realloc( l->line, l->capacity * sizeof( *line ) ) ) == NULL )
+      return(-1);
+    l->line = line;
+  }
+  if( ( l->line[l->count] = strndup( text, length ) ) == NULL )
+    return(-1);
+  l->count++;
+  return(0);
+}
+
+static void free_lines( struct lines *l )
+{
+  int i;
+
+  for( i = 0; i < l->count; i++ )
+    free( l->line[i] );
+  free( l->line );
+}
+
+static int apply_record( struct lines *l, const struct jcjournal_record *r )
+{
+  char pattern[JCJOURNAL_LINE_SIZE];
+  char *line;
+  int i;
+
+  switch( r->op )
+  {
+    case JCJ_ADD:
+      if( jcjournal_record_pattern( r->text, pattern ) != 0 ||
+          find_line( l, pattern ) >= 0 )
+        return(0);
+      return( add_line( l, r->text, strlen( r->text ) ) );
+
+    case JCJ_REMOVE:
+      for( i = l->count - 1; i >= 0; i-- )
+      {
+        if( jcjournal_record_pattern( l->line[i], pattern ) == 0 &&
+            jcjournal_same_pattern( pattern, r->text ) )
+        {
+          free( l->line[i] );
+          memmove( &l->line[i], &l->line[i + 1], ( l->count - i - 1 ) * sizeof( *l->line ) );
+          l->count--;
+        }
+      }
+      return(0);
+
+    case JCJ_TOUCH:
+      if( strlen( r->text ) < 8 || ( i = find_line( l, r->text + 7 ) ) < 0 )
+        return(0);
+      line = l->line[i];
+      if( !( r->list == JCP_BLACK && strncmp( &line[19], "++++++", 6 ) == 0 ) )
+        memcpy( &line[19], r->text, 6 );
+      return(0);
+  }
+  return(0);
+}
+
+//
+// Apply the records for one list to its file, writing the result to a
+// temporary file and renaming it over the old one.
+//
+static int fold_file( const char *filename, int list,
+                      const struct jcjournal_record *records, int count )
+{
+  struct lines l = { NULL, 0, 0 };
+  char tmpName[1024];
+  struct stat st;
+  char *line = NULL;
+  size_t size = 0;
+  ssize_t n;
+  FILE *fp;
+  int rc = -1;
+  int i;
+
+  st.st_mode = 0644;
+  if( ( fp = fopen( filename, "r" ) ) != NULL )
+  {
+    fstat( fileno( fp ), &st );
+    while( ( n = getline( &line, &size, fp ) ) > 0 )
+    {
+      if( line[n - 1] == '\n' )
+        n--;
+      if( add_line( &l, line, n ) != 0 )
+        break;
+    }
+    free( line );
+    i = ferror( fp ) || !feof( fp );
+    fclose( fp );
+    if( i )
+      goto done;
+  }
+  else if( errno != ENOENT )
+    return(-1);
+
+  for( i = 0; i < count; i++ )
+  {
+    if( records[i].list == list && apply_record( &l, &records[i] ) != 0 )
+      goto done;
+  }
+
+  snprintf( tmpName, sizeof( tmpName ), "%s.fold", filename );
+  if( ( fp = fopen( tmpName, "w" ) ) == NULL )
+    goto done;
+  fchmod( fileno( fp ), st.st_mode & 07777 );
+  for( i = 0; i < l.count; i++ )
+    fprintf( fp, "%s\n", l.line[i] );
+  if( fflush( fp ) != 0 || fsync( fileno( fp ) ) != 0 )
+  {
+    fclose( fp );
+    unlink( tmpName );
+    goto done;
+  }
+  if( fclose( fp ) != 0 || rename( tmpName, filename ) != 0 )
+  {
+    unlink( tmpName );
+    goto done;
+  }
+  rc = 0;
+
+done:
+  free_lines( &l );
+  return(rc);
+}
+
+//
+// Apply the journal's records to the list files and empty the journal.
+// Records not read yet are passed to apply() first, so that a reader
+// that was up to date is still up to date with the files. Returns the
+// number of records folded, or -1 on an error, leaving the journal as
+// it was.
+//
+int jcjournal_fold( struct jcjournal *j, const char *files[JCP_GROUPS],
+                    jcjournal_apply apply, void *arg )
+{
+  struct jcjournal_record *records = NULL;
+  int touched[JCP_GROUPS] = { 0, 0 };
+  int count = 0, unread = -1;
+  int current;
+  uint64_t last, base;
+  char *text = NULL, *line, *nl;
+  off_t size, length;
+  int rc = -1;
+  int i;
+
+  if( lock( j, LOCK_EX ) != 0 )
+    return(-1);
+  if( prepare( j, &last ) != 0 || read_header( j->fd, &base, &size ) != 0 )
+    goto done;
+  if( ( length = size - JCJOURNAL_HEADER_SIZE ) == 0 )
+  {
+    rc = 0;
+    goto done;
+  }
+
+  // Records are at least 8 bytes ("1 A W x\n").
+  if( ( text = malloc( length + 1 ) ) == NULL ||
+      ( records = malloc( ( length / 8 + 1 ) * sizeof( *records ) ) ) == NULL ||
+      pread( j->fd, text, length, JCJOURNAL_HEADER_SIZE ) != length )
+    goto done;
+  text[length] = 0;
+
+  // Note where the reader is up to, if it is reading this journal.
+  current = ( j->offset != 0 && base == j->base );
+  for( line = text; ( nl = strchr( line, '\n' ) ) != NULL; line = nl + 1 )
+  {
+    *nl = 0;
+    if( current && unread < 0 && JCJOURNAL_HEADER_SIZE + ( line - text ) >= j->offset )
+      unread = count;
+    if( parse_record( line, &records[count] ) == 0 )
+      touched[records[count++].list] = 1;
+  }
+  if( current && unread < 0 )
+    unread = count;
+
+  for( i = 0; i < JCP_GROUPS; i++ )
+  {
+    if( touched[i] && fold_file( files[i], i, records, count ) != 0 )
+      goto done;
+  }
+  if( write_header( j->fd, last ) != 0 )
+    goto done;
+
+  if( current )
+  {
+    for( i = unread; i < count && apply != NULL; i++ )
+      apply( arg, &records[i] );
+    j->base = j->lastSeq = last;
+    j->offset = JCJOURNAL_HEADER_SIZE;
+  }
+  rc = count;
+
+done:
+  free( records );
+  free( text );
+  unlock( j );
+  return(rc);
+}
+
+void jcjournal_close( struct jcjournal *j )
+{
+  if( j->fd >= 0 )
+    close( j->fd );
+  j->fd = -1;
+}
@@ -0,0 +1,109 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: jcjournal.h
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	The list journal (lists.journal): changes to whitelist.dat and
+ *	blacklist.dat that jcblock and jcadmin have made but not yet written
+ *	into the files. The lists are the files with the journal's records
+ *	applied in order. Appending a record is one small write, where
+ *	changing a list file means rewriting it (or, for an entry's date,
+ *	writing into the middle of a file the other program may be
+ *	replacing), and each program picks up the other's changes by
+ *	reading just the records it hasn't seen.
+ *
+ *	The file starts with a header line holding the sequence number of
+ *	the last record folded into the list files. Each record after it
+ *	is one line:
+ *
+ *	    <seq> <op> <list> <text>
+ *
+ *	where list is W or B and op is
+ *
+ *	    A   add the record 'text', unless an entry has its pattern
+ *	    R   remove every entry whose pattern is 'text'
+ *	    T   'text' is "MMDDYY pattern": set the date of the first entry
+ *	        with the pattern, unless it is a permanent ("++++++")
+ *	        blacklist entry
+ *
+ *	Patterns are compared without the spaces around them. Applying a
+ *	record twice does no harm, so a record may be applied to a list
+ *	file that already has it.
+ *
+ *	Writers hold an exclusive flock() on the journal; readers hold a
+ *	shared one. jcjournal_fold() applies the records to the list files
+ *	(each written to a temporary file and renamed over the old one)
+ *	and then empties the journal, in place so the lock stays good,
+ *	writing a new header. Readers notice from the header that the
+ *	journal was folded and read the list files again.
+ */
+#ifndef JCJOURNAL_H
+#define JCJOURNAL_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "jcpattern.h"
+
+#define JCJOURNAL_FILE         "./lists.journal"
+#define JCJOURNAL_HEADER       "#jcblock list journal, folded to %012llu\n"
+#define JCJOURNAL_HEADER_SIZE  46
+#define JCJOURNAL_FOLD_SIZE    16384   // bytes of records worth folding
+#define JCJOURNAL_LINE_SIZE    256     // longest record line
+
+#define JCJ_ADD     'A'
+#define JCJ_REMOVE  'R'
+#define JCJ_TOUCH   'T'
+
+// Result of jcjournal_read() when the journal has been folded since
+// it was last read: read the list files again, then jcjournal_rewind().
+#define JCJOURNAL_FOLDED  -2
+
+struct jcjournal_record
+{
+  uint64_t seq;
+  char op;                      // JCJ_ADD, JCJ_REMOVE or JCJ_TOUCH
+  int list;                     // JCP_WHITE or JCP_BLACK
+  const char *text;             // without the '\n'
+};
+
+typedef void (*jcjournal_apply)( void *arg, const struct jcjournal_record *r );
+
+struct jcjournal
+{
+  int fd;
+  uint64_t base;                // header's sequence number when last read
+  uint64_t lastSeq;             // of the last record read
+  off_t offset;                 // read up to here; 0 to start again
+  int locked;                   // jcjournal_lock() is held
+};
+
+int jcjournal_open( struct jcjournal *j, const char *filename );
+int jcjournal_lock( struct jcjournal *j );
+void jcjournal_unlock( struct jcjournal *j );
+int jcjournal_read( struct jcjournal *j, jcjournal_apply apply, void *arg );
+void jcjournal_rewind( struct jcjournal *j );
+int jcjournal_append( struct jcjournal *j, struct jcjournal_record *records,
+                      int count );
+long jcjournal_size( struct jcjournal *j );
+int jcjournal_fold( struct jcjournal *j, const char *files[JCP_GROUPS],
+                    jcjournal_apply apply, void *arg );
+int jcjournal_same_pattern( const char *pattern, const char *text );
+int jcjournal_record_pattern( const char *record, char *pattern );
+void jcjournal_close( struct jcjournal *j );
+
+#endif
@@ -0,0 +1,561 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: jclist.c
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Description:
+ *	Whitelist/blacklist record validation and matching, and parsing of
+ *	callerID.dat records. The rules here are the ones check_whitelist()
+ *	and check_blacklist() have always applied: a record is read with
+ *	fgets() into a 100 byte buffer, must be at least 26 characters long
+ *	(so it can hold the date field), and must have a '?' within its first
+ *	19 characters. The search string is the first '?' delimited token,
+ *	and a call matches if the search string appears anywhere in the
+ *	caller ID string.
+ *
+ *	Entries that start with a field anchor (see jclist.h) are matched
+ *	here one at a time; jcpattern.c compiles whole lists of them into
+ *	one automaton, and must agree with jclist_entry_match().
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/stat.h>
+
+#include "jclist.h"
+
+const char *jclistFieldLabels[JCL_NUM_FIELDS] = { "NMBR:", "NAME:" };
+
+//
+// Check one list record (as returned by fgets()) and, if it is a
+// usable entry, copy its search string into 'pattern' (which must
+// hold JCL_RECORD_SIZE characters). Returns one of the JCL_ codes.
+//
+int jclist_parse_record( const char *record, char *pattern )
+{
+  char buf[JCL_RECORD_SIZE];
+  char *strptr;
+  char *saveptr;
+  char *token;
+
+  // Comment lines and empty lines
+  if( record[0] == '#' )
+    return(JCL_COMMENT);
+  if( record[0] == '\n' )
+    return(JCL_BLANK);
+
+  // Records that don't have room for the date
+  if( strlen( record ) < 26 )
+    return(JCL_TOO_SHORT);
+
+  // The search string must be terminated with a '?' that is
+  // within the first twenty characters.
+  if( ( strptr = strchr( record, '?' ) ) == NULL )
+    return(JCL_NO_TERMINATOR);
+  if( (int)( strptr - record ) > 18 )
+    return(JCL_TERMINATOR_TOO_FAR);
+
+  // In an anchored entry '?' is a wildcard, so the pattern runs up
+  // to the last '?' within those characters.
+  if( strncmp( record, jclistFieldLabels[JCL_FIELD_NMBR], 5 ) == 0 ||
+      strncmp( record, jclistFieldLabels[JCL_FIELD_NAME], 5 ) == 0 )
+  {
+    while( ( token = strchr( strptr + 1, '?' ) ) != NULL && token - record <= 18 )
+      strptr = token;
+    memcpy( pattern, record, strptr - record );
+    pattern[strptr - record] = 0;
+    if( jclist_terms( pattern, NULL ) <= 0 )
+      return(JCL_BAD_PATTERN);
+    return(JCL_ENTRY);
+  }
+
+  strncpy( buf, record, sizeof( buf ) - 1 );
+  buf[sizeof( buf ) - 1] = 0;
+  if( ( token = strtok_r( buf, "?", &saveptr ) ) == NULL )
+    return(JCL_NO_PATTERN);
+
+  strcpy( pattern, token );
+  return(JCL_ENTRY);
+}
+
+//
+// Split an anchored entry into its field terms, in the order the
+// fields appear in a caller ID string. 'terms' (which may be NULL)
+// must hold JCL_NUM_FIELDS of them. Returns the number of terms, 0
+// if the entry is a literal search string, or -1 if it is anchored
+// but malformed (a field given twice, or a glob that doesn't parse).
+//
+int jclist_terms( const char *pattern, struct jclist_term *terms )
+{
+  struct jclist_term found[JCL_NUM_FIELDS];
+  unsigned char set[256];
+  const char *p = pattern;
+  const char *next, *anchor;
+  size_t n, length;
+  int repeat;
+  int count = 0;
+  int field, f, i;
+
+  for( field = -1; *p; p = next )
+  {
+    for( f = 0; f < JCL_NUM_FIELDS; f++ )
+      if( strncmp( p, jclistFieldLabels[f], 5 ) == 0 )
+        break;
+    if( f == JCL_NUM_FIELDS )
+      return( field < 0 ? 0 : -1 );
+    for( i = 0; i < count; i++ )
+      if( found[i].field == f )
+        return(-1);
+    field = f;
+
+    // The glob runs to the next anchor.
+    p += 5;
+    next = p + strlen( p );
+    for( f = 0; f < JCL_NUM_FIELDS; f++ )
+      if( ( anchor = strstr( p, jclistFieldLabels[f] ) ) != NULL && anchor < next )
+        next = anchor;
+
+    for( length = 0; length < (size_t)( next - p ); length += n )
+      if( ( n = jclist_glob_element( p + length, next - p - length, set, &repeat ) ) == 0 )
+        return(-1);
+
+    // Keep the terms in field order.
+    for( i = count; i > 0 && found[i - 1].field > field; i-- )
+      found[i] = found[i - 1];
+    found[i].field = field;
+    found[i].glob = p;
+    found[i].length = next - p;
+    count++;
+  }
+
+  if( terms != NULL )
+    memcpy( terms, found, count * sizeof( *terms ) );
+  return( count );
+}
+
+//
+// Decode the first element of a glob: set[c] is made 1 for each
+// character c it matches and 0 for the rest, and *repeat says whether
+// it is a '*'. Wildcards never match '-', which separates the fields
+// of a caller ID string, or '\n'. Returns the number of characters
+// the element takes up, or 0 if it is malformed.
+//
+size_t jclist_glob_element( const char *glob, size_t length,
+                            unsigned char *set, int *repeat )
+{
+  size_t i, n;
+  int negate;
+  int c;
+
+  *repeat = 0;
+  memset( set, 0, 256 );
+  if( length == 0 )
+    return(0);
+
+  switch( glob[0] )
+  {
+    case '*':
+      *repeat = 1;
+      // fall through
+    case '?':
+      memset( set, 1, 256 );
+      set['-'] = set['\n'] = set[0] = 0;
+      return(1);
+
+    case '#':
+      memset( set + '0', 1, 10 );
+      return(1);
+
+    case '[':
+      i = 1;
+      negate = ( i < length && glob[i] == '!' );
+      i += negate;
+      for( n = 0; i < length && glob[i] != ']'; n++ )
+      {
+        if( i + 2 < length && glob[i + 1] == '-' && glob[i + 2] != ']' )
+        {
+          for( c = (unsigned char)glob[i]; c <= (unsigned char)glob[i + 2]; c++ )
+            set[c] = 1;
+          i += 3;
+        }
+        else
+          set[(unsigned char)glob[i++]] = 1;
+      }
+      if( i >= length || n == 0 )
+        return(0);
+      if( negate )
+      {
+        for( c = 0; c < 256; c++ )
+          set[c] = !set[c];
+        set['-'] = set['\n'] = set[0] = 0;
+      }
+      return(i + 1);
+
+    default:
+      set[(unsigned char)glob[0]] = 1;
+      return(1);
+  }
+}
+
+// Does the whole of 'text' match the glob?
+static int glob_match( const char *glob, size_t length,
+                       const char *text, size_t textLength )
+{
+  unsigned char set[256];
+  size_t n, i;
+  int repeat;
+
+  if( length == 0 )
+    return( textLength == 0 );
+  if( ( n = jclist_glob_element( glob, length, set, &repeat ) ) == 0 )
+    return(0);
+
+  if( repeat )
+  {
+    for( i = 0; ; i++ )
+    {
+      if( glob_match( glob + n, length - n, text + i, textLength - i ) )
+        return(1);
+      if( i == textLength || !set[(unsigned char)text[i]] )
+        return(0);
+    }
+  }
+  return( textLength > 0 && set[(unsigned char)text[0]] &&
+          glob_match( glob + n, length - n, text + 1, textLength - 1 ) );
+}
+
+//
+// Does one entry match the caller ID string? A literal entry matches
+// if it appears anywhere in the string; an anchored one if each of its
+// terms matches the whole of its field (the text between "-NMBR = "
+// or "-NAME = " and the next "--").
+//
+int jclist_entry_match( const char *pattern, const char *callstr )
+{
+  static const char *labels[JCL_NUM_FIELDS] = { "-NMBR = ", "-NAME = " };
+  struct jclist_term terms[JCL_NUM_FIELDS];
+  const char *value, *end;
+  int count, i;
+
+  if( ( count = jclist_terms( pattern, terms ) ) == 0 )
+    return( strstr( callstr, pattern ) != NULL );
+
+  for( i = 0; i < count; i++ )
+  {
+    if( ( value = strstr( callstr, labels[terms[i].field] ) ) == NULL )
+      return(0);
+    value += 8;
+    if( ( end = strstr( value, "--" ) ) == NULL ||
+        !glob_match( terms[i].glob, terms[i].length, value, end - value ) )
+      return(0);
+  }
+  return( count > 0 );
+}
+
+void jclist_init( struct jclist *list )
+{
+  list->entries = NULL;
+  list->count = 0;
+  list->capacity = 0;
+}
+
+int jclist_add( struct jclist *list, const char *pattern, long offset )
+{
+  struct jclist_entry *entries;
+  int capacity;
+
+  if( list->count == list->capacity )
+  {
+    capacity = list->capacity ? 2 * list->capacity : 64;
+    entries = realloc( list->entries, capacity * sizeof( *entries ) );
+    if( entries == NULL )
+      return(-1);
+    list->entries = entries;
+    list->capacity = capacity;
+  }
+
+  if( ( list->entries[list->count].pattern = strdup( pattern ) ) == NULL )
+    return(-1);
+  list->entries[list->count].offset = offset;
+  list->count++;
+  return(0);
+}
+
+void jclist_remove( struct jclist *list, int index )
+{
+  free( list->entries[index].pattern );
+  memmove( &list->entries[index], &list->entries[index + 1],
+           ( list->count - index - 1 ) * sizeof( *list->entries ) );
+  list->count--;
+}
+
+//
+// Load the entries of a whitelist.dat or blacklist.dat image. The text
+// is cut into records exactly the way fgets() would cut the file, so
+// overlong lines behave here the way they do in the running daemon.
+// Returns 0 on success or -1 if memory ran out.
+//
+int jclist_load_buffer( struct jclist *list, const char *text, size_t length )
+{
+  char record[JCL_RECORD_SIZE];
+  char pattern[JCL_RECORD_SIZE];
+  size_t pos = 0;
+  size_t start;
+  int n;
+
+  while( pos < length )
+  {
+    start = pos;
+    n = 0;
+    while( pos < length && n < JCL_RECORD_SIZE - 1 )
+    {
+      record[n++] = text[pos++];
+      if( record[n - 1] == '\n' )
+        break;
+    }
+    record[n] = 0;
+
+    if( jclist_parse_record( record, pattern ) == JCL_ENTRY )
+    {
+      if( jclist_add( list, pattern, (long)start ) != 0 )
+        return(-1);
+    }
+  }
+  return(0);
+}
+
+//
+// Load the entries of a list file. Returns 0 on success or -1 if the
+// file could not be read (errno is set).
+//
+int jclist_load_file( struct jclist *list, const char *filename )
+{
+  char record[JCL_RECORD_SIZE];
+  char pattern[JCL_RECORD_SIZE];
+  FILE *fp;
+  long offset;
+  int result = 0;
+
+  if( ( fp = fopen( filename, "r" ) ) == NULL )
+    return(-1);
+
+  offset = ftell( fp );
+  while( fgets( record, sizeof( record ), fp ) != NULL )
+  {
+    if( jclist_parse_record( record, pattern ) == JCL_ENTRY )
+    {
+      if( jclist_add( list, pattern, offset ) != 0 )
+      {
+        result = -1;
+        break;
+      }
+    }
+    offset = ftell( fp );
+  }
+
+  fclose( fp );
+  return(result);
+}
+
+void jclist_free( struct jclist *list )
+{
+  int i;
+
+  for( i = 0; i < list->count; i++ )
+    free( list->entries[i].pattern );
+  free( list->entries );
+  jclist_init( list );
+}
+
+//
+// Return the index of the first entry that matches the caller ID
+// string, or -1 if none does.
+//
+int jclist_match( const struct jclist *list, const char *callstr )
+{
+  int i;
+
+  for( i = 0; i < list->count; i++ )
+  {
+    if( jclist_entry_match( list->entries[i].pattern, callstr ) )
+      return(i);
+  }
+  return(-1);
+}
+
+//
+// Return 1 if the search string could match the DATE or TIME digits
+// of some caller ID string (see JCL_CALL_LAYOUT), so that whether it
+// matches a call depends on when the call came in and not just on
+// who made it; otherwise 0. Text matched past the end of the layout
+// is in the NMBR field, which could be anything.
+//
+int jclist_time_dependent( const char *pattern )
+{
+  static const char layout[] = JCL_CALL_LAYOUT;
+  int digits;
+  int s, i;
+
+  // Anchored entries only look at the NMBR and NAME fields.
+  if( strpbrk( pattern, "0123456789" ) == NULL || jclist_terms( pattern, NULL ) != 0 )
+    return(0);
+
+  for( s = 0; layout[s]; s++ )
+  {
+    digits = 0;
+    for( i = 0; pattern[i] && layout[s + i]; i++ )
+    {
+      if( layout[s + i] == '#' )
+      {
+        if( !isdigit( (unsigned char)pattern[i] ) )
+          break;
+        digits = 1;
+      }
+      else if( pattern[i] != layout[s + i] )
+        break;
+    }
+    if( digits && ( pattern[i] == 0 || layout[s + i] == 0 ) )
+      return(1);
+  }
+  return(0);
+}
+
+//
+// Decide a call the way jcblock does: a whitelist match accepts the
+// call before the blacklist is consulted. 'white' may be NULL when
+// there is no whitelist.dat file. The index of the matching entry (or
+// -1) is stored in 'rule' if it is not NULL.
+//
+int jclist_verdict( const struct jclist *white, const struct jclist *black,
+                    const char *callstr, int *rule )
+{
+  int index;
+  int verdict = JCL_NEUTRAL;
+
+  if( white != NULL && ( index = jclist_match( white, callstr ) ) >= 0 )
+    verdict = JCL_SAFE;
+  else if( black != NULL && ( index = jclist_match( black, callstr ) ) >= 0 )
+    verdict = JCL_BLOCKED;
+  else
+    index = -1;
+
+  if( rule != NULL )
+    *rule = index;
+  return(verdict);
+}
+
+//
+// See whether a watched list file has changed since the last call.
+// Returns 1 if it has. The first call always returns 1.
+//
+// Updating an entry's date in place changes no verdict. After doing
+// that, call this with ourWrite set: the file's new details are just
+// noted, as long as its size is unchanged (if not, someone else has
+// changed it too, and the next call will say so).
+//
+int jclist_watch_check( struct jclist_watch *w, int ourWrite )
+{
+  struct stat st;
+  int sameFile;
+
+  if( stat( w->name, &st ) < 0 )
+    memset( &st, 0, sizeof( st ) );
+
+  sameFile = ( w->seen && st.st_dev == w->dev && st.st_ino == w->ino &&
+               st.st_size == w->size );
+  if( sameFile && st.st_mtim.tv_sec == w->mtime.tv_sec &&
+      st.st_mtim.tv_nsec == w->mtime.tv_nsec )
+    return(0);
+  if( ourWrite && !sameFile )
+    return(1);
+
+  w->seen = 1;
+  w->dev = st.st_dev;
+  w->ino = st.st_ino;
+  w->size = st.st_size;
+  w->mtime = st.st_mtim;
+  return( !ourWrite );
+}
+
+// Copy the field text up to the next "--" into 'dest'. Returns the
+// position of the "--" or NULL if the field is missing or too long.
+static const char *copy_field( const char *src, const char *end,
+                               const char *label, char *dest, size_t size )
+{
+  size_t labelLength = strlen( label );
+  size_t n = 0;
+
+  if( (size_t)( end - src ) < labelLength ||
+      strncmp( src, label, labelLength ) != 0 )
+    return(NULL);
+  src += labelLength;
+
+  while( src < end && *src != '-' )
+  {
+    if( n + 1 >= size )
+      return(NULL);
+    dest[n++] = *src++;
+  }
+  dest[n] = 0;
+
+  if( end - src < 2 || src[1] != '-' )
+    return(NULL);
+  return(src);
+}
+
+//
+// Parse one callerID.dat record, for example:
+//   B-DATE = 011916--TIME = 1616--NMBR = 8774845967--NAME = TOLL FREE CALLE--
+// The line need not be terminated; a trailing "\r\n" is ignored.
+// Returns 0 on success or -1 if the line is not a call record.
+//
+int jccall_parse( const char *line, size_t length, struct jccall *call )
+{
+  const char *end = line + length;
+  const char *p;
+  char digits[8];
+
+  while( end > line && ( end[-1] == '\n' || end[-1] == '\r' ) )
+    end--;
+
+  if( end - line < 2 || line[1] != '-' )
+    return(-1);
+  if( strchr( "WB*-", line[0] ) == NULL || line[0] == 0 )
+    return(-1);
+  call->tag = line[0];
+
+  if( ( p = copy_field( line + 2, end, "DATE = ", digits, sizeof( digits ) ) ) == NULL ||
+      strlen( digits ) != 6 || strspn( digits, "0123456789" ) != 6 )
+    return(-1);
+  strcpy( call->date, digits );
+
+  if( ( p = copy_field( p + 2, end, "TIME = ", digits, sizeof( digits ) ) ) == NULL ||
+      strlen( digits ) != 4 || strspn( digits, "0123456789" ) != 4 )
+    return(-1);
+  strcpy( call->time, digits );
+
+  if( ( p = copy_field( p + 2, end, "NMBR = ", call->nmbr, sizeof( call->nmbr ) ) ) == NULL )
+    return(-1);
+  if( ( p = copy_field( p + 2, end, "NAME = ", call->name, sizeof( call->name ) ) ) == NULL )
+    return(-1);
+
+  // Nothing may follow the final "--".
+  if( p + 2 != end )
+    return(-1);
+  return(0);
+}
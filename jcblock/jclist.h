@@ -0,0 +1,136 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: jclist.h
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Declarations for the whitelist/blacklist matcher and the callerID.dat
+ *	record parser in jclist.c. This code is shared by the jcblock programs,
+ *	the jcadmin native addon and the command line tools, so that they all
+ *	agree on what a list entry is and which calls it matches.
+ *
+ *	An entry is normally a literal search string, matched anywhere in
+ *	the caller ID string. An entry that starts with a field anchor,
+ *	"NMBR:" or "NAME:", is a pattern instead: the text after the anchor
+ *	must match the whole of that field, with
+ *	    ?      any one character
+ *	    *      any run of characters (including none)
+ *	    #      any digit
+ *	    [...]  any one of the characters listed; ranges such as 2-9
+ *	           are allowed, and [!...] matches any character not listed
+ *	Anchors may be combined: "NMBR:8##*NAME:O" matches toll free
+ *	numbers with the name "O". Because '?' is a wildcard, the last '?'
+ *	within the first 19 characters of such a record ends the pattern.
+ */
+#ifndef JCLIST_H
+#define JCLIST_H
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+
+// Size of the fgets() buffers jcblock reads list records into. Lines
+// longer than this are read (and checked) in pieces, and so are they here.
+#define JCL_RECORD_SIZE 100
+
+// Results of jclist_parse_record().
+#define JCL_ENTRY               0   // a usable entry
+#define JCL_COMMENT             1   // line starts with '#'
+#define JCL_BLANK               2   // line is just a '\n'
+#define JCL_TOO_SHORT           3   // no room for the date field
+#define JCL_NO_TERMINATOR       4   // no '?' in the record
+#define JCL_TERMINATOR_TOO_FAR  5   // '?' not within the first 19 characters
+#define JCL_NO_PATTERN          6   // nothing but '?' characters
+#define JCL_BAD_PATTERN         7   // an anchored pattern that makes no sense
+
+// How a caller ID string starts once jcblock has inserted the year.
+// '#' stands for any digit.
+#define JCL_CALL_LAYOUT "--DATE = ######--TIME = ####--"
+
+// The fields an anchored entry can match, in the order they appear
+// in a caller ID string.
+#define JCL_FIELD_NMBR  0
+#define JCL_FIELD_NAME  1
+#define JCL_NUM_FIELDS  2
+
+// Verdicts returned by jclist_verdict().
+#define JCL_NEUTRAL  0
+#define JCL_SAFE     1
+#define JCL_BLOCKED  2
+
+struct jclist_entry
+{
+  char *pattern;             // search string (the text before the '?')
+  long offset;               // file position of the record
+};
+
+struct jclist
+{
+  struct jclist_entry *entries;
+  int count;
+  int capacity;
+};
+
+// One field term of an anchored entry ("NAME:O" is field
+// JCL_FIELD_NAME, glob "O").
+struct jclist_term
+{
+  int field;
+  const char *glob;
+  size_t length;
+};
+
+// A list file that is watched for changes (see jclist_watch_check()).
+struct jclist_watch
+{
+  const char *name;
+  int seen;                  // the details below have been filled in
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+};
+
+struct jccall
+{
+  char tag;                  // 'W', 'B', '*' or '-'
+  char date[7];              // MMDDYY
+  char time[5];              // HHMM
+  char nmbr[64];
+  char name[64];
+};
+
+extern const char *jclistFieldLabels[JCL_NUM_FIELDS];
+
+int jclist_parse_record( const char *record, char *pattern );
+int jclist_terms( const char *pattern, struct jclist_term *terms );
+size_t jclist_glob_element( const char *glob, size_t length,
+                            unsigned char *set, int *repeat );
+int jclist_entry_match( const char *pattern, const char *callstr );
+void jclist_init( struct jclist *list );
+int jclist_add( struct jclist *list, const char *pattern, long offset );
+void jclist_remove( struct jclist *list, int index );
+int jclist_load_buffer( struct jclist *list, const char *text, size_t length );
+int jclist_load_file( struct jclist *list, const char *filename );
+void jclist_free( struct jclist *list );
+int jclist_match( const struct jclist *list, const char *callstr );
+int jclist_time_dependent( const char *pattern );
+int jclist_verdict( const struct jclist *white, const struct jclist *black,
+                    const char *callstr, int *rule );
+int jclist_watch_check( struct jclist_watch *w, int ourWrite );
+int jccall_parse( const char *line, size_t length, struct jccall *call );
+
+#endif
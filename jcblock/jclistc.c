@@ -0,0 +1,200 @@
+/*
+ *	Program name: jclistc
+ *
+ *	File name: jclistc.c
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Description:
+ *	Compiles whitelist.dat and blacklist.dat into the image jcblock
+ *	maps instead of reading them (see jcimage.h). Run it in jcblock's
+ *	directory after changing the lists; until it is run again, jcblock
+ *	notices the image is stale and reads the text lists.
+ *
+ *	With -t, checks an existing image instead: that it is intact, is
+ *	current, and decides the calls in any callerID.dat files given the
+ *	same way as the text lists.
+ *
+ *	Compile with:
+ *	    gcc -Wall -O2 -o jclistc jclistc.c jcimage.c jcpattern.c jclist.c
+ *
+ *	Usage:
+ *	    jclistc [-w whitelist] [-b blacklist] [-o image] [-t] [callerID.dat ...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include "jcimage.h"
+
+static double seconds_since( const struct timespec *t0 )
+{
+  struct timespec t1;
+
+  clock_gettime( CLOCK_MONOTONIC, &t1 );
+  return( ( t1.tv_sec - t0->tv_sec ) + ( t1.tv_nsec - t0->tv_nsec ) / 1e9 );
+}
+
+//
+// Decide the calls in a callerID.dat file with both the image and
+// the text lists. Returns the number of calls decided differently.
+//
+static long compare_calls( const char *filename, const struct jcimage *img,
+                           const struct jclist *white, const struct jclist *black,
+                           long *calls )
+{
+  char line[JCL_RECORD_SIZE * 2];
+  struct jccall call;
+  int rules[JCP_GROUPS];
+  size_t length;
+  long differ = 0;
+  FILE *fp;
+
+  if( ( fp = fopen( filename, "r" ) ) == NULL )
+  {
+    fprintf( stderr, "jclistc: %s: %s\n", filename, strerror( errno ) );
+    return(0);
+  }
+  while( fgets( line, sizeof( line ), fp ) != NULL )
+  {
+    length = strcspn( line, "\n" );
+    line[length] = 0;
+    if( jccall_parse( line, length, &call ) != 0 )
+      continue;
+    (*calls)++;
+    line[0] = '-';
+    jcimage_run( img, line, rules );
+    if( rules[JCP_WHITE] != jclist_match( white, line ) ||
+        rules[JCP_BLACK] != jclist_match( black, line ) )
+    {
+      printf( "  differs: %s\n", line );
+      differ++;
+    }
+  }
+  fclose( fp );
+  return(differ);
+}
+
+static int test_image( const char *imageFile, const char *sources[JCP_GROUPS],
+                       int numCalls, char **callFiles )
+{
+  static const char *problems[] = { "", "missing", "damaged or of another version", "stale" };
+  struct jclist white, black;
+  struct jcimage img;
+  struct timespec t0;
+  double openTime;
+  long calls = 0, differ = 0;
+  int rc, i;
+
+  clock_gettime( CLOCK_MONOTONIC, &t0 );
+  rc = jcimage_open( &img, imageFile, sources );
+  openTime = seconds_since( &t0 );
+  if( rc != JCIMAGE_OK )
+  {
+    printf( "%s: %s\n", imageFile, problems[rc] );
+    return(1);
+  }
+  printf( "%s: opened in %.1f microseconds\n", imageFile, openTime * 1e6 );
+  if( jcimage_check( &img ) != 0 )
+  {
+    printf( "%s: body checksum is wrong\n", imageFile );
+    return(1);
+  }
+  printf( "%s: intact and current: %d + %d entries, %d numbers, %d states\n",
+          imageFile, img.header->counts[JCP_WHITE], img.header->counts[JCP_BLACK],
+          img.header->numNumbers, img.header->numStates );
+
+  if( numCalls > 0 )
+  {
+    jclist_init( &white );
+    jclist_init( &black );
+    if( sources[JCP_WHITE] != NULL )
+      jclist_load_file( &white, sources[JCP_WHITE] );
+    jclist_load_file( &black, sources[JCP_BLACK] );
+    for( i = 0; i < numCalls; i++ )
+      differ += compare_calls( callFiles[i], &img, &white, &black, &calls );
+    printf( "%ld calls replayed, %ld decided differently\n", calls, differ );
+  }
+  jcimage_close( &img );
+  return( differ > 0 );
+}
+
+int main( int argc, char **argv )
+{
+  const char *sources[JCP_GROUPS] = { "./whitelist.dat", "./blacklist.dat" };
+  const char *imageFile = JCIMAGE_FILE;
+  struct jcimage img;
+  struct timespec t0;
+  int test = 0;
+  int optChar;
+
+  while( ( optChar = getopt( argc, argv, "w:b:o:th" ) ) != EOF )
+  {
+    switch( optChar )
+    {
+      case 'w':
+        sources[JCP_WHITE] = optarg;
+        break;
+
+      case 'b':
+        sources[JCP_BLACK] = optarg;
+        break;
+
+      case 'o':
+        imageFile = optarg;
+        break;
+
+      case 't':
+        test = 1;
+        break;
+
+      case 'h':
+      default:
+        fprintf( stderr, "Usage: jclistc [-w whitelist] [-b blacklist] [-o image] [-t] [callerID.dat ...]\n" );
+        fprintf( stderr, "  -o   image to write (default %s)\n", JCIMAGE_FILE );
+        fprintf( stderr, "  -t   check the image instead, replaying any callerID.dat files given\n" );
+        return(1);
+    }
+  }
+
+  // As with jcblock, a whitelist is optional.
+  if( access( sources[JCP_WHITE], F_OK ) != 0 )
+    sources[JCP_WHITE] = NULL;
+  if( test )
+    return test_image( imageFile, sources, argc - optind, argv + optind );
+
+  clock_gettime( CLOCK_MONOTONIC, &t0 );
+  if( jcimage_write( imageFile, sources ) != 0 )
+  {
+    fprintf( stderr, "jclistc: %s: %s\n", imageFile,
+             errno == EFBIG ? "lists too big to compile" : strerror( errno ) );
+    return(1);
+  }
+  printf( "jclistc: compiled in %.3f seconds\n", seconds_since( &t0 ) );
+
+  if( jcimage_open( &img, imageFile, sources ) == JCIMAGE_OK )
+  {
+    printf( "jclistc: %s: %d + %d entries, %zu bytes, %d numbers, %d states\n",
+            imageFile, img.header->counts[JCP_WHITE], img.header->counts[JCP_BLACK],
+            img.size, img.header->numNumbers, img.header->numStates );
+    jcimage_close( &img );
+  }
+  else
+    printf( "jclistc: a list changed while compiling; run jclistc again\n" );
+  return(0);
+}
@@ -0,0 +1,255 @@
+/*
+ *	Program name: jcnums
+ *
+ *	File name: jcnums.c
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Description:
+ *	Makes an imported number store (see jcnumset.h) from a file of
+ *	numbers, one to a line, or reports on one. The numbers are sorted
+ *	in memory, so this is for trying out filter sizes on lists of a few
+ *	million numbers at most; jcimport makes the stores jcblock reads.
+ *
+ *	With -s, reports on an existing store instead: its size in each
+ *	tier, the filter's false positive rate (estimated, and measured
+ *	with random ten digit numbers) and how long looking up a number
+ *	not in the store takes. Any numbers given are looked up.
+ *
+ *	Compile with:
+ *	    gcc -Wall -O2 -o jcnums jcnums.c jcnumset.c -lm
+ *
+ *	Usage:
+ *	    jcnums -o store [-b bits] numbers.txt
+ *	    jcnums -s [-o store] [number ...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include "jcnumset.h"
+
+#define PROBES  1000000
+
+static double seconds_since( const struct timespec *t0 )
+{
+  struct timespec t1;
+
+  clock_gettime( CLOCK_MONOTONIC, &t1 );
+  return( ( t1.tv_sec - t0->tv_sec ) + ( t1.tv_nsec - t0->tv_nsec ) / 1e9 );
+}
+
+static int compare_keys( const void *a, const void *b )
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+  return( x < y ? -1 : x > y );
+}
+
+static int build_store( const char *storeFile, const char *numbersFile, int bits )
+{
+  char line[256];
+  uint64_t *keys = NULL;
+  size_t count = 0, size = 0, i;
+  long skipped = 0;
+  struct jcnumset_writer w;
+  struct timespec t0;
+  uint64_t key;
+  FILE *fp;
+
+  if( ( fp = fopen( numbersFile, "r" ) ) == NULL )
+  {
+    fprintf( stderr, "jcnums: %s: %s\n", numbersFile, strerror( errno ) );
+    return(1);
+  }
+  clock_gettime( CLOCK_MONOTONIC, &t0 );
+  while( fgets( line, sizeof( line ), fp ) != NULL )
+  {
+    if( ( key = jcnumset_parse( line, strcspn( line, "\r\n" ) ) ) == 0 )
+    {
+      skipped++;
+      continue;
+    }
+    if( count == size )
+    {
+      size = ( size == 0 ? 65536 : 2 * size );
+      if( ( keys = realloc( keys, size * sizeof( *keys ) ) ) == NULL )
+      {
+        fprintf( stderr, "jcnums: out of memory\n" );
+        return(1);
+      }
+    }
+    keys[count++] = key;
+  }
+  fclose( fp );
+  qsort( keys, count, sizeof( *keys ), compare_keys );
+
+  if( jcnumset_create( &w, storeFile, count, bits ) != 0 )
+  {
+    fprintf( stderr, "jcnums: %s: %s\n", storeFile, strerror( errno ) );
+    return(1);
+  }
+  for( i = 0; i < count; i++ )
+  {
+    if( jcnumset_add( &w, keys[i] ) != 0 )
+    {
+      fprintf( stderr, "jcnums: %s: %s\n", storeFile, strerror( errno ) );
+      jcnumset_abandon( &w );
+      return(1);
+    }
+  }
+  if( jcnumset_finish( &w ) != 0 )
+  {
+    fprintf( stderr, "jcnums: %s: %s\n", storeFile, strerror( errno ) );
+    return(1);
+  }
+  free( keys );
+  printf( "jcnums: %s: stored %llu numbers in %.3f seconds", storeFile,
+          (unsigned long long)w.h.count, seconds_since( &t0 ) );
+  if( skipped > 0 )
+    printf( " (%ld lines weren't numbers)", skipped );
+  printf( "\n" );
+  return(0);
+}
+
+static int report_store( const char *storeFile, int numLookups, char **lookups )
+{
+  const struct jcnumset_header *h;
+  struct jcnumset set;
+  struct timespec t0;
+  uint64_t *probes;
+  uint64_t x = 88172645463325252ULL;
+  long members = 0, falsePositives = 0, found = 0;
+  double n, seconds;
+  char digits[JCNUMSET_DIGITS + 1];
+  uint64_t key;
+  int i;
+
+  clock_gettime( CLOCK_MONOTONIC, &t0 );
+  if( jcnumset_open( &set, storeFile ) != 0 )
+  {
+    fprintf( stderr, "jcnums: %s: %s\n", storeFile,
+             errno == EINVAL ? "not a number store of this version" : strerror( errno ) );
+    return(1);
+  }
+  seconds = seconds_since( &t0 );
+  h = set.header;
+  n = ( h->count > 0 ? h->count : 1 );
+  printf( "%s: %llu numbers, %zu bytes (%.2f bytes a number), opened in %.1f microseconds\n",
+          storeFile, (unsigned long long)h->count, set.size, set.size / n, seconds * 1e6 );
+  printf( "  filter   %10llu bytes  %5.2f bits a number\n",
+          (unsigned long long)h->numBlocks * 64, h->numBlocks * 512 / n );
+  printf( "  numbers  %10llu bytes  %5.2f bytes a number\n",
+          (unsigned long long)h->dataSize, h->dataSize / n );
+  printf( "  index    %10llu bytes  %5.2f bytes a number\n",
+          (unsigned long long)( h->numGroups * sizeof( struct jcnumset_group ) ),
+          h->numGroups * sizeof( struct jcnumset_group ) / n );
+
+  // Random ten digit numbers, as most calls are from numbers not in
+  // the store.
+  if( ( probes = malloc( PROBES * sizeof( *probes ) ) ) == NULL )
+  {
+    fprintf( stderr, "jcnums: out of memory\n" );
+    return(1);
+  }
+  for( i = 0; i < PROBES; i++ )
+  {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    probes[i] = 10000000000ULL + 2000000000ULL + x % 8000000000ULL;
+  }
+  for( i = 0; i < PROBES; i++ )
+  {
+    if( jcnumset_contains( &set, probes[i] ) )
+      members++;
+    else if( jcnumset_maybe( &set, probes[i] ) )
+      falsePositives++;
+  }
+  printf( "  false positives: %.3f%% estimated, %.3f%% of %ld random numbers not in the store\n",
+          100 * jcnumset_estimated_fpr( &set ),
+          100.0 * falsePositives / ( PROBES - members ), PROBES - members );
+
+  clock_gettime( CLOCK_MONOTONIC, &t0 );
+  for( i = 0; i < PROBES; i++ )
+    found += jcnumset_contains( &set, probes[i] );
+  seconds = seconds_since( &t0 );
+  printf( "  lookup of a random number: %.0f nanoseconds (%ld found)\n",
+          seconds * 1e9 / PROBES, found );
+  free( probes );
+
+  for( i = 0; i < numLookups; i++ )
+  {
+    key = jcnumset_parse( lookups[i], strlen( lookups[i] ) );
+    if( key == 0 )
+      printf( "%s: not a number\n", lookups[i] );
+    else
+    {
+      jcnumset_format( key, digits );
+      printf( "%s: %s %s\n", lookups[i], digits,
+              jcnumset_contains( &set, key ) ? "is in the store" : "is not in the store" );
+    }
+  }
+  jcnumset_close( &set );
+  return(0);
+}
+
+int main( int argc, char **argv )
+{
+  const char *storeFile = NULL;
+  int bits = JCNUMSET_BITS;
+  int report = 0;
+  int optChar;
+
+  while( ( optChar = getopt( argc, argv, "o:b:sh" ) ) != EOF )
+  {
+    switch( optChar )
+    {
+      case 'o':
+        storeFile = optarg;
+        break;
+
+      case 'b':
+        bits = atoi( optarg );
+        break;
+
+      case 's':
+        report = 1;
+        break;
+
+      case 'h':
+      default:
+        fprintf( stderr, "Usage: jcnums -o store [-b bits] numbers.txt\n" );
+        fprintf( stderr, "       jcnums -s [-o store] [number ...]\n" );
+        fprintf( stderr, "  -o   the store (default for -s %s)\n", JCNUMSET_FILE );
+        fprintf( stderr, "  -b   filter bits a number (default %d)\n", JCNUMSET_BITS );
+        fprintf( stderr, "  -s   report on the store, looking up any numbers given\n" );
+        return(1);
+    }
+  }
+
+  if( report )
+    return report_store( storeFile != NULL ? storeFile : JCNUMSET_FILE,
+                         argc - optind, argv + optind );
+  if( storeFile == NULL || argc - optind != 1 || bits <= 0 )
+  {
+    fprintf( stderr, "Usage: jcnums -o store [-b bits] numbers.txt\n" );
+    return(1);
+  }
+  return build_store( storeFile, argv[optind], bits );
+}
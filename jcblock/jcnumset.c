@@ -0,0 +1,448 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: jcnumset.c
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Description:
+ *	Writes and maps the imported number store (see jcnumset.h). A store
+ *	is written a number at a time in ascending order, so only its filter
+ *	and index are held in memory, not the numbers; it is renamed into
+ *	place when complete, so jcblock never maps a half written one.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "jcnumset.h"
+
+#define ALIGN(n, a)  ( ( (n) + (a) - 1 ) & ~(uint64_t)( (a) - 1 ) )
+
+// Multipliers choosing the bit set in each word of a filter block.
+static const uint32_t salts[8] =
+{
+  0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+  0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+};
+
+// The splitmix64 finaliser: every bit of the key affects every bit.
+static uint64_t mix( uint64_t x )
+{
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return(x);
+}
+
+static uint64_t block_of( uint64_t h, uint64_t numBlocks )
+{
+  return( ( ( h >> 32 ) * numBlocks ) >> 32 );
+}
+
+static int bit_of( uint64_t h, int word )
+{
+  return( (uint32_t)( (uint32_t)h * salts[word] ) >> 26 );
+}
+
+//
+// The key for a number as written in a list or caller ID string:
+// digits, perhaps separated by spaces, dots, dashes or parentheses or
+// preceded by '+'. A 1 before ten more digits is the North American
+// country code, which the modem leaves off, so it is dropped. Returns
+// 0 if the text isn't a number.
+//
+uint64_t jcnumset_parse( const char *text, size_t length )
+{
+  uint64_t key = 1;
+  int digits = 0;
+  size_t i;
+
+  for( i = 0; i < length; i++ )
+  {
+    if( text[i] >= '0' && text[i] <= '9' )
+    {
+      if( ++digits > JCNUMSET_DIGITS )
+        return(0);
+      key = key * 10 + ( text[i] - '0' );
+    }
+    else if( strchr( " ().-+", text[i] ) == NULL || text[i] == 0 )
+      return(0);
+  }
+  if( digits == 0 )
+    return(0);
+  if( digits == 11 && key / 10000000000ULL == 11 )
+    key -= 100000000000ULL;
+  return(key);
+}
+
+// Write a key's digits into 'digits' (JCNUMSET_DIGITS + 1 bytes).
+// Returns how many.
+int jcnumset_format( uint64_t key, char *digits )
+{
+  char reversed[JCNUMSET_DIGITS + 1];
+  int n = 0, i;
+
+  for( ; key > 1 && n < JCNUMSET_DIGITS; key /= 10 )
+    reversed[n++] = '0' + key % 10;
+  for( i = 0; i < n; i++ )
+    digits[i] = reversed[n - 1 - i];
+  digits[n] = 0;
+  return(n);
+}
+
+static int flush_data( struct jcnumset_writer *w )
+{
+  if( w->used > 0 &&
+      pwrite( w->fd, w->buffer, w->used, w->h.dataOffset + w->h.dataSize ) != (ssize_t)w->used )
+    return(-1);
+  w->h.dataSize += w->used;
+  w->used = 0;
+  return(0);
+}
+
+//
+// Start writing a store of at most 'maxCount' numbers, with a filter
+// of 'bitsPerNumber' bits for each. Returns 0 on success, or -1 with
+// errno set.
+//
+int jcnumset_create( struct jcnumset_writer *w, const char *filename,
+                     uint64_t maxCount, int bitsPerNumber )
+{
+  memset( w, 0, sizeof( *w ) );
+  w->fd = -1;
+  if( strlen( filename ) + 5 > sizeof( w->filename ) || bitsPerNumber <= 0 )
+  {
+    errno = EINVAL;
+    return(-1);
+  }
+  strcpy( w->filename, filename );
+  snprintf( w->tmpName, sizeof( w->tmpName ), "%s.tmp", filename );
+
+  w->h.magic = JCNUMSET_MAGIC;
+  w->h.version = JCNUMSET_VERSION;
+  w->h.numBlocks = ( maxCount * bitsPerNumber + 511 ) / 512;
+  if( w->h.numBlocks == 0 )
+    w->h.numBlocks = 1;
+  if( w->h.numBlocks >= ( (uint64_t)1 << 32 ) )
+  {
+    errno = EFBIG;
+    return(-1);
+  }
+  w->h.bloomOffset = ALIGN( sizeof( w->h ), 64 );
+  w->h.dataOffset = w->h.bloomOffset + w->h.numBlocks * 64;
+
+  w->indexSize = 1024;
+  if( ( w->bloom = calloc( w->h.numBlocks, 64 ) ) == NULL ||
+      ( w->index = malloc( w->indexSize * sizeof( *w->index ) ) ) == NULL ||
+      ( w->fd = open( w->tmpName, O_WRONLY | O_CREAT | O_TRUNC, 0644 ) ) < 0 )
+  {
+    free( w->bloom );
+    free( w->index );
+    return(-1);
+  }
+  return(0);
+}
+
+//
+// Add a number to a store being written. Keys must come in ascending
+// order; a repeat of the last is ignored. Returns 0 on success, or -1
+// with errno set.
+//
+int jcnumset_add( struct jcnumset_writer *w, uint64_t key )
+{
+  uint64_t h = mix( key );
+  uint64_t *block = &w->bloom[block_of( h, w->h.numBlocks ) * 8];
+  uint64_t delta;
+  int i;
+
+  if( w->h.count > 0 && key <= w->last )
+  {
+    if( key == w->last )
+      return(0);
+    errno = EINVAL;
+    return(-1);
+  }
+  if( w->h.count >= w->h.numBlocks * 512 )
+  {
+    errno = EFBIG;               // more than the filter was made for
+    return(-1);
+  }
+
+  for( i = 0; i < 8; i++ )
+    block[i] |= (uint64_t)1 << bit_of( h, i );
+
+  if( w->h.count % JCNUMSET_GROUP == 0 )
+  {
+    if( w->h.numGroups == w->indexSize )
+    {
+      struct jcnumset_group *bigger;
+
+      if( ( bigger = realloc( w->index, 2 * w->indexSize * sizeof( *bigger ) ) ) == NULL )
+        return(-1);
+      w->index = bigger;
+      w->indexSize *= 2;
+    }
+    w->index[w->h.numGroups].first = key;
+    w->index[w->h.numGroups].offset = w->h.dataSize + w->used;
+    w->h.numGroups++;
+  }
+  else
+  {
+    if( w->used + 10 > sizeof( w->buffer ) && flush_data( w ) != 0 )
+      return(-1);
+    for( delta = key - w->last; delta >= 0x80; delta >>= 7 )
+      w->buffer[w->used++] = 0x80 | ( delta & 0x7f );
+    w->buffer[w->used++] = delta;
+  }
+  w->last = key;
+  w->h.count++;
+  return(0);
+}
+
+//
+// Finish a store: write the filter, index and header after the
+// numbers, and rename it into place. Returns 0 on success, or -1 with
+// errno set (the store is abandoned either way).
+//
+int jcnumset_finish( struct jcnumset_writer *w )
+{
+  size_t indexBytes;
+  int result = -1;
+
+  if( flush_data( w ) == 0 )
+  {
+    w->h.indexOffset = ALIGN( w->h.dataOffset + w->h.dataSize, 8 );
+    indexBytes = w->h.numGroups * sizeof( *w->index );
+    w->h.fileSize = w->h.indexOffset + indexBytes;
+    w->h.created = time( NULL );
+    if( pwrite( w->fd, w->index, indexBytes, w->h.indexOffset ) == (ssize_t)indexBytes &&
+        pwrite( w->fd, w->bloom, w->h.numBlocks * 64, w->h.bloomOffset ) ==
+          (ssize_t)( w->h.numBlocks * 64 ) &&
+        pwrite( w->fd, &w->h, sizeof( w->h ), 0 ) == sizeof( w->h ) &&
+        ftruncate( w->fd, w->h.fileSize ) == 0 &&
+        fsync( w->fd ) == 0 )
+    {
+      close( w->fd );
+      w->fd = -1;
+      if( rename( w->tmpName, w->filename ) == 0 )
+        result = 0;
+    }
+  }
+  jcnumset_abandon( w );
+  return(result);
+}
+
+// Give up writing a store, removing what was written of it.
+void jcnumset_abandon( struct jcnumset_writer *w )
+{
+  int savedErrno = errno;
+
+  if( w->fd >= 0 )
+    close( w->fd );
+  unlink( w->tmpName );
+  free( w->bloom );
+  free( w->index );
+  w->fd = -1;
+  w->bloom = NULL;
+  w->index = NULL;
+  errno = savedErrno;
+}
+
+//
+// Map a store. Returns 0 on success, or -1 with errno set (ENOENT if
+// there is none, EINVAL if it is damaged or of another version).
+//
+int jcnumset_open( struct jcnumset *set, const char *filename )
+{
+  const struct jcnumset_header *h;
+  struct stat st;
+  int fd;
+
+  memset( set, 0, sizeof( *set ) );
+  if( ( fd = open( filename, O_RDONLY ) ) < 0 )
+    return(-1);
+  if( fstat( fd, &st ) != 0 || st.st_size < (off_t)sizeof( *h ) )
+  {
+    close( fd );
+    errno = EINVAL;
+    return(-1);
+  }
+  set->size = st.st_size;
+  set->map = mmap( NULL, set->size, PROT_READ, MAP_SHARED, fd, 0 );
+  close( fd );
+  if( set->map == MAP_FAILED )
+  {
+    set->map = NULL;
+    return(-1);
+  }
+
+  h = set->header = set->map;
+  if( h->magic != JCNUMSET_MAGIC || h->version != JCNUMSET_VERSION ||
+      h->fileSize != set->size || h->numBlocks == 0 ||
+      h->numBlocks >= ( (uint64_t)1 << 32 ) || h->bloomOffset % 64 != 0 ||
+      h->numGroups != ( h->count + JCNUMSET_GROUP - 1 ) / JCNUMSET_GROUP ||
+      h->bloomOffset + h->numBlocks * 64 > h->dataOffset ||
+      h->dataOffset + h->dataSize > h->indexOffset ||
+      h->indexOffset + h->numGroups * sizeof( struct jcnumset_group ) > h->fileSize )
+  {
+    jcnumset_close( set );
+    errno = EINVAL;
+    return(-1);
+  }
+
+  set->bloom = (const uint64_t *)( (const char *)set->map + h->bloomOffset );
+  set->data = (const unsigned char *)set->map + h->dataOffset;
+  set->index = (const void *)( (const char *)set->map + h->indexOffset );
+  // Every call reads the filter, so have it read in now.
+  madvise( (char *)set->map + h->bloomOffset, h->numBlocks * 64, MADV_WILLNEED );
+  return(0);
+}
+
+// The filter alone: 0 if the key is certainly not in the store.
+int jcnumset_maybe( const struct jcnumset *set, uint64_t key )
+{
+  uint64_t h = mix( key );
+  const uint64_t *block = &set->bloom[block_of( h, set->header->numBlocks ) * 8];
+  int i;
+
+  for( i = 0; i < 8; i++ )
+  {
+    if( !( block[i] & ( (uint64_t)1 << bit_of( h, i ) ) ) )
+      return(0);
+  }
+  return(1);
+}
+
+// Read one difference, not going past 'end'.
+static uint64_t read_delta( const unsigned char *data, uint64_t *pos, uint64_t end )
+{
+  uint64_t delta = 0;
+  int shift = 0;
+
+  while( *pos < end && ( data[*pos] & 0x80 ) && shift < 63 )
+  {
+    delta |= (uint64_t)( data[(*pos)++] & 0x7f ) << shift;
+    shift += 7;
+  }
+  if( *pos < end )
+    delta |= (uint64_t)data[(*pos)++] << shift;
+  return(delta);
+}
+
+// Where group 'g''s differences end.
+static uint64_t group_end( const struct jcnumset *set, uint64_t g )
+{
+  const struct jcnumset_header *h = set->header;
+  uint64_t end = ( g + 1 < h->numGroups ? set->index[g + 1].offset : h->dataSize );
+
+  return( end > h->dataSize ? h->dataSize : end );
+}
+
+// 1 if the key is in the store.
+int jcnumset_contains( const struct jcnumset *set, uint64_t key )
+{
+  const struct jcnumset_header *h = set->header;
+  uint64_t lo, hi, mid, value, pos, end;
+
+  if( set->map == NULL || !jcnumset_maybe( set, key ) )
+    return(0);
+
+  // The last group starting at or before the key.
+  lo = 0;
+  hi = h->numGroups;
+  while( lo < hi )
+  {
+    mid = lo + ( hi - lo ) / 2;
+    if( set->index[mid].first <= key )
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if( lo == 0 )
+    return(0);
+  value = set->index[lo - 1].first;
+  pos = set->index[lo - 1].offset;
+  end = group_end( set, lo - 1 );
+  while( value < key && pos < end )
+    value += read_delta( set->data, &pos, end );
+  return( value == key );
+}
+
+// Start reading a store's numbers (a store that isn't mapped has none).
+void jcnumset_first( const struct jcnumset *set, struct jcnumset_cursor *c )
+{
+  memset( c, 0, sizeof( *c ) );
+  c->set = set;
+}
+
+// Read the next number into 'key'. Returns 0 when there are no more.
+int jcnumset_next( struct jcnumset_cursor *c, uint64_t *key )
+{
+  const struct jcnumset *set = c->set;
+  uint64_t g;
+
+  if( set->map == NULL || c->read >= set->header->count )
+    return(0);
+  if( c->read % JCNUMSET_GROUP == 0 )
+  {
+    g = c->read / JCNUMSET_GROUP;
+    c->value = set->index[g].first;
+    c->pos = set->index[g].offset;
+    c->end = group_end( set, g );
+  }
+  else
+    c->value += read_delta( set->data, &c->pos, c->end );
+  c->read++;
+  *key = c->value;
+  return(1);
+}
+
+//
+// The filter's false positive rate for numbers not in the store. A
+// block holding j numbers has each bit of a word set with probability
+// 1 - (63/64)^j, and how many numbers each block holds is Poisson
+// distributed.
+//
+double jcnumset_estimated_fpr( const struct jcnumset *set )
+{
+  double lambda = (double)set->header->count / set->header->numBlocks;
+  double p = exp( -lambda );       // of a block holding j numbers
+  double fpr = 0;
+  int j;
+
+  for( j = 0; j < lambda * 4 + 64; j++ )
+  {
+    fpr += p * pow( 1 - pow( 63.0 / 64.0, j ), 8 );
+    p *= lambda / ( j + 1 );
+  }
+  return(fpr);
+}
+
+void jcnumset_close( struct jcnumset *set )
+{
+  if( set->map != NULL )
+    munmap( set->map, set->size );
+  memset( set, 0, sizeof( *set ) );
+}
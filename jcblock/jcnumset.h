@@ -0,0 +1,132 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: jcnumset.h
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	A store of imported phone numbers (public complaint lists and the
+ *	like, millions of numbers) that jcblock blocks alongside
+ *	blacklist.dat. It is a file jcblock maps, in two tiers:
+ *
+ *	    bloom     a Bloom filter in 64 byte blocks, one cache line each.
+ *	              A number sets one bit in each of the 8 words of one
+ *	              block, so deciding that a number is not in the store,
+ *	              as it isn't for most calls, reads one cache line.
+ *	    data      the numbers, sorted, as the differences between them
+ *	              in a variable number of bytes, in groups of
+ *	              JCNUMSET_GROUP.
+ *	    index     each group's first number and where its differences
+ *	              start, for a binary search. Only numbers the filter
+ *	              lets through are looked up here.
+ *
+ *	Numbers are stored as keys: the number's digits after a leading 1,
+ *	so that leading zeros count. See jcnumset_parse() for how a number
+ *	is written down in a list or caller ID string.
+ *
+ *	jcimport keeps the numbers of each imported list in a store of its
+ *	own in JCNUMSET_SOURCES, and jcblock uses three stores made from
+ *	them: JCNUMSET_FILE, the numbers of all the lists when last merged,
+ *	and two small ones of the numbers added (JCNUMSET_ADDED) and removed
+ *	(JCNUMSET_REMOVED) by lists imported again since. A number is
+ *	imported if it was added, or is in the merged store and wasn't
+ *	removed.
+ */
+#ifndef JCNUMSET_H
+#define JCNUMSET_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define JCNUMSET_FILE     "./imported.num"
+#define JCNUMSET_ADDED    "./imported.add.num"
+#define JCNUMSET_REMOVED  "./imported.del.num"
+#define JCNUMSET_SOURCES  "./imported"       // a store for each list
+#define JCNUMSET_MAGIC    0x4d554e4a     // "JNUM"
+#define JCNUMSET_VERSION  1
+#define JCNUMSET_GROUP    64             // numbers per index entry
+#define JCNUMSET_BITS     12             // default filter bits per number
+#define JCNUMSET_DIGITS   18             // most digits in a number
+
+struct jcnumset_header
+{
+  uint32_t magic, version;
+  uint64_t fileSize;
+  uint64_t count;               // numbers
+  uint64_t numBlocks;           // of the filter
+  uint64_t numGroups;
+  uint64_t bloomOffset;         // uint64_t[numBlocks][8], 64 byte aligned
+  uint64_t dataOffset, dataSize;
+  uint64_t indexOffset;         // struct jcnumset_group[numGroups]
+  int64_t created;              // time()
+};
+
+struct jcnumset_group
+{
+  uint64_t first;               // key
+  uint64_t offset;              // in data, of the differences after 'first'
+};
+
+struct jcnumset
+{
+  void *map;
+  size_t size;
+  const struct jcnumset_header *header;
+  const uint64_t *bloom;
+  const unsigned char *data;
+  const struct jcnumset_group *index;
+};
+
+// A position in a store, for reading its numbers in order.
+struct jcnumset_cursor
+{
+  const struct jcnumset *set;
+  uint64_t read;                // numbers read so far
+  uint64_t pos, end;            // of the current group's differences
+  uint64_t value;
+};
+
+// A store being written, numbers in ascending order.
+struct jcnumset_writer
+{
+  int fd;
+  char filename[1024], tmpName[1024];
+  struct jcnumset_header h;
+  uint64_t *bloom;
+  struct jcnumset_group *index;
+  uint64_t indexSize;           // allocated
+  unsigned char buffer[65536];  // data not yet written
+  size_t used;
+  uint64_t last;
+};
+
+uint64_t jcnumset_parse( const char *text, size_t length );
+int jcnumset_format( uint64_t key, char *digits );
+
+int jcnumset_create( struct jcnumset_writer *w, const char *filename,
+                     uint64_t maxCount, int bitsPerNumber );
+int jcnumset_add( struct jcnumset_writer *w, uint64_t key );
+int jcnumset_finish( struct jcnumset_writer *w );
+void jcnumset_abandon( struct jcnumset_writer *w );
+
+int jcnumset_open( struct jcnumset *set, const char *filename );
+int jcnumset_maybe( const struct jcnumset *set, uint64_t key );
+int jcnumset_contains( const struct jcnumset *set, uint64_t key );
+void jcnumset_first( const struct jcnumset *set, struct jcnumset_cursor *c );
+int jcnumset_next( struct jcnumset_cursor *c, uint64_t *key );
+double jcnumset_estimated_fpr( const struct jcnumset *set );
+void jcnumset_close( struct jcnumset *set );
+
+#endif
@@ -0,0 +1,626 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: jcpattern.c
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Description:
+ *	Compiles the lists into one DFA (see jcpattern.h). Every entry is
+ *	first turned into a sequence of elements, each a set of characters
+ *	that is matched once or, for a wildcard '*', any number of times:
+ *	    literal FOO      F O O
+ *	    NMBR:8##*        - N M B R space = space 8 [0-9] [0-9] [^-]* - -
+ *	An anchored entry with two terms has them back to back, the way
+ *	the NMBR and NAME fields are in a caller ID string.
+ *
+ *	The NFA states are the positions between elements. The DFA is
+ *	built from sets of them by the subset construction; the start
+ *	positions of every entry are in every set (an entry can begin
+ *	matching at any character), so they are left out of the sets and
+ *	added to each transition from a table. The DFA is then minimised
+ *	by Moore's partition refinement, starting from states grouped by
+ *	what they accept.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "jcpattern.h"
+
+// The NFA: one entry per position. A position before an element
+// steps over (or, if it repeats, stays on) characters in its set;
+// the position after an entry's last element accepts it.
+struct nfa
+{
+  int count, capacity;
+  int32_t *set;                 // element's set (index into sets), -1 if accepting
+  unsigned char *repeat;
+  unsigned char *isStart;       // in the closure of an entry's first position
+  int32_t *group, *rule;        // what an accepting position accepts
+
+  unsigned char (*sets)[256];   // distinct character sets
+  int numSets, setCapacity;
+};
+
+// Interns arrays of ints: each distinct array gets the next number.
+struct intern
+{
+  int32_t *pool;
+  size_t poolUsed, poolSize;
+  size_t *offsets;
+  int32_t *lengths;
+  int count, capacity;
+  int32_t *table;               // open addressing; -1 = empty
+  size_t tableSize;
+};
+
+static int grow( void **array, int *capacity, int needed, size_t size )
+{
+  void *p;
+  int n = *capacity ? *capacity : 64;
+
+  if( needed <= *capacity )
+    return(0);
+  while( n < needed )
+    n *= 2;
+  if( ( p = realloc( *array, (size_t)n * size ) ) == NULL )
+    return(-1);
+  *array = p;
+  *capacity = n;
+  return(0);
+}
+
+static int add_set( struct nfa *n, const unsigned char *set )
+{
+  int i;
+
+  for( i = 0; i < n->numSets; i++ )
+    if( memcmp( n->sets[i], set, 256 ) == 0 )
+      return(i);
+  if( grow( (void **)&n->sets, &n->setCapacity, n->numSets + 1, 256 ) != 0 )
+    return(-1);
+  memcpy( n->sets[n->numSets], set, 256 );
+  return( n->numSets++ );
+}
+
+static int add_position( struct nfa *n, const unsigned char *set, int repeat,
+                         int group, int rule )
+{
+  int i = n->count;
+  int c = n->capacity ? 2 * n->capacity : 256;
+
+  if( i == n->capacity )
+  {
+    if( ( n->set = realloc( n->set, c * sizeof( int32_t ) ) ) == NULL ||
+        ( n->repeat = realloc( n->repeat, c ) ) == NULL ||
+        ( n->isStart = realloc( n->isStart, c ) ) == NULL ||
+        ( n->group = realloc( n->group, c * sizeof( int32_t ) ) ) == NULL ||
+        ( n->rule = realloc( n->rule, c * sizeof( int32_t ) ) ) == NULL )
+      return(-1);
+    n->capacity = c;
+  }
+
+  if( set == NULL )
+    n->set[i] = -1;
+  else if( ( n->set[i] = add_set( n, set ) ) < 0 )
+    return(-1);
+  n->repeat[i] = repeat;
+  n->isStart[i] = 0;
+  n->group[i] = group;
+  n->rule[i] = rule;
+  n->count++;
+  return(0);
+}
+
+static int add_literal( struct nfa *n, const char *text, size_t length )
+{
+  unsigned char set[256];
+  size_t i;
+
+  for( i = 0; i < length; i++ )
+  {
+    memset( set, 0, sizeof( set ) );
+    set[(unsigned char)text[i]] = 1;
+    if( add_position( n, set, 0, -1, -1 ) != 0 )
+      return(-1);
+  }
+  return(0);
+}
+
+//
+// Add the positions for one entry. Returns -1 if memory ran out.
+//
+static int add_entry( struct nfa *n, const char *pattern, int group, int rule )
+{
+  static const char *labels[JCL_NUM_FIELDS] = { "-NMBR = ", "NAME = " };
+  struct jclist_term terms[JCL_NUM_FIELDS];
+  unsigned char set[256];
+  int first = n->count;
+  int count, t, repeat;
+  size_t i, e;
+
+  if( ( count = jclist_terms( pattern, terms ) ) < 0 )
+    return(0);                  // matches nothing
+  if( count == 0 && add_literal( n, pattern, strlen( pattern ) ) != 0 )
+    return(-1);
+
+  for( t = 0; t < count; t++ )
+  {
+    // A NAME term on its own still needs the '-' before its label.
+    if( t == 0 && terms[t].field == JCL_FIELD_NAME && add_literal( n, "-", 1 ) != 0 )
+      return(-1);
+    if( add_literal( n, labels[terms[t].field], strlen( labels[terms[t].field] ) ) != 0 )
+      return(-1);
+    for( i = 0; i < terms[t].length; i += e )
+    {
+      e = jclist_glob_element( terms[t].glob + i, terms[t].length - i, set, &repeat );
+      if( add_position( n, set, repeat, -1, -1 ) != 0 )
+        return(-1);
+    }
+    if( add_literal( n, "--", 2 ) != 0 )
+      return(-1);
+  }
+
+  if( add_position( n, NULL, 0, group, rule ) != 0 )
+    return(-1);
+
+  // The entry can start matching anywhere.
+  for( i = first; ; i++ )
+  {
+    n->isStart[i] = 1;
+    if( !n->repeat[i] )
+      break;
+  }
+  return(0);
+}
+
+static void free_nfa( struct nfa *n )
+{
+  free( n->set );
+  free( n->repeat );
+  free( n->isStart );
+  free( n->group );
+  free( n->rule );
+  free( n->sets );
+}
+
+static uint32_t hash_ints( const int32_t *items, int n )
+{
+  uint32_t h = 2166136261u;
+  int i;
+
+  for( i = 0; i < n; i++ )
+    h = ( h ^ (uint32_t)items[i] ) * 16777619u;
+  return h;
+}
+
+static int intern_init( struct intern *t, size_t tableSize )
+{
+  memset( t, 0, sizeof( *t ) );
+  t->tableSize = tableSize;
+  if( ( t->table = malloc( tableSize * sizeof( int32_t ) ) ) == NULL )
+    return(-1);
+  memset( t->table, -1, tableSize * sizeof( int32_t ) );
+  return(0);
+}
+
+static void intern_free( struct intern *t )
+{
+  free( t->pool );
+  free( t->offsets );
+  free( t->lengths );
+  free( t->table );
+}
+
+//
+// Return the number of the array 'items' (giving it the next number if
+// it is new), or -1 if memory ran out or the table is full.
+//
+static int intern( struct intern *t, const int32_t *items, int n )
+{
+  size_t slot = hash_ints( items, n ) & ( t->tableSize - 1 );
+  int32_t *pool;
+  size_t poolSize;
+  int capacity;
+  int id;
+
+  while( ( id = t->table[slot] ) >= 0 )
+  {
+    if( t->lengths[id] == n &&
+        memcmp( t->pool + t->offsets[id], items, n * sizeof( int32_t ) ) == 0 )
+      return(id);
+    slot = ( slot + 1 ) & ( t->tableSize - 1 );
+  }
+  if( (size_t)t->count * 2 >= t->tableSize )
+    return(-1);
+
+  if( t->poolUsed + n > t->poolSize )
+  {
+    poolSize = t->poolSize ? t->poolSize : 4096;
+    while( poolSize < t->poolUsed + n )
+      poolSize *= 2;
+    if( ( pool = realloc( t->pool, poolSize * sizeof( int32_t ) ) ) == NULL )
+      return(-1);
+    t->pool = pool;
+    t->poolSize = poolSize;
+  }
+  capacity = t->capacity;
+  if( grow( (void **)&t->offsets, &capacity, t->count + 1, sizeof( size_t ) ) != 0 ||
+      ( capacity = t->capacity,
+        grow( (void **)&t->lengths, &capacity, t->count + 1, sizeof( int32_t ) ) ) != 0 )
+    return(-1);
+  t->capacity = capacity;
+
+  memcpy( t->pool + t->poolUsed, items, n * sizeof( int32_t ) );
+  t->offsets[t->count] = t->poolUsed;
+  t->lengths[t->count] = n;
+  t->poolUsed += n;
+  t->table[slot] = t->count;
+  return( t->count++ );
+}
+
+static int compare_ints( const void *a, const void *b )
+{
+  int32_t x = *(const int32_t *)a, y = *(const int32_t *)b;
+
+  return ( x > y ) - ( x < y );
+}
+
+//
+// Add position 'pos' and those reachable from it without reading a
+// character (past repeating elements) to 'out', leaving out the start
+// positions, which every state has anyway, and any already marked
+// with 'stamp'.
+//
+static int close_over( const struct nfa *n, int pos, int32_t *out, int count,
+                       uint32_t *mark, uint32_t stamp )
+{
+  for( ;; )
+  {
+    if( !n->isStart[pos] && mark[pos] != stamp )
+    {
+      mark[pos] = stamp;
+      out[count++] = pos;
+    }
+    if( n->set[pos] < 0 || !n->repeat[pos] )
+      return(count);
+    pos++;
+  }
+}
+
+// Characters in the same column are in exactly the same sets.
+static void make_columns( struct jcpattern *p, const struct nfa *n )
+{
+  int split[2][256];
+  int s, c, count;
+
+  memset( p->classes, 0, sizeof( p->classes ) );
+  p->numClasses = 1;
+  for( s = 0; s < n->numSets; s++ )
+  {
+    memset( split, -1, sizeof( split ) );
+    count = 0;
+    for( c = 0; c < 256; c++ )
+    {
+      int *column = &split[n->sets[s][c]][p->classes[c]];
+      if( *column < 0 )
+        *column = count++;
+      p->classes[c] = *column;
+    }
+    p->numClasses = count;
+  }
+}
+
+//
+// Build the (unminimised) DFA. On success p->next and p->accept hold
+// p->numStates states; state 0 is the start.
+//
+static int build_dfa( struct jcpattern *p, const struct nfa *n )
+{
+  struct intern states;
+  int32_t *step = NULL, *startStep = NULL, *startCount = NULL;
+  int32_t *members;
+  uint32_t *mark = NULL;
+  uint32_t stamp = 0;
+  int representative[256];
+  int capacity = 0;
+  int result = -1;
+  int s, c, i, pos, count, id, g;
+
+  memset( &states, 0, sizeof( states ) );
+  for( c = 255; c >= 0; c-- )
+    representative[p->classes[c]] = c;
+
+  // Where the start positions go on each column.
+  startStep = malloc( (size_t)p->numClasses * n->count * sizeof( int32_t ) );
+  startCount = calloc( p->numClasses, sizeof( int32_t ) );
+  step = malloc( (size_t)n->count * sizeof( int32_t ) + sizeof( int32_t ) );
+  mark = calloc( n->count, sizeof( uint32_t ) );
+  if( startStep == NULL || startCount == NULL || step == NULL || mark == NULL ||
+      intern_init( &states, 1 << 16 ) != 0 )
+    goto done;
+
+  for( c = 0; c < p->numClasses; c++ )
+  {
+    int32_t *out = startStep + (size_t)c * n->count;
+    stamp++;
+    for( pos = 0; pos < n->count; pos++ )
+      if( n->isStart[pos] && n->set[pos] >= 0 &&
+          n->sets[n->set[pos]][representative[c]] )
+        startCount[c] = close_over( n, n->repeat[pos] ? pos : pos + 1,
+                                    out, startCount[c], mark, stamp );
+  }
+
+  p->numStates = 0;
+  if( intern( &states, step, 0 ) != 0 )
+    goto done;
+
+  for( s = 0; s < states.count; s++ )
+  {
+    if( states.count > JCP_MAX_STATES )
+      goto done;
+    if( grow( (void **)&p->next, &capacity, states.count * p->numClasses,
+              sizeof( int32_t ) ) != 0 )
+      goto done;
+
+    for( c = 0; c < p->numClasses; c++ )
+    {
+      members = states.pool + states.offsets[s];
+      count = 0;
+      stamp++;
+      for( i = 0; i < startCount[c]; i++ )
+      {
+        pos = startStep[(size_t)c * n->count + i];
+        mark[pos] = stamp;
+        step[count++] = pos;
+      }
+      for( i = 0; i < states.lengths[s]; i++ )
+      {
+        pos = members[i];
+        if( n->set[pos] >= 0 && n->sets[n->set[pos]][representative[c]] )
+          count = close_over( n, n->repeat[pos] ? pos : pos + 1, step, count,
+                              mark, stamp );
+      }
+      qsort( step, count, sizeof( int32_t ), compare_ints );
+
+      // The table may have to grow to take a new state.
+      if( (size_t)states.count * 2 + 2 >= states.tableSize )
+      {
+        struct intern bigger;
+        if( intern_init( &bigger, states.tableSize * 4 ) != 0 )
+          goto done;
+        for( i = 0; i < states.count; i++ )
+          if( intern( &bigger, states.pool + states.offsets[i], states.lengths[i] ) != i )
+          {
+            intern_free( &bigger );
+            goto done;
+          }
+        intern_free( &states );
+        states = bigger;
+      }
+      if( ( id = intern( &states, step, count ) ) < 0 )
+        goto done;
+      p->next[(size_t)s * p->numClasses + c] = id;
+    }
+  }
+
+  // What each state accepts: the first entry of each list.
+  p->numStates = states.count;
+  if( ( p->accept = malloc( (size_t)p->numStates * JCP_GROUPS * sizeof( int32_t ) ) ) == NULL )
+    goto done;
+  for( s = 0; s < p->numStates; s++ )
+  {
+    int32_t *a = &p->accept[s * JCP_GROUPS];
+    for( g = 0; g < JCP_GROUPS; g++ )
+      a[g] = -1;
+    members = states.pool + states.offsets[s];
+    for( i = 0; i < states.lengths[s]; i++ )
+    {
+      pos = members[i];
+      g = n->group[pos];
+      if( n->set[pos] < 0 && ( a[g] < 0 || n->rule[pos] < a[g] ) )
+        a[g] = n->rule[pos];
+    }
+  }
+  result = 0;
+
+done:
+  intern_free( &states );
+  free( mark );
+  free( step );
+  free( startStep );
+  free( startCount );
+  return(result);
+}
+
+//
+// Merge states that cannot be told apart by what they accept on any
+// input (Moore's algorithm). The start state stays state 0.
+//
+static int minimise( struct jcpattern *p )
+{
+  struct intern blocks;
+  int32_t *block, *newBlock, *signature;
+  int32_t *next, *accept;
+  int numBlocks = 0, previous;
+  int k = p->numClasses;
+  int result = -1;
+  size_t tableSize = 1;
+  int s, c, b;
+
+  while( tableSize < (size_t)p->numStates * 4 )
+    tableSize *= 2;
+  block = malloc( p->numStates * sizeof( int32_t ) );
+  newBlock = malloc( p->numStates * sizeof( int32_t ) );
+  signature = malloc( ( k + JCP_GROUPS ) * sizeof( int32_t ) );
+  if( block == NULL || newBlock == NULL || signature == NULL )
+    goto done;
+
+  // Start with the states grouped by what they accept.
+  if( intern_init( &blocks, tableSize ) != 0 )
+    goto done;
+  for( s = 0; s < p->numStates; s++ )
+    block[s] = intern( &blocks, &p->accept[s * JCP_GROUPS], JCP_GROUPS );
+  numBlocks = blocks.count;
+  intern_free( &blocks );
+
+  // Split blocks until no state goes to a different block than
+  // another state in its block on some column.
+  do
+  {
+    previous = numBlocks;
+    if( intern_init( &blocks, tableSize ) != 0 )
+      goto done;
+    for( s = 0; s < p->numStates; s++ )
+    {
+      signature[0] = block[s];
+      for( c = 0; c < k; c++ )
+        signature[c + 1] = block[p->next[(size_t)s * k + c]];
+      newBlock[s] = intern( &blocks, signature, k + 1 );
+    }
+    numBlocks = blocks.count;
+    intern_free( &blocks );
+    memcpy( block, newBlock, p->numStates * sizeof( int32_t ) );
+  } while( numBlocks != previous );
+
+  // Blocks are numbered in order of their first state, so the start
+  // state's block is 0.
+  next = malloc( (size_t)numBlocks * k * sizeof( int32_t ) );
+  accept = malloc( (size_t)numBlocks * JCP_GROUPS * sizeof( int32_t ) );
+  if( next == NULL || accept == NULL )
+  {
+    free( next );
+    free( accept );
+    goto done;
+  }
+  for( s = 0; s < p->numStates; s++ )
+  {
+    b = block[s];
+    for( c = 0; c < k; c++ )
+      next[(size_t)b * k + c] = block[p->next[(size_t)s * k + c]];
+    memcpy( &accept[b * JCP_GROUPS], &p->accept[s * JCP_GROUPS],
+            JCP_GROUPS * sizeof( int32_t ) );
+  }
+  free( p->next );
+  free( p->accept );
+  p->next = next;
+  p->accept = accept;
+  p->numStates = numBlocks;
+  result = 0;
+
+done:
+  free( block );
+  free( newBlock );
+  free( signature );
+  return(result);
+}
+
+//
+// Compile the lists ('white' may be NULL). Returns 0 on success or -1
+// if the automaton would be too big or memory ran out; the lists are
+// then checked one entry at a time. Either way, free the result with
+// jcpattern_free(), and keep the lists until then.
+//
+int jcpattern_compile( struct jcpattern *p, const struct jclist *white,
+                       const struct jclist *black )
+{
+  struct nfa n;
+  int g, i;
+
+  memset( p, 0, sizeof( *p ) );
+  memset( &n, 0, sizeof( n ) );
+  p->lists[JCP_WHITE] = white;
+  p->lists[JCP_BLACK] = black;
+
+  for( g = 0; g < JCP_GROUPS; g++ )
+    for( i = 0; p->lists[g] != NULL && i < p->lists[g]->count; i++ )
+      if( add_entry( &n, p->lists[g]->entries[i].pattern, g, i ) != 0 )
+        goto failed;
+
+  make_columns( p, &n );
+  if( build_dfa( p, &n ) != 0 || minimise( p ) != 0 )
+    goto failed;
+  free_nfa( &n );
+  return(0);
+
+failed:
+  free_nfa( &n );
+  free( p->next );
+  free( p->accept );
+  p->next = p->accept = NULL;
+  p->numStates = 0;
+  return(-1);
+}
+
+//
+// Find the first entry of each list that matches the caller ID
+// string: rules[JCP_WHITE] and rules[JCP_BLACK] are entry indexes,
+// or -1.
+//
+void jcpattern_run( const struct jcpattern *p, const char *callstr,
+                    int rules[JCP_GROUPS] )
+{
+  const unsigned char *c = (const unsigned char *)callstr;
+  const int32_t *a;
+  int32_t best[JCP_GROUPS] = { INT32_MAX, INT32_MAX };
+  int32_t s = 0;
+  int g;
+
+  if( p->numStates == 0 )
+  {
+    for( g = 0; g < JCP_GROUPS; g++ )
+      rules[g] = p->lists[g] ? jclist_match( p->lists[g], callstr ) : -1;
+    return;
+  }
+
+  for( ; *c; c++ )
+  {
+    s = p->next[(size_t)s * p->numClasses + p->classes[*c]];
+    a = &p->accept[s * JCP_GROUPS];
+    if( a[JCP_WHITE] >= 0 && a[JCP_WHITE] < best[JCP_WHITE] )
+      best[JCP_WHITE] = a[JCP_WHITE];
+    if( a[JCP_BLACK] >= 0 && a[JCP_BLACK] < best[JCP_BLACK] )
+      best[JCP_BLACK] = a[JCP_BLACK];
+  }
+
+  for( g = 0; g < JCP_GROUPS; g++ )
+    rules[g] = ( best[g] == INT32_MAX ) ? -1 : best[g];
+}
+
+//
+// Decide a call the way jclist_verdict() does, in one pass.
+//
+int jcpattern_verdict( const struct jcpattern *p, const char *callstr, int *rule )
+{
+  int rules[JCP_GROUPS];
+
+  jcpattern_run( p, callstr, rules );
+  if( rules[JCP_WHITE] >= 0 )
+  {
+    *rule = rules[JCP_WHITE];
+    return(JCL_SAFE);
+  }
+  *rule = rules[JCP_BLACK];
+  return( *rule >= 0 ? JCL_BLOCKED : JCL_NEUTRAL );
+}
+
+void jcpattern_free( struct jcpattern *p )
+{
+  free( p->next );
+  free( p->accept );
+  memset( p, 0, sizeof( *p ) );
+}
@@ -0,0 +1,61 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: jcpattern.h
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	The whitelist and blacklist compiled into one minimised DFA. Every
+ *	entry of both lists, literal or anchored (see jclist.h), becomes
+ *	part of a single automaton that reads the caller ID string once,
+ *	one table lookup per character, however many entries there are.
+ *	Each state records the first entry of each list that has matched
+ *	when it is reached, so the result is the same as checking the
+ *	entries one by one in file order (jclist_match()).
+ *
+ *	Characters that no entry tells apart share a column of the
+ *	transition table. If the automaton would be too big, compiling
+ *	fails and jcpattern_run() falls back to checking entries in turn.
+ */
+#ifndef JCPATTERN_H
+#define JCPATTERN_H
+
+#include <stdint.h>
+
+#include "jclist.h"
+
+#define JCP_WHITE        0
+#define JCP_BLACK        1
+#define JCP_GROUPS       2
+#define JCP_MAX_STATES   200000
+
+struct jcpattern
+{
+  const struct jclist *lists[JCP_GROUPS];   // not copied: keep them
+  int numStates;                 // 0 if compiling failed
+  int numClasses;
+  unsigned char classes[256];    // character -> column
+  int32_t *next;                 // [state * numClasses + column]
+  int32_t *accept;               // [state * JCP_GROUPS + group]: entry, or -1
+};
+
+int jcpattern_compile( struct jcpattern *p, const struct jclist *white,
+                       const struct jclist *black );
+void jcpattern_run( const struct jcpattern *p, const char *callstr,
+                    int rules[JCP_GROUPS] );
+int jcpattern_verdict( const struct jcpattern *p, const char *callstr, int *rule );
+void jcpattern_free( struct jcpattern *p );
+
+#endif
@@ -0,0 +1,154 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: jcplay.c
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	Description:
+ *	The intercept message (see jcplay.h). All the work of making the
+ *	audio is done by jcplay_build_sit() at startup; playing it is
+ *	just writing a buffer. jcblock calls jcplay_write() whenever the
+ *	port has room, so the modem's buffer stays full and the playback
+ *	can't run dry, while (RTS/CTS) flow control sets the pace; if the
+ *	modem stops taking data, jcplay_cancel() ends the playback.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+
+#include "jcplay.h"
+
+#define DLE        0x10
+#define ETX        0x03
+#define CAN        0x18
+#define AMPLITUDE  48.0             // of 127: about -9 dB
+#define RAMP_MS    5                // rise and fall of each tone
+
+// The intercept (IC) SIT: three tones, short, short, long.
+static const struct { double freq; int ms; } sitTones[] =
+{
+  { 913.8, 274 }, { 1370.6, 274 }, { 1776.7, 380 }
+};
+#define SIT_GAP_MS  1000            // silence after each repeat
+
+static int append_tone( unsigned char *out, int pos, double freq, int ms )
+{
+  int n = JCPLAY_RATE * ms / 1000;
+  int ramp = JCPLAY_RATE * RAMP_MS / 1000;
+  double gain;
+  int i;
+
+  for( i = 0; i < n; i++ )
+  {
+    gain = 1.0;
+    if( i < ramp )
+      gain = (double)i / ramp;
+    else if( n - i < ramp )
+      gain = (double)( n - i ) / ramp;
+    out[pos++] = 128 + (int)lrint( AMPLITUDE * gain *
+                                   sin( 2.0 * M_PI * freq * i / JCPLAY_RATE ) );
+  }
+  return pos;
+}
+
+//
+// Build the SIT, 'repeats' times over, with DLE escapes and the final
+// DLE ETX in place. Returns 0 on success.
+//
+int jcplay_build_sit( struct jcplay_message *msg, int repeats )
+{
+  unsigned char *samples;
+  size_t n = 0;
+  size_t i, j;
+  int r, t;
+
+  memset( msg, 0, sizeof( *msg ) );
+  for( t = 0; t < sizeof( sitTones ) / sizeof( sitTones[0] ); t++ )
+    n += JCPLAY_RATE * sitTones[t].ms / 1000;
+  n = ( n + JCPLAY_RATE * SIT_GAP_MS / 1000 ) * repeats;
+
+  if( ( samples = malloc( n ) ) == NULL )
+    return(-1);
+  for( i = 0, r = 0; r < repeats; r++ )
+  {
+    for( t = 0; t < sizeof( sitTones ) / sizeof( sitTones[0] ); t++ )
+      i = append_tone( samples, i, sitTones[t].freq, sitTones[t].ms );
+    memset( samples + i, 128, JCPLAY_RATE * SIT_GAP_MS / 1000 );
+    i += JCPLAY_RATE * SIT_GAP_MS / 1000;
+  }
+
+  // At worst every sample is a DLE
+  if( ( msg->bytes = malloc( 2 * n + 2 ) ) == NULL )
+  {
+    free( samples );
+    return(-1);
+  }
+  for( i = 0, j = 0; i < n; i++ )
+  {
+    if( samples[i] == DLE )
+      msg->bytes[j++] = DLE;
+    msg->bytes[j++] = samples[i];
+  }
+  msg->bytes[j++] = DLE;
+  msg->bytes[j++] = ETX;
+  msg->length = j;
+  msg->samples = n;
+  free( samples );
+  return(0);
+}
+
+//
+// Write as much more of the message as the modem will take now. The
+// port must be non-blocking and the modem in AT+VTX; '*done' counts
+// the bytes written so far, and the message is all written once it
+// reaches msg->length. Returns 0, or -1 on an error.
+//
+int jcplay_write( int fd, const struct jcplay_message *msg, size_t *done )
+{
+  ssize_t n;
+
+  while( *done < msg->length )
+  {
+    n = write( fd, msg->bytes + *done, msg->length - *done );
+    if( n > 0 )
+      *done += n;
+    else if( n == 0 || errno == EAGAIN )
+      return(0);
+    else if( errno != EINTR )
+    {
+      perror( "jcplay: write" );
+      return(-1);
+    }
+  }
+  return(0);
+}
+
+//
+// Ask the modem to drop what it has of the message and leave AT+VTX.
+//
+void jcplay_cancel( int fd )
+{
+  static const unsigned char cancel[] = { DLE, CAN, DLE, ETX };
+
+  if( write( fd, cancel, sizeof( cancel ) ) != sizeof( cancel ) )
+    printf("jcplay: couldn't cancel playback\n");
+}
+
+void jcplay_free( struct jcplay_message *msg )
+{
+  free( msg->bytes );
+  memset( msg, 0, sizeof( *msg ) );
+}
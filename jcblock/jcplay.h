@@ -0,0 +1,43 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: jcplay.h
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	The intercept message jcblockAT.c plays to blocked callers (-s):
+ *	the special information tones (SIT) that precede a "number
+ *	disconnected" announcement. Autodialers that hear them commonly
+ *	drop the number. The message is built once, at startup, as the
+ *	bytes to send after AT+VTX: 8 bit unsigned samples at 8000 per
+ *	second with every DLE already doubled, ending in DLE ETX.
+ */
+#ifndef JCPLAY_H
+#define JCPLAY_H
+
+#include <stddef.h>
+
+#define JCPLAY_RATE   8000          // samples per second
+
+struct jcplay_message
+{
+  unsigned char *bytes;             // escaped samples, then DLE ETX
+  size_t length;
+  size_t samples;                   // samples in the message
+};
+
+int jcplay_build_sit( struct jcplay_message *msg, int repeats );
+int jcplay_write( int fd, const struct jcplay_message *msg, size_t *done );
+void jcplay_cancel( int fd );
+void jcplay_free( struct jcplay_message *msg );
+
+#endif
@@ -0,0 +1,417 @@
+/*
+ *	Program name: jcprune
+ *
+ *	File name: jcprune.c
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Description:
+ *	Finds whitelist.dat and blacklist.dat entries that can go, and
+ *	prints the lists without them as a diff (diff -U0 format, which
+ *	patch accepts). The lists themselves are not changed.
+ *
+ *	    redundant   covered by an entry of the same list (jcsubsume.c):
+ *	                removing it changes no verdict, so it is removed
+ *	    shadowed    a blacklist entry covered by a whitelist entry, so
+ *	                it can never block a call
+ *	    overridden  a blacklist entry that matched calls in the history
+ *	                the whitelist let through
+ *	    dead        decided none of the calls in the history (with the
+ *	                redundant entries gone); removed with -d, unless its
+ *	                date is '++++++'
+ *
+ *	Shadowed and overridden entries are only reported: which list is
+ *	wrong is for the user to decide.
+ *
+ *	Compile with:
+ *	    gcc -Wall -O2 -o jcprune jcprune.c jcsubsume.c jcpattern.c jclist.c
+ *
+ *	Usage:
+ *	    jcprune [-w whitelist] [-b blacklist] [-d] [-m] [callerID.dat ...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "jclist.h"
+#include "jcpattern.h"
+#include "jcsubsume.h"
+
+// Why an entry is removed from the minimised list.
+#define KEEP       0
+#define REDUNDANT  1
+#define DEAD       2
+
+struct listfile
+{
+  const char *filename;
+  char *text;
+  size_t length;
+  struct jclist list;
+  int *drop;                     // per entry: KEEP, REDUNDANT or DEAD
+  long *hits;                    // calls decided, replaying the history
+  long *overridden;              // blacklist: matched calls the whitelist took
+  struct jclist kept;            // the entries not dropped as redundant
+  int *keptIndex;                // kept entry -> entry
+};
+
+static struct listfile lists[2];
+static const char *listNames[2] = { "whitelist", "blacklist" };
+
+static int load_list( struct listfile *f )
+{
+  FILE *fp;
+  long size;
+  int n;
+
+  jclist_init( &f->list );
+  jclist_init( &f->kept );
+  if( ( fp = fopen( f->filename, "r" ) ) == NULL )
+    return(-1);
+  if( fseek( fp, 0, SEEK_END ) != 0 || ( size = ftell( fp ) ) < 0 ||
+      fseek( fp, 0, SEEK_SET ) != 0 || ( f->text = malloc( size + 1 ) ) == NULL ||
+      fread( f->text, 1, size, fp ) != (size_t)size )
+  {
+    fclose( fp );
+    return(-1);
+  }
+  fclose( fp );
+  f->length = size;
+  f->text[size] = 0;
+
+  if( jclist_load_buffer( &f->list, f->text, f->length ) != 0 )
+    return(-1);
+  n = f->list.count + 1;
+  if( ( f->drop = calloc( n, sizeof( int ) ) ) == NULL ||
+      ( f->hits = calloc( n, sizeof( long ) ) ) == NULL ||
+      ( f->overridden = calloc( n, sizeof( long ) ) ) == NULL ||
+      ( f->keptIndex = calloc( n, sizeof( int ) ) ) == NULL )
+    return(-1);
+  return(0);
+}
+
+// The entries' records, where a list line starts with one (jcblock
+// reads long lines in pieces; only the first piece can be removed).
+static int record_line( const struct listfile *f, int entry )
+{
+  long offset = f->list.entries[entry].offset;
+
+  return( offset == 0 || f->text[offset - 1] == '\n' );
+}
+
+static int is_permanent( const struct listfile *f, int entry )
+{
+  long offset = f->list.entries[entry].offset;
+
+  return( offset + 25 <= (long)f->length &&
+          strncmp( f->text + offset + 19, "++++++", 6 ) == 0 );
+}
+
+//
+// Replay the calls in a callerID.dat file against the kept entries.
+// Returns the number of calls, or -1 if the file can't be read.
+//
+static long replay( const char *filename, const struct jcpattern *matcher )
+{
+  char line[JCL_RECORD_SIZE * 2];
+  struct jccall call;
+  int rules[JCP_GROUPS];
+  size_t length;
+  long calls = 0;
+  FILE *fp;
+
+  if( ( fp = fopen( filename, "r" ) ) == NULL )
+    return(-1);
+  while( fgets( line, sizeof( line ), fp ) != NULL )
+  {
+    length = strcspn( line, "\n" );
+    line[length] = 0;
+    if( jccall_parse( line, length, &call ) != 0 )
+      continue;
+    calls++;
+
+    // jcblock matches the caller ID string before it writes the
+    // tag character over its first character.
+    line[0] = '-';
+    jcpattern_run( matcher, line, rules );
+    if( rules[JCP_WHITE] >= 0 )
+    {
+      lists[0].hits[lists[0].keptIndex[rules[JCP_WHITE]]]++;
+      if( rules[JCP_BLACK] >= 0 )
+        lists[1].overridden[lists[1].keptIndex[rules[JCP_BLACK]]]++;
+    }
+    else if( rules[JCP_BLACK] >= 0 )
+      lists[1].hits[lists[1].keptIndex[rules[JCP_BLACK]]]++;
+  }
+  fclose( fp );
+  return(calls);
+}
+
+// Print removed lines text[from..to) the way diff does.
+static void print_removed( const char *text, size_t from, size_t to )
+{
+  size_t end;
+
+  for( ; from < to; from = end + 1 )
+  {
+    end = from + strcspn( text + from, "\n" );
+    printf( "-%.*s\n", (int)( end - from ), text + from );
+    if( end >= to )
+    {
+      printf( "\\ No newline at end of file\n" );
+      break;
+    }
+  }
+}
+
+//
+// Print the removed records as a diff -U0 hunk per run of them, or
+// (if 'out' isn't NULL) write the list without them to 'out'.
+//
+static void emit_list( const struct listfile *f, FILE *out )
+{
+  const char *text = f->text;
+  size_t pos, end, runPos = 0;
+  int line, removed = 0;
+  int runStart = 0, runLength = 0;
+  int dropped;
+  int e = 0;
+
+  if( out == NULL )
+    printf( "--- %s\n+++ %s.min\n", f->filename, f->filename );
+  for( pos = 0, line = 1; pos <= f->length; pos = end, line++ )
+  {
+    dropped = 0;
+    end = f->length;
+    if( pos < f->length )
+    {
+      end = pos + strcspn( text + pos, "\n" );
+      if( end < f->length )
+        end++;
+
+      // Is this line the record of a dropped entry?
+      while( e < f->list.count && f->list.entries[e].offset < (long)pos )
+        e++;
+      dropped = ( e < f->list.count && f->list.entries[e].offset == (long)pos &&
+                  f->drop[e] != KEEP );
+    }
+
+    if( dropped )
+    {
+      if( runLength++ == 0 )
+      {
+        runStart = line;
+        runPos = pos;
+      }
+    }
+    else
+    {
+      // A run of removed lines has ended: print it as a hunk.
+      if( runLength > 0 && out == NULL )
+      {
+        printf( "@@ -%d,%d +%d,0 @@\n", runStart, runLength, runStart - 1 - removed );
+        print_removed( text, runPos, pos );
+      }
+      removed += runLength;
+      runLength = 0;
+      if( out != NULL )
+        fwrite( text + pos, 1, end - pos, out );
+    }
+    if( pos == f->length )
+      break;
+  }
+}
+
+static void usage()
+{
+  fprintf( stderr, "Usage: jcprune [-w whitelist] [-b blacklist] [-d] [-m] [callerID.dat ...]\n" );
+  fprintf( stderr, "  -w   whitelist (default ./whitelist.dat)\n" );
+  fprintf( stderr, "  -b   blacklist (default ./blacklist.dat)\n" );
+  fprintf( stderr, "  -d   also remove dead entries (those no call in the history used)\n" );
+  fprintf( stderr, "  -m   write the minimised lists to whitelist.min and blacklist.min\n" );
+  fprintf( stderr, "       (the list file names with .min added)\n" );
+  exit(1);
+}
+
+int main( int argc, char **argv )
+{
+  struct jcsubsume findings;
+  struct jcsub_finding *finding;
+  struct jcpattern matcher;
+  struct listfile *f;
+  char minFile[1024];
+  FILE *fp;
+  long calls = 0, n;
+  int dropDead = 0, writeMin = 0;
+  int haveWhitelist = 1;
+  int count, i, l, optChar;
+
+  lists[0].filename = "./whitelist.dat";
+  lists[1].filename = "./blacklist.dat";
+  while( ( optChar = getopt( argc, argv, "w:b:dmh" ) ) != EOF )
+  {
+    switch( optChar )
+    {
+      case 'w':
+        lists[0].filename = optarg;
+        break;
+
+      case 'b':
+        lists[1].filename = optarg;
+        break;
+
+      case 'd':
+        dropDead = 1;
+        break;
+
+      case 'm':
+        writeMin = 1;
+        break;
+
+      case 'h':
+      default:
+        usage();
+    }
+  }
+
+  // As with jcblock, a whitelist is optional.
+  if( load_list( &lists[0] ) != 0 )
+  {
+    if( errno != ENOENT )
+    {
+      fprintf( stderr, "jcprune: %s: %s\n", lists[0].filename, strerror( errno ) );
+      return(1);
+    }
+    haveWhitelist = 0;
+  }
+  if( load_list( &lists[1] ) != 0 )
+  {
+    fprintf( stderr, "jcprune: %s: %s\n", lists[1].filename, strerror( errno ) );
+    return(1);
+  }
+
+  if( jcsubsume_analyse( &findings, &lists[0].list, &lists[1].list ) != 0 )
+  {
+    fprintf( stderr, "jcprune: out of memory\n" );
+    return(1);
+  }
+
+  printf( "Redundant entries (entry, covered by):\n" );
+  for( i = count = 0; i < findings.count; i++ )
+  {
+    finding = &findings.findings[i];
+    f = &lists[finding->list];
+    if( finding->kind != JCSUB_REDUNDANT || !record_line( f, finding->entry ) )
+      continue;
+    f->drop[finding->entry] = REDUNDANT;
+    printf( "  %s  %-20s  %s\n", listNames[finding->list],
+            f->list.entries[finding->entry].pattern,
+            f->list.entries[finding->by].pattern );
+    count++;
+  }
+  printf( "  (%d)\n", count );
+
+  printf( "\nShadowed blacklist entries (entry, whitelist entry that always wins):\n" );
+  for( i = count = 0; i < findings.count; i++ )
+  {
+    finding = &findings.findings[i];
+    if( finding->kind != JCSUB_SHADOWED )
+      continue;
+    printf( "  %-20s  %s\n", lists[1].list.entries[finding->entry].pattern,
+            lists[0].list.entries[finding->by].pattern );
+    count++;
+  }
+  printf( "  (%d)\n", count );
+
+  // Replay the history against the lists without the redundant entries.
+  if( optind < argc )
+  {
+    for( l = 0; l < 2; l++ )
+    {
+      f = &lists[l];
+      for( i = 0; i < f->list.count; i++ )
+      {
+        if( f->drop[i] != KEEP )
+          continue;
+        f->keptIndex[f->kept.count] = i;
+        if( jclist_add( &f->kept, f->list.entries[i].pattern, f->list.entries[i].offset ) != 0 )
+        {
+          fprintf( stderr, "jcprune: out of memory\n" );
+          return(1);
+        }
+      }
+    }
+    if( jcpattern_compile( &matcher, &lists[0].kept, &lists[1].kept ) != 0 )
+      fprintf( stderr, "jcprune: lists too big to compile; checking entries in turn\n" );
+
+    for( i = optind; i < argc; i++ )
+    {
+      if( ( n = replay( argv[i], &matcher ) ) < 0 )
+      {
+        fprintf( stderr, "jcprune: %s: %s\n", argv[i], strerror( errno ) );
+        return(1);
+      }
+      calls += n;
+    }
+
+    printf( "\nOverridden blacklist entries (calls the whitelist let through, entry):\n" );
+    for( i = count = 0; i < lists[1].list.count; i++ )
+    {
+      if( lists[1].overridden[i] > 0 )
+      {
+        printf( "  %8ld  %s\n", lists[1].overridden[i], lists[1].list.entries[i].pattern );
+        count++;
+      }
+    }
+    printf( "  (%d)\n", count );
+
+    printf( "\nDead entries (none of the %ld calls replayed used them):\n", calls );
+    for( l = count = 0; l < 2; l++ )
+    {
+      f = &lists[l];
+      for( i = 0; i < f->list.count; i++ )
+      {
+        if( f->drop[i] != KEEP || f->hits[i] > 0 )
+          continue;
+        printf( "  %s  %s%s\n", listNames[l], f->list.entries[i].pattern,
+                is_permanent( f, i ) ? "  (permanent)" : "" );
+        if( dropDead && !is_permanent( f, i ) && record_line( f, i ) )
+          f->drop[i] = DEAD;
+        count++;
+      }
+    }
+    printf( "  (%d)\n", count );
+  }
+
+  for( l = haveWhitelist ? 0 : 1; l < 2; l++ )
+  {
+    f = &lists[l];
+    printf( "\n" );
+    emit_list( f, NULL );
+    if( !writeMin )
+      continue;
+    snprintf( minFile, sizeof( minFile ), "%s.min", f->filename );
+    if( ( fp = fopen( minFile, "w" ) ) == NULL )
+    {
+      fprintf( stderr, "jcprune: %s: %s\n", minFile, strerror( errno ) );
+      return(1);
+    }
+    emit_list( f, fp );
+    fclose( fp );
+  }
+  return(0);
+}
@@ -0,0 +1,389 @@
+/*
+ *	Program name: jcquery
+ *
+ *	File name: jcquery.c
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Description:
+ *	Asks jcblock's verdict service (jcblock -u, see jcservice.h) what
+ *	it would do with calls from the numbers given, all in one write,
+ *	and prints the answers.
+ *
+ *	With -b, loads the service instead: 'count' queries from -c
+ *	clients, each keeping -d queries unanswered (sending another as
+ *	each answer comes), and reports the queries answered a second and
+ *	how long answers took. The queries are for the numbers given, in
+ *	turn, or random ten digit numbers if none are.
+ *
+ *	Compile with:
+ *	    gcc -Wall -O2 -o jcquery jcquery.c
+ *
+ *	Usage:
+ *	    jcquery [-u socket] [-n name] number ...
+ *	    jcquery [-u socket] -b count [-c clients] [-d depth] [number ...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "jclist.h"
+#include "jcservice.h"
+
+#define MAX_DEPTH     1000       // unanswered queries a client, so writes never wait on jcblock
+#define QUERY_SIZE    ( sizeof( struct jcservice_query ) + 2 * 255 )
+
+struct client
+{
+  int fd;
+  long sent, answered;
+  unsigned char in[MAX_DEPTH * sizeof( struct jcservice_answer )];
+  size_t inUsed;
+};
+
+static const char *name = "";
+static char **numbers;
+static int numNumbers;
+static uint64_t randomState = 88172645463325252ULL;
+
+static double now( void )
+{
+  struct timespec t;
+
+  clock_gettime( CLOCK_MONOTONIC, &t );
+  return( t.tv_sec + t.tv_nsec / 1e9 );
+}
+
+static int connect_service( const char *path )
+{
+  struct sockaddr_un addr;
+  int fd;
+
+  memset( &addr, 0, sizeof( addr ) );
+  addr.sun_family = AF_UNIX;
+  strncpy( addr.sun_path, path, sizeof( addr.sun_path ) - 1 );
+  if( ( fd = socket( AF_UNIX, SOCK_STREAM, 0 ) ) < 0 ||
+      connect( fd, (struct sockaddr *)&addr, sizeof( addr ) ) != 0 )
+  {
+    fprintf( stderr, "jcquery: %s: %s\n", path, strerror( errno ) );
+    return(-1);
+  }
+  return(fd);
+}
+
+// Append a query for 'nmbr' to 'buffer', returning its size.
+static size_t make_query( unsigned char *buffer, uint32_t id, const char *nmbr )
+{
+  struct jcservice_query q;
+  size_t nmbrLength = strlen( nmbr ), nameLength = strlen( name );
+
+  if( nmbrLength > 255 )
+    nmbrLength = 255;
+  if( nameLength > 255 )
+    nameLength = 255;
+  memset( &q, 0, sizeof( q ) );
+  q.id = id;
+  q.nmbrLength = nmbrLength;
+  q.nameLength = nameLength;
+  memcpy( buffer, &q, sizeof( q ) );
+  memcpy( buffer + sizeof( q ), nmbr, nmbrLength );
+  memcpy( buffer + sizeof( q ) + nmbrLength, name, nameLength );
+  return( sizeof( q ) + nmbrLength + nameLength );
+}
+
+static int write_all( int fd, const unsigned char *buffer, size_t size )
+{
+  ssize_t n;
+
+  while( size > 0 )
+  {
+    if( ( n = write( fd, buffer, size ) ) < 0 )
+    {
+      if( errno == EINTR )
+        continue;
+      return(-1);
+    }
+    buffer += n;
+    size -= n;
+  }
+  return(0);
+}
+
+static const char *verdict_name( int verdict )
+{
+  return( verdict == JCL_SAFE ? "accepted" : verdict == JCL_BLOCKED ? "blocked" : "neutral" );
+}
+
+static int query_numbers( const char *path )
+{
+  unsigned char *buffer;
+  struct jcservice_answer a;
+  size_t size = 0;
+  ssize_t n;
+  int fd, i;
+
+  if( ( fd = connect_service( path ) ) < 0 )
+    return(1);
+  if( ( buffer = malloc( numNumbers * QUERY_SIZE ) ) == NULL )
+  {
+    fprintf( stderr, "jcquery: out of memory\n" );
+    return(1);
+  }
+  for( i = 0; i < numNumbers; i++ )
+    size += make_query( buffer + size, i, numbers[i] );
+  if( write_all( fd, buffer, size ) != 0 )
+  {
+    fprintf( stderr, "jcquery: write: %s\n", strerror( errno ) );
+    return(1);
+  }
+
+  for( i = 0; i < numNumbers; i++ )
+  {
+    // Answers are small enough to arrive whole.
+    if( ( n = recv( fd, &a, sizeof( a ), MSG_WAITALL ) ) != sizeof( a ) )
+    {
+      fprintf( stderr, "jcquery: no answer from jcblock\n" );
+      return(1);
+    }
+    printf( "%s: %s", numbers[a.id], verdict_name( a.verdict ) );
+    if( a.list == JCSERVICE_WHITE )
+      printf( " by whitelist entry %d", a.rule + 1 );
+    else if( a.list == JCSERVICE_BLACK )
+      printf( " by blacklist entry %d", a.rule + 1 );
+    else if( a.list == JCSERVICE_IMPORTED )
+      printf( " as an imported number" );
+    printf( " (lists %u)\n", a.generation );
+  }
+  free( buffer );
+  close( fd );
+  return(0);
+}
+
+static int compare_doubles( const void *a, const void *b )
+{
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return( x < y ? -1 : x > y );
+}
+
+//
+// Send 'client' up to 'count' more queries, in one write.
+//
+static int send_queries( struct client *c, int count, double *sentAt )
+{
+  static unsigned char buffer[MAX_DEPTH * QUERY_SIZE];
+  char random[16];
+  const char *nmbr;
+  size_t size = 0;
+  uint32_t id;
+  double t;
+  int i;
+
+  t = now();
+  for( i = 0; i < count; i++ )
+  {
+    id = c->sent++;
+    if( numNumbers > 0 )
+      nmbr = numbers[id % numNumbers];
+    else
+    {
+      randomState ^= randomState << 13;
+      randomState ^= randomState >> 7;
+      randomState ^= randomState << 17;
+      sprintf( random, "%010llu", (unsigned long long)( 2000000000ULL + randomState % 8000000000ULL ) );
+      nmbr = random;
+    }
+    size += make_query( buffer + size, id, nmbr );
+    sentAt[id] = t;
+  }
+  return( write_all( c->fd, buffer, size ) );
+}
+
+static int load_service( const char *path, long count, int numClients, int depth )
+{
+  struct client *clients;
+  struct pollfd *fds;
+  struct jcservice_answer a;
+  double **sentAt, *latencies, start, seconds, t;
+  long perClient = ( count + numClients - 1 ) / numClients;
+  long answered = 0, verdicts[3] = { 0, 0, 0 }, outOfOrder = 0, n;
+  size_t pos;
+  int i;
+
+  clients = calloc( numClients, sizeof( *clients ) );
+  fds = calloc( numClients, sizeof( *fds ) );
+  sentAt = calloc( numClients, sizeof( *sentAt ) );
+  latencies = malloc( numClients * perClient * sizeof( *latencies ) );
+  if( clients == NULL || fds == NULL || sentAt == NULL || latencies == NULL )
+  {
+    fprintf( stderr, "jcquery: out of memory\n" );
+    return(1);
+  }
+  for( i = 0; i < numClients; i++ )
+  {
+    if( ( sentAt[i] = malloc( perClient * sizeof( double ) ) ) == NULL )
+    {
+      fprintf( stderr, "jcquery: out of memory\n" );
+      return(1);
+    }
+    if( ( clients[i].fd = connect_service( path ) ) < 0 )
+      return(1);
+    fds[i].fd = clients[i].fd;
+    fds[i].events = POLLIN;
+  }
+
+  start = now();
+  for( i = 0; i < numClients; i++ )
+  {
+    if( send_queries( &clients[i], depth < perClient ? depth : perClient, sentAt[i] ) != 0 )
+    {
+      fprintf( stderr, "jcquery: write: %s\n", strerror( errno ) );
+      return(1);
+    }
+  }
+
+  while( answered < numClients * perClient )
+  {
+    if( poll( fds, numClients, -1 ) < 0 )
+    {
+      if( errno == EINTR )
+        continue;
+      fprintf( stderr, "jcquery: poll: %s\n", strerror( errno ) );
+      return(1);
+    }
+    for( i = 0; i < numClients; i++ )
+    {
+      struct client *c = &clients[i];
+
+      if( fds[i].revents == 0 )
+        continue;
+      n = read( c->fd, c->in + c->inUsed, sizeof( c->in ) - c->inUsed );
+      if( n <= 0 )
+      {
+        fprintf( stderr, "jcquery: jcblock closed the connection\n" );
+        return(1);
+      }
+      c->inUsed += n;
+      t = now();
+      for( pos = 0; c->inUsed - pos >= sizeof( a ); pos += sizeof( a ) )
+      {
+        memcpy( &a, c->in + pos, sizeof( a ) );
+        if( a.id != c->answered )
+          outOfOrder++;
+        if( a.id < perClient )
+          latencies[answered] = t - sentAt[i][a.id];
+        if( a.verdict < 3 )
+          verdicts[a.verdict]++;
+        c->answered++;
+        answered++;
+      }
+      memmove( c->in, c->in + pos, c->inUsed - pos );
+      c->inUsed -= pos;
+
+      // Keep 'depth' queries unanswered.
+      n = pos / sizeof( a );
+      if( n > perClient - c->sent )
+        n = perClient - c->sent;
+      if( n > 0 && send_queries( c, n, sentAt[i] ) != 0 )
+      {
+        fprintf( stderr, "jcquery: write: %s\n", strerror( errno ) );
+        return(1);
+      }
+    }
+  }
+  seconds = now() - start;
+
+  qsort( latencies, answered, sizeof( *latencies ), compare_doubles );
+  printf( "%ld queries from %d clients, %d deep, in %.3f seconds: %.0f queries a second\n",
+          answered, numClients, depth, seconds, answered / seconds );
+  printf( "  answered in: median %.1f, 99%% %.1f, 99.9%% %.1f, max %.1f microseconds\n",
+          latencies[answered / 2] * 1e6, latencies[answered * 99 / 100] * 1e6,
+          latencies[answered * 999 / 1000] * 1e6, latencies[answered - 1] * 1e6 );
+  printf( "  %ld accepted, %ld blocked, %ld neutral", verdicts[JCL_SAFE],
+          verdicts[JCL_BLOCKED], verdicts[JCL_NEUTRAL] );
+  if( outOfOrder > 0 )
+    printf( "; %ld answers out of order!", outOfOrder );
+  printf( "\n" );
+  return( outOfOrder > 0 );
+}
+
+int main( int argc, char **argv )
+{
+  const char *path = JCSERVICE_SOCKET;
+  long count = 0;
+  int numClients = 1, depth = 64;
+  int optChar;
+
+  while( ( optChar = getopt( argc, argv, "u:n:b:c:d:h" ) ) != EOF )
+  {
+    switch( optChar )
+    {
+      case 'u':
+        path = optarg;
+        break;
+
+      case 'n':
+        name = optarg;
+        break;
+
+      case 'b':
+        count = atol( optarg );
+        break;
+
+      case 'c':
+        numClients = atoi( optarg );
+        break;
+
+      case 'd':
+        depth = atoi( optarg );
+        break;
+
+      case 'h':
+      default:
+        fprintf( stderr, "Usage: jcquery [-u socket] [-n name] number ...\n" );
+        fprintf( stderr, "       jcquery [-u socket] -b count [-c clients] [-d depth] [number ...]\n" );
+        fprintf( stderr, "  -u   jcblock's socket (default %s)\n", JCSERVICE_SOCKET );
+        fprintf( stderr, "  -n   the caller's name (default none)\n" );
+        fprintf( stderr, "  -b   load the service with 'count' queries\n" );
+        fprintf( stderr, "  -c   clients (default 1, at most %d)\n", JCSERVICE_CLIENTS );
+        fprintf( stderr, "  -d   unanswered queries a client (default 64, at most %d)\n", MAX_DEPTH );
+        return(1);
+    }
+  }
+  numbers = argv + optind;
+  numNumbers = argc - optind;
+
+  if( count > 0 )
+  {
+    if( numClients < 1 || numClients > JCSERVICE_CLIENTS || depth < 1 || depth > MAX_DEPTH )
+    {
+      fprintf( stderr, "jcquery: -c must be 1 to %d and -d 1 to %d\n", JCSERVICE_CLIENTS, MAX_DEPTH );
+      return(1);
+    }
+    return load_service( path, count, numClients, depth );
+  }
+  if( numNumbers == 0 )
+  {
+    fprintf( stderr, "Usage: jcquery [-u socket] [-n name] number ...\n" );
+    return(1);
+  }
+  return query_numbers( path );
+}
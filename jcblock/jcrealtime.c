@@ -0,0 +1,145 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: jcrealtime.c
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Description:
+ *	Real-time mode (see jcrealtime.h). SCHED_FIFO needs root or
+ *	CAP_SYS_NICE, and locking more than RLIMIT_MEMLOCK needs root or
+ *	CAP_IPC_LOCK; each step is tried even if one before it failed.
+ */
+#define _GNU_SOURCE             // CPU_SET(), RUSAGE_THREAD
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "jcrealtime.h"
+
+//
+// Fault in the stack the thread will use, so that its pages are
+// there (and, once mlockall() has been called, locked) before a call
+// needs them.
+//
+static void prefault_stack( long pageSize )
+{
+  volatile unsigned char stack[JCREALTIME_STACK];
+  size_t i;
+
+  for( i = 0; i < sizeof( stack ); i += pageSize )
+    stack[i] = 0;
+}
+
+//
+// Fault in heap for the allocations made while handling calls, and
+// have malloc() keep it rather than give it back to the system.
+//
+static int prefault_heap( long pageSize )
+{
+  unsigned char *heap;
+  size_t i;
+
+  mallopt( M_TRIM_THRESHOLD, -1 );
+  mallopt( M_MMAP_MAX, 0 );
+  if( ( heap = malloc( JCREALTIME_HEAP ) ) == NULL )
+    return(-1);
+  for( i = 0; i < JCREALTIME_HEAP; i += pageSize )
+    heap[i] = 0;
+  free( heap );
+  return(0);
+}
+
+//
+// Lock the program's memory and make the calling thread SCHED_FIFO
+// at 'priority' (if it is not 0), on CPU 'cpu' (if it is not -1).
+// Returns 0 if everything asked for was done.
+//
+int jcrealtime_start( int priority, int cpu )
+{
+  long pageSize = sysconf( _SC_PAGESIZE );
+  struct sched_param param;
+  cpu_set_t cpus;
+  int rc = 0;
+  int err;
+
+  if( mlockall( MCL_CURRENT | MCL_FUTURE ) != 0 )
+  {
+    printf("jcrealtime: mlockall() failed: %s\n", strerror(errno));
+    rc = -1;
+  }
+  prefault_stack( pageSize );
+  if( prefault_heap( pageSize ) != 0 )
+  {
+    printf("jcrealtime: can't fault in the heap\n");
+    rc = -1;
+  }
+
+  if( cpu >= 0 )
+  {
+    CPU_ZERO( &cpus );
+    CPU_SET( cpu, &cpus );
+    if( ( err = pthread_setaffinity_np( pthread_self(), sizeof( cpus ), &cpus ) ) != 0 )
+    {
+      printf("jcrealtime: can't run on CPU %d: %s\n", cpu, strerror(err));
+      rc = -1;
+    }
+  }
+
+  if( priority != 0 )
+  {
+    if( priority < sched_get_priority_min( SCHED_FIFO ) ||
+        priority > sched_get_priority_max( SCHED_FIFO ) )
+    {
+      printf("jcrealtime: priority %d is out of range (%d to %d)\n", priority,
+             sched_get_priority_min( SCHED_FIFO ), sched_get_priority_max( SCHED_FIFO ));
+      return(-1);
+    }
+    memset( &param, 0, sizeof( param ) );
+    param.sched_priority = priority;
+    if( ( err = pthread_setschedparam( pthread_self(), SCHED_FIFO, &param ) ) != 0 )
+    {
+      printf("jcrealtime: can't use SCHED_FIFO: %s\n", strerror(err));
+      rc = -1;
+    }
+  }
+  return(rc);
+}
+
+//
+// The calling thread's page faults and context switches so far.
+//
+void jcrealtime_usage( struct jcrealtime_usage *u )
+{
+  struct rusage ru;
+
+  if( getrusage( RUSAGE_THREAD, &ru ) != 0 )
+  {
+    memset( u, 0, sizeof( *u ) );
+    return;
+  }
+  u->minorFaults = ru.ru_minflt;
+  u->majorFaults = ru.ru_majflt;
+  u->voluntarySwitches = ru.ru_nvcsw;
+  u->involuntarySwitches = ru.ru_nivcsw;
+}
@@ -0,0 +1,55 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: jcrealtime.h
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Real-time mode (jcblockAT.c, DO_REALTIME, options -f and -a). On a
+ *	machine kept busy by other programs (jcadmin under Node, say) the
+ *	scheduler can leave the thread reading the modem and deciding
+ *	calls waiting for a CPU long enough for a blocked call to ring
+ *	twice. jcrealtime_start() makes the calling thread SCHED_FIFO, so
+ *	it runs as soon as the modem's bytes arrive, optionally keeps it to
+ *	one CPU, and locks the program's memory (mlockall) with the stack
+ *	and some heap already faulted in, so that deciding a call doesn't
+ *	wait on a page fault either.
+ *
+ *	Only the calling thread is made real-time: threads started before
+ *	it (the stages, the verdict service) keep the ordinary policy. All
+ *	of the program's memory is locked, their stacks included.
+ *
+ *	jcrealtime_usage() reads the calling thread's page faults and
+ *	context switches so far, for jcblock to count those that happen
+ *	while it decides a call.
+ */
+#ifndef JCREALTIME_H
+#define JCREALTIME_H
+
+#define JCREALTIME_STACK  ( 256 * 1024 )        // stack bytes faulted in
+#define JCREALTIME_HEAP   ( 4 * 1024 * 1024 )   // heap bytes faulted in and kept
+
+struct jcrealtime_usage
+{
+  long minorFaults;             // page faults served without a disk read
+  long majorFaults;             // page faults that read the disk
+  long voluntarySwitches;       // the thread waited (for I/O, say)
+  long involuntarySwitches;     // the thread was preempted
+};
+
+int jcrealtime_start( int priority, int cpu );
+void jcrealtime_usage( struct jcrealtime_usage *u );
+
+#endif
@@ -0,0 +1,402 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: jcrecord.c
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	Description:
+ *	Call recording (see jcrecord.h). The modem sends 8 bit unsigned
+ *	samples with any DLE doubled. jcrecord_read() reads into the free
+ *	space of the ring and runs the DLE decoder over it; the voice
+ *	bytes come back through jcrecord_data() and are moved down over
+ *	the DLE sequences removed, which only costs a copy after the first
+ *	escape in a read. The writer thread is the only other user of the
+ *	ring. It encodes 4 bit IMA ADPCM (half the size of the modem's
+ *	data, and playable by anything that plays WAV files).
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/stat.h>
+
+#include "jcrecord.h"
+
+#define BLOCK_ALIGN        256                        // bytes per ADPCM block
+#define BLOCK_SAMPLES      ( ( BLOCK_ALIGN - 4 ) * 2 + 1 )
+
+// The ring. head is where the reader puts the next byte; tail is
+// the next byte the writer takes. Both only grow. fill is where the
+// byte being unescaped goes, between head and the end of the read.
+static unsigned char ring[JCRECORD_RING];
+static uint64_t head, tail;
+static uint64_t fill;
+static pthread_mutex_t ringLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dataReady = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t spaceReady = PTHREAD_COND_INITIALIZER;
+
+// The recording in progress. The file is opened by jcrecord_start()
+// and finished (and closed) by the writer after jcrecord_stop().
+static FILE *fpRec;
+static char recName[128];
+static int stopping;
+static unsigned long fullWaits;               // reads held up by a full ring
+
+static pthread_t writerId;
+
+// The ADPCM encoder
+static const int16_t stepTable[89] =
+{
+  7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37,
+  41, 45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173,
+  190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658,
+  724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+  2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484,
+  7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818,
+  18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const int8_t indexTable[8] = { -1, -1, -1, -1, 2, 4, 6, 8 };
+
+struct adpcm
+{
+  int predictor;
+  int index;
+  int16_t block[BLOCK_SAMPLES];
+  int count;                      // samples in block[]
+  unsigned long samples;          // samples written
+};
+
+static struct adpcm enc;
+
+static int encode_sample( struct adpcm *a, int sample )
+{
+  int step = stepTable[a->index];
+  int diff = sample - a->predictor;
+  int code = 0;
+  int delta = step >> 3;
+
+  if( diff < 0 )
+  {
+    code = 8;
+    diff = -diff;
+  }
+  if( diff >= step ) { code |= 4; diff -= step; delta += step; }
+  step >>= 1;
+  if( diff >= step ) { code |= 2; diff -= step; delta += step; }
+  step >>= 1;
+  if( diff >= step ) { code |= 1; delta += step; }
+
+  a->predictor += ( code & 8 ) ? -delta : delta;
+  if( a->predictor > 32767 )
+    a->predictor = 32767;
+  else if( a->predictor < -32768 )
+    a->predictor = -32768;
+
+  a->index += indexTable[code & 7];
+  if( a->index < 0 )
+    a->index = 0;
+  else if( a->index > 88 )
+    a->index = 88;
+  return(code);
+}
+
+// Encode and write the samples in a->block[], padded to a full block.
+static void write_block( struct adpcm *a, FILE *fp )
+{
+  unsigned char out[BLOCK_ALIGN];
+  int i, lo;
+
+  if( a->count == 0 )
+    return;
+  for( i = a->count; i < BLOCK_SAMPLES; i++ )
+    a->block[i] = a->block[a->count - 1];
+
+  // Each block starts with its first sample as is
+  a->predictor = a->block[0];
+  out[0] = a->predictor & 0xff;
+  out[1] = ( a->predictor >> 8 ) & 0xff;
+  out[2] = a->index;
+  out[3] = 0;
+  for( i = 1; i < BLOCK_SAMPLES; i += 2 )
+  {
+    lo = encode_sample( a, a->block[i] );
+    out[4 + i / 2] = lo | ( encode_sample( a, a->block[i + 1] ) << 4 );
+  }
+  fwrite( out, 1, sizeof( out ), fp );
+  a->samples += a->count;
+  a->count = 0;
+}
+
+static void put_le16( unsigned char *p, unsigned v )
+{
+  p[0] = v & 0xff;
+  p[1] = ( v >> 8 ) & 0xff;
+}
+
+static void put_le32( unsigned char *p, unsigned long v )
+{
+  put_le16( p, v & 0xffff );
+  put_le16( p + 2, ( v >> 16 ) & 0xffff );
+}
+
+//
+// Write (or, once the sizes are known, rewrite) the WAV header.
+//
+static void write_header( FILE *fp, unsigned long samples, unsigned long dataBytes )
+{
+  unsigned char h[60];
+
+  memcpy( h, "RIFF", 4 );
+  put_le32( h + 4, sizeof( h ) - 8 + dataBytes );
+  memcpy( h + 8, "WAVEfmt ", 8 );
+  put_le32( h + 16, 20 );                        // fmt chunk size
+  put_le16( h + 20, 0x11 );                      // IMA ADPCM
+  put_le16( h + 22, 1 );                         // mono
+  put_le32( h + 24, JCRECORD_RATE );
+  put_le32( h + 28, (unsigned long)JCRECORD_RATE * BLOCK_ALIGN / BLOCK_SAMPLES );
+  put_le16( h + 32, BLOCK_ALIGN );
+  put_le16( h + 34, 4 );                         // bits per sample
+  put_le16( h + 36, 2 );                         // extra format bytes
+  put_le16( h + 38, BLOCK_SAMPLES );
+  memcpy( h + 40, "fact", 4 );
+  put_le32( h + 44, 4 );
+  put_le32( h + 48, samples );
+  memcpy( h + 52, "data", 4 );
+  put_le32( h + 56, dataBytes );
+
+  fseek( fp, 0, SEEK_SET );
+  fwrite( h, 1, sizeof( h ), fp );
+  fseek( fp, 0, SEEK_END );
+}
+
+//
+// The writer thread. Takes whatever is in the ring, encodes it and
+// writes it out; finishes the file when the recording is stopped.
+//
+static void* writer( void *arg )
+{
+  unsigned char chunk[4096];
+  size_t n, i, at;
+  int finish;
+
+  pthread_mutex_lock( &ringLock );
+  while(1)
+  {
+    while( head == tail && !stopping )
+      pthread_cond_wait( &dataReady, &ringLock );
+
+    // Copy out what's there (up to the end of the ring) and let
+    // the reader carry on while it is encoded.
+    at = tail % JCRECORD_RING;
+    n = head - tail;
+    if( n > JCRECORD_RING - at )
+      n = JCRECORD_RING - at;
+    if( n > sizeof( chunk ) )
+      n = sizeof( chunk );
+    memcpy( chunk, ring + at, n );
+    tail += n;
+    finish = ( stopping && head == tail );
+    pthread_cond_signal( &spaceReady );
+    pthread_mutex_unlock( &ringLock );
+
+    for( i = 0; i < n && fpRec != NULL; i++ )
+    {
+      enc.block[enc.count++] = ( chunk[i] - 128 ) << 8;
+      if( enc.count == BLOCK_SAMPLES )
+        write_block( &enc, fpRec );
+    }
+
+    if( finish && fpRec != NULL )
+    {
+      write_block( &enc, fpRec );
+      write_header( fpRec, enc.samples,
+                    ( enc.samples + BLOCK_SAMPLES - 1 ) / BLOCK_SAMPLES * BLOCK_ALIGN );
+      fclose( fpRec );
+      if( enc.samples == 0 )
+        unlink( recName );
+      else
+        printf("jcrecord: wrote %s (%.1f seconds, ring full %lu times)\n",
+               recName, (double)enc.samples / JCRECORD_RATE, fullWaits );
+      fflush( stdout );
+    }
+
+    pthread_mutex_lock( &ringLock );
+    if( finish )
+    {
+      fpRec = NULL;
+      stopping = 0;
+      pthread_cond_broadcast( &spaceReady );     // for jcrecord_start()
+    }
+  }
+  return NULL;
+}
+
+//
+// Start the writer thread. Returns 0 on success.
+//
+int jcrecord_init( void )
+{
+  sigset_t allSignals, oldSignals;
+  int err;
+
+  if( mkdir( JCRECORD_DIR, 0755 ) < 0 && errno != EEXIST )
+  {
+    perror( JCRECORD_DIR );
+    return(-1);
+  }
+
+  // Signals are left to the main thread
+  sigfillset( &allSignals );
+  pthread_sigmask( SIG_SETMASK, &allSignals, &oldSignals );
+  err = pthread_create( &writerId, NULL, &writer, NULL );
+  pthread_sigmask( SIG_SETMASK, &oldSignals, NULL );
+  if( err != 0 )
+  {
+    printf("jcrecord: can't create thread: %s\n", strerror(err));
+    return(-1);
+  }
+  return(0);
+}
+
+// Copy a field of the caller ID string into a file name, keeping
+// letters and digits only.
+static size_t name_field( char *out, size_t room, const char *callstr,
+                          const char *field )
+{
+  const char *p = strstr( callstr, field );
+  size_t n = 0;
+
+  if( p == NULL )
+    return 0;
+  for( p += strlen( field ); *p && *p != '-' && n + 1 < room; p++ )
+    if( ( *p >= '0' && *p <= '9' ) || ( *p >= 'A' && *p <= 'Z' ) ||
+        ( *p >= 'a' && *p <= 'z' ) )
+      out[n++] = *p;
+  out[n] = 0;
+  return n;
+}
+
+//
+// Open a file for a call, named for its date, time and number.
+// Waits for the last recording to be finished first. Returns 0 on
+// success.
+//
+int jcrecord_start( const char *callstr )
+{
+  char date[8], hhmm[8], nmbr[24];
+  int i;
+
+  pthread_mutex_lock( &ringLock );
+  while( fpRec != NULL )
+    pthread_cond_wait( &spaceReady, &ringLock );
+  pthread_mutex_unlock( &ringLock );
+
+  name_field( date, sizeof( date ), callstr, "DATE = " );
+  name_field( hhmm, sizeof( hhmm ), callstr, "TIME = " );
+  if( name_field( nmbr, sizeof( nmbr ), callstr, "NMBR = " ) == 0 )
+    strcpy( nmbr, "unknown" );
+
+  for( i = 0; i < 100; i++ )
+  {
+    if( i == 0 )
+      snprintf( recName, sizeof( recName ), "%s/%s-%s-%s.wav",
+                JCRECORD_DIR, date, hhmm, nmbr );
+    else
+      snprintf( recName, sizeof( recName ), "%s/%s-%s-%s-%d.wav",
+                JCRECORD_DIR, date, hhmm, nmbr, i );
+    if( ( fpRec = fopen( recName, "wbx" ) ) != NULL || errno != EEXIST )
+      break;
+  }
+  if( fpRec == NULL )
+  {
+    perror( recName );
+    return(-1);
+  }
+
+  memset( &enc, 0, sizeof( enc ) );
+  write_header( fpRec, 0, 0 );
+  fullWaits = 0;
+  return(0);
+}
+
+//
+// Read what the modem has sent into the ring and decode it. The
+// decoder's data callback must pass voice data to jcrecord_data().
+// Blocks only while the ring is full. Returns what read() returned.
+//
+ssize_t jcrecord_read( int fd, struct jcdle_decoder *decoder )
+{
+  size_t at, room;
+  ssize_t nbytes;
+
+  pthread_mutex_lock( &ringLock );
+  while( head - tail == JCRECORD_RING )
+  {
+    fullWaits++;
+    pthread_cond_wait( &spaceReady, &ringLock );
+  }
+  at = head % JCRECORD_RING;
+  room = JCRECORD_RING - ( head - tail );
+  if( room > JCRECORD_RING - at )
+    room = JCRECORD_RING - at;
+  pthread_mutex_unlock( &ringLock );
+
+  // The writer never touches the space past head, so no lock is
+  // needed to fill it.
+  if( ( nbytes = read( fd, ring + at, room ) ) <= 0 )
+    return(nbytes);
+
+  fill = head;
+  jcdle_feed( decoder, (char *)ring + at, nbytes );
+
+  pthread_mutex_lock( &ringLock );
+  if( fpRec != NULL && !stopping && fill > head )
+  {
+    head = fill;
+    pthread_cond_signal( &dataReady );
+  }
+  pthread_mutex_unlock( &ringLock );
+  return(nbytes);
+}
+
+//
+// Voice data from the decoder. It lies in the part of the ring just
+// read (or is an escaped DLE), never before the place it belongs,
+// so moving it down into place is all the unescaping there is.
+//
+void jcrecord_data( const char *data, size_t length )
+{
+  unsigned char *to = ring + fill % JCRECORD_RING;
+
+  if( (const unsigned char *)data != to )
+    memmove( to, data, length );
+  fill += length;
+}
+
+//
+// End the recording. The writer finishes the file in the background.
+//
+void jcrecord_stop( void )
+{
+  pthread_mutex_lock( &ringLock );
+  if( fpRec != NULL )
+  {
+    stopping = 1;
+    pthread_cond_signal( &dataReady );
+  }
+  pthread_mutex_unlock( &ringLock );
+}
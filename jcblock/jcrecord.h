@@ -0,0 +1,46 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: jcrecord.h
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Recording of blocked calls (jcblockAT.c, DO_RECORD). The thread
+ *	reading the modem in voice receive mode (AT+VRX) reads straight
+ *	into a ring buffer with jcrecord_read(); the DLE decoder's data
+ *	callback hands the voice bytes back with jcrecord_data(), which
+ *	unescapes them in place. A writer thread takes them out of the
+ *	ring, compresses them to IMA ADPCM and writes one WAV file per
+ *	call in ./recordings.
+ */
+#ifndef JCRECORD_H
+#define JCRECORD_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "jcdle.h"
+
+#define JCRECORD_DIR      "./recordings"
+#define JCRECORD_RATE     8000           // samples per second
+#define JCRECORD_RING     65536          // bytes (8 seconds); a power of 2
+
+int jcrecord_init( void );
+int jcrecord_start( const char *callstr );
+ssize_t jcrecord_read( int fd, struct jcdle_decoder *decoder );
+void jcrecord_data( const char *data, size_t length );
+void jcrecord_stop( void );
+
+#endif
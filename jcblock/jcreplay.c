@@ -0,0 +1,487 @@
+/*
+ *	Program name: jcreplay
+ *
+ *	File name: jcreplay.c
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Description:
+ *	Replays recorded calls against candidate whitelist.dat and
+ *	blacklist.dat files, to show what a list change would have done
+ *	before it is put in place. Each callerID.dat file (or rotated
+ *	segment of one) named on the command line is memory mapped and cut
+ *	into chunks at line boundaries; worker threads decide the calls in
+ *	each chunk with the same code jcblock uses (jclist.c, and the lists
+ *	compiled into one automaton by jcpattern.c).
+ *
+ *	The report gives the number of hits for every list entry, the calls
+ *	the candidate lists would block that were not blocked when they
+ *	arrived, and conflicts: calls that match the blacklist but are let
+ *	through by the whitelist.
+ *
+ *	Compile with:
+ *	    gcc -pthread -Wall -O2 -o jcreplay jcreplay.c jclist.c jcpattern.c
+ *
+ *	Usage:
+ *	    jcreplay [-w whitelist] [-b blacklist] [-t threads] [-q] callerID.dat ...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "jclist.h"
+#include "jcpattern.h"
+
+#define CHUNKS_PER_THREAD 8       // small chunks keep the threads evenly loaded
+#define MAX_THREADS       64
+
+struct segment
+{
+  const char *filename;
+  char *data;                     // mmap()ed file contents
+  size_t size;
+};
+
+// A call to be listed in the report.
+struct finding
+{
+  int segment;
+  size_t offset;                  // start of the line in the segment
+  size_t length;
+  int rule;                       // matching blacklist entry
+};
+
+struct findings
+{
+  struct finding *items;
+  int count;
+  int capacity;
+};
+
+// A piece of one segment, processed by a single thread. Findings are
+// kept per chunk so the report lists them in file order.
+struct chunk
+{
+  int segment;
+  size_t start, end;
+  struct findings newlyBlocked;
+  struct findings conflicts;
+};
+
+// Totals kept by each worker thread, added up when they finish.
+struct tally
+{
+  long records;
+  long skipped;                   // lines that are not call records
+  long verdicts[3];               // indexed by JCL_NEUTRAL, JCL_SAFE, JCL_BLOCKED
+  long loggedBlocked;             // calls blocked when they arrived
+  long *whiteHits;
+  long *blackHits;
+};
+
+static struct jclist white, black;
+static struct jcpattern matcher;
+static int haveWhitelist;
+static struct segment *segments;
+static int numSegments;
+static struct chunk *chunks;
+static int numChunks;
+static int nextChunk;
+static pthread_mutex_t chunkLock = PTHREAD_MUTEX_INITIALIZER;
+
+static int add_finding( struct findings *f, int segment, size_t offset,
+                        size_t length, int rule )
+{
+  struct finding *items;
+  int capacity;
+
+  if( f->count == f->capacity )
+  {
+    capacity = f->capacity ? 2 * f->capacity : 16;
+    if( ( items = realloc( f->items, capacity * sizeof( *items ) ) ) == NULL )
+      return(-1);
+    f->items = items;
+    f->capacity = capacity;
+  }
+  f->items[f->count].segment = segment;
+  f->items[f->count].offset = offset;
+  f->items[f->count].length = length;
+  f->items[f->count].rule = rule;
+  f->count++;
+  return(0);
+}
+
+//
+// Decide every call record in one chunk.
+//
+static int replay_chunk( struct chunk *c, struct tally *t )
+{
+  const char *data = segments[c->segment].data;
+  char callstr[JCL_RECORD_SIZE * 2];
+  struct jccall call;
+  size_t pos, end, length;
+  const char *nl;
+  int rules[JCP_GROUPS];
+  int w, b, verdict;
+
+  for( pos = c->start; pos < c->end; pos = end + 1 )
+  {
+    nl = memchr( data + pos, '\n', c->end - pos );
+    end = nl ? (size_t)( nl - data ) : c->end;
+    length = end - pos;
+
+    if( length >= sizeof( callstr ) ||
+        jccall_parse( data + pos, length, &call ) != 0 )
+    {
+      t->skipped++;
+      continue;
+    }
+    t->records++;
+
+    // jcblock matches the caller ID string before it writes the
+    // tag character over its first character.
+    memcpy( callstr, data + pos, length );
+    callstr[length] = 0;
+    callstr[0] = '-';
+
+    // Both lists in one pass; without a whitelist 'white' is empty.
+    jcpattern_run( &matcher, callstr, rules );
+    w = rules[JCP_WHITE];
+    b = rules[JCP_BLACK];
+    if( w >= 0 )
+      verdict = JCL_SAFE;
+    else if( b >= 0 )
+      verdict = JCL_BLOCKED;
+    else
+      verdict = JCL_NEUTRAL;
+    t->verdicts[verdict]++;
+
+    // Hits count the entry that decided the call; a blacklist entry
+    // shadowed by the whitelist shows up as a conflict instead.
+    if( w >= 0 )
+      t->whiteHits[w]++;
+    else if( b >= 0 )
+      t->blackHits[b]++;
+
+    if( call.tag == 'B' || call.tag == '*' )
+      t->loggedBlocked++;
+    else if( verdict == JCL_BLOCKED )
+    {
+      if( add_finding( &c->newlyBlocked, c->segment, pos, length, b ) != 0 )
+        return(-1);
+    }
+
+    if( w >= 0 && b >= 0 )
+    {
+      if( add_finding( &c->conflicts, c->segment, pos, length, b ) != 0 )
+        return(-1);
+    }
+  }
+  return(0);
+}
+
+static void *worker( void *arg )
+{
+  struct tally *t = arg;
+  int i;
+
+  for( ;; )
+  {
+    pthread_mutex_lock( &chunkLock );
+    i = nextChunk++;
+    pthread_mutex_unlock( &chunkLock );
+
+    if( i >= numChunks )
+      break;
+    if( replay_chunk( &chunks[i], t ) != 0 )
+    {
+      fprintf( stderr, "jcreplay: out of memory\n" );
+      exit(1);
+    }
+  }
+  return NULL;
+}
+
+static int map_segment( struct segment *s )
+{
+  struct stat st;
+  int fd;
+
+  if( ( fd = open( s->filename, O_RDONLY ) ) < 0 )
+    return(-1);
+  if( fstat( fd, &st ) < 0 )
+  {
+    close( fd );
+    return(-1);
+  }
+
+  s->size = st.st_size;
+  s->data = NULL;
+  if( s->size > 0 )
+  {
+    s->data = mmap( NULL, s->size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    if( s->data == MAP_FAILED )
+    {
+      close( fd );
+      return(-1);
+    }
+    madvise( s->data, s->size, MADV_SEQUENTIAL );
+  }
+  close( fd );
+  return(0);
+}
+
+//
+// Cut every segment into pieces of about 'target' bytes, ending
+// each piece just after a '\n'.
+//
+static int make_chunks( size_t target )
+{
+  size_t start, end;
+  const char *nl;
+  int i;
+
+  for( i = 0; i < numSegments; i++ )
+  {
+    for( start = 0; start < segments[i].size; start = end )
+    {
+      end = start + target;
+      if( end >= segments[i].size )
+        end = segments[i].size;
+      else if( ( nl = memchr( segments[i].data + end, '\n',
+                              segments[i].size - end ) ) != NULL )
+        end = nl - segments[i].data + 1;
+      else
+        end = segments[i].size;
+
+      chunks = realloc( chunks, ( numChunks + 1 ) * sizeof( *chunks ) );
+      if( chunks == NULL )
+        return(-1);
+      memset( &chunks[numChunks], 0, sizeof( *chunks ) );
+      chunks[numChunks].segment = i;
+      chunks[numChunks].start = start;
+      chunks[numChunks].end = end;
+      numChunks++;
+    }
+  }
+  return(0);
+}
+
+static void print_findings( const char *title, int which )
+{
+  struct findings *f;
+  struct finding *item;
+  int i, j;
+
+  printf( "\n%s:\n", title );
+  for( i = 0; i < numChunks; i++ )
+  {
+    f = which ? &chunks[i].conflicts : &chunks[i].newlyBlocked;
+    for( j = 0; j < f->count; j++ )
+    {
+      item = &f->items[j];
+      printf( "  %s:%lu: %.*s   [%s]\n", segments[item->segment].filename,
+              (unsigned long)item->offset, (int)item->length,
+              segments[item->segment].data + item->offset,
+              black.entries[item->rule].pattern );
+    }
+  }
+}
+
+static void print_hits( const char *title, const struct jclist *list,
+                        const long *hits )
+{
+  int i;
+
+  printf( "\n%s (hits, entry):\n", title );
+  for( i = 0; i < list->count; i++ )
+    printf( "  %8ld  %s\n", hits[i], list->entries[i].pattern );
+}
+
+static void usage()
+{
+  fprintf( stderr, "Usage: jcreplay [-w whitelist] [-b blacklist] [-t threads] [-q] callerID.dat ...\n" );
+  fprintf( stderr, "  -w   candidate whitelist (default ./whitelist.dat)\n" );
+  fprintf( stderr, "  -b   candidate blacklist (default ./blacklist.dat)\n" );
+  fprintf( stderr, "  -t   number of worker threads (default: one per CPU)\n" );
+  fprintf( stderr, "  -q   print totals and hit counts only, not the calls\n" );
+  exit(1);
+}
+
+int main( int argc, char **argv )
+{
+  char *whiteFile = "./whitelist.dat";
+  char *blackFile = "./blacklist.dat";
+  int numThreads = (int)sysconf( _SC_NPROCESSORS_ONLN );
+  int quiet = 0;
+  pthread_t threads[MAX_THREADS];
+  struct tally tallies[MAX_THREADS];
+  struct tally total;
+  struct timespec t0, t1;
+  size_t bytes = 0;
+  long newlyBlocked = 0, conflicts = 0;
+  int optChar, i, j;
+
+  while( ( optChar = getopt( argc, argv, "w:b:t:qh" ) ) != EOF )
+  {
+    switch( optChar )
+    {
+      case 'w':
+        whiteFile = optarg;
+        break;
+
+      case 'b':
+        blackFile = optarg;
+        break;
+
+      case 't':
+        numThreads = atoi( optarg );
+        break;
+
+      case 'q':
+        quiet = 1;
+        break;
+
+      case 'h':
+      default:
+        usage();
+    }
+  }
+  if( optind >= argc )
+    usage();
+  if( numThreads < 1 )
+    numThreads = 1;
+  if( numThreads > MAX_THREADS )
+    numThreads = MAX_THREADS;
+
+  // Load the candidate lists. As with jcblock, a whitelist is optional.
+  jclist_init( &white );
+  jclist_init( &black );
+  if( jclist_load_file( &white, whiteFile ) == 0 )
+    haveWhitelist = 1;
+  else if( errno == ENOENT )
+    fprintf( stderr, "jcreplay: no whitelist %s; replaying without one\n", whiteFile );
+  else
+  {
+    fprintf( stderr, "jcreplay: %s: %s\n", whiteFile, strerror( errno ) );
+    return(1);
+  }
+  if( jclist_load_file( &black, blackFile ) != 0 )
+  {
+    fprintf( stderr, "jcreplay: %s: %s\n", blackFile, strerror( errno ) );
+    return(1);
+  }
+  if( jcpattern_compile( &matcher, &white, &black ) != 0 )
+    fprintf( stderr, "jcreplay: lists too big to compile; checking entries in turn\n" );
+
+  // Map the call records.
+  numSegments = argc - optind;
+  if( ( segments = calloc( numSegments, sizeof( *segments ) ) ) == NULL )
+  {
+    fprintf( stderr, "jcreplay: out of memory\n" );
+    return(1);
+  }
+  for( i = 0; i < numSegments; i++ )
+  {
+    segments[i].filename = argv[optind + i];
+    if( map_segment( &segments[i] ) != 0 )
+    {
+      fprintf( stderr, "jcreplay: %s: %s\n", segments[i].filename, strerror( errno ) );
+      return(1);
+    }
+    bytes += segments[i].size;
+  }
+
+  if( make_chunks( bytes / ( numThreads * CHUNKS_PER_THREAD ) + 4096 ) != 0 )
+  {
+    fprintf( stderr, "jcreplay: out of memory\n" );
+    return(1);
+  }
+
+  clock_gettime( CLOCK_MONOTONIC, &t0 );
+  for( i = 0; i < numThreads; i++ )
+  {
+    memset( &tallies[i], 0, sizeof( tallies[i] ) );
+    tallies[i].whiteHits = calloc( white.count + 1, sizeof( long ) );
+    tallies[i].blackHits = calloc( black.count + 1, sizeof( long ) );
+    if( tallies[i].whiteHits == NULL || tallies[i].blackHits == NULL )
+    {
+      fprintf( stderr, "jcreplay: out of memory\n" );
+      return(1);
+    }
+    if( pthread_create( &threads[i], NULL, worker, &tallies[i] ) != 0 )
+    {
+      fprintf( stderr, "jcreplay: pthread_create() failed\n" );
+      return(1);
+    }
+  }
+
+  // Add up the totals as the threads finish.
+  memset( &total, 0, sizeof( total ) );
+  total.whiteHits = calloc( white.count + 1, sizeof( long ) );
+  total.blackHits = calloc( black.count + 1, sizeof( long ) );
+  for( i = 0; i < numThreads; i++ )
+  {
+    pthread_join( threads[i], NULL );
+    total.records += tallies[i].records;
+    total.skipped += tallies[i].skipped;
+    total.loggedBlocked += tallies[i].loggedBlocked;
+    for( j = 0; j < 3; j++ )
+      total.verdicts[j] += tallies[i].verdicts[j];
+    for( j = 0; j < white.count; j++ )
+      total.whiteHits[j] += tallies[i].whiteHits[j];
+    for( j = 0; j < black.count; j++ )
+      total.blackHits[j] += tallies[i].blackHits[j];
+  }
+  clock_gettime( CLOCK_MONOTONIC, &t1 );
+
+  for( i = 0; i < numChunks; i++ )
+  {
+    newlyBlocked += chunks[i].newlyBlocked.count;
+    conflicts += chunks[i].conflicts.count;
+  }
+
+  printf( "Replayed %ld calls (%lu bytes, %d files) with %d threads in %.3f seconds.\n",
+          total.records, (unsigned long)bytes, numSegments, numThreads,
+          ( t1.tv_sec - t0.tv_sec ) + ( t1.tv_nsec - t0.tv_nsec ) / 1e9 );
+  if( total.skipped > 0 )
+    printf( "Skipped %ld lines that are not call records.\n", total.skipped );
+  printf( "Whitelist: %s (%d entries)\n", haveWhitelist ? whiteFile : "none", white.count );
+  printf( "Blacklist: %s (%d entries)\n", blackFile, black.count );
+  printf( "Accepted by whitelist: %ld\n", total.verdicts[JCL_SAFE] );
+  printf( "Blocked:               %ld (%ld were blocked when they arrived)\n",
+          total.verdicts[JCL_BLOCKED], total.loggedBlocked );
+  printf( "Neutral:               %ld\n", total.verdicts[JCL_NEUTRAL] );
+  printf( "Newly blocked:         %ld\n", newlyBlocked );
+  printf( "Conflicts:             %ld\n", conflicts );
+
+  if( haveWhitelist )
+    print_hits( "Whitelist entries", &white, total.whiteHits );
+  print_hits( "Blacklist entries", &black, total.blackHits );
+
+  if( !quiet )
+  {
+    print_findings( "Newly blocked calls (file:offset: record [blacklist entry])", 0 );
+    print_findings( "Conflicts: whitelisted calls that match the blacklist", 1 );
+  }
+  return(0);
+}
@@ -0,0 +1,283 @@
+/*
+ *	Program name: jcrtbench
+ *
+ *	File name: jcrtbench.c
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Description:
+ *	Measures how long a call's verdict takes, from the caller ID string
+ *	arriving to the call being decided, while -l threads keep every CPU
+ *	busy: the delay jcblock's real-time mode (-f, -a; see jcrealtime.h)
+ *	is there to cut. Run it once as it is and once with the -f (and -a)
+ *	that jcblock is given, and compare.
+ *
+ *	A "modem" thread writes a caller ID string for a random number into
+ *	a pipe every -i milliseconds, stamped with the time; it runs at the
+ *	highest SCHED_FIFO priority if it can, standing in for the serial
+ *	port's interrupt. The main thread reads each string and decides it
+ *	with the lists, as jcblock does (jclist.c, jcpattern.c). The report
+ *	gives the verdict times, and the page faults and context switches
+ *	of the main thread while it decided the calls.
+ *
+ *	Compile with:
+ *	    gcc -pthread -Wall -O2 -o jcrtbench jcrtbench.c jcrealtime.c jclist.c jcpattern.c
+ *
+ *	Usage:
+ *	    jcrtbench [-w whitelist] [-b blacklist] [-n calls] [-i ms] [-l threads]
+ *	              [-f priority] [-a cpu]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "jclist.h"
+#include "jcpattern.h"
+#include "jcrealtime.h"
+
+struct message
+{
+  double sentAt;
+  char callstr[JCL_RECORD_SIZE];
+};
+
+static struct jclist white, black;
+static struct jcpattern matcher;
+static int pipeFds[2];
+static int numCalls = 1000;
+static int interval = 20;         // ms between calls
+
+static double now( void )
+{
+  struct timespec t;
+
+  clock_gettime( CLOCK_MONOTONIC, &t );
+  return( t.tv_sec + t.tv_nsec / 1e9 );
+}
+
+static int compare_doubles( const void *a, const void *b )
+{
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return( x < y ? -1 : x > y );
+}
+
+// The synthetic load: one CPU's worth of work, forever.
+static void *burn( void *arg )
+{
+  volatile unsigned long n = 0;
+
+  for( ;; )
+    n++;
+  return NULL;
+}
+
+// The modem: a caller ID string every 'interval' ms.
+static void *modem( void *arg )
+{
+  struct sched_param param;
+  struct message m;
+  struct timespec pause;
+  int i;
+
+  memset( &param, 0, sizeof( param ) );
+  param.sched_priority = sched_get_priority_max( SCHED_FIFO );
+  if( pthread_setschedparam( pthread_self(), SCHED_FIFO, &param ) != 0 )
+    fprintf( stderr, "jcrtbench: the modem thread can't be real-time; "
+             "times include its own delays\n" );
+
+  pause.tv_sec = interval / 1000;
+  pause.tv_nsec = ( interval % 1000 ) * 1000000L;
+  for( i = 0; i < numCalls; i++ )
+  {
+    nanosleep( &pause, NULL );
+    memset( &m, 0, sizeof( m ) );
+    snprintf( m.callstr, sizeof( m.callstr ),
+              "--DATE = 101926--TIME = 1204--NMBR = %03d%03d%04d--NAME = JCRTBENCH--\n",
+              200 + rand() % 800, rand() % 1000, rand() % 10000 );
+    m.sentAt = now();
+    if( write( pipeFds[1], &m, sizeof( m ) ) != sizeof( m ) )
+    {
+      fprintf( stderr, "jcrtbench: write: %s\n", strerror( errno ) );
+      exit(1);
+    }
+  }
+  return NULL;
+}
+
+static void usage()
+{
+  fprintf( stderr, "Usage: jcrtbench [-w whitelist] [-b blacklist] [-n calls] [-i ms] [-l threads]\n" );
+  fprintf( stderr, "                 [-f priority] [-a cpu]\n" );
+  fprintf( stderr, "  -w   whitelist (default ./whitelist.dat)\n" );
+  fprintf( stderr, "  -b   blacklist (default ./blacklist.dat)\n" );
+  fprintf( stderr, "  -n   number of calls (default 1000)\n" );
+  fprintf( stderr, "  -i   milliseconds between calls (default 20)\n" );
+  fprintf( stderr, "  -l   threads keeping the CPUs busy (default: two per CPU)\n" );
+  fprintf( stderr, "  -f   decide calls at this SCHED_FIFO priority, as jcblock -f does\n" );
+  fprintf( stderr, "  -a   decide calls on this CPU, as jcblock -a does\n" );
+  exit(1);
+}
+
+int main( int argc, char **argv )
+{
+  char *whiteFile = "./whitelist.dat";
+  char *blackFile = "./blacklist.dat";
+  int numLoad = 2 * (int)sysconf( _SC_NPROCESSORS_ONLN );
+  int priority = 0, cpu = -1;
+  struct jcrealtime_usage before, after;
+  long faults = 0, majorFaults = 0, yields = 0, preemptions = 0;
+  long verdicts[3] = { 0, 0, 0 };
+  int rules[JCP_GROUPS];
+  double *latencies;
+  struct message m;
+  pthread_t thread;
+  int optChar, i;
+
+  while( ( optChar = getopt( argc, argv, "w:b:n:i:l:f:a:h" ) ) != EOF )
+  {
+    switch( optChar )
+    {
+      case 'w':
+        whiteFile = optarg;
+        break;
+
+      case 'b':
+        blackFile = optarg;
+        break;
+
+      case 'n':
+        numCalls = atoi( optarg );
+        break;
+
+      case 'i':
+        interval = atoi( optarg );
+        break;
+
+      case 'l':
+        numLoad = atoi( optarg );
+        break;
+
+      case 'f':
+        priority = atoi( optarg );
+        break;
+
+      case 'a':
+        cpu = atoi( optarg );
+        break;
+
+      case 'h':
+      default:
+        usage();
+    }
+  }
+  if( optind < argc || numCalls < 1 || interval < 1 || numLoad < 0 )
+    usage();
+
+  // Load the lists. As with jcblock, a whitelist is optional.
+  jclist_init( &white );
+  jclist_init( &black );
+  if( jclist_load_file( &white, whiteFile ) != 0 && errno != ENOENT )
+  {
+    fprintf( stderr, "jcrtbench: %s: %s\n", whiteFile, strerror( errno ) );
+    return(1);
+  }
+  if( jclist_load_file( &black, blackFile ) != 0 )
+  {
+    fprintf( stderr, "jcrtbench: %s: %s\n", blackFile, strerror( errno ) );
+    return(1);
+  }
+  if( jcpattern_compile( &matcher, &white, &black ) != 0 )
+    fprintf( stderr, "jcrtbench: lists too big to compile; checking entries in turn\n" );
+
+  if( ( latencies = calloc( numCalls, sizeof( *latencies ) ) ) == NULL )
+  {
+    fprintf( stderr, "jcrtbench: out of memory\n" );
+    return(1);
+  }
+  if( pipe( pipeFds ) != 0 )
+  {
+    fprintf( stderr, "jcrtbench: pipe: %s\n", strerror( errno ) );
+    return(1);
+  }
+
+  // The load, then (like jcblock) real-time mode for this thread
+  // alone, then the calls.
+  for( i = 0; i < numLoad; i++ )
+  {
+    if( pthread_create( &thread, NULL, burn, NULL ) != 0 )
+    {
+      fprintf( stderr, "jcrtbench: pthread_create() failed\n" );
+      return(1);
+    }
+  }
+  if( ( priority != 0 || cpu >= 0 ) && jcrealtime_start( priority, cpu ) != 0 )
+    fprintf( stderr, "jcrtbench: real-time mode is only partly set up\n" );
+  if( pthread_create( &thread, NULL, modem, NULL ) != 0 )
+  {
+    fprintf( stderr, "jcrtbench: pthread_create() failed\n" );
+    return(1);
+  }
+
+  for( i = 0; i < numCalls; i++ )
+  {
+    if( read( pipeFds[0], &m, sizeof( m ) ) != sizeof( m ) )
+    {
+      fprintf( stderr, "jcrtbench: read: %s\n", strerror( errno ) );
+      return(1);
+    }
+    jcrealtime_usage( &before );
+
+    // Both lists in one pass, as jcblock checks them.
+    m.callstr[0] = '-';
+    jcpattern_run( &matcher, m.callstr, rules );
+    if( rules[JCP_WHITE] >= 0 )
+      verdicts[JCL_SAFE]++;
+    else if( rules[JCP_BLACK] >= 0 )
+      verdicts[JCL_BLOCKED]++;
+    else
+      verdicts[JCL_NEUTRAL]++;
+    latencies[i] = now() - m.sentAt;
+
+    jcrealtime_usage( &after );
+    faults += after.minorFaults - before.minorFaults;
+    majorFaults += after.majorFaults - before.majorFaults;
+    yields += after.voluntarySwitches - before.voluntarySwitches;
+    preemptions += after.involuntarySwitches - before.involuntarySwitches;
+  }
+
+  qsort( latencies, numCalls, sizeof( *latencies ), compare_doubles );
+  printf( "%d calls, one every %d ms, %d load threads, ", numCalls, interval, numLoad );
+  if( priority != 0 )
+    printf( "deciding at SCHED_FIFO priority %d", priority );
+  else
+    printf( "deciding at the ordinary priority" );
+  if( cpu >= 0 )
+    printf( " on CPU %d", cpu );
+  printf( "\n" );
+  printf( "  verdict in: median %.1f, 90%% %.1f, 99%% %.1f, max %.1f microseconds\n",
+          latencies[numCalls / 2] * 1e6, latencies[numCalls * 90 / 100] * 1e6,
+          latencies[numCalls * 99 / 100] * 1e6, latencies[numCalls - 1] * 1e6 );
+  printf( "  while deciding: %ld page faults (%ld major), %ld waits, %ld preemptions\n",
+          faults + majorFaults, majorFaults, yields, preemptions );
+  printf( "  %ld accepted, %ld blocked, %ld neutral\n", verdicts[JCL_SAFE],
+          verdicts[JCL_BLOCKED], verdicts[JCL_NEUTRAL] );
+  return(0);
+}
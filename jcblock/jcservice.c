@@ -0,0 +1,312 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: jcservice.c
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Description:
+ *	The verdict service (see jcservice.h). One thread polls the
+ *	listening socket and the clients. Whatever a client has written is
+ *	read in one go and every whole query in it is answered, the answers
+ *	going out in one write, so a client sending queries in batches gets
+ *	its answers in batches. While a client's answers can't all be
+ *	written, no more of its queries are read.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "jcservice.h"
+
+// Longest caller ID string made from a query
+#define CALLSTR_SIZE  ( 64 + 2 * 255 )
+
+struct client
+{
+  int fd;                       // -1 if the slot is free
+  size_t inUsed;                // bytes of queries in 'in'
+  size_t outUsed;               // bytes of answers in 'out'
+  unsigned char in[JCSERVICE_BUFFER];
+  unsigned char out[JCSERVICE_BUFFER];
+};
+
+static struct client clients[JCSERVICE_CLIENTS];
+static int listenFd = -1;
+static char socketPath[sizeof( ((struct sockaddr_un *)0)->sun_path )];
+static jcservice_decide decideCall;
+static pthread_t serviceId;
+
+//
+// Make the caller ID string for a query, as jcblock makes it from
+// the modem's: the date with the year, and '-' for the line ends.
+//
+static void make_callstr( const struct jcservice_query *q,
+                          const unsigned char *fields, char *callstr )
+{
+  time_t when = ( q->when != 0 ? (time_t)q->when : time( NULL ) );
+  struct tm tm;
+  int n, i;
+
+  localtime_r( &when, &tm );
+  n = sprintf( callstr, "--DATE = %02d%02d%02d--TIME = %02d%02d--NMBR = ",
+               tm.tm_mon + 1, tm.tm_mday, tm.tm_year % 100, tm.tm_hour, tm.tm_min );
+  memcpy( callstr + n, fields, q->nmbrLength );
+  n += q->nmbrLength;
+  n += sprintf( callstr + n, "--NAME = " );
+  memcpy( callstr + n, fields + q->nmbrLength, q->nameLength );
+  n += q->nameLength;
+  strcpy( callstr + n, "--\n" );
+
+  // A query can't add fields of its own.
+  for( i = 0; callstr[i] != '\n'; i++ )
+  {
+    if( callstr[i] == '\r' || callstr[i] == '\0' )
+      callstr[i] = '-';
+  }
+}
+
+//
+// Answer the client's whole queries, as many as there is room for
+// answers to.
+//
+static void answer_queries( struct client *c )
+{
+  struct jcservice_query q;
+  struct jcservice_answer a;
+  char callstr[CALLSTR_SIZE];
+  size_t pos = 0, size;
+
+  while( c->inUsed - pos >= sizeof( q ) &&
+         c->outUsed + sizeof( a ) <= sizeof( c->out ) )
+  {
+    memcpy( &q, c->in + pos, sizeof( q ) );
+    size = sizeof( q ) + q.nmbrLength + q.nameLength;
+    if( c->inUsed - pos < size )
+      break;
+    make_callstr( &q, c->in + pos + sizeof( q ), callstr );
+    memset( &a, 0, sizeof( a ) );
+    a.id = q.id;
+    (*decideCall)( callstr, &a );
+    memcpy( c->out + c->outUsed, &a, sizeof( a ) );
+    c->outUsed += sizeof( a );
+    pos += size;
+  }
+  if( pos > 0 )
+  {
+    memmove( c->in, c->in + pos, c->inUsed - pos );
+    c->inUsed -= pos;
+  }
+}
+
+static void drop_client( struct client *c )
+{
+  close( c->fd );
+  c->fd = -1;
+}
+
+//
+// Write what answers the client will take. Returns -1 if it has gone.
+//
+static int write_answers( struct client *c )
+{
+  ssize_t n;
+
+  // MSG_NOSIGNAL: a client gone away is no reason to stop jcblock.
+  n = send( c->fd, c->out, c->outUsed, MSG_NOSIGNAL );
+  if( n < 0 )
+    return( errno == EAGAIN || errno == EINTR ? 0 : -1 );
+  memmove( c->out, c->out + n, c->outUsed - n );
+  c->outUsed -= n;
+  return(0);
+}
+
+//
+// Read the client's queries and answer them. Returns -1 if it has
+// gone. ('in' always has room: answers to all the queries it can
+// hold fit in 'out'.)
+//
+static int serve_client( struct client *c )
+{
+  ssize_t n;
+
+  n = read( c->fd, c->in + c->inUsed, sizeof( c->in ) - c->inUsed );
+  if( n == 0 )
+    return(-1);
+  if( n < 0 )
+    return( errno == EAGAIN || errno == EINTR ? 0 : -1 );
+  c->inUsed += n;
+  answer_queries( c );
+  return( write_answers( c ) );
+}
+
+static void accept_client( void )
+{
+  int clientFd, i;
+
+  if( ( clientFd = accept( listenFd, NULL, NULL ) ) < 0 )
+    return;
+  fcntl( clientFd, F_SETFL, O_NONBLOCK );
+  fcntl( clientFd, F_SETFD, FD_CLOEXEC );
+  for( i = 0; i < JCSERVICE_CLIENTS; i++ )
+  {
+    if( clients[i].fd < 0 )
+    {
+      clients[i].fd = clientFd;
+      clients[i].inUsed = clients[i].outUsed = 0;
+      return;
+    }
+  }
+  close( clientFd );                // too many clients
+}
+
+static void *serve( void *arg )
+{
+  struct pollfd fds[1 + JCSERVICE_CLIENTS];
+  struct client *polled[1 + JCSERVICE_CLIENTS];
+  struct client *c;
+  int numFds, i;
+
+  while( 1 )
+  {
+    fds[0].fd = listenFd;
+    fds[0].events = POLLIN;
+    numFds = 1;
+    for( i = 0; i < JCSERVICE_CLIENTS; i++ )
+    {
+      c = &clients[i];
+      if( c->fd < 0 )
+        continue;
+      fds[numFds].fd = c->fd;
+      fds[numFds].events = 0;
+      // Read queries only while their answers could be written out.
+      if( c->outUsed == 0 )
+        fds[numFds].events |= POLLIN;
+      else
+        fds[numFds].events |= POLLOUT;
+      polled[numFds++] = c;
+    }
+
+    if( poll( fds, numFds, -1 ) < 0 )
+    {
+      if( errno == EINTR )
+        continue;
+      printf("jcservice: poll() failed: %s\n", strerror(errno));
+      return(NULL);
+    }
+
+    for( i = 1; i < numFds; i++ )
+    {
+      c = polled[i];
+      if( fds[i].revents == 0 )
+        continue;
+      if( ( fds[i].revents & POLLOUT ) != 0 )
+      {
+        // Answers went out: answer the queries held back meanwhile.
+        if( write_answers( c ) != 0 )
+        {
+          drop_client( c );
+          continue;
+        }
+        if( c->outUsed == 0 && c->inUsed > 0 )
+        {
+          answer_queries( c );
+          if( write_answers( c ) != 0 )
+            drop_client( c );
+        }
+      }
+      else if( serve_client( c ) != 0 )
+        drop_client( c );
+    }
+
+    if( ( fds[0].revents & POLLIN ) != 0 )
+      accept_client();
+  }
+  return(NULL);
+}
+
+//
+// Listen on 'path' (replacing any socket left there) and start the
+// thread answering queries with 'decide'. Returns 0 on success.
+//
+int jcservice_start( const char *path, jcservice_decide decide )
+{
+  struct sockaddr_un addr;
+  sigset_t allSignals, oldSignals;
+  int err, i;
+
+  if( strlen( path ) >= sizeof( addr.sun_path ) )
+  {
+    printf("jcservice: %s: path too long\n", path);
+    return(-1);
+  }
+  memset( &addr, 0, sizeof( addr ) );
+  addr.sun_family = AF_UNIX;
+  strcpy( addr.sun_path, path );
+
+  if( ( listenFd = socket( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 ) ) < 0 )
+  {
+    printf("jcservice: socket() failed: %s\n", strerror(errno));
+    return(-1);
+  }
+  unlink( path );
+  if( bind( listenFd, (struct sockaddr *)&addr, sizeof( addr ) ) != 0 ||
+      listen( listenFd, JCSERVICE_CLIENTS ) != 0 )
+  {
+    printf("jcservice: %s: %s\n", path, strerror(errno));
+    close( listenFd );
+    listenFd = -1;
+    return(-1);
+  }
+  strcpy( socketPath, path );
+  decideCall = decide;
+  for( i = 0; i < JCSERVICE_CLIENTS; i++ )
+    clients[i].fd = -1;
+
+  // Signals are left to the main thread
+  sigfillset( &allSignals );
+  pthread_sigmask( SIG_SETMASK, &allSignals, &oldSignals );
+  err = pthread_create( &serviceId, NULL, &serve, NULL );
+  pthread_sigmask( SIG_SETMASK, &oldSignals, NULL );
+  if( err != 0 )
+  {
+    printf("jcservice: can't create thread: %s\n", strerror(err));
+    jcservice_stop();
+    return(-1);
+  }
+  return(0);
+}
+
+//
+// Stop listening, removing the socket. The thread is left to end
+// with the program.
+//
+void jcservice_stop( void )
+{
+  if( listenFd < 0 )
+    return;
+  close( listenFd );
+  listenFd = -1;
+  unlink( socketPath );
+}
@@ -0,0 +1,79 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: jcservice.h
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	The verdict service (jcblockAT.c, DO_SERVICE, -u): jcblock answers
+ *	"would this call be blocked?" for other programs on the machine (a
+ *	PBX script, jcquery) over a Unix domain stream socket, from the
+ *	lists it has in memory. Asking changes nothing: no entry dates are
+ *	touched and nothing is logged.
+ *
+ *	A client writes queries and reads answers, one answer for each
+ *	query, in the order of the queries. It need not wait for an answer
+ *	before writing the next query, and several queries may go in one
+ *	write. Each query is a struct jcservice_query followed by the
+ *	number and then the name (nmbrLength and nameLength bytes, no
+ *	'\0's); each answer is a struct jcservice_answer. Both are in the
+ *	machine's own byte order, as both ends are on the one machine.
+ *
+ *	One thread serves every client, so a client that stops reading
+ *	its answers is just not read from until it does.
+ */
+#ifndef JCSERVICE_H
+#define JCSERVICE_H
+
+#include <stdint.h>
+
+#define JCSERVICE_SOCKET     "./jcblock.sock"
+#define JCSERVICE_CLIENTS    16        // most clients connected at once
+#define JCSERVICE_BUFFER     16384     // bytes of queries, or of answers, a client
+
+// Where an answer's verdict came from
+#define JCSERVICE_NONE       0         // no entry matched (JCL_NEUTRAL)
+#define JCSERVICE_WHITE      1         // whitelist entry 'rule'
+#define JCSERVICE_BLACK      2         // blacklist entry 'rule'
+#define JCSERVICE_IMPORTED   3         // the imported numbers
+
+struct jcservice_query
+{
+  uint32_t id;                  // returned in the answer
+  uint8_t nmbrLength;
+  uint8_t nameLength;
+  uint16_t flags;               // 0
+  int64_t when;                 // time() of the call, for DATE and TIME; 0 for now
+};
+
+struct jcservice_answer
+{
+  uint32_t id;
+  uint8_t verdict;              // JCL_NEUTRAL, JCL_SAFE or JCL_BLOCKED
+  uint8_t list;                 // JCSERVICE_NONE etc.
+  uint16_t flags;               // 0
+  int32_t rule;                 // entry in its list, or -1
+  uint32_t generation;          // of the lists (equal for answers from the same lists)
+};
+
+// Decides a call, given as a caller ID string like those jcblock reads
+// from the modem (with the year), filling in all but 'id' of 'answer'.
+// Called on the service thread.
+typedef void (*jcservice_decide)( char *callstr, struct jcservice_answer *answer );
+
+int jcservice_start( const char *path, jcservice_decide decide );
+void jcservice_stop( void );
+
+#endif
@@ -0,0 +1,150 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: jcstage.c
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Description:
+ *	Stage threads and their single-producer single-consumer queues
+ *	(see jcstage.h). The producer publishes a job by storing head with
+ *	release order after filling the slot, and the stage frees the slot
+ *	by storing tail with release order after doing the job; each reads
+ *	the other's counter with acquire order. The eventfd only wakes the
+ *	stage: it counts, so a job queued just as the stage finds the queue
+ *	empty still wakes it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+
+#include "jcstage.h"
+
+static void *run_stage( void *arg )
+{
+  struct jcstage *s = arg;
+  uint64_t tail, head, n;
+
+  while( 1 )
+  {
+    tail = atomic_load_explicit( &s->tail, memory_order_relaxed );
+    head = atomic_load_explicit( &s->head, memory_order_acquire );
+    if( tail == head )
+    {
+      if( read( s->wakeFd, &n, sizeof( n ) ) < 0 && errno != EINTR )
+      {
+        printf("jcstage: %s: read() failed: %s\n", s->name, strerror(errno));
+        return(NULL);
+      }
+      continue;
+    }
+    (*s->work)( s->jobs + ( tail % JCSTAGE_SLOTS ) * s->jobSize );
+    atomic_store_explicit( &s->tail, tail + 1, memory_order_release );
+  }
+  return(NULL);
+}
+
+//
+// Start a stage whose thread does 'work' to each job (of 'jobSize'
+// bytes) queued. Returns 0 on success.
+//
+int jcstage_start( struct jcstage *s, const char *name, size_t jobSize,
+                   jcstage_work work )
+{
+  sigset_t allSignals, oldSignals;
+  int err;
+
+  memset( s, 0, sizeof( *s ) );
+  s->name = name;
+  s->work = work;
+  s->jobSize = jobSize;
+  if( ( s->jobs = calloc( JCSTAGE_SLOTS, jobSize ) ) == NULL ||
+      ( s->wakeFd = eventfd( 0, EFD_CLOEXEC ) ) < 0 )
+  {
+    printf("jcstage: %s: can't make the queue\n", name);
+    free( s->jobs );
+    return(-1);
+  }
+
+  // Signals are left to the main thread
+  sigfillset( &allSignals );
+  pthread_sigmask( SIG_SETMASK, &allSignals, &oldSignals );
+  err = pthread_create( &s->thread, NULL, &run_stage, s );
+  pthread_sigmask( SIG_SETMASK, &oldSignals, NULL );
+  if( err != 0 )
+  {
+    printf("jcstage: %s: can't create thread: %s\n", name, strerror(err));
+    close( s->wakeFd );
+    free( s->jobs );
+    return(-1);
+  }
+  return(0);
+}
+
+//
+// The slot for the next job, or NULL if the queue is full.
+//
+void *jcstage_slot( struct jcstage *s )
+{
+  uint64_t head = atomic_load_explicit( &s->head, memory_order_relaxed );
+
+  if( head - atomic_load_explicit( &s->tail, memory_order_acquire ) >= JCSTAGE_SLOTS )
+    return(NULL);
+  return( s->jobs + ( head % JCSTAGE_SLOTS ) * s->jobSize );
+}
+
+//
+// The slot for the next job, waiting for the stage to free one if
+// the queue is full.
+//
+void *jcstage_wait_slot( struct jcstage *s )
+{
+  void *job;
+
+  while( ( job = jcstage_slot( s ) ) == NULL )
+    usleep( 1000 );
+  return(job);
+}
+
+//
+// Queue the job in the slot jcstage_slot() gave. Returns the jobs
+// waiting as it was queued, counting this one, for the statistics.
+//
+uint64_t jcstage_push( struct jcstage *s )
+{
+  uint64_t head = atomic_load_explicit( &s->head, memory_order_relaxed ) + 1;
+  uint64_t depth = head - atomic_load_explicit( &s->tail, memory_order_relaxed );
+  uint64_t one = 1;
+
+  atomic_store_explicit( &s->head, head, memory_order_release );
+  if( write( s->wakeFd, &one, sizeof( one ) ) != sizeof( one ) )
+    printf("jcstage: %s: write() failed: %s\n", s->name, strerror(errno));
+  return(depth);
+}
+
+//
+// Wait for the stage to finish every job queued, before the producer
+// touches what the jobs do (callerID.dat, say) itself.
+//
+void jcstage_drain( struct jcstage *s )
+{
+  while( atomic_load_explicit( &s->tail, memory_order_acquire ) !=
+         atomic_load_explicit( &s->head, memory_order_relaxed ) )
+    usleep( 1000 );
+}
@@ -0,0 +1,69 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: jcstage.h
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Stages (jcblockAT.c, DO_STAGES): threads that do the work of a call
+ *	which can wait (writing callerID.dat, the journal's entry dates, the
+ *	network broadcast), so that the thread reading the modem and
+ *	deciding calls never waits on a disk or the network itself.
+ *
+ *	Each stage has a queue of jobs with one producer (the thread
+ *	deciding calls) and one consumer (the stage's thread). The queue is
+ *	a ring of JCSTAGE_SLOTS fixed size jobs and two counters, head
+ *	(jobs queued, written only by the producer) and tail (jobs done,
+ *	written only by the stage), so neither side takes a lock. The
+ *	producer fills the slot jcstage_slot() gives it and queues it with
+ *	jcstage_push(); the stage's thread sleeps on an eventfd while the
+ *	queue is empty.
+ *
+ *	A full queue is the producer's to deal with: jcstage_slot() returns
+ *	NULL, and the producer either drops the job or waits for a slot
+ *	with jcstage_wait_slot().
+ */
+#ifndef JCSTAGE_H
+#define JCSTAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define JCSTAGE_SLOTS  256             // jobs a queue holds; a power of 2
+
+typedef void (*jcstage_work)( void *job );
+
+struct jcstage
+{
+  const char *name;
+  jcstage_work work;
+  size_t jobSize;
+  unsigned char *jobs;                 // JCSTAGE_SLOTS jobs of jobSize bytes
+  _Atomic uint64_t head;               // jobs queued
+  _Atomic uint64_t tail;               // jobs done
+  int wakeFd;
+  pthread_t thread;
+};
+
+int jcstage_start( struct jcstage *s, const char *name, size_t jobSize,
+                   jcstage_work work );
+void *jcstage_slot( struct jcstage *s );
+void *jcstage_wait_slot( struct jcstage *s );
+uint64_t jcstage_push( struct jcstage *s );
+void jcstage_drain( struct jcstage *s );
+
+#endif
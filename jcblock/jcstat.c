@@ -0,0 +1,156 @@
+/*
+ *	Program name: jcstat
+ *
+ *	File name: jcstat.c
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Description:
+ *	Prints the counters and histograms jcblock publishes in shared
+ *	memory (see jcstats.h). The segment is only read: jcblock is not
+ *	disturbed in any way.
+ *
+ *	Compile with:
+ *	    gcc -Wall -O2 -o jcstat jcstat.c jcstats.c -lrt
+ *
+ *	Usage:
+ *	    jcstat [-j] [-i seconds]
+ *	      -j  print JSON instead of a table
+ *	      -i  print again every 'seconds' seconds
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+
+#include "jcstats.h"
+
+static int is_running( pid_t pid )
+{
+  return kill( pid, 0 ) == 0;
+}
+
+static void print_table( const struct jcstats *s )
+{
+  const struct jcstats_hist *h;
+  double scale;
+  int i;
+
+  printf( "jcblock pid %ld, %s, started %s", (long)s->pid,
+          is_running( s->pid ) ? "running" : "not running",
+          ctime( (time_t *)&s->started ) );
+
+  printf( "\n" );
+  for( i = 0; i < JCS_NUM_COUNTERS; i++ )
+    printf( "  %-16s %12llu\n", jcstatsCounterNames[i],
+            (unsigned long long)s->counters[i] );
+
+  printf( "\n  %-16s %10s %10s %10s %10s %10s %10s\n", "histogram",
+          "count", "mean", "p50", "p90", "p99", "max" );
+  for( i = 0; i < JCS_NUM_HISTS; i++ )
+  {
+    h = &s->hists[i];
+    // Times are shown in microseconds, sizes in bytes or jobs.
+    scale = ( i == JCS_H_READ_SIZE || i == JCS_H_STAGE_DEPTH ) ? 1.0 : 1000.0;
+    printf( "  %-16s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+            jcstatsHistNames[i], (unsigned long long)h->count,
+            h->count ? (double)h->sum / h->count / scale : 0.0,
+            jcstats_percentile( h, 0.50 ) / scale,
+            jcstats_percentile( h, 0.90 ) / scale,
+            jcstats_percentile( h, 0.99 ) / scale,
+            h->max / scale );
+  }
+  printf( "  (times in microseconds, %s in bytes, %s in jobs)\n",
+          jcstatsHistNames[JCS_H_READ_SIZE], jcstatsHistNames[JCS_H_STAGE_DEPTH] );
+}
+
+static void print_json( const struct jcstats *s )
+{
+  const struct jcstats_hist *h;
+  int i, b;
+
+  printf( "{\"pid\":%ld,\"running\":%s,\"started\":%lld,\"counters\":{",
+          (long)s->pid, is_running( s->pid ) ? "true" : "false",
+          (long long)s->started );
+  for( i = 0; i < JCS_NUM_COUNTERS; i++ )
+    printf( "%s\"%s\":%llu", i ? "," : "", jcstatsCounterNames[i],
+            (unsigned long long)s->counters[i] );
+  printf( "},\"histograms\":{" );
+  for( i = 0; i < JCS_NUM_HISTS; i++ )
+  {
+    h = &s->hists[i];
+    printf( "%s\"%s\":{\"count\":%llu,\"sum\":%llu,\"max\":%llu,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"buckets\":[",
+            i ? "," : "", jcstatsHistNames[i],
+            (unsigned long long)h->count, (unsigned long long)h->sum,
+            (unsigned long long)h->max,
+            (unsigned long long)jcstats_percentile( h, 0.50 ),
+            (unsigned long long)jcstats_percentile( h, 0.90 ),
+            (unsigned long long)jcstats_percentile( h, 0.99 ) );
+    for( b = 0; b < JCSTATS_BUCKETS; b++ )
+      printf( "%s%llu", b ? "," : "", (unsigned long long)h->buckets[b] );
+    printf( "]}" );
+  }
+  printf( "}}\n" );
+}
+
+int main( int argc, char **argv )
+{
+  const struct jcstats *s;
+  int json = 0;
+  int interval = 0;
+  int optChar;
+
+  while( ( optChar = getopt( argc, argv, "ji:h" ) ) != EOF )
+  {
+    switch( optChar )
+    {
+      case 'j':
+        json = 1;
+        break;
+
+      case 'i':
+        interval = atoi( optarg );
+        break;
+
+      case 'h':
+      default:
+        fprintf( stderr, "Usage: jcstat [-j] [-i seconds]\n" );
+        return(1);
+    }
+  }
+
+  if( ( s = jcstats_attach() ) == NULL )
+  {
+    fprintf( stderr, "jcstat: no statistics segment (is jcblock built with DO_STATS?)\n" );
+    return(1);
+  }
+
+  for( ;; )
+  {
+    if( json )
+      print_json( s );
+    else
+      print_table( s );
+    fflush( stdout );
+
+    if( interval <= 0 )
+      break;
+    sleep( interval );
+    if( !json )
+      printf( "\n" );
+  }
+  return(0);
+}
@@ -0,0 +1,210 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: jcstats.c
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Description:
+ *	The shared memory statistics segment (see jcstats.h). jcblock
+ *	creates it with jcstats_open(); until then, or if it can't be
+ *	created, updates go to a private copy so callers never need to
+ *	check. Every update is a single relaxed atomic operation: no locks
+ *	and no system calls on the call handling path.
+ */
+#define DO_STATS
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "jcstats.h"
+
+const char *jcstatsCounterNames[JCS_NUM_COUNTERS] =
+{
+  "calls", "rings", "safe", "blocked", "neutral", "starKey",
+  "serialReads", "serialBytes", "modemCommands", "modemFailures",
+  "logWrites", "cacheHits", "cacheMisses", "imported", "queries",
+  "stageWaits", "stageDrops",
+  "callMinorFaults", "callMajorFaults", "callYields", "callPreemptions"
+};
+
+const char *jcstatsHistNames[JCS_NUM_HISTS] =
+{
+  "match", "modemCommand", "hangup", "readSize", "listReload", "logWrite",
+  "stageLag", "stageDepth"
+};
+
+static struct jcstats privateStats;
+static struct jcstats *stats = &privateStats;
+static uint64_t callStart;
+
+uint64_t jcstats_now( void )
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+//
+// Create (or re-create) the shared segment. Returns 0 on success;
+// on failure the statistics are still kept, just not published.
+//
+int jcstats_open( void )
+{
+  struct jcstats *s;
+  int fd;
+
+  if( ( fd = shm_open( JCSTATS_NAME, O_RDWR | O_CREAT, 0644 ) ) < 0 )
+  {
+    perror( "jcstats: shm_open" );
+    return(-1);
+  }
+  if( ftruncate( fd, sizeof( struct jcstats ) ) < 0 )
+  {
+    perror( "jcstats: ftruncate" );
+    close( fd );
+    return(-1);
+  }
+  s = mmap( NULL, sizeof( struct jcstats ), PROT_READ | PROT_WRITE,
+            MAP_SHARED, fd, 0 );
+  close( fd );
+  if( s == MAP_FAILED )
+  {
+    perror( "jcstats: mmap" );
+    return(-1);
+  }
+
+  // Readers ignore the segment until the magic number is back.
+  atomic_store( &s->magic, 0 );
+  memset( (char *)s + sizeof( s->magic ), 0, sizeof( *s ) - sizeof( s->magic ) );
+  s->version = JCSTATS_VERSION;
+  s->numCounters = JCS_NUM_COUNTERS;
+  s->numHists = JCS_NUM_HISTS;
+  s->pid = getpid();
+  s->started = time( NULL );
+  atomic_store_explicit( &s->magic, JCSTATS_MAGIC, memory_order_release );
+
+  stats = s;
+  return(0);
+}
+
+void jcstats_close( void )
+{
+  if( stats != &privateStats )
+  {
+    munmap( stats, sizeof( struct jcstats ) );
+    stats = &privateStats;
+  }
+}
+
+//
+// Map the segment of a running (or last run) jcblock read-only.
+// Returns NULL if there is none.
+//
+const struct jcstats *jcstats_attach( void )
+{
+  struct jcstats *s;
+  int fd;
+
+  if( ( fd = shm_open( JCSTATS_NAME, O_RDONLY, 0 ) ) < 0 )
+    return NULL;
+  s = mmap( NULL, sizeof( struct jcstats ), PROT_READ, MAP_SHARED, fd, 0 );
+  close( fd );
+  if( s == MAP_FAILED )
+    return NULL;
+
+  if( atomic_load_explicit( &s->magic, memory_order_acquire ) != JCSTATS_MAGIC ||
+      s->version != JCSTATS_VERSION )
+  {
+    munmap( s, sizeof( struct jcstats ) );
+    return NULL;
+  }
+  return s;
+}
+
+void jcstats_count( int counter, uint64_t n )
+{
+  atomic_fetch_add_explicit( &stats->counters[counter], n, memory_order_relaxed );
+}
+
+void jcstats_record( int hist, uint64_t value )
+{
+  struct jcstats_hist *h = &stats->hists[hist];
+  uint64_t max;
+  int b;
+
+  b = value ? 64 - __builtin_clzll( value ) : 0;
+  if( b >= JCSTATS_BUCKETS )
+    b = JCSTATS_BUCKETS - 1;
+
+  atomic_fetch_add_explicit( &h->buckets[b], 1, memory_order_relaxed );
+  atomic_fetch_add_explicit( &h->sum, value, memory_order_relaxed );
+  atomic_fetch_add_explicit( &h->count, 1, memory_order_relaxed );
+
+  max = atomic_load_explicit( &h->max, memory_order_relaxed );
+  while( value > max &&
+         !atomic_compare_exchange_weak_explicit( &h->max, &max, value,
+                                                 memory_order_relaxed,
+                                                 memory_order_relaxed ) )
+    ;
+}
+
+// Mark the arrival of a caller ID string; jcstats_verdict() records
+// the time from here to the decision.
+void jcstats_call_start( void )
+{
+  callStart = jcstats_now();
+  jcstats_count( JCS_CALLS, 1 );
+}
+
+void jcstats_verdict( int counter )
+{
+  jcstats_count( counter, 1 );
+  jcstats_record( JCS_H_MATCH, jcstats_now() - callStart );
+}
+
+//
+// Estimate a percentile (0 < p <= 1) from the histogram buckets.
+// Returns the upper bound of the bucket holding it, capped at the max.
+//
+uint64_t jcstats_percentile( const struct jcstats_hist *h, double p )
+{
+  uint64_t count = atomic_load_explicit( &h->count, memory_order_relaxed );
+  uint64_t max = atomic_load_explicit( &h->max, memory_order_relaxed );
+  uint64_t seen = 0;
+  uint64_t bound;
+  int b;
+
+  if( count == 0 )
+    return 0;
+
+  for( b = 0; b < JCSTATS_BUCKETS; b++ )
+  {
+    seen += atomic_load_explicit( &h->buckets[b], memory_order_relaxed );
+    if( seen >= p * count )
+    {
+      bound = b ? ( (uint64_t)1 << b ) - 1 : 0;
+      return bound < max ? bound : max;
+    }
+  }
+  return max;
+}
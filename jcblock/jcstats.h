@@ -0,0 +1,124 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: jcstats.h
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Counters and histograms that jcblock publishes in a POSIX shared
+ *	memory segment (/dev/shm/jcblock-stats). jcblock updates them with
+ *	relaxed atomic adds; jcstat and jcadmin map the segment read-only.
+ *
+ *	The layout of struct jcstats is read by jcadmin.js (ReadJcblockStats)
+ *	as well: change JCSTATS_VERSION, and jcadmin, if it changes.
+ *
+ *	If DO_STATS is not defined when this file is included, the update
+ *	calls compile to nothing and jcstats_now() to 0.
+ */
+#ifndef JCSTATS_H
+#define JCSTATS_H
+
+#include <stdint.h>
+
+#define JCSTATS_NAME     "/jcblock-stats"
+#define JCSTATS_MAGIC    0x5453434a     // "JCST"
+#define JCSTATS_VERSION  6
+#define JCSTATS_BUCKETS  40
+
+// Counters
+#define JCS_CALLS           0   // caller ID strings received
+#define JCS_RINGS           1   // RING strings received
+#define JCS_SAFE            2   // calls accepted by the whitelist
+#define JCS_BLOCKED         3   // calls terminated by the blacklist
+#define JCS_NEUTRAL         4   // calls that matched neither list
+#define JCS_STAR_KEY        5   // calls blacklisted with the star key
+#define JCS_SERIAL_READS    6   // read()s of the modem port
+#define JCS_SERIAL_BYTES    7
+#define JCS_MODEM_COMMANDS  8   // AT commands sent
+#define JCS_MODEM_FAILURES  9   // AT commands that did not get OK
+#define JCS_LOG_WRITES     10   // records written to callerID.dat
+#define JCS_CACHE_HITS     11   // calls decided by the verdict cache
+#define JCS_CACHE_MISSES   12   // calls that needed the lists checked
+#define JCS_IMPORTED       13   // calls blocked by the imported numbers
+#define JCS_QUERIES        14   // verdict service queries answered
+#define JCS_STAGE_WAITS    15   // jobs that waited for room in a stage's queue
+#define JCS_STAGE_DROPS    16   // broadcasts dropped, their queue full
+// What happened to the thread deciding calls between caller ID
+// received and verdict (DO_REALTIME builds; see jcrealtime.h)
+#define JCS_CALL_MINOR_FAULTS  17   // page faults served from memory
+#define JCS_CALL_MAJOR_FAULTS  18   // page faults that read the disk
+#define JCS_CALL_YIELDS        19   // times it waited (voluntary switches)
+#define JCS_CALL_PREEMPTIONS   20   // times it was preempted
+#define JCS_NUM_COUNTERS   21
+
+// Histograms. Values are nanoseconds except JCS_H_READ_SIZE (bytes)
+// and JCS_H_STAGE_DEPTH (jobs).
+#define JCS_H_MATCH         0   // caller ID received -> verdict
+#define JCS_H_MODEM_CMD     1   // AT command written -> OK read
+#define JCS_H_HANGUP        2   // blacklist match -> modem back on hook
+#define JCS_H_READ_SIZE     3   // bytes returned by each port read()
+#define JCS_H_LIST_RELOAD   4   // re-opening a list file
+#define JCS_H_LOG_WRITE     5   // writing a callerID.dat record
+#define JCS_H_STAGE_LAG     6   // job queued for a stage -> done
+#define JCS_H_STAGE_DEPTH   7   // jobs in a stage's queue, as each is queued
+#define JCS_NUM_HISTS       8
+
+// Bucket 0 counts zeros; bucket b > 0 counts values in [2^(b-1), 2^b).
+// The last bucket also takes everything larger.
+struct jcstats_hist
+{
+  _Atomic uint64_t count;
+  _Atomic uint64_t sum;
+  _Atomic uint64_t max;
+  _Atomic uint64_t buckets[JCSTATS_BUCKETS];
+};
+
+struct jcstats
+{
+  _Atomic uint32_t magic;       // set last, once the segment is ready
+  uint32_t version;
+  uint32_t numCounters;
+  uint32_t numHists;
+  int64_t pid;                  // the jcblock process
+  int64_t started;              // time(NULL) when it started
+  _Atomic uint64_t counters[JCS_NUM_COUNTERS];
+  struct jcstats_hist hists[JCS_NUM_HISTS];
+};
+
+extern const char *jcstatsCounterNames[JCS_NUM_COUNTERS];
+extern const char *jcstatsHistNames[JCS_NUM_HISTS];
+
+const struct jcstats *jcstats_attach( void );
+uint64_t jcstats_percentile( const struct jcstats_hist *h, double p );
+
+#ifdef DO_STATS
+uint64_t jcstats_now( void );
+int jcstats_open( void );
+void jcstats_close( void );
+void jcstats_count( int counter, uint64_t n );
+void jcstats_record( int hist, uint64_t value );
+void jcstats_call_start( void );
+void jcstats_verdict( int counter );
+#else
+#define jcstats_now()               ((uint64_t)0)
+#define jcstats_open()              ((void)0)
+#define jcstats_close()             ((void)0)
+#define jcstats_count( c, n )       ((void)0)
+#define jcstats_record( h, v )      ((void)0)
+#define jcstats_call_start()        ((void)0)
+#define jcstats_verdict( c )        ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,454 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: jcsubsume.c
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Description:
+ *	Finds covered list entries (see jcsubsume.h).
+ *
+ *	Literal entries are by far the most common, and one covers another
+ *	when it is part of it. They all go in a trie; walking the trie
+ *	along every suffix of an entry finds every literal entry inside it,
+ *	without comparing each pair of entries.
+ *
+ *	Anchored entries are compared with every other entry. As in
+ *	jcpattern.c, an entry is a sequence of elements, each a set of
+ *	characters matched once or, for '*', any number of times. A literal
+ *	entry covers an anchored one if every string the anchored one
+ *	matches (with the field labels around it) contains the literal;
+ *	an anchored entry covers another if each of its terms matches
+ *	every value the other's term for the same field matches. Both are
+ *	answered by searching the pairs of states of the two automata for
+ *	a string one accepts and the other doesn't.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "jcsubsume.h"
+
+#define MAX_ELEMENTS  40      // the labels and an 18 character pattern
+#define MAX_PAIRS     1024    // states included() explores before giving up
+
+struct seq
+{
+  int count;
+  unsigned char set[MAX_ELEMENTS][256];
+  unsigned char repeat[MAX_ELEMENTS];
+};
+
+struct trie_node
+{
+  int child, sibling;
+  int first[2];                 // first entry of each list ending here, or -1
+  unsigned char c;
+};
+
+struct trie
+{
+  struct trie_node *nodes;      // nodes[0] is the root
+  int count, capacity;
+};
+
+static int append_text( struct seq *s, const char *text, size_t length )
+{
+  size_t i;
+
+  if( s->count + length > MAX_ELEMENTS )
+    return(-1);
+  for( i = 0; i < length; i++ )
+  {
+    memset( s->set[s->count], 0, 256 );
+    s->set[s->count][(unsigned char)text[i]] = 1;
+    s->repeat[s->count++] = 0;
+  }
+  return(0);
+}
+
+static int append_glob( struct seq *s, const char *glob, size_t length )
+{
+  size_t n;
+  int repeat;
+
+  while( length > 0 )
+  {
+    if( s->count == MAX_ELEMENTS ||
+        ( n = jclist_glob_element( glob, length, s->set[s->count], &repeat ) ) == 0 )
+      return(-1);
+    s->repeat[s->count++] = repeat;
+    glob += n;
+    length -= n;
+  }
+  return(0);
+}
+
+//
+// The strings of a caller ID string an anchored entry matches: its
+// terms back to back, with the field labels, as jcpattern.c has them.
+//
+static int anchored_seq( struct seq *s, const struct jclist_term *terms, int count )
+{
+  static const char *labels[JCL_NUM_FIELDS] = { "NMBR = ", "NAME = " };
+  int i;
+
+  s->count = 0;
+  if( append_text( s, "-", 1 ) != 0 )
+    return(-1);
+  for( i = 0; i < count; i++ )
+  {
+    if( append_text( s, labels[terms[i].field], 7 ) != 0 ||
+        append_glob( s, terms[i].glob, terms[i].length ) != 0 ||
+        append_text( s, "--", 2 ) != 0 )
+      return(-1);
+  }
+  return(0);
+}
+
+//
+// Whether every string 'b' matches contains 'a'. Searches the pairs
+// (element of b, characters of 'a' matched so far) for a way to the
+// end of b that never matches all of 'a'.
+//
+static int contains_all( const struct seq *b, const char *a )
+{
+  static unsigned char seen[MAX_ELEMENTS + 1][JCL_RECORD_SIZE];
+  static int stack[( MAX_ELEMENTS + 1 ) * JCL_RECORD_SIZE];
+  int fail[JCL_RECORD_SIZE];
+  int m = strlen( a );
+  int top = 0;
+  int i, j, k, c, next;
+
+  if( m == 0 || m >= JCL_RECORD_SIZE )
+    return( m == 0 );
+
+  // fail[k] is the longest proper border of a[0..k] (as in KMP).
+  fail[0] = 0;
+  for( k = 1, j = 0; k < m; k++ )
+  {
+    while( j > 0 && a[k] != a[j] )
+      j = fail[j - 1];
+    if( a[k] == a[j] )
+      j++;
+    fail[k] = j;
+  }
+
+  memset( seen, 0, sizeof( seen ) );
+  seen[0][0] = 1;
+  stack[top++] = 0;
+  while( top > 0 )
+  {
+    i = stack[--top] / JCL_RECORD_SIZE;
+    k = stack[top] % JCL_RECORD_SIZE;
+    if( i == b->count )
+      return(0);
+
+    if( b->repeat[i] && !seen[i + 1][k] )
+    {
+      seen[i + 1][k] = 1;
+      stack[top++] = ( i + 1 ) * JCL_RECORD_SIZE + k;
+    }
+    for( c = 1; c < 256; c++ )
+    {
+      if( !b->set[i][c] )
+        continue;
+      for( j = k; j > 0 && (unsigned char)a[j] != c; j = fail[j - 1] )
+        ;
+      if( (unsigned char)a[j] == c && ++j == m )
+        continue;
+      next = b->repeat[i] ? i : i + 1;
+      if( !seen[next][j] )
+      {
+        seen[next][j] = 1;
+        stack[top++] = next * JCL_RECORD_SIZE + j;
+      }
+    }
+  }
+  return(1);
+}
+
+// Add the positions that a repeating element may skip to.
+static uint64_t closure( const struct seq *a, uint64_t mask )
+{
+  int i;
+
+  for( i = 0; i < a->count; i++ )
+    if( ( mask >> i & 1 ) && a->repeat[i] )
+      mask |= (uint64_t)1 << ( i + 1 );
+  return(mask);
+}
+
+//
+// Whether every string 'b' matches is matched by 'a'. The pairs are
+// (element of b, set of positions a can be at); a pair at the end of
+// b without a at its end is a string b matches and a doesn't. If
+// there are too many pairs, the answer is no.
+//
+static int included( const struct seq *b, const struct seq *a )
+{
+  static struct { int i; uint64_t mask; } pairs[MAX_PAIRS];
+  uint64_t accept = (uint64_t)1 << a->count;
+  uint64_t mask, next, last;
+  int count = 1;
+  int done, i, j, n, c;
+
+  pairs[0].i = 0;
+  pairs[0].mask = closure( a, 1 );
+  for( done = 0; done < count; done++ )
+  {
+    i = pairs[done].i;
+    mask = pairs[done].mask;
+    if( i == b->count )
+    {
+      if( !( mask & accept ) )
+        return(0);
+      continue;
+    }
+
+    last = ~(uint64_t)0;
+    for( c = b->repeat[i] ? -1 : 1; c < 256; c++ )
+    {
+      if( c < 0 )
+      {
+        next = mask;            // b skips its repeating element
+        n = i + 1;
+      }
+      else if( c == 0 || !b->set[i][c] )
+        continue;
+      else
+      {
+        for( next = 0, j = 0; j < a->count; j++ )
+          if( ( mask >> j & 1 ) && a->set[j][c] )
+            next |= (uint64_t)1 << ( a->repeat[j] ? j : j + 1 );
+        next = closure( a, next );
+        n = b->repeat[i] ? i : i + 1;
+        if( next == last )
+          continue;
+        last = next;
+      }
+
+      for( j = 0; j < count; j++ )
+        if( pairs[j].i == n && pairs[j].mask == next )
+          break;
+      if( j == count )
+      {
+        if( count == MAX_PAIRS )
+          return(0);
+        pairs[count].i = n;
+        pairs[count++].mask = next;
+      }
+    }
+  }
+  return(1);
+}
+
+//
+// Whether every call entry 'b' matches is also matched by entry 'a'.
+// Returns 0 when that can't be shown.
+//
+int jcsubsume_covers( const char *a, const char *b )
+{
+  static struct seq sa, sb;
+  struct jclist_term ta[JCL_NUM_FIELDS], tb[JCL_NUM_FIELDS];
+  int na, nb, i, j;
+
+  na = jclist_terms( a, ta );
+  nb = jclist_terms( b, tb );
+  if( na < 0 || nb < 0 )
+    return(0);
+
+  if( na == 0 && nb == 0 )
+    return( strstr( b, a ) != NULL );
+  if( na == 0 )
+    return( anchored_seq( &sb, tb, nb ) == 0 && contains_all( &sb, a ) );
+  if( nb == 0 )
+    return(0);
+
+  // Each of a's terms must match every value b's term matches.
+  for( i = 0; i < na; i++ )
+  {
+    for( j = 0; j < nb && tb[j].field != ta[i].field; j++ )
+      ;
+    if( j == nb )
+      return(0);
+    sa.count = sb.count = 0;
+    if( append_glob( &sa, ta[i].glob, ta[i].length ) != 0 ||
+        append_glob( &sb, tb[j].glob, tb[j].length ) != 0 ||
+        !included( &sb, &sa ) )
+      return(0);
+  }
+  return(1);
+}
+
+static int trie_add( struct trie *t, const char *text, int list, int entry )
+{
+  struct trie_node *p;
+  int node = 0;
+  int n;
+
+  for( ; *text; text++ )
+  {
+    for( n = t->nodes[node].child; n >= 0 && t->nodes[n].c != (unsigned char)*text;
+         n = t->nodes[n].sibling )
+      ;
+    if( n < 0 )
+    {
+      if( t->count == t->capacity )
+      {
+        if( ( p = realloc( t->nodes, 2 * t->capacity * sizeof( *p ) ) ) == NULL )
+          return(-1);
+        t->nodes = p;
+        t->capacity *= 2;
+      }
+      n = t->count++;
+      t->nodes[n].child = -1;
+      t->nodes[n].sibling = t->nodes[node].child;
+      t->nodes[n].first[0] = t->nodes[n].first[1] = -1;
+      t->nodes[n].c = *text;
+      t->nodes[node].child = n;
+    }
+    node = n;
+  }
+  if( t->nodes[node].first[list] < 0 )
+    t->nodes[node].first[list] = entry;
+  return(0);
+}
+
+//
+// Find the literal entries inside literal entry 'entry' of 'list':
+// the first one of its own list (*same) and of the whitelist (*white).
+//
+static void trie_search( const struct trie *t, const char *text, int list,
+                         int entry, int *same, int *white )
+{
+  const struct trie_node *nodes = t->nodes;
+  const char *s, *p;
+  int n, e;
+
+  *same = *white = -1;
+  for( s = text; *s; s++ )
+  {
+    n = 0;
+    for( p = s; *p; p++ )
+    {
+      for( n = nodes[n].child; n >= 0 && nodes[n].c != (unsigned char)*p; n = nodes[n].sibling )
+        ;
+      if( n < 0 )
+        break;
+      // The entry itself (or a later copy of it) doesn't count.
+      if( ( e = nodes[n].first[list] ) >= 0 && e != entry && *same < 0 )
+        *same = e;
+      if( list == JCSUB_BLACK && ( e = nodes[n].first[JCSUB_WHITE] ) >= 0 && *white < 0 )
+        *white = e;
+    }
+  }
+}
+
+static int add_finding( struct jcsubsume *s, int kind, int list, int entry,
+                        int byList, int by )
+{
+  struct jcsub_finding *f;
+  int size = s->size ? 2 * s->size : 64;
+
+  if( s->count == s->size )
+  {
+    if( ( f = realloc( s->findings, size * sizeof( *f ) ) ) == NULL )
+      return(-1);
+    s->findings = f;
+    s->size = size;
+  }
+  f = &s->findings[s->count++];
+  f->kind = kind;
+  f->list = list;
+  f->entry = entry;
+  f->byList = byList;
+  f->by = by;
+  return(0);
+}
+
+//
+// Find the covered entries of both lists. An entry covered by an
+// entry of its own list is reported as redundant; of two entries that
+// cover each other, the later one is. Otherwise a blacklist entry
+// covered by a whitelist entry is reported as shadowed. 'white' may
+// be NULL. Returns 0 on success or -1 if out of memory.
+//
+int jcsubsume_analyse( struct jcsubsume *s, const struct jclist *white,
+                       const struct jclist *black )
+{
+  static const struct jclist noList;
+  const struct jclist *lists[2];
+  const char *b;
+  struct trie t;
+  int list, e, a, same, shadow;
+  int result = 0;
+
+  memset( s, 0, sizeof( *s ) );
+  lists[JCSUB_WHITE] = white ? white : &noList;
+  lists[JCSUB_BLACK] = black;
+
+  t.capacity = 256;
+  t.count = 1;
+  if( ( t.nodes = malloc( t.capacity * sizeof( *t.nodes ) ) ) == NULL )
+    return(-1);
+  t.nodes[0].child = t.nodes[0].sibling = -1;
+  t.nodes[0].first[0] = t.nodes[0].first[1] = -1;
+  for( list = 0; list < 2 && result == 0; list++ )
+    for( e = 0; e < lists[list]->count && result == 0; e++ )
+      if( jclist_terms( lists[list]->entries[e].pattern, NULL ) == 0 )
+        result = trie_add( &t, lists[list]->entries[e].pattern, list, e );
+
+  for( list = 0; list < 2 && result == 0; list++ )
+  {
+    for( e = 0; e < lists[list]->count && result == 0; e++ )
+    {
+      b = lists[list]->entries[e].pattern;
+      if( jclist_terms( b, NULL ) == 0 )
+        trie_search( &t, b, list, e, &same, &shadow );
+      else
+      {
+        // No anchored entry covers a literal one, so only an anchored
+        // entry needs comparing with the others.
+        same = shadow = -1;
+        for( a = 0; a < lists[list]->count && same < 0; a++ )
+          if( a != e && jcsubsume_covers( lists[list]->entries[a].pattern, b ) &&
+              ( a < e || !jcsubsume_covers( b, lists[list]->entries[a].pattern ) ) )
+            same = a;
+        for( a = 0; list == JCSUB_BLACK && same < 0 && a < lists[JCSUB_WHITE]->count &&
+                    shadow < 0; a++ )
+          if( jcsubsume_covers( lists[JCSUB_WHITE]->entries[a].pattern, b ) )
+            shadow = a;
+      }
+
+      if( same >= 0 )
+        result = add_finding( s, JCSUB_REDUNDANT, list, e, list, same );
+      else if( shadow >= 0 )
+        result = add_finding( s, JCSUB_SHADOWED, list, e, JCSUB_WHITE, shadow );
+    }
+  }
+
+  free( t.nodes );
+  if( result != 0 )
+    jcsubsume_free( s );
+  return(result);
+}
+
+void jcsubsume_free( struct jcsubsume *s )
+{
+  free( s->findings );
+  memset( s, 0, sizeof( *s ) );
+}
@@ -0,0 +1,65 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: jcsubsume.h
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Finds list entries that other entries make pointless. Entry A
+ *	covers entry B when every call B matches is also matched by A: the
+ *	entry "FLORIDA CALL" is covered by "FLORIDA", and "NMBR:203###*" by
+ *	"NMBR:203*". An entry covered by another entry of its own list can
+ *	be removed without changing any verdict. A blacklist entry covered
+ *	by a whitelist entry can never block a call, since the whitelist is
+ *	checked first; that is most likely a mistake in one of the lists.
+ *
+ *	The answer is conservative: an entry is only reported when it is
+ *	certainly covered.
+ */
+#ifndef JCSUBSUME_H
+#define JCSUBSUME_H
+
+#include "jclist.h"
+
+// Lists, as numbered in the findings.
+#define JCSUB_WHITE  0
+#define JCSUB_BLACK  1
+
+// Kinds of finding.
+#define JCSUB_REDUNDANT  0   // covered by an entry of its own list
+#define JCSUB_SHADOWED   1   // blacklist entry covered by a whitelist entry
+
+struct jcsub_finding
+{
+  int kind;
+  int list;                  // JCSUB_WHITE or JCSUB_BLACK
+  int entry;                 // index of the entry in its list
+  int byList;
+  int by;                    // index of the entry that covers it
+};
+
+struct jcsubsume
+{
+  struct jcsub_finding *findings;   // in list order, one per entry at most
+  int count;
+  int size;
+};
+
+int jcsubsume_covers( const char *a, const char *b );
+int jcsubsume_analyse( struct jcsubsume *s, const struct jclist *white,
+                       const struct jclist *black );
+void jcsubsume_free( struct jcsubsume *s );
+
+#endif
@@ -0,0 +1,139 @@
+/*
+ *	Program name: jctimeline
+ *
+ *	File name: jctimeline.c
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Description:
+ *	Dumps jcblock's per-call stage timeline ring (see jctrace.h) as
+ *	Chrome trace JSON, or as a table of milliseconds spent reaching
+ *	each stage. The ring is only read; jcblock is not disturbed.
+ *
+ *	Compile with:
+ *	    gcc -Wall -O2 -o jctimeline jctimeline.c jctrace.c -lrt
+ *
+ *	Usage:
+ *	    jctimeline [-n calls] [-o file] [-s]
+ *	      -n  only the most recent 'calls' calls
+ *	      -o  write the JSON to 'file' instead of stdout
+ *	      -s  print a table instead of JSON
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "jctrace.h"
+
+static void print_table( const struct jctrace *t, int maxCalls )
+{
+  struct jctrace_call call;
+  const struct jctrace_call *slot;
+  uint64_t next, seq, oldest, prev;
+  int s;
+
+  next = __atomic_load_n( &t->nextSeq, __ATOMIC_ACQUIRE );
+  oldest = ( next > JCTRACE_CALLS ) ? next - JCTRACE_CALLS + 1 : 1;
+  if( maxCalls > 0 && next >= (uint64_t)maxCalls && next - maxCalls + 1 > oldest )
+    oldest = next - maxCalls + 1;
+
+  // One column per stage after the first: milliseconds since the
+  // previous stage that was reached ('-' if not reached).
+  printf( "%6s %-3s %-12s", "seq", "tag", "number" );
+  for( s = 1; s < JCT_NUM_STAGES; s++ )
+    printf( " %9.9s", jctraceStageNames[s] );
+  printf( " %9s\n", "total" );
+
+  for( seq = oldest; seq <= next && next > 0; seq++ )
+  {
+    slot = &t->calls[( seq - 1 ) % JCTRACE_CALLS];
+    if( __atomic_load_n( &slot->seq, __ATOMIC_ACQUIRE ) != seq )
+      continue;
+    memcpy( &call, slot, sizeof( call ) );
+    __atomic_thread_fence( __ATOMIC_ACQUIRE );
+    if( __atomic_load_n( &slot->seq, __ATOMIC_RELAXED ) != seq )
+      continue;
+
+    printf( "%6llu  %c  %-12s", (unsigned long long)seq, call.tag, call.nmbr );
+    prev = call.stamps[JCT_FIRST_BYTE];
+    for( s = 1; s < JCT_NUM_STAGES; s++ )
+    {
+      if( call.stamps[s] == 0 )
+        printf( " %9s", "-" );
+      else
+      {
+        printf( " %9.3f", call.stamps[s] > prev ? ( call.stamps[s] - prev ) / 1e6 : 0.0 );
+        prev = call.stamps[s];
+      }
+    }
+    printf( " %9.3f\n", ( prev - call.stamps[JCT_FIRST_BYTE] ) / 1e6 );
+  }
+}
+
+int main( int argc, char **argv )
+{
+  const struct jctrace *t;
+  FILE *fp = stdout;
+  char *outFile = NULL;
+  int maxCalls = 0;
+  int table = 0;
+  int optChar;
+
+  while( ( optChar = getopt( argc, argv, "n:o:sh" ) ) != EOF )
+  {
+    switch( optChar )
+    {
+      case 'n':
+        maxCalls = atoi( optarg );
+        break;
+
+      case 'o':
+        outFile = optarg;
+        break;
+
+      case 's':
+        table = 1;
+        break;
+
+      case 'h':
+      default:
+        fprintf( stderr, "Usage: jctimeline [-n calls] [-o file] [-s]\n" );
+        return(1);
+    }
+  }
+
+  if( ( t = jctrace_attach() ) == NULL )
+  {
+    fprintf( stderr, "jctimeline: no trace ring (is jcblock built with DO_TRACE?)\n" );
+    return(1);
+  }
+
+  if( table )
+  {
+    print_table( t, maxCalls );
+    return(0);
+  }
+
+  if( outFile != NULL && ( fp = fopen( outFile, "w" ) ) == NULL )
+  {
+    perror( outFile );
+    return(1);
+  }
+  jctrace_write_json( fp, t, maxCalls );
+  if( fp != stdout )
+    fclose( fp );
+  return(0);
+}
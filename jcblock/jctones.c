@@ -0,0 +1,93 @@
+/*
+ *	Program name: jctones
+ *
+ *	File name: jctones.c
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Description:
+ *	Runs jcblock's DTMF detector (tones.c) over recordings and prints
+ *	each key press found, with the time of the frame it was found in.
+ *	Use it to check the detector against recordings of a phone, or to
+ *	see what it makes of speech and music (ideally, nothing).
+ *
+ *	Compile with:
+ *	    gcc -Wall -O2 -o jctones jctones.c tones.c -lm
+ *	(add -lasound if DO_ALSA is defined in tones.c).
+ *
+ *	Usage:
+ *	    jctones [-f] file...
+ *	      file  a WAV file (16 bit PCM), or raw 16 bit mono 8 kHz PCM
+ *	      -f    print every frame's key, not just the start of each press
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "tones.h"
+
+int main( int argc, char **argv )
+{
+  struct tones_source src;
+  struct tones_detector d;
+  int16_t frame[48000 / 50];
+  long frameNum;
+  int everyFrame = 0;
+  int optChar;
+  int keys;
+  char key;
+
+  while( ( optChar = getopt( argc, argv, "fh" ) ) != EOF )
+  {
+    switch( optChar )
+    {
+      case 'f':
+        everyFrame = 1;
+        break;
+
+      case 'h':
+      default:
+        fprintf( stderr, "Usage: jctones [-f] file...\n" );
+        return(1);
+    }
+  }
+  if( optind >= argc )
+  {
+    fprintf( stderr, "Usage: jctones [-f] file...\n" );
+    return(1);
+  }
+
+  for( ; optind < argc; optind++ )
+  {
+    if( tones_open_file( &src, argv[optind] ) != 0 )
+      continue;
+    tones_detector_init( &d, src.rate );
+
+    printf( "%s (%d Hz)\n", argv[optind], src.rate );
+    keys = 0;
+    for( frameNum = 0; tones_read( &src, frame, d.frameSize ) == d.frameSize; frameNum++ )
+    {
+      key = everyFrame ? tones_detect( &d, frame, d.frameSize )
+                       : tones_detect_new( &d, frame, d.frameSize );
+      if( key == 0 )
+        continue;
+      printf( "  %8.3f  %c\n", frameNum * 0.020, key );
+      keys++;
+    }
+    printf( "  %d key%s\n", keys, keys == 1 ? "" : "s" );
+    tones_close_source( &src );
+  }
+  return(0);
+}
@@ -0,0 +1,348 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: jctrace.c
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Description:
+ *	The per-call trace ring (see jctrace.h). Stamping a stage is one
+ *	clock_gettime() and a store. A call's slot is marked busy (seq 0)
+ *	while it is being recorded and gets its sequence number back when
+ *	the call is finished, so readers can tell a complete record from
+ *	one that is being overwritten.
+ */
+#define DO_TRACE
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "jctrace.h"
+
+const char *jctraceStageNames[JCT_NUM_STAGES] =
+{
+  "first byte", "frame complete", "normalised", "whitelist checked",
+  "blacklist checked", "hangup sent", "on hook", "broadcast sent",
+  "log written"
+};
+
+static struct jctrace privateTrace;
+static struct jctrace *trace = &privateTrace;
+static struct jctrace_call *current;        // call being recorded
+static uint64_t currentSeq;
+static uint64_t firstByteTime, frameTime;   // of the last string read
+static volatile sig_atomic_t dumpRequested;
+
+static uint64_t jctrace_now( void )
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void request_dump( int signo )
+{
+  dumpRequested = 1;
+}
+
+static void dump_trace( void )
+{
+  FILE *fp;
+
+  dumpRequested = 0;
+  if( ( fp = fopen( JCTRACE_DUMPFILE, "w" ) ) == NULL )
+  {
+    printf("jctrace: fopen() of %s failed\n", JCTRACE_DUMPFILE );
+    return;
+  }
+  jctrace_write_json( fp, trace, 0 );
+  fclose( fp );
+  printf("jctrace: wrote %s\n", JCTRACE_DUMPFILE );
+}
+
+//
+// Create the shared trace ring and arrange for SIGUSR1 to dump it.
+// Returns 0 on success; on failure calls are still traced in private
+// memory (and can still be dumped with SIGUSR1).
+//
+int jctrace_open( void )
+{
+  struct jctrace *t;
+  struct sigaction sa;
+  int fd;
+  int result = -1;
+
+  // No SA_RESTART: the signal must interrupt the wait for input.
+  memset( &sa, 0, sizeof( sa ) );
+  sa.sa_handler = request_dump;
+  sigemptyset( &sa.sa_mask );
+  sigaction( SIGUSR1, &sa, NULL );
+
+  if( ( fd = shm_open( JCTRACE_NAME, O_RDWR | O_CREAT, 0644 ) ) < 0 )
+  {
+    perror( "jctrace: shm_open" );
+    return(-1);
+  }
+  if( ftruncate( fd, sizeof( struct jctrace ) ) == 0 )
+  {
+    t = mmap( NULL, sizeof( struct jctrace ), PROT_READ | PROT_WRITE,
+              MAP_SHARED, fd, 0 );
+    if( t != MAP_FAILED )
+    {
+      __atomic_store_n( &t->magic, 0, __ATOMIC_RELEASE );
+      memset( (char *)t + sizeof( t->magic ), 0, sizeof( *t ) - sizeof( t->magic ) );
+      t->version = JCTRACE_VERSION;
+      t->numStages = JCT_NUM_STAGES;
+      t->numCalls = JCTRACE_CALLS;
+      t->pid = getpid();
+      __atomic_store_n( &t->magic, JCTRACE_MAGIC, __ATOMIC_RELEASE );
+      trace = t;
+      result = 0;
+    }
+  }
+  if( result != 0 )
+    perror( "jctrace: ftruncate/mmap" );
+  close( fd );
+  return(result);
+}
+
+//
+// Dump the trace if SIGUSR1 asked for it. For a wait other than
+// jctrace_wait_input()'s to call when it is interrupted.
+//
+void jctrace_signalled( void )
+{
+  if( dumpRequested )
+    dump_trace();
+}
+
+//
+// Wait for the modem to send something, noting when the first
+// character arrives. A SIGUSR1 received meanwhile dumps the trace.
+// Errors are left for the read() that follows to report.
+//
+void jctrace_wait_input( int fd )
+{
+  struct pollfd pfd;
+
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  for( ;; )
+  {
+    jctrace_signalled();
+    if( poll( &pfd, 1, -1 ) > 0 )
+    {
+      firstByteTime = jctrace_now();
+      return;
+    }
+    if( errno != EINTR )
+      return;
+  }
+}
+
+// The read() of a complete string from the modem has returned.
+void jctrace_frame_read( void )
+{
+  frameTime = jctrace_now();
+  if( firstByteTime == 0 || firstByteTime > frameTime )
+    firstByteTime = frameTime;
+}
+
+// The string just read is a caller ID string: start a new record.
+void jctrace_begin( void )
+{
+  currentSeq = trace->nextSeq + 1;
+  current = &trace->calls[( currentSeq - 1 ) % JCTRACE_CALLS];
+
+  __atomic_store_n( &current->seq, 0, __ATOMIC_RELEASE );
+  memset( current->stamps, 0, sizeof( current->stamps ) );
+  current->tag = '-';
+  current->nmbr[0] = 0;
+  current->stamps[JCT_FIRST_BYTE] = firstByteTime;
+  current->stamps[JCT_FRAME_COMPLETE] = frameTime;
+  __atomic_store_n( &trace->nextSeq, currentSeq, __ATOMIC_RELEASE );
+
+  firstByteTime = 0;
+}
+
+void jctrace_stage( int stage )
+{
+  if( current != NULL && current->stamps[stage] == 0 )
+    current->stamps[stage] = jctrace_now();
+}
+
+//
+// The record of the call being handled, for a stage another thread
+// reaches later (see jcstage.h) to stamp with jctrace_stage_of(),
+// which it may do after the record is finished.
+//
+struct jctrace_call *jctrace_current( void )
+{
+  return( current );
+}
+
+void jctrace_stage_of( struct jctrace_call *call, int stage )
+{
+  if( call != NULL && call->stamps[stage] == 0 )
+    call->stamps[stage] = jctrace_now();
+}
+
+//
+// The call has been decided and its record queued: note its tag and
+// number, and stop stamping it as the current call. Returns the
+// sequence number for jctrace_publish() to give the record once the
+// stages queued for it have been stamped (0 if nothing is recorded).
+//
+uint64_t jctrace_close( const char *callstr )
+{
+  const char *nmbr;
+  int i;
+
+  if( current == NULL )
+    return(0);
+
+  current->tag = callstr[0];
+  if( ( nmbr = strstr( callstr, "NMBR = " ) ) != NULL )
+  {
+    nmbr += 7;
+    for( i = 0; i < sizeof( current->nmbr ) - 1 && nmbr[i] && nmbr[i] != '-'; i++ )
+      current->nmbr[i] = ( nmbr[i] == '"' || nmbr[i] == '\\' ) ? '_' : nmbr[i];
+    current->nmbr[i] = 0;
+  }
+  current = NULL;
+  return( currentSeq );
+}
+
+// Mark a closed record complete, from whichever thread finishes it.
+void jctrace_publish( struct jctrace_call *call, uint64_t seq )
+{
+  if( call != NULL && seq != 0 )
+    __atomic_store_n( &call->seq, seq, __ATOMIC_RELEASE );
+}
+
+// Close the call's record and mark it complete at once.
+void jctrace_end( const char *callstr )
+{
+  struct jctrace_call *call = current;
+
+  jctrace_publish( call, jctrace_close( callstr ) );
+}
+
+//
+// Map the trace ring of a running (or last run) jcblock read-only.
+// Returns NULL if there is none.
+//
+const struct jctrace *jctrace_attach( void )
+{
+  struct jctrace *t;
+  int fd;
+
+  if( ( fd = shm_open( JCTRACE_NAME, O_RDONLY, 0 ) ) < 0 )
+    return NULL;
+  t = mmap( NULL, sizeof( struct jctrace ), PROT_READ, MAP_SHARED, fd, 0 );
+  close( fd );
+  if( t == MAP_FAILED )
+    return NULL;
+
+  if( __atomic_load_n( &t->magic, __ATOMIC_ACQUIRE ) != JCTRACE_MAGIC ||
+      t->version != JCTRACE_VERSION )
+  {
+    munmap( t, sizeof( struct jctrace ) );
+    return NULL;
+  }
+  return t;
+}
+
+static void print_event( FILE *fp, int *first, const char *name, const char *cat,
+                         uint64_t start, uint64_t end, long pid, int tid,
+                         uint64_t seq )
+{
+  fprintf( fp, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+           "\"pid\":%ld,\"tid\":%d,\"args\":{\"seq\":%llu}}",
+           *first ? "" : ",", name, cat, start / 1000.0,
+           ( end > start ) ? ( end - start ) / 1000.0 : 0.0,
+           pid, tid, (unsigned long long)seq );
+  *first = 0;
+}
+
+//
+// Write the most recent 'maxCalls' complete calls (all of them if
+// maxCalls is 0) as Chrome trace JSON. Each call is an event on
+// thread 1 and each of its stages an event on thread 2, lasting from
+// the previous stage reached. Returns the number of calls written.
+//
+int jctrace_write_json( FILE *fp, const struct jctrace *t, int maxCalls )
+{
+  struct jctrace_call call;
+  uint64_t next, seq, oldest, prev, last;
+  char name[64];
+  int first = 1;
+  int written = 0;
+  int s;
+
+  next = __atomic_load_n( &t->nextSeq, __ATOMIC_ACQUIRE );
+  oldest = ( next > JCTRACE_CALLS ) ? next - JCTRACE_CALLS + 1 : 1;
+  if( maxCalls > 0 && next >= (uint64_t)maxCalls && next - maxCalls + 1 > oldest )
+    oldest = next - maxCalls + 1;
+
+  fprintf( fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" );
+  fprintf( fp, "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%ld,\"tid\":1,\"args\":{\"name\":\"calls\"}},"
+               "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%ld,\"tid\":2,\"args\":{\"name\":\"stages\"}}",
+           (long)t->pid, (long)t->pid );
+  first = 0;
+
+  for( seq = oldest; seq <= next && next > 0; seq++ )
+  {
+    // Copy the record, then make sure it wasn't being rewritten meanwhile.
+    const struct jctrace_call *slot = &t->calls[( seq - 1 ) % JCTRACE_CALLS];
+    if( __atomic_load_n( &slot->seq, __ATOMIC_ACQUIRE ) != seq )
+      continue;
+    memcpy( &call, slot, sizeof( call ) );
+    __atomic_thread_fence( __ATOMIC_ACQUIRE );
+    if( __atomic_load_n( &slot->seq, __ATOMIC_RELAXED ) != seq )
+      continue;
+
+    prev = call.stamps[JCT_FIRST_BYTE];
+    last = prev;
+    for( s = 1; s < JCT_NUM_STAGES; s++ )
+    {
+      if( call.stamps[s] == 0 )
+        continue;
+      print_event( fp, &first, jctraceStageNames[s], "stage", prev,
+                   call.stamps[s], (long)t->pid, 2, seq );
+      prev = call.stamps[s];
+      if( prev > last )
+        last = prev;
+    }
+
+    snprintf( name, sizeof( name ), "call %llu %c %s",
+              (unsigned long long)seq, call.tag, call.nmbr );
+    print_event( fp, &first, name, "call", call.stamps[JCT_FIRST_BYTE], last,
+                 (long)t->pid, 1, seq );
+    written++;
+  }
+
+  fprintf( fp, "\n]}\n" );
+  return(written);
+}
@@ -0,0 +1,103 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: jctrace.h
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Per-call stage timelines. jcblock stamps each stage of handling a
+ *	call with CLOCK_MONOTONIC and keeps the last JCTRACE_CALLS calls in
+ *	a ring in shared memory (/dev/shm/jcblock-trace). The ring is written
+ *	out as Chrome trace JSON (chrome://tracing, ui.perfetto.dev) when
+ *	jcblock gets SIGUSR1, or at any time by the jctrace program.
+ *
+ *	If DO_TRACE is not defined when this file is included, the calls
+ *	jcblock makes compile to nothing.
+ */
+#ifndef JCTRACE_H
+#define JCTRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define JCTRACE_NAME     "/jcblock-trace"
+#define JCTRACE_MAGIC    0x5254434a     // "JCTR"
+#define JCTRACE_VERSION  1
+#define JCTRACE_CALLS    256            // calls kept in the ring
+#define JCTRACE_DUMPFILE "./jcblock-trace.json"
+
+// Stages of a call, in the order they normally happen.
+#define JCT_FIRST_BYTE       0   // first character of the caller ID arrived
+#define JCT_FRAME_COMPLETE   1   // read() returned the whole string
+#define JCT_NORMALISED       2   // spaces and year inserted
+#define JCT_WHITELIST        3   // whitelist checked
+#define JCT_BLACKLIST        4   // blacklist checked
+#define JCT_HANGUP_SENT      5   // first hangup command written
+#define JCT_ON_HOOK          6   // modem back on hook
+#define JCT_BROADCAST        7   // UDP broadcast sent
+#define JCT_LOG_WRITTEN      8   // callerID.dat record written
+#define JCT_NUM_STAGES       9
+
+struct jctrace_call
+{
+  uint64_t seq;                 // 0 while the call is being recorded
+  uint64_t stamps[JCT_NUM_STAGES];  // CLOCK_MONOTONIC ns; 0 = stage not reached
+  char tag;                     // the callerID.dat tag
+  char nmbr[23];
+};
+
+struct jctrace
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t numStages;
+  uint32_t numCalls;
+  int64_t pid;
+  uint64_t nextSeq;             // sequence number of the next call
+  struct jctrace_call calls[JCTRACE_CALLS];
+};
+
+extern const char *jctraceStageNames[JCT_NUM_STAGES];
+
+const struct jctrace *jctrace_attach( void );
+int jctrace_write_json( FILE *fp, const struct jctrace *t, int maxCalls );
+
+#ifdef DO_TRACE
+int jctrace_open( void );
+void jctrace_signalled( void );
+void jctrace_wait_input( int fd );
+void jctrace_frame_read( void );
+void jctrace_begin( void );
+void jctrace_stage( int stage );
+struct jctrace_call *jctrace_current( void );
+void jctrace_stage_of( struct jctrace_call *call, int stage );
+uint64_t jctrace_close( const char *callstr );
+void jctrace_publish( struct jctrace_call *call, uint64_t seq );
+void jctrace_end( const char *callstr );
+#else
+#define jctrace_open()           ((void)0)
+#define jctrace_signalled()      ((void)0)
+#define jctrace_wait_input( fd ) ((void)0)
+#define jctrace_frame_read()     ((void)0)
+#define jctrace_begin()          ((void)0)
+#define jctrace_stage( s )       ((void)0)
+#define jctrace_current()        NULL
+#define jctrace_stage_of( c, s ) ((void)0)
+#define jctrace_close( c )       ((uint64_t)0)
+#define jctrace_publish( c, s )  ((void)0)
+#define jctrace_end( c )         ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,394 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: tones.c
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Description:
+ *	Star (*) key detection for jcblock.c (DO_TONES). Audio comes from
+ *	the sound card (ALSA, the microphone next to the phone) or, if
+ *	the JCBLOCK_TONES_FILE environment variable names one, from a WAV
+ *	or raw PCM file. tonesPoll() reads one 20 ms frame and runs it
+ *	through the Goertzel filter bank, so a key is seen within a frame
+ *	of the tone starting.
+ *
+ *	A frame holds a key when:
+ *	- it is loud enough to be worth looking at,
+ *	- the strongest row tone and the strongest column tone are each
+ *	  well clear of the other tones in their group,
+ *	- their levels are within the allowed twist of each other, and
+ *	- together they carry most of the frame's energy (which speech
+ *	  and music do not).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "common.h"
+#include "tones.h"
+
+// Uncomment the following define to read tones from the sound card.
+// It needs the ALSA development files (libasound2-dev on Debian and
+// Raspbian); add -lasound to the gcc compile command. Without it,
+// tones can only be read from a file (see above).
+//#define DO_ALSA
+
+#ifdef DO_ALSA
+#include <alsa/asoundlib.h>
+#define ALSA_DEVICE "default"
+#endif
+
+#define MAX_RATE         48000
+#define MIN_LEVEL        100.0     // RMS of the quietest frame looked at
+#define GROUP_MARGIN     4.0       // 6 dB over the next tone in the group
+#define FORWARD_TWIST    6.3       // row up to 8 dB louder than column
+#define REVERSE_TWIST    2.5       // column up to 4 dB louder than row
+#define MIN_TONE_SHARE   0.6       // of the frame energy in the two tones
+
+static const float dtmfFreqs[TONES_NUM_FREQS] =
+{
+  697, 770, 852, 941,              // rows
+  1209, 1336, 1477, 1633           // columns
+};
+
+static const char dtmfKeys[4][4] =
+{
+  { '1', '2', '3', 'A' },
+  { '4', '5', '6', 'B' },
+  { '7', '8', '9', 'C' },
+  { '*', '0', '#', 'D' }
+};
+
+void tones_detector_init( struct tones_detector *d, int rate )
+{
+  int k;
+
+  memset( d, 0, sizeof( *d ) );
+  d->rate = rate;
+  d->frameSize = rate / 50;
+  for( k = 0; k < TONES_NUM_FREQS; k++ )
+    d->coeff[k] = 2.0 * cos( 2.0 * M_PI * dtmfFreqs[k] / rate );
+  d->minEnergy = MIN_LEVEL * MIN_LEVEL;
+}
+
+// The strongest of four tones, or -1 if it doesn't stand out.
+static int strongest( const float *power )
+{
+  int best = 0;
+  int k;
+
+  for( k = 1; k < 4; k++ )
+    if( power[k] > power[best] )
+      best = k;
+  for( k = 0; k < 4; k++ )
+    if( k != best && power[best] < GROUP_MARGIN * power[k] )
+      return(-1);
+  return(best);
+}
+
+//
+// Decide which key, if any, is held in 'count' samples (normally one
+// frame). Returns the key, or 0 for none.
+//
+char tones_detect( struct tones_detector *d, const int16_t *samples, int count )
+{
+  float s0, s1[TONES_NUM_FREQS], s2[TONES_NUM_FREQS];
+  float power[TONES_NUM_FREQS];
+  float energy = 0.0;
+  float x;
+  int i, k, row, col;
+
+  if( count <= 0 )
+    return(0);
+
+  // The filters are run side by side over each sample so that the
+  // inner loop is a straight line of vector multiply-adds.
+  memset( s1, 0, sizeof( s1 ) );
+  memset( s2, 0, sizeof( s2 ) );
+  for( i = 0; i < count; i++ )
+  {
+    x = samples[i];
+    energy += x * x;
+    for( k = 0; k < TONES_NUM_FREQS; k++ )
+    {
+      s0 = x + d->coeff[k] * s1[k] - s2[k];
+      s2[k] = s1[k];
+      s1[k] = s0;
+    }
+  }
+
+  if( energy < d->minEnergy * count )
+    return(0);
+
+  // Scale each power to the energy a tone of that size puts in the
+  // frame, so it can be compared with the frame energy.
+  for( k = 0; k < TONES_NUM_FREQS; k++ )
+    power[k] = ( s1[k] * s1[k] + s2[k] * s2[k] - d->coeff[k] * s1[k] * s2[k] )
+               * 2.0 / count;
+
+  if( ( row = strongest( power ) ) < 0 || ( col = strongest( power + 4 ) ) < 0 )
+    return(0);
+
+  if( power[row] > FORWARD_TWIST * power[4 + col] ||
+      power[4 + col] > REVERSE_TWIST * power[row] )
+    return(0);
+
+  if( power[row] + power[4 + col] < MIN_TONE_SHARE * energy )
+    return(0);
+
+  return(dtmfKeys[row][col]);
+}
+
+//
+// As tones_detect(), but a key held over several frames is only
+// returned for the first of them.
+//
+char tones_detect_new( struct tones_detector *d, const int16_t *samples, int count )
+{
+  char key = tones_detect( d, samples, count );
+
+  if( key == d->lastKey )
+    return(0);
+  d->lastKey = key;
+  return(key);
+}
+
+static uint32_t get_le32( const unsigned char *p )
+{
+  return p[0] | ( p[1] << 8 ) | ( p[2] << 16 ) | ( (uint32_t)p[3] << 24 );
+}
+
+//
+// Open a file of 16 bit signed little endian samples: a WAV file, or
+// anything else taken as raw mono PCM at 8 kHz. Returns 0 on success.
+//
+int tones_open_file( struct tones_source *src, const char *filename )
+{
+  unsigned char header[16];
+  uint32_t size;
+  int format = 0;
+  int bits = 16;
+
+  memset( src, 0, sizeof( *src ) );
+  src->rate = TONES_RATE;
+  src->channels = 1;
+  if( ( src->fp = fopen( filename, "rb" ) ) == NULL )
+  {
+    perror( filename );
+    return(-1);
+  }
+
+  if( fread( header, 1, 12, src->fp ) != 12 ||
+      memcmp( header, "RIFF", 4 ) != 0 || memcmp( header + 8, "WAVE", 4 ) != 0 )
+  {
+    rewind( src->fp );
+    return(0);
+  }
+
+  // Walk the chunks up to "data", picking up the format on the way.
+  while( fread( header, 1, 8, src->fp ) == 8 )
+  {
+    size = get_le32( header + 4 );
+    if( memcmp( header, "data", 4 ) == 0 )
+    {
+      if( format != 1 || bits != 16 || src->channels < 1 || src->channels > 8 ||
+          src->rate <= 0 || src->rate > MAX_RATE )
+      {
+        fprintf( stderr, "%s: only 16 bit PCM up to %d Hz is supported\n",
+                 filename, MAX_RATE );
+        break;
+      }
+      return(0);
+    }
+    if( memcmp( header, "fmt ", 4 ) == 0 && size >= 16 )
+    {
+      if( fread( header, 1, 16, src->fp ) != 16 )
+        break;
+      format = header[0] | ( header[1] << 8 );
+      src->channels = header[2] | ( header[3] << 8 );
+      src->rate = get_le32( header + 4 );
+      bits = header[14] | ( header[15] << 8 );
+      size -= 16;
+    }
+    if( fseek( src->fp, size + ( size & 1 ), SEEK_CUR ) != 0 )
+      break;
+  }
+
+  fprintf( stderr, "%s: not a usable WAV file\n", filename );
+  fclose( src->fp );
+  src->fp = NULL;
+  return(-1);
+}
+
+#ifdef DO_ALSA
+static int tones_open_alsa( struct tones_source *src )
+{
+  snd_pcm_t *pcm;
+  int err;
+
+  memset( src, 0, sizeof( *src ) );
+  if( ( err = snd_pcm_open( &pcm, ALSA_DEVICE, SND_PCM_STREAM_CAPTURE, 0 ) ) < 0 )
+  {
+    printf("tones: snd_pcm_open() failed: %s\n", snd_strerror( err ) );
+    return(-1);
+  }
+
+  // Mono at 8 kHz (resampled by ALSA if need be), at most 100 ms
+  // buffered.
+  if( ( err = snd_pcm_set_params( pcm, SND_PCM_FORMAT_S16_LE,
+                                  SND_PCM_ACCESS_RW_INTERLEAVED, 1,
+                                  TONES_RATE, 1, 100000 ) ) < 0 )
+  {
+    printf("tones: snd_pcm_set_params() failed: %s\n", snd_strerror( err ) );
+    snd_pcm_close( pcm );
+    return(-1);
+  }
+  src->pcm = pcm;
+  src->rate = TONES_RATE;
+  src->channels = 1;
+  return(0);
+}
+#endif
+
+//
+// Read up to 'count' samples (of the first channel). Blocks for sound
+// card input. Returns the number read; 0 at end of file or on error.
+//
+int tones_read( struct tones_source *src, int16_t *samples, int count )
+{
+  int16_t buf[MAX_RATE / 50 * 2];
+  int i, n, want, got;
+#ifdef DO_ALSA
+  snd_pcm_sframes_t frames;
+#endif
+
+  if( src->fp != NULL )
+  {
+    if( src->channels == 1 )
+      return fread( samples, sizeof( int16_t ), count, src->fp );
+
+    // Keep the first channel
+    n = 0;
+    while( n < count )
+    {
+      want = count - n;
+      if( want > sizeof( buf ) / sizeof( buf[0] ) / src->channels )
+        want = sizeof( buf ) / sizeof( buf[0] ) / src->channels;
+      got = fread( buf, sizeof( int16_t ) * src->channels, want, src->fp );
+      for( i = 0; i < got; i++ )
+        samples[n++] = buf[i * src->channels];
+      if( got < want )
+        break;
+    }
+    return(n);
+  }
+
+#ifdef DO_ALSA
+  if( src->pcm != NULL )
+  {
+    n = 0;
+    while( n < count )
+    {
+      frames = snd_pcm_readi( src->pcm, samples + n, count - n );
+      if( frames < 0 )
+      {
+        // Recover from an overrun (we were away too long) and go on
+        if( snd_pcm_recover( src->pcm, frames, 1 ) < 0 )
+        {
+          printf("tones: snd_pcm_readi() failed: %s\n", snd_strerror( frames ) );
+          return(n);
+        }
+        continue;
+      }
+      n += frames;
+    }
+    return(n);
+  }
+#endif
+
+  return(0);
+}
+
+void tones_close_source( struct tones_source *src )
+{
+  if( src->fp != NULL )
+    fclose( src->fp );
+#ifdef DO_ALSA
+  if( src->pcm != NULL )
+    snd_pcm_close( src->pcm );
+#endif
+  memset( src, 0, sizeof( *src ) );
+}
+
+//
+// The functions jcblock.c uses (declared in common.h).
+//
+static struct tones_source source;
+static struct tones_detector detector;
+static int16_t frame[MAX_RATE / 50];
+
+void tonesInit()
+{
+  char *filename = getenv( TONES_FILE_ENV );
+
+  if( filename != NULL )
+    tones_open_file( &source, filename );
+#ifdef DO_ALSA
+  else
+    tones_open_alsa( &source );
+#else
+  else
+    printf("tones: no sound card support; set %s\n", TONES_FILE_ENV );
+#endif
+
+  tones_detector_init( &detector, source.rate ? source.rate : TONES_RATE );
+}
+
+//
+// Throw away audio captured before the star key window opened.
+//
+void tonesClearBuffer()
+{
+#ifdef DO_ALSA
+  if( source.pcm != NULL )
+  {
+    snd_pcm_drop( source.pcm );
+    snd_pcm_prepare( source.pcm );
+  }
+#endif
+  detector.lastKey = 0;
+}
+
+//
+// Read one frame and return TRUE if a star (*) key press starts in it.
+// Takes one frame time (20 ms) whether or not there is any input.
+//
+bool tonesPoll()
+{
+  if( tones_read( &source, frame, detector.frameSize ) < detector.frameSize )
+  {
+    usleep( 20000 );
+    return(FALSE);
+  }
+  return( tones_detect_new( &detector, frame, detector.frameSize ) == '*' );
+}
+
+void tonesClose()
+{
+  tones_close_source( &source );
+}
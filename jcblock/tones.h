@@ -0,0 +1,65 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: tones.h
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	The DTMF detector behind the star (*) key feature of jcblock.c
+ *	(tonesInit() and friends, declared in common.h). Audio is taken
+ *	in 20 ms frames; each frame is run through a bank of eight
+ *	Goertzel filters, one per DTMF frequency, and the key (if any) is
+ *	decided from that frame alone.
+ */
+#ifndef TONES_H
+#define TONES_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define TONES_RATE         8000    // samples per second
+#define TONES_FRAME        160     // samples per frame (20 ms)
+#define TONES_NUM_FREQS    8       // four row and four column tones
+
+// Environment variable naming a WAV or raw PCM (16 bit signed, mono,
+// 8 kHz) file to read instead of the sound card.
+#define TONES_FILE_ENV     "JCBLOCK_TONES_FILE"
+
+struct tones_detector
+{
+  int rate;                          // sample rate
+  int frameSize;                     // samples per frame
+  float coeff[TONES_NUM_FREQS];      // 2cos(2 pi f / rate)
+  float minEnergy;                   // quietest frame considered
+  char lastKey;                      // key in the previous frame, or 0
+};
+
+struct tones_source
+{
+  FILE *fp;                          // WAV or raw file, or NULL
+  void *pcm;                         // ALSA capture handle, or NULL
+  int rate;
+  int channels;
+};
+
+void tones_detector_init( struct tones_detector *d, int rate );
+char tones_detect( struct tones_detector *d, const int16_t *samples, int count );
+char tones_detect_new( struct tones_detector *d, const int16_t *samples, int count );
+
+int tones_open_file( struct tones_source *src, const char *filename );
+int tones_read( struct tones_source *src, int16_t *samples, int count );
+void tones_close_source( struct tones_source *src );
+
+#endif
@@ -228,6 +228,23 @@ void close_time_save_file()
   fclose( fpTime );
 }
 
+//
+// Function to tell whether truncate_records() would truncate the files
+// now, that is, whether thirty days have passed since it last did.
+//
+int truncate_due()
+{
+  time_t savedTime;
+  int due = 0;
+
+  if( create_time_save_file() == -1 )
+    return 0;
+  if( time( &currentTime ) != -1 && (savedTime = get_saved_time()) != -1 )
+    due = ( (currentTime - savedTime) >= CHECK_SECS );
+  close_time_save_file();
+  return due;
+}
+
 //
 // Function to truncate (remove) callerID.dat records that are older
 // than nine months.
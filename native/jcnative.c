@@ -0,0 +1,454 @@
+/*
+    jcnative.c  -  Node.js binding for jcblock's list matcher and caller ID parser.
+
+    https://github.com/cosinekitty/jcadmin
+
+    This is the same C code (jcblock/jclist.c) that jcblock itself uses to
+    decide calls, so verdicts computed by jcadmin agree with the daemon.
+    jcadmin.js falls back to a JavaScript copy of the rules if this addon
+    has not been built.
+
+    Exports:
+        parseCallLog(buffer)
+            Parses every complete line of a callerID.dat fragment.
+            Returns {consumed, calls}, where consumed is the number of bytes
+            up to and including the last '\n', and calls is a flat array of
+            [start, end, tag, date, time, nmbr, name] for each valid record.
+
+        compileList(text)
+            Compiles the contents of whitelist.dat or blacklist.dat (string
+            or Buffer) into an opaque list object.
+
+        listEntries(list)
+            Returns [pattern, offset, pattern, offset, ...] for a compiled list.
+
+        verdict(white, black, callstr)
+            Decides a caller ID string the way jcblock does. 'white' may be null.
+            Returns [status, rule] where status is 'safe', 'blocked' or 'neutral'
+            and rule is the index of the matching entry (or -1).
+
+        verdicts(white, black, callstrs)
+            Same as verdict() for an array of strings; returns a flat array.
+
+        subsumption(white, black)
+            Finds the entries that other entries make pointless (jcsubsume.c).
+            'white' may be null. Returns [kind, list, entry, byList, by, ...]
+            where kind is 'redundant' or 'shadowed', lists are 0 (whitelist)
+            or 1 (blacklist) and entries are indexes into them.
+
+        journalAppend(filename, records)
+            Appends records to the list journal (jcblock/jcjournal.h) under its
+            lock, numbering them. Each record is a string "<op> <list> <text>".
+            Returns the sequence number of the last.
+
+        journalFold(filename, whitelist, blacklist)
+            Folds the list journal into the list files and empties it.
+            Returns the number of records folded.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <node_api.h>
+
+#include "jclist.h"
+#include "jcsubsume.h"
+#include "jcjournal.h"
+
+#define CHECK(call)                                                 \
+    do {                                                            \
+        if ((call) != napi_ok) {                                    \
+            napi_throw_error(env, NULL, "jcnative: " #call " failed"); \
+            return NULL;                                            \
+        }                                                           \
+    } while (0)
+
+static const char *StatusName[] = { "neutral", "safe", "blocked" };
+static const char *FindingName[] = { "redundant", "shadowed" };
+
+static napi_value Str(napi_env env, const char *text) {
+    napi_value value;
+    if (napi_create_string_utf8(env, text, NAPI_AUTO_LENGTH, &value) != napi_ok) {
+        return NULL;
+    }
+    return value;
+}
+
+static napi_value Int(napi_env env, double n) {
+    napi_value value;
+    if (napi_create_double(env, n, &value) != napi_ok) {
+        return NULL;
+    }
+    return value;
+}
+
+// Copy a JavaScript string into a malloc'd buffer. Returns NULL on failure.
+static char *GetString(napi_env env, napi_value value, size_t *length) {
+    size_t size;
+    char *text;
+
+    if (napi_get_value_string_utf8(env, value, NULL, 0, &size) != napi_ok) {
+        return NULL;
+    }
+    if ((text = malloc(size + 1)) == NULL) {
+        return NULL;
+    }
+    if (napi_get_value_string_utf8(env, value, text, size + 1, &size) != napi_ok) {
+        free(text);
+        return NULL;
+    }
+    if (length) {
+        *length = size;
+    }
+    return text;
+}
+
+static napi_value ParseCallLog(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value argv[1];
+    napi_value result, calls;
+    char *data;
+    size_t length, start, end;
+    uint32_t n = 0;
+    struct jccall call;
+
+    CHECK(napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+    if (argc < 1 || napi_get_buffer_info(env, argv[0], (void **)&data, &length) != napi_ok) {
+        napi_throw_type_error(env, NULL, "parseCallLog: expected a Buffer");
+        return NULL;
+    }
+
+    CHECK(napi_create_array(env, &calls));
+    for (start = 0; start < length; start = end + 1) {
+        const char *nl = memchr(data + start, '\n', length - start);
+        if (nl == NULL) {
+            break;      // partial line: leave it for next time
+        }
+        end = nl - data;
+        if (jccall_parse(data + start, end - start, &call) == 0) {
+            char tag[2] = { call.tag, 0 };
+            CHECK(napi_set_element(env, calls, n++, Int(env, start)));
+            CHECK(napi_set_element(env, calls, n++, Int(env, end)));
+            CHECK(napi_set_element(env, calls, n++, Str(env, tag)));
+            CHECK(napi_set_element(env, calls, n++, Str(env, call.date)));
+            CHECK(napi_set_element(env, calls, n++, Str(env, call.time)));
+            CHECK(napi_set_element(env, calls, n++, Str(env, call.nmbr)));
+            CHECK(napi_set_element(env, calls, n++, Str(env, call.name)));
+        }
+    }
+
+    CHECK(napi_create_object(env, &result));
+    CHECK(napi_set_named_property(env, result, "consumed", Int(env, start)));
+    CHECK(napi_set_named_property(env, result, "calls", calls));
+    return result;
+}
+
+static void FreeList(napi_env env, void *data, void *hint) {
+    jclist_free((struct jclist *)data);
+    free(data);
+}
+
+static napi_value CompileList(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value argv[1];
+    napi_value result;
+    struct jclist *list;
+    char *text = NULL;
+    char *copy = NULL;
+    size_t length;
+    bool isBuffer;
+    int rc;
+
+    CHECK(napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+    if (argc < 1) {
+        napi_throw_type_error(env, NULL, "compileList: expected list text");
+        return NULL;
+    }
+
+    CHECK(napi_is_buffer(env, argv[0], &isBuffer));
+    if (isBuffer) {
+        CHECK(napi_get_buffer_info(env, argv[0], (void **)&text, &length));
+    } else if ((text = copy = GetString(env, argv[0], &length)) == NULL) {
+        napi_throw_type_error(env, NULL, "compileList: expected a string or Buffer");
+        return NULL;
+    }
+
+    if ((list = malloc(sizeof(*list))) == NULL) {
+        free(copy);
+        napi_throw_error(env, NULL, "compileList: out of memory");
+        return NULL;
+    }
+    jclist_init(list);
+    rc = jclist_load_buffer(list, text, length);
+    free(copy);
+    if (rc != 0) {
+        FreeList(env, list, NULL);
+        napi_throw_error(env, NULL, "compileList: out of memory");
+        return NULL;
+    }
+
+    if (napi_create_external(env, list, FreeList, NULL, &result) != napi_ok) {
+        FreeList(env, list, NULL);
+        napi_throw_error(env, NULL, "compileList: napi_create_external failed");
+        return NULL;
+    }
+    return result;
+}
+
+// Get the compiled list from an argument, or NULL for null/undefined.
+// Returns 0 on success, -1 (with an exception pending) otherwise.
+static int GetList(napi_env env, napi_value value, struct jclist **list) {
+    napi_valuetype type;
+
+    *list = NULL;
+    if (napi_typeof(env, value, &type) != napi_ok) {
+        return -1;
+    }
+    if (type == napi_null || type == napi_undefined) {
+        return 0;
+    }
+    if (type != napi_external || napi_get_value_external(env, value, (void **)list) != napi_ok) {
+        napi_throw_type_error(env, NULL, "expected a list returned by compileList()");
+        return -1;
+    }
+    return 0;
+}
+
+static napi_value ListEntries(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value argv[1];
+    napi_value result;
+    struct jclist *list;
+    int i;
+
+    CHECK(napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+    if (argc < 1 || GetList(env, argv[0], &list) != 0) {
+        return NULL;
+    }
+
+    CHECK(napi_create_array(env, &result));
+    for (i = 0; list && i < list->count; ++i) {
+        CHECK(napi_set_element(env, result, 2*i, Str(env, list->entries[i].pattern)));
+        CHECK(napi_set_element(env, result, 2*i + 1, Int(env, list->entries[i].offset)));
+    }
+    return result;
+}
+
+static napi_value Verdicts(napi_env env, napi_callback_info info) {
+    size_t argc = 3;
+    napi_value argv[3];
+    napi_value result, item;
+    struct jclist *white, *black;
+    bool isArray;
+    uint32_t count, i;
+    char *callstr;
+    int status, rule;
+
+    CHECK(napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+    if (argc < 3 || GetList(env, argv[0], &white) != 0 || GetList(env, argv[1], &black) != 0) {
+        if (argc < 3) {
+            napi_throw_type_error(env, NULL, "expected (white, black, callstr)");
+        }
+        return NULL;
+    }
+
+    CHECK(napi_is_array(env, argv[2], &isArray));
+    if (isArray) {
+        CHECK(napi_get_array_length(env, argv[2], &count));
+    } else {
+        count = 1;
+    }
+
+    CHECK(napi_create_array(env, &result));
+    for (i = 0; i < count; ++i) {
+        if (isArray) {
+            CHECK(napi_get_element(env, argv[2], i, &item));
+        } else {
+            item = argv[2];
+        }
+        if ((callstr = GetString(env, item, NULL)) == NULL) {
+            napi_throw_type_error(env, NULL, "expected caller ID string");
+            return NULL;
+        }
+        status = jclist_verdict(white, black, callstr, &rule);
+        free(callstr);
+        CHECK(napi_set_element(env, result, 2*i, Str(env, StatusName[status])));
+        CHECK(napi_set_element(env, result, 2*i + 1, Int(env, rule)));
+    }
+    return result;
+}
+
+static napi_value Subsumption(napi_env env, napi_callback_info info) {
+    size_t argc = 2;
+    napi_value argv[2];
+    napi_value result;
+    struct jclist *white, *black;
+    struct jcsubsume s;
+    struct jcsub_finding *f;
+    int i;
+
+    CHECK(napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+    if (argc < 2 || GetList(env, argv[0], &white) != 0 || GetList(env, argv[1], &black) != 0) {
+        if (argc < 2) {
+            napi_throw_type_error(env, NULL, "expected (white, black)");
+        }
+        return NULL;
+    }
+    if (black == NULL) {
+        napi_throw_type_error(env, NULL, "subsumption: a blacklist is required");
+        return NULL;
+    }
+    if (jcsubsume_analyse(&s, white, black) != 0) {
+        napi_throw_error(env, NULL, "subsumption: out of memory");
+        return NULL;
+    }
+
+    if (napi_create_array(env, &result) != napi_ok) {
+        jcsubsume_free(&s);
+        napi_throw_error(env, NULL, "subsumption: napi_create_array failed");
+        return NULL;
+    }
+    for (i = 0; i < s.count; ++i) {
+        f = &s.findings[i];
+        if (napi_set_element(env, result, 5*i, Str(env, FindingName[f->kind])) != napi_ok ||
+            napi_set_element(env, result, 5*i + 1, Int(env, f->list)) != napi_ok ||
+            napi_set_element(env, result, 5*i + 2, Int(env, f->entry)) != napi_ok ||
+            napi_set_element(env, result, 5*i + 3, Int(env, f->byList)) != napi_ok ||
+            napi_set_element(env, result, 5*i + 4, Int(env, f->by)) != napi_ok) {
+            jcsubsume_free(&s);
+            napi_throw_error(env, NULL, "subsumption: napi_set_element failed");
+            return NULL;
+        }
+    }
+    jcsubsume_free(&s);
+    return result;
+}
+
+static void ThrowErrno(napi_env env, const char *what, const char *filename) {
+    char message[1100];
+    snprintf(message, sizeof(message), "%s: %s: %s", what, filename, strerror(errno));
+    napi_throw_error(env, NULL, message);
+}
+
+static napi_value JournalAppend(napi_env env, napi_callback_info info) {
+    size_t argc = 2;
+    napi_value argv[2];
+    napi_value item;
+    struct jcjournal j;
+    struct jcjournal_record *records = NULL;
+    char **texts = NULL;
+    char *filename = NULL;
+    uint32_t count = 0, i;
+    bool isArray = false;
+    napi_value result = NULL;
+
+    CHECK(napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+    if (argc < 2 || napi_is_array(env, argv[1], &isArray) != napi_ok || !isArray ||
+        (filename = GetString(env, argv[0], NULL)) == NULL) {
+        napi_throw_type_error(env, NULL, "journalAppend: expected (filename, records)");
+        return NULL;
+    }
+    CHECK(napi_get_array_length(env, argv[1], &count));
+    records = calloc(count + 1, sizeof(*records));
+    texts = calloc(count + 1, sizeof(*texts));
+    if (records == NULL || texts == NULL) {
+        napi_throw_error(env, NULL, "journalAppend: out of memory");
+        goto done;
+    }
+    for (i = 0; i < count; ++i) {
+        if (napi_get_element(env, argv[1], i, &item) != napi_ok ||
+            (texts[i] = GetString(env, item, NULL)) == NULL ||
+            strlen(texts[i]) < 4 || (texts[i][2] != 'W' && texts[i][2] != 'B')) {
+            napi_throw_type_error(env, NULL, "journalAppend: a record must be \"<op> <list> <text>\"");
+            goto done;
+        }
+        records[i].op = texts[i][0];
+        records[i].list = (texts[i][2] == 'W') ? JCP_WHITE : JCP_BLACK;
+        records[i].text = texts[i] + 4;
+    }
+
+    if (jcjournal_open(&j, filename) != 0) {
+        ThrowErrno(env, "journalAppend", filename);
+        jcjournal_close(&j);
+        goto done;
+    }
+    if (jcjournal_append(&j, records, count) != 0) {
+        ThrowErrno(env, "journalAppend", filename);
+    } else {
+        result = Int(env, count > 0 ? (double)records[count - 1].seq : 0);
+    }
+    jcjournal_close(&j);
+
+done:
+    for (i = 0; texts != NULL && i < count; ++i) {
+        free(texts[i]);
+    }
+    free(texts);
+    free(records);
+    free(filename);
+    return result;
+}
+
+static napi_value JournalFold(napi_env env, napi_callback_info info) {
+    size_t argc = 3;
+    napi_value argv[3];
+    struct jcjournal j;
+    char *names[3] = { NULL, NULL, NULL };
+    const char *files[JCP_GROUPS];
+    napi_value result = NULL;
+    int i, count;
+
+    CHECK(napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+    for (i = 0; i < 3; ++i) {
+        if ((size_t)i >= argc || (names[i] = GetString(env, argv[i], NULL)) == NULL) {
+            napi_throw_type_error(env, NULL, "journalFold: expected (filename, whitelist, blacklist)");
+            goto done;
+        }
+    }
+    files[JCP_WHITE] = names[1];
+    files[JCP_BLACK] = names[2];
+    if (jcjournal_open(&j, names[0]) != 0) {
+        ThrowErrno(env, "journalFold", names[0]);
+        jcjournal_close(&j);
+        goto done;
+    }
+    if ((count = jcjournal_fold(&j, files, NULL, NULL)) < 0) {
+        ThrowErrno(env, "journalFold", names[0]);
+    } else {
+        result = Int(env, count);
+    }
+    jcjournal_close(&j);
+
+done:
+    for (i = 0; i < 3; ++i) {
+        free(names[i]);
+    }
+    return result;
+}
+
+NAPI_MODULE_INIT() {
+    static const struct {
+        const char *name;
+        napi_callback func;
+    } table[] = {
+        { "parseCallLog", ParseCallLog },
+        { "compileList",  CompileList  },
+        { "listEntries",  ListEntries  },
+        { "verdict",      Verdicts     },
+        { "verdicts",     Verdicts     },
+        { "subsumption",  Subsumption  },
+        { "journalAppend", JournalAppend },
+        { "journalFold",  JournalFold  },
+    };
+    size_t i;
+    napi_value fn;
+
+    for (i = 0; i < sizeof(table) / sizeof(table[0]); ++i) {
+        if (napi_create_function(env, table[i].name, NAPI_AUTO_LENGTH, table[i].func, NULL, &fn) != napi_ok ||
+            napi_set_named_property(env, exports, table[i].name, fn) != napi_ok) {
+            return NULL;
+        }
+    }
+    return exports;
+}
@@ -7,7 +7,7 @@
 ;(function(){
     'use strict';
 
-    function ApiCall(verb, path, onSuccess, onFailure) {
+    function ApiCall(verb, path, onSuccess, onFailure, body) {
         var handled = false;
         var request = new XMLHttpRequest();
         request.onreadystatechange = function(){
@@ -34,7 +34,12 @@
 
         request.open(verb, path);
         request.timeout = 2000;
-        request.send(null);
+        if (body) {
+            request.setRequestHeader('Content-Type', 'application/json');
+            request.send(JSON.stringify(body));
+        } else {
+            request.send(null);
+        }
     }
 
     function ApiGet(path, onSuccess, onFailure) {
@@ -49,6 +54,10 @@
         ApiCall('DELETE', path, onSuccess, onFailure);
     }
 
+    function ApiPostJson(path, body, onSuccess, onFailure) {
+        ApiCall('POST', path, onSuccess, onFailure, body);
+    }
+
     // A list of all mutually-exclusive elements (only one is visible at a time):
     var ModalDivList = [
         'RecentCallsDiv',
@@ -70,6 +79,9 @@
         safe: true
     };
 
+    // Phone numbers selected in the call history for a batch operation.
+    var SelectedNumbers = {};
+
     var HistoryDisplayModeIndex = 0;
     var HistoryDisplayModeRing = ['all', 'safe', 'blocked', 'neutral'];
 
@@ -104,11 +116,10 @@
             modified: '',
             data: {
                 calls: [],
-                limit: 0,
-                start: 0,
                 total: 0,
-                count: {},
-                names: {}
+                count: {},      // aggregates for phone numbers, merged in as they are fetched
+                names: {},
+                callid: {}
             }
         },
 
@@ -298,6 +309,30 @@
         return SanitizeSpaces(PrevPoll.callerid.data.callid[number]);
     }
 
+    function ShowVerdict(call) {
+        // Ask the server what jcblock would do with this caller, using jcblock's own matching rules.
+        var verdictDiv = document.getElementById('TargetVerdictDiv');
+        verdictDiv.textContent = '';
+        var url = '/api/verdict/' + encodeURIComponent(call.number);
+        if (call.callid) {
+            url += '/' + encodeURIComponent(call.callid);
+        }
+        ApiGet(url, function(data) {
+            switch (data.status) {
+                case 'safe':
+                    verdictDiv.textContent = 'jcblock would accept this call (whitelist entry "' + data.pattern + '").';
+                    break;
+                case 'blocked':
+                    verdictDiv.textContent = 'jcblock would block this call (blacklist entry "' + data.pattern + '").';
+                    break;
+                default:
+                    verdictDiv.textContent = 'No list entry matches this caller.';
+                    break;
+            }
+            verdictDiv.className = 'VerdictNote ' + BlockStatusClassName(data.status);
+        });
+    }
+
     function SetTargetCall(call, history) {
         var backButton    = document.getElementById('BackToListButton');
         var safeButton    = document.getElementById('TargetRadioButtonSafe');
@@ -319,6 +354,7 @@
             ApiPost(url, function(data) {
                 var detail = FilterStatus(data.status, FieldStatus(call.callid));
                 SetTargetStatus(detail.numberStatus, detail.callidStatus);
+                ShowVerdict(call);
                 EnableDisableControls(true);
             });
         }
@@ -334,6 +370,7 @@
 
         var detail = DetailedStatus(call);
         SetTargetStatus(detail.numberStatus, detail.callidStatus);
+        ShowVerdict(call);
 
         switch (detail.numberStatus) {
             case 'blocked': blockButton.checked = true;     break;
@@ -421,6 +458,7 @@
         }
 
         PushActiveDiv('CreateEditNumberDiv');
+        RefreshPhoneBook();
     }
 
     function CreateCallerCell(call, status) {
@@ -578,8 +616,89 @@
         return iconCell;
     }
 
+    function SelectedNumberList() {
+        return Object.keys(SelectedNumbers);
+    }
+
+    function ClassifySelected(status) {
+        var ops = SelectedNumberList().map(function(number) {
+            return {op: 'classify', number: number, status: status};
+        });
+        ApiPostJson('/api/batch', ops, function(data) {
+            SelectedNumbers = {};
+            PopulateCallHistory();
+        });
+    }
+
+    function CreateBatchToolbar() {
+        // A row of buttons that act on every selected phone number at once.
+        // Hidden while nothing is selected.
+        var toolbar = document.createElement('div');
+        toolbar.className = 'NavSection BatchToolbar';
+
+        var countSpan = document.createElement('span');
+        toolbar.appendChild(countSpan);
+
+        [['safe', 'Safe'], ['neutral', 'Neutral'], ['blocked', 'Block']].forEach(function(pair) {
+            var button = document.createElement('span');
+            button.className = 'NavButton BatchButton ' + BlockStatusClassName(pair[0]);
+            button.textContent = pair[1];
+            button.onclick = function() {
+                ClassifySelected(pair[0]);
+            }
+            toolbar.appendChild(button);
+        });
+
+        var clearButton = document.createElement('span');
+        clearButton.className = 'NavButton BatchButton';
+        clearButton.textContent = 'Clear';
+        clearButton.onclick = function() {
+            SelectedNumbers = {};
+            PopulateCallHistory();
+        }
+        toolbar.appendChild(clearButton);
+
+        toolbar.update = function() {
+            var count = SelectedNumberList().length;
+            countSpan.textContent = count + ' selected';
+            toolbar.style.display = (count > 0) ? '' : 'none';
+        }
+        toolbar.update();
+        return toolbar;
+    }
+
+    function CreateSelectCell(call, checkboxList, toolbar) {
+        var selectCell = document.createElement('td');
+        selectCell.className = 'SelectColumn';
+        if (IsPhoneNumber(call.number)) {
+            var checkbox = document.createElement('input');
+            checkbox.setAttribute('type', 'checkbox');
+            checkbox.setAttribute('data-phone-number', call.number);
+            checkbox.checked = !!SelectedNumbers[call.number];
+            checkbox.onchange = function() {
+                if (this.checked) {
+                    SelectedNumbers[call.number] = true;
+                } else {
+                    delete SelectedNumbers[call.number];
+                }
+                // Keep other rows for the same caller in agreement.
+                for (var i=0; i < checkboxList.length; ++i) {
+                    if (checkboxList[i].getAttribute('data-phone-number') === call.number) {
+                        checkboxList[i].checked = this.checked;
+                    }
+                }
+                toolbar.update();
+            }
+            checkboxList.push(checkbox);
+            selectCell.appendChild(checkbox);
+        }
+        return selectCell;
+    }
+
     function PopulateCallHistory() {
         var rowlist = [];
+        var checkboxList = [];
+        var toolbar = CreateBatchToolbar();
         var recent = PrevPoll.callerid.data.calls;
         var table = document.createElement('table');
         table.setAttribute('class', 'RecentCallTable');
@@ -621,6 +740,10 @@
         hcell_new.onclick = CreateNewCaller;
         hrow.appendChild(hcell_new);
 
+        var hcell_select = document.createElement('th');
+        hcell_select.className = 'SelectColumn';
+        hrow.appendChild(hcell_select);
+
         thead.appendChild(hrow);
 
         var now = new Date();
@@ -648,6 +771,7 @@
             row.appendChild(whenCell);
 
             row.appendChild(CreateCallerCell(call));
+            row.appendChild(CreateSelectCell(call, checkboxList, toolbar));
 
             tbody.appendChild(row);
             rowlist.push(row);
@@ -662,6 +786,7 @@
         ClearElement(rcdiv);
 
         // Fill in newly-generted content for the RecentCallsDiv...
+        rcdiv.appendChild(toolbar);
         rcdiv.appendChild(table);
         UpdateRowDisplay(rowlist);
     }
@@ -908,18 +1033,79 @@
         PushActiveDiv('SettingsDiv');
     }
 
+    function IsActiveDiv(divId) {
+        return (ActiveDivStack.length > 0) && (ActiveDivStack[ActiveDivStack.length - 1].divid === divId);
+    }
+
     function UpdateUserInterface() {
         if (IsAllDataLoaded()) {
             PopulateCallHistory();
-            PopulatePhoneBook();
+            if (IsActiveDiv('CreateEditNumberDiv')) {
+                RefreshPhoneBook();
+            } else {
+                PopulatePhoneBook();    // from what we have so far; refreshed when displayed
+            }
+        }
+    }
+
+    // Asking for more phone numbers than this in one URL risks exceeding
+    // the server's header size limit, so we ask for all of them instead.
+    var MaxNumbersPerQuery = 200;
+
+    function MergeNumberInfo(numbers) {
+        var data = PrevPoll.callerid.data;
+        for (var number in numbers) {
+            var info = numbers[number];
+            data.count[number] = info.count;
+            data.names[number] = info.name;
+            data.callid[number] = info.callid;
+        }
+    }
+
+    function FetchNumberInfo(numberList, callback) {
+        var url = '/api/numbers';
+        if (numberList.length <= MaxNumbersPerQuery) {
+            url += '/' + numberList.join(',');
         }
+        ApiGet(url, function(data) {
+            MergeNumberInfo(data.numbers);
+            callback();
+        });
     }
 
     function RefreshCallHistory() {
-        ApiGet('/api/calls/0/' + ClientSettings.RecentCallLimit, function(calldata){
-            PrevPoll.callerid.data = calldata;
-            PrevPoll.callerid.loaded = true;
-            UpdateUserInterface();
+        // Fetch just the page of calls we display, then the aggregate
+        // info for the phone numbers that appear in it.
+        ApiGet('/api/history/latest/' + ClientSettings.RecentCallLimit, function(page){
+            var numberSet = {};
+            for (var i=0; i < page.calls.length; ++i) {
+                if (IsPhoneNumber(page.calls[i].number)) {
+                    numberSet[page.calls[i].number] = true;
+                }
+            }
+
+            var numberList = Object.keys(numberSet);
+            var Finish = function() {
+                PrevPoll.callerid.data.calls = page.calls;
+                PrevPoll.callerid.data.total = page.total;
+                PrevPoll.callerid.loaded = true;
+                UpdateUserInterface();
+            };
+
+            if (numberList.length > 0) {
+                FetchNumberInfo(numberList, Finish);
+            } else {
+                Finish();
+            }
+        });
+    }
+
+    function RefreshPhoneBook() {
+        // The phone book lists every known caller, so it needs
+        // the aggregate info for all of them.
+        ApiGet('/api/numbers', function(data) {
+            MergeNumberInfo(data.numbers);
+            PopulatePhoneBook();
         });
     }
 